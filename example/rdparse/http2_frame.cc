@@ -0,0 +1,128 @@
+#include "http2_frame.h"
+#include <cstring>
+
+using namespace http;
+
+void http::parseHttp2FrameHeader(const char *data, Http2FrameHeader &headerOut) noexcept {
+	const uint8_t *p = (const uint8_t *)data;
+
+	headerOut.length = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[2];
+	headerOut.type = (Http2FrameType)p[3];
+	headerOut.flags = p[4];
+	headerOut.streamId = readHttp2Uint32(data + 5) & 0x7fffffff;
+}
+
+void http::formatHttp2FrameHeader(char *buffer, uint32_t length, Http2FrameType type, uint8_t flags, uint32_t streamId) noexcept {
+	buffer[0] = (char)(length >> 16);
+	buffer[1] = (char)(length >> 8);
+	buffer[2] = (char)length;
+	buffer[3] = (char)type;
+	buffer[4] = (char)flags;
+	writeHttp2Uint32(buffer + 5, streamId);
+}
+
+bool http::appendHttp2Frame(peff::String &out, Http2FrameType type, uint8_t flags, uint32_t streamId, const std::string_view &payload) noexcept {
+	const size_t szOld = out.size();
+
+	if (!out.resizeUninitialized(szOld + HTTP2_FRAME_HEADER_SIZE + payload.size()))
+		return false;
+
+	char *p = out.data() + szOld;
+
+	formatHttp2FrameHeader(p, (uint32_t)payload.size(), type, flags, streamId);
+	if (payload.size())
+		memcpy(p + HTTP2_FRAME_HEADER_SIZE, payload.data(), payload.size());
+
+	return true;
+}
+
+bool Http2Settings::apply(const std::string_view &payload, Http2ErrorCode &errorCodeOut) noexcept {
+	if (payload.size() % 6) {
+		errorCodeOut = Http2ErrorCode::FrameSizeError;
+		return false;
+	}
+
+	for (size_t i = 0; i < payload.size(); i += 6) {
+		const uint16_t id = (uint16_t)(((uint8_t)payload[i] << 8) | (uint8_t)payload[i + 1]);
+		const uint32_t value = readHttp2Uint32(payload.data() + i + 2);
+
+		switch ((Http2SettingId)id) {
+			case Http2SettingId::HeaderTableSize:
+				headerTableSize = value;
+				break;
+			case Http2SettingId::EnablePush:
+				if (value > 1) {
+					errorCodeOut = Http2ErrorCode::ProtocolError;
+					return false;
+				}
+				isPushEnabled = value;
+				break;
+			case Http2SettingId::MaxConcurrentStreams:
+				maxConcurrentStreams = value;
+				break;
+			case Http2SettingId::InitialWindowSize:
+				if (value > HTTP2_MAX_WINDOW_SIZE) {
+					errorCodeOut = Http2ErrorCode::FlowControlError;
+					return false;
+				}
+				initialWindowSize = value;
+				break;
+			case Http2SettingId::MaxFrameSize:
+				if ((value < HTTP2_DEFAULT_MAX_FRAME_SIZE) || (value > HTTP2_MAX_MAX_FRAME_SIZE)) {
+					errorCodeOut = Http2ErrorCode::ProtocolError;
+					return false;
+				}
+				maxFrameSize = value;
+				break;
+			case Http2SettingId::MaxHeaderListSize:
+				maxHeaderListSize = value;
+				break;
+			default:
+				break;
+		}
+	}
+
+	return true;
+}
+
+static NETKNOT_FORCEINLINE int base64UrlDigitValue(char c) noexcept {
+	if ((c >= 'A') && (c <= 'Z'))
+		return c - 'A';
+	if ((c >= 'a') && (c <= 'z'))
+		return c - 'a' + 26;
+	if ((c >= '0') && (c <= '9'))
+		return c - '0' + 52;
+	if (c == '-')
+		return 62;
+	if (c == '_')
+		return 63;
+	return -1;
+}
+
+bool Http2Settings::applyBase64(const std::string_view &value) noexcept {
+	// Each setting takes 6 bytes, which are exactly 8 digits, so the settings are decoded one by one without padding.
+	if (value.size() % 8)
+		return false;
+
+	for (size_t i = 0; i < value.size(); i += 8) {
+		char setting[6];
+		uint64_t bits = 0;
+
+		for (size_t j = 0; j < 8; ++j) {
+			const int digit = base64UrlDigitValue(value[i + j]);
+
+			if (digit < 0)
+				return false;
+			bits = (bits << 6) | (uint64_t)digit;
+		}
+
+		for (size_t j = 0; j < 6; ++j)
+			setting[j] = (char)(bits >> (40 - j * 8));
+
+		Http2ErrorCode errorCode;
+		if (!apply(std::string_view(setting, sizeof(setting)), errorCode))
+			return false;
+	}
+
+	return true;
+}
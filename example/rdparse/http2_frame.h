@@ -0,0 +1,125 @@
+#ifndef _HTTP2_FRAME_H_
+#define _HTTP2_FRAME_H_
+
+#include <netknot/basedefs.h>
+#include <peff/containers/string.h>
+#include <cstdint>
+#include <string_view>
+
+namespace http {
+	/// @brief Preface which an HTTP/2 client sends before its first frame.
+	constexpr std::string_view HTTP2_CONNECTION_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+	constexpr size_t HTTP2_FRAME_HEADER_SIZE = 9;
+	/// @brief Maximum frame payload size before the peer says otherwise, which is also the least one a peer may ask for.
+	constexpr uint32_t HTTP2_DEFAULT_MAX_FRAME_SIZE = 16384;
+	constexpr uint32_t HTTP2_MAX_MAX_FRAME_SIZE = 16777215;
+	/// @brief Initial flow-control window of the connection and of the streams before the peer says otherwise.
+	constexpr uint32_t HTTP2_DEFAULT_WINDOW_SIZE = 65535;
+	constexpr uint32_t HTTP2_MAX_WINDOW_SIZE = 0x7fffffff;
+	constexpr uint32_t HTTP2_DEFAULT_HEADER_TABLE_SIZE = 4096;
+
+	enum class Http2FrameType : uint8_t {
+		Data = 0,
+		Headers,
+		Priority,
+		RstStream,
+		Settings,
+		PushPromise,
+		Ping,
+		GoAway,
+		WindowUpdate,
+		Continuation
+	};
+
+	constexpr uint8_t HTTP2_FLAG_END_STREAM = 0x01;
+	constexpr uint8_t HTTP2_FLAG_ACK = 0x01;
+	constexpr uint8_t HTTP2_FLAG_END_HEADERS = 0x04;
+	constexpr uint8_t HTTP2_FLAG_PADDED = 0x08;
+	constexpr uint8_t HTTP2_FLAG_PRIORITY = 0x20;
+
+	enum class Http2ErrorCode : uint32_t {
+		NoError = 0,
+		ProtocolError,
+		InternalError,
+		FlowControlError,
+		SettingsTimeout,
+		StreamClosed,
+		FrameSizeError,
+		RefusedStream,
+		Cancel,
+		CompressionError,
+		ConnectError,
+		EnhanceYourCalm,
+		InadequateSecurity,
+		Http11Required
+	};
+
+	enum class Http2SettingId : uint16_t {
+		HeaderTableSize = 1,
+		EnablePush,
+		MaxConcurrentStreams,
+		InitialWindowSize,
+		MaxFrameSize,
+		MaxHeaderListSize
+	};
+
+	struct Http2FrameHeader {
+		uint32_t length;
+		Http2FrameType type;
+		uint8_t flags;
+		uint32_t streamId;
+	};
+
+	/// @brief Parse a frame header, the reserved bit of the stream ID is ignored.
+	///
+	/// @param data Header to be parsed, which must hold HTTP2_FRAME_HEADER_SIZE bytes.
+	/// @param headerOut Where to store the header.
+	void parseHttp2FrameHeader(const char *data, Http2FrameHeader &headerOut) noexcept;
+	/// @brief Write a frame header.
+	///
+	/// @param buffer Buffer to store the header, which must hold HTTP2_FRAME_HEADER_SIZE bytes.
+	void formatHttp2FrameHeader(char *buffer, uint32_t length, Http2FrameType type, uint8_t flags, uint32_t streamId) noexcept;
+	/// @brief Append a whole frame.
+	///
+	/// @param out String which the frame is appended to.
+	/// @param payload Payload of the frame, which must fit in a frame of the peer.
+	/// @return Whether the frame is appended, false if out of memory.
+	[[nodiscard]] bool appendHttp2Frame(peff::String &out, Http2FrameType type, uint8_t flags, uint32_t streamId, const std::string_view &payload) noexcept;
+
+	NETKNOT_FORCEINLINE uint32_t readHttp2Uint32(const char *data) noexcept {
+		const uint8_t *p = (const uint8_t *)data;
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	NETKNOT_FORCEINLINE void writeHttp2Uint32(char *buffer, uint32_t value) noexcept {
+		buffer[0] = (char)(value >> 24);
+		buffer[1] = (char)(value >> 16);
+		buffer[2] = (char)(value >> 8);
+		buffer[3] = (char)value;
+	}
+
+	/// @brief Settings of an endpoint, the ones never sent keep their initial values.
+	struct Http2Settings {
+		uint32_t headerTableSize = HTTP2_DEFAULT_HEADER_TABLE_SIZE;
+		bool isPushEnabled = true;
+		uint32_t maxConcurrentStreams = UINT32_MAX;
+		uint32_t initialWindowSize = HTTP2_DEFAULT_WINDOW_SIZE;
+		uint32_t maxFrameSize = HTTP2_DEFAULT_MAX_FRAME_SIZE;
+		uint32_t maxHeaderListSize = UINT32_MAX;
+
+		/// @brief Apply the payload of a SETTINGS frame, the unknown settings are ignored.
+		///
+		/// @param payload Payload of the frame.
+		/// @param errorCodeOut Where to store the error of a malformed payload.
+		/// @return Whether the payload is well-formed, the settings before the malformed one have been applied otherwise.
+		[[nodiscard]] bool apply(const std::string_view &payload, Http2ErrorCode &errorCodeOut) noexcept;
+		/// @brief Apply the value of the HTTP2-Settings header of an upgrade, which is a SETTINGS payload in base64url.
+		///
+		/// @param value Value of the header.
+		/// @return Whether the value is well-formed.
+		[[nodiscard]] bool applyBase64(const std::string_view &value) noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,650 @@
+#include "http2_hpack.h"
+#include <cstring>
+
+using namespace http;
+
+using std::operator""sv;
+
+struct HpackStaticEntry {
+	std::string_view name;
+	std::string_view value;
+};
+
+static constexpr HpackStaticEntry g_hpackStaticTable[HPACK_STATIC_TABLE_SIZE] = {
+	{ ":authority"sv, ""sv },
+	{ ":method"sv, "GET"sv },
+	{ ":method"sv, "POST"sv },
+	{ ":path"sv, "/"sv },
+	{ ":path"sv, "/index.html"sv },
+	{ ":scheme"sv, "http"sv },
+	{ ":scheme"sv, "https"sv },
+	{ ":status"sv, "200"sv },
+	{ ":status"sv, "204"sv },
+	{ ":status"sv, "206"sv },
+	{ ":status"sv, "304"sv },
+	{ ":status"sv, "400"sv },
+	{ ":status"sv, "404"sv },
+	{ ":status"sv, "500"sv },
+	{ "accept-charset"sv, ""sv },
+	{ "accept-encoding"sv, "gzip, deflate"sv },
+	{ "accept-language"sv, ""sv },
+	{ "accept-ranges"sv, ""sv },
+	{ "accept"sv, ""sv },
+	{ "access-control-allow-origin"sv, ""sv },
+	{ "age"sv, ""sv },
+	{ "allow"sv, ""sv },
+	{ "authorization"sv, ""sv },
+	{ "cache-control"sv, ""sv },
+	{ "content-disposition"sv, ""sv },
+	{ "content-encoding"sv, ""sv },
+	{ "content-language"sv, ""sv },
+	{ "content-length"sv, ""sv },
+	{ "content-location"sv, ""sv },
+	{ "content-range"sv, ""sv },
+	{ "content-type"sv, ""sv },
+	{ "cookie"sv, ""sv },
+	{ "date"sv, ""sv },
+	{ "etag"sv, ""sv },
+	{ "expect"sv, ""sv },
+	{ "expires"sv, ""sv },
+	{ "from"sv, ""sv },
+	{ "host"sv, ""sv },
+	{ "if-match"sv, ""sv },
+	{ "if-modified-since"sv, ""sv },
+	{ "if-none-match"sv, ""sv },
+	{ "if-range"sv, ""sv },
+	{ "if-unmodified-since"sv, ""sv },
+	{ "last-modified"sv, ""sv },
+	{ "link"sv, ""sv },
+	{ "location"sv, ""sv },
+	{ "max-forwards"sv, ""sv },
+	{ "proxy-authenticate"sv, ""sv },
+	{ "proxy-authorization"sv, ""sv },
+	{ "range"sv, ""sv },
+	{ "referer"sv, ""sv },
+	{ "refresh"sv, ""sv },
+	{ "retry-after"sv, ""sv },
+	{ "server"sv, ""sv },
+	{ "set-cookie"sv, ""sv },
+	{ "strict-transport-security"sv, ""sv },
+	{ "transfer-encoding"sv, ""sv },
+	{ "user-agent"sv, ""sv },
+	{ "vary"sv, ""sv },
+	{ "via"sv, ""sv },
+	{ "www-authenticate"sv, ""sv }
+};
+
+constexpr size_t HPACK_HUFFMAN_EOS = 256;
+constexpr size_t HPACK_HUFFMAN_MAX_CODE_LENGTH = 30;
+
+// Lengths of the codes of the Huffman code of RFC 7541, which is canonical, so the codes are derived from the lengths.
+static constexpr uint8_t g_hpackHuffmanCodeLengths[HPACK_HUFFMAN_EOS + 1] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+struct HpackHuffmanTable {
+	uint32_t codes[HPACK_HUFFMAN_EOS + 1] = {};
+	/// @brief First code of each length, the codes of a length are consecutive.
+	uint32_t firstCodes[HPACK_HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+	uint16_t nCodes[HPACK_HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+	/// @brief Index of the first symbol of each length in the symbols.
+	uint16_t offSymbols[HPACK_HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+	/// @brief Symbols ordered by their codes.
+	uint16_t symbols[HPACK_HUFFMAN_EOS + 1] = {};
+};
+
+static constexpr HpackHuffmanTable buildHuffmanTable() noexcept {
+	HpackHuffmanTable table;
+	uint32_t code = 0;
+	uint16_t nSymbols = 0;
+
+	for (size_t length = 1; length <= HPACK_HUFFMAN_MAX_CODE_LENGTH; ++length) {
+		table.firstCodes[length] = code;
+		table.offSymbols[length] = nSymbols;
+
+		for (uint16_t symbol = 0; symbol <= HPACK_HUFFMAN_EOS; ++symbol) {
+			if (g_hpackHuffmanCodeLengths[symbol] == length) {
+				table.codes[symbol] = code++;
+				table.symbols[nSymbols++] = symbol;
+			}
+		}
+
+		table.nCodes[length] = (uint16_t)(nSymbols - table.offSymbols[length]);
+		code <<= 1;
+	}
+
+	return table;
+}
+
+static constexpr HpackHuffmanTable g_hpackHuffmanTable = buildHuffmanTable();
+static_assert(g_hpackHuffmanTable.codes[HPACK_HUFFMAN_EOS] == 0x3fffffff, "The Huffman code lengths are corrupted");
+
+static NETKNOT_FORCEINLINE uint8_t toLowerAscii(uint8_t c) noexcept {
+	return ((c >= 'A') && (c <= 'Z')) ? (uint8_t)(c | 0x20) : c;
+}
+
+// Decode a Huffman-coded string, the output must hold 8 / 5 of the input as the shortest code has 5 bits.
+static bool huffmanDecode(const uint8_t *data, size_t size, char *out, size_t &szOut) noexcept {
+	const HpackHuffmanTable &table = g_hpackHuffmanTable;
+	uint64_t bits = 0;
+	size_t nBits = 0;
+	char *q = out;
+
+	for (size_t i = 0; i < size; ++i) {
+		bits = (bits << 8) | data[i];
+		nBits += 8;
+
+		// Each symbol is matched against the codes from the shortest length up.
+		while (nBits >= 5) {
+			const size_t maxLength = nBits < HPACK_HUFFMAN_MAX_CODE_LENGTH ? nBits : HPACK_HUFFMAN_MAX_CODE_LENGTH;
+			size_t length = 5;
+			uint32_t code = 0;
+
+			for (; length <= maxLength; ++length) {
+				code = (uint32_t)(bits >> (nBits - length)) & (uint32_t)((1ull << length) - 1);
+				if (code - table.firstCodes[length] < table.nCodes[length])
+					break;
+			}
+
+			if (length > maxLength) {
+				if (nBits >= HPACK_HUFFMAN_MAX_CODE_LENGTH)
+					return false;
+				break;
+			}
+
+			const uint16_t symbol = table.symbols[table.offSymbols[length] + code - table.firstCodes[length]];
+
+			if (symbol == HPACK_HUFFMAN_EOS)
+				return false;
+
+			*q++ = (char)symbol;
+			nBits -= length;
+			bits &= (1ull << nBits) - 1;
+		}
+	}
+
+	// The padding is a prefix of EOS, which is all ones and shorter than a byte.
+	if ((nBits > 7) || (bits != (1ull << nBits) - 1))
+		return false;
+
+	szOut = (size_t)(q - out);
+	return true;
+}
+
+static size_t getHuffmanEncodedSize(const std::string_view &s, bool isLowercased) noexcept {
+	size_t nBits = 0;
+
+	for (char c : s)
+		nBits += g_hpackHuffmanCodeLengths[isLowercased ? toLowerAscii((uint8_t)c) : (uint8_t)c];
+
+	return (nBits + 7) / 8;
+}
+
+static void huffmanEncode(const std::string_view &s, bool isLowercased, char *out) noexcept {
+	const HpackHuffmanTable &table = g_hpackHuffmanTable;
+	uint64_t bits = 0;
+	size_t nBits = 0;
+
+	for (char c : s) {
+		const uint8_t symbol = isLowercased ? toLowerAscii((uint8_t)c) : (uint8_t)c;
+		const size_t length = g_hpackHuffmanCodeLengths[symbol];
+
+		bits = (bits << length) | table.codes[symbol];
+		nBits += length;
+
+		while (nBits >= 8) {
+			nBits -= 8;
+			*out++ = (char)(bits >> nBits);
+		}
+		bits &= (1ull << nBits) - 1;
+	}
+
+	// The last byte is padded with the prefix of EOS.
+	if (nBits)
+		*out = (char)((bits << (8 - nBits)) | (0xff >> nBits));
+}
+
+HpackDynamicTable::HpackDynamicTable(peff::Alloc *allocator, size_t maxSize) : _allocator(allocator), _entries(allocator), _maxSize(maxSize) {
+}
+
+HpackDynamicTable::~HpackDynamicTable() {
+	while (_nEntries)
+		_evictOldest();
+}
+
+void HpackDynamicTable::_evictOldest() noexcept {
+	Entry &entry = _entries.at(_offFirst);
+
+	if (entry.data)
+		_allocator->release(entry.data, entry.szName + entry.szValue, 1);
+	_size -= entry.szName + entry.szValue + HPACK_ENTRY_OVERHEAD;
+
+	_offFirst = (_offFirst + 1) % _entries.size();
+	--_nEntries;
+}
+
+bool HpackDynamicTable::add(const std::string_view &name, const std::string_view &value) noexcept {
+	const size_t szEntry = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+
+	if (szEntry > _maxSize) {
+		while (_nEntries)
+			_evictOldest();
+		return true;
+	}
+
+	while (_size + szEntry > _maxSize)
+		_evictOldest();
+
+	if (_nEntries == _entries.size()) {
+		// The ring is full, it is unrolled into a larger one.
+		peff::DynArray<Entry> newEntries(_allocator.get());
+
+		if (!newEntries.resizeUninitialized(_entries.size() ? _entries.size() * 2 : 16))
+			return false;
+
+		for (size_t i = 0; i < _nEntries; ++i)
+			newEntries.at(i) = _entries.at((_offFirst + i) % _entries.size());
+
+		_entries = std::move(newEntries);
+		_offFirst = 0;
+	}
+
+	char *data = nullptr;
+
+	if (name.size() + value.size()) {
+		if (!(data = (char *)_allocator->alloc(name.size() + value.size(), 1)))
+			return false;
+
+		memcpy(data, name.data(), name.size());
+		memcpy(data + name.size(), value.data(), value.size());
+	}
+
+	_entries.at((_offFirst + _nEntries) % _entries.size()) = { data, name.size(), value.size() };
+	++_nEntries;
+	_size += szEntry;
+
+	return true;
+}
+
+void HpackDynamicTable::setMaxSize(size_t maxSize) noexcept {
+	_maxSize = maxSize;
+
+	while (_size > _maxSize)
+		_evictOldest();
+}
+
+HpackDecoder::HpackDecoder(peff::Alloc *allocator, size_t maxTableSize) : _table(allocator, maxTableSize), _maxTableSize(maxTableSize), _nameScratch(allocator), _valueScratch(allocator) {
+}
+
+static bool decodeInteger(const uint8_t *&p, const uint8_t *end, size_t nPrefixBits, size_t &valueOut) noexcept {
+	const size_t mask = ((size_t)1 << nPrefixBits) - 1;
+	size_t value = *p++ & mask;
+
+	if (value < mask) {
+		valueOut = value;
+		return true;
+	}
+
+	for (size_t shift = 0; p < end; shift += 7) {
+		// No sensible index or length is that large, it is refused before it overflows.
+		if (shift > 28)
+			return false;
+
+		const uint8_t b = *p++;
+
+		value += (size_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			valueOut = value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Copy a string which may not outlive the block, the empty one still has a non-null data pointer.
+static HpackDecodeResult copyString(peff::Alloc *allocator, const std::string_view &s, std::string_view &strOut) noexcept {
+	if (!s.size()) {
+		strOut = ""sv;
+		return HpackDecodeResult::Done;
+	}
+
+	char *data = (char *)allocator->alloc(s.size(), 1);
+
+	if (!data)
+		return HpackDecodeResult::OutOfMemory;
+
+	memcpy(data, s.data(), s.size());
+	strOut = std::string_view(data, s.size());
+
+	return HpackDecodeResult::Done;
+}
+
+// Read the header of a string, the data are left in the block.
+static HpackDecodeResult readString(const uint8_t *&p, const uint8_t *end, bool &isHuffmanCodedOut, const uint8_t *&dataOut, size_t &sizeOut) noexcept {
+	if (p == end)
+		return HpackDecodeResult::Malformed;
+
+	isHuffmanCodedOut = *p & 0x80;
+
+	if (!decodeInteger(p, end, 7, sizeOut))
+		return HpackDecodeResult::Malformed;
+	if (sizeOut > (size_t)(end - p))
+		return HpackDecodeResult::Malformed;
+
+	dataOut = p;
+	p += sizeOut;
+
+	return HpackDecodeResult::Done;
+}
+
+static HpackDecodeResult decodeString(const uint8_t *&p, const uint8_t *end, peff::Alloc *allocator, std::string_view &strOut) noexcept {
+	bool isHuffmanCoded;
+	const uint8_t *data;
+	size_t size;
+	HpackDecodeResult result;
+
+	if ((result = readString(p, end, isHuffmanCoded, data, size)) != HpackDecodeResult::Done)
+		return result;
+
+	if ((!isHuffmanCoded) || (!size))
+		return copyString(allocator, std::string_view((const char *)data, size), strOut);
+
+	const size_t szMax = size * 8 / 5;
+	char *decoded = (char *)allocator->alloc(szMax, 1);
+	size_t szDecoded;
+
+	if (!decoded)
+		return HpackDecodeResult::OutOfMemory;
+
+	if (!huffmanDecode(data, size, decoded, szDecoded))
+		return HpackDecodeResult::Malformed;
+
+	if (!szDecoded) {
+		strOut = ""sv;
+		return HpackDecodeResult::Done;
+	}
+
+	// An arena gives back the unused tail in place.
+	if (szDecoded < szMax) {
+		if (!(decoded = (char *)allocator->realloc(decoded, szMax, 1, szDecoded, 1)))
+			return HpackDecodeResult::OutOfMemory;
+	}
+
+	strOut = std::string_view(decoded, szDecoded);
+	return HpackDecodeResult::Done;
+}
+
+// Decode a string which is only needed until the end of its field, a plain one refers to the block
+// and a Huffman-coded one is decoded into the scratch buffer, which is reused by the following fields.
+static HpackDecodeResult decodeTransientString(const uint8_t *&p, const uint8_t *end, peff::DynArray<char> &scratch, std::string_view &strOut) noexcept {
+	bool isHuffmanCoded;
+	const uint8_t *data;
+	size_t size;
+	HpackDecodeResult result;
+
+	if ((result = readString(p, end, isHuffmanCoded, data, size)) != HpackDecodeResult::Done)
+		return result;
+
+	if ((!isHuffmanCoded) || (!size)) {
+		strOut = std::string_view((const char *)data, size);
+		return HpackDecodeResult::Done;
+	}
+
+	size_t szDecoded;
+
+	if ((scratch.size() < size * 8 / 5) && (!scratch.resizeUninitialized(size * 8 / 5)))
+		return HpackDecodeResult::OutOfMemory;
+
+	if (!huffmanDecode(data, size, scratch.data(), szDecoded))
+		return HpackDecodeResult::Malformed;
+
+	strOut = std::string_view(scratch.data(), szDecoded);
+	return HpackDecodeResult::Done;
+}
+
+HpackDecodeResult HpackDecoder::decode(const char *data, size_t size, size_t maxListSize, peff::Alloc *fieldAllocator, peff::DynArray<HttpHeaderField> &fieldsOut) noexcept {
+	const uint8_t *p = (const uint8_t *)data, *const end = p + size;
+	size_t szList = 0;
+	bool isTooLarge = false, isFieldSeen = false;
+
+	// The names and values in the dynamic table are referred to until the field is known to be kept,
+	// so the references which the list has no room for cost nothing.
+	auto resolveName = [this](size_t index, std::string_view &nameOut, bool &isInTableOut) noexcept -> bool {
+		if ((!index) || (index > HPACK_STATIC_TABLE_SIZE + _table.getCount()))
+			return false;
+
+		if ((isInTableOut = index > HPACK_STATIC_TABLE_SIZE))
+			nameOut = _table.getName(index - HPACK_STATIC_TABLE_SIZE - 1);
+		else
+			nameOut = g_hpackStaticTable[index - 1].name;
+
+		return true;
+	};
+
+	while (p < end) {
+		const uint8_t b = *p;
+		std::string_view name, value;
+		bool isNameInTable = false, isValueInTable = false, isAdded = false;
+		HpackDecodeResult result;
+
+		if (b & 0x80) {
+			size_t index;
+
+			if (!decodeInteger(p, end, 7, index))
+				return HpackDecodeResult::Malformed;
+
+			if (!resolveName(index, name, isNameInTable))
+				return HpackDecodeResult::Malformed;
+
+			if ((isValueInTable = isNameInTable))
+				value = _table.getValue(index - HPACK_STATIC_TABLE_SIZE - 1);
+			else
+				value = g_hpackStaticTable[index - 1].value;
+		} else if ((b & 0xe0) == 0x20) {
+			size_t maxSize;
+
+			// The size may only be updated at the beginning of a block, and never beyond what we have announced.
+			if (isFieldSeen)
+				return HpackDecodeResult::Malformed;
+			if (!decodeInteger(p, end, 5, maxSize))
+				return HpackDecodeResult::Malformed;
+			if (maxSize > _maxTableSize)
+				return HpackDecodeResult::Malformed;
+
+			_table.setMaxSize(maxSize);
+			continue;
+		} else {
+			// Literal with incremental indexing, or without indexing and never indexed, which only differ in the prefix.
+			size_t nameIndex;
+
+			isAdded = b & 0x40;
+
+			if (!decodeInteger(p, end, isAdded ? 6 : 4, nameIndex))
+				return HpackDecodeResult::Malformed;
+
+			// The strings of a field which cannot be kept anymore are only decoded for the dynamic table.
+			const bool isTransient = isTooLarge || (maxListSize - szList < HPACK_ENTRY_OVERHEAD);
+
+			if (nameIndex) {
+				if (!resolveName(nameIndex, name, isNameInTable))
+					return HpackDecodeResult::Malformed;
+			} else if ((result = isTransient ? decodeTransientString(p, end, _nameScratch, name) : decodeString(p, end, fieldAllocator, name)) != HpackDecodeResult::Done)
+				return result;
+
+			if ((result = isTransient ? decodeTransientString(p, end, _valueScratch, value) : decodeString(p, end, fieldAllocator, value)) != HpackDecodeResult::Done)
+				return result;
+		}
+
+		isFieldSeen = true;
+
+		const size_t szField = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+		const bool isKept = (!isTooLarge) && (szField <= maxListSize - szList);
+
+		// The strings in the dynamic table are copied before the new entry may evict them.
+		if (isKept) {
+			if (isNameInTable && ((result = copyString(fieldAllocator, name, name)) != HpackDecodeResult::Done))
+				return result;
+			if (isValueInTable && ((result = copyString(fieldAllocator, value, value)) != HpackDecodeResult::Done))
+				return result;
+		} else {
+			isTooLarge = true;
+
+			if (isAdded && isNameInTable) {
+				if ((_nameScratch.size() < name.size()) && (!_nameScratch.resizeUninitialized(name.size())))
+					return HpackDecodeResult::OutOfMemory;
+
+				memcpy(_nameScratch.data(), name.data(), name.size());
+				name = std::string_view(_nameScratch.data(), name.size());
+			}
+		}
+
+		if (isAdded && (!_table.add(name, value)))
+			return HpackDecodeResult::OutOfMemory;
+
+		if (!isKept)
+			continue;
+		szList += szField;
+
+		if (!fieldsOut.pushBack({ name, value }))
+			return HpackDecodeResult::OutOfMemory;
+	}
+
+	return isTooLarge ? HpackDecodeResult::TooLarge : HpackDecodeResult::Done;
+}
+
+HpackEncoder::HpackEncoder(peff::Alloc *allocator) : _table(allocator, MAX_TABLE_SIZE) {
+}
+
+static bool appendInteger(peff::String &out, uint8_t flags, size_t nPrefixBits, size_t value) noexcept {
+	const size_t mask = ((size_t)1 << nPrefixBits) - 1;
+	char buffer[2 + sizeof(size_t) * 8 / 7];
+	size_t n = 0;
+
+	if (value < mask) {
+		buffer[n++] = (char)(flags | value);
+	} else {
+		buffer[n++] = (char)(flags | mask);
+		value -= mask;
+
+		while (value >= 0x80) {
+			buffer[n++] = (char)((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		buffer[n++] = (char)value;
+	}
+
+	return out.append(std::string_view(buffer, n));
+}
+
+static bool appendString(peff::String &out, const std::string_view &s, bool isLowercased) noexcept {
+	const size_t szHuffman = getHuffmanEncodedSize(s, isLowercased);
+	const bool isHuffmanCoded = szHuffman < s.size();
+	const size_t szEncoded = isHuffmanCoded ? szHuffman : s.size();
+
+	if (!appendInteger(out, isHuffmanCoded ? 0x80 : 0x00, 7, szEncoded))
+		return false;
+
+	const size_t szOld = out.size();
+
+	if (!out.resizeUninitialized(szOld + szEncoded))
+		return false;
+
+	char *p = out.data() + szOld;
+
+	if (isHuffmanCoded) {
+		huffmanEncode(s, isLowercased, p);
+	} else if (isLowercased) {
+		for (size_t i = 0; i < s.size(); ++i)
+			p[i] = (char)toLowerAscii((uint8_t)s[i]);
+	} else if (s.size()) {
+		memcpy(p, s.data(), s.size());
+	}
+
+	return true;
+}
+
+void HpackEncoder::setMaxTableSize(size_t maxSize) noexcept {
+	if (maxSize > MAX_TABLE_SIZE)
+		maxSize = MAX_TABLE_SIZE;
+
+	if ((!_isMaxSizeChanged) && (maxSize == _table.getMaxSize()))
+		return;
+
+	// The peer learns every shrink, so the least size before the next block is announced as well as the final one.
+	if ((!_isMaxSizeChanged) || (maxSize < _minPendingMaxSize))
+		_minPendingMaxSize = maxSize;
+	_isMaxSizeChanged = true;
+
+	_table.setMaxSize(maxSize);
+}
+
+bool HpackEncoder::beginBlock(peff::String &out) noexcept {
+	if (!_isMaxSizeChanged)
+		return true;
+
+	if (_minPendingMaxSize < _table.getMaxSize()) {
+		if (!appendInteger(out, 0x20, 5, _minPendingMaxSize))
+			return false;
+	}
+	if (!appendInteger(out, 0x20, 5, _table.getMaxSize()))
+		return false;
+
+	_isMaxSizeChanged = false;
+	return true;
+}
+
+bool HpackEncoder::encode(const std::string_view &name, const std::string_view &value, bool isIndexable, peff::String &out) noexcept {
+	size_t nameIndex = 0;
+
+	for (size_t i = 0; i < HPACK_STATIC_TABLE_SIZE; ++i) {
+		if (!isHttpHeaderNameEqual(g_hpackStaticTable[i].name, name))
+			continue;
+
+		if (g_hpackStaticTable[i].value == value)
+			return appendInteger(out, 0x80, 7, i + 1);
+		if (!nameIndex)
+			nameIndex = i + 1;
+	}
+
+	for (size_t i = 0; i < _table.getCount(); ++i) {
+		if (!isHttpHeaderNameEqual(_table.getName(i), name))
+			continue;
+
+		if (_table.getValue(i) == value)
+			return appendInteger(out, 0x80, 7, HPACK_STATIC_TABLE_SIZE + 1 + i);
+		if (!nameIndex)
+			nameIndex = HPACK_STATIC_TABLE_SIZE + 1 + i;
+	}
+
+	const bool isIndexed = isIndexable && (name.size() + value.size() + HPACK_ENTRY_OVERHEAD <= _table.getMaxSize());
+
+	if (!appendInteger(out, isIndexed ? 0x40 : 0x00, isIndexed ? 6 : 4, nameIndex))
+		return false;
+	if ((!nameIndex) && (!appendString(out, name, true)))
+		return false;
+	if (!appendString(out, value, false))
+		return false;
+
+	// The peer adds the entry in the same way, so the tables stay the same.
+	if (isIndexed)
+		return _table.add(name, value);
+
+	return true;
+}
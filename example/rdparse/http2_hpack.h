@@ -0,0 +1,142 @@
+#ifndef _HTTP2_HPACK_H_
+#define _HTTP2_HPACK_H_
+
+#include "http2_frame.h"
+#include "http_headers.h"
+#include <peff/containers/dynarray.h>
+#include <peff/containers/string.h>
+
+namespace http {
+	/// @brief Size which an entry takes in a dynamic table besides its name and value.
+	constexpr size_t HPACK_ENTRY_OVERHEAD = 32;
+	constexpr size_t HPACK_STATIC_TABLE_SIZE = 61;
+
+	/// @brief Dynamic table of HPACK, whose entries are evicted from the oldest one to keep the table within its maximum size.
+	/// The entries are indexed from the newest one, which is index 0.
+	class HpackDynamicTable {
+	private:
+		/// @brief Entry of the table, the name and the value are stored together.
+		struct Entry {
+			char *data;
+			size_t szName;
+			size_t szValue;
+		};
+
+		peff::RcObjectPtr<peff::Alloc> _allocator;
+		/// @brief Ring of the entries, the oldest one is at _offFirst.
+		peff::DynArray<Entry> _entries;
+		size_t _offFirst = 0;
+		size_t _nEntries = 0;
+		size_t _size = 0;
+		size_t _maxSize;
+
+		NETKNOT_FORCEINLINE const Entry &_getEntry(size_t index) const noexcept {
+			return _entries.at((_offFirst + _nEntries - 1 - index) % _entries.size());
+		}
+
+		void _evictOldest() noexcept;
+
+	public:
+		HpackDynamicTable(peff::Alloc *allocator, size_t maxSize);
+		HpackDynamicTable(const HpackDynamicTable &) = delete;
+		~HpackDynamicTable();
+
+		/// @brief Add an entry, evicting the oldest ones to make room.
+		/// An entry larger than the maximum size empties the table and is not added.
+		///
+		/// @return Whether the entry is added, false if out of memory.
+		[[nodiscard]] bool add(const std::string_view &name, const std::string_view &value) noexcept;
+		/// @brief Change the maximum size, the oldest entries are evicted until the table fits.
+		void setMaxSize(size_t maxSize) noexcept;
+
+		NETKNOT_FORCEINLINE size_t getMaxSize() const noexcept {
+			return _maxSize;
+		}
+
+		NETKNOT_FORCEINLINE size_t getCount() const noexcept {
+			return _nEntries;
+		}
+
+		NETKNOT_FORCEINLINE std::string_view getName(size_t index) const noexcept {
+			const Entry &entry = _getEntry(index);
+			return std::string_view(entry.data, entry.szName);
+		}
+
+		NETKNOT_FORCEINLINE std::string_view getValue(size_t index) const noexcept {
+			const Entry &entry = _getEntry(index);
+			return std::string_view(entry.data + entry.szName, entry.szValue);
+		}
+	};
+
+	enum class HpackDecodeResult : uint8_t {
+		Done = 0,
+		/// @brief The header list exceeds the size limit, the fields beyond the limit are dropped.
+		/// The dynamic table is still updated by the whole block, so the following blocks can be decoded.
+		TooLarge,
+		/// @brief The header block is malformed, which is a compression error of the connection.
+		Malformed,
+		OutOfMemory
+	};
+
+	/// @brief Decoder of the header blocks of a connection, which keeps the dynamic table between the blocks.
+	class HpackDecoder {
+	private:
+		HpackDynamicTable _table;
+		/// @brief Bound of the dynamic table which we have announced, the peer may only shrink the table below it.
+		size_t _maxTableSize;
+		/// @brief Buffers of the Huffman-coded strings of the fields beyond the size limit, which are only decoded for the dynamic table.
+		peff::DynArray<char> _nameScratch, _valueScratch;
+
+	public:
+		HpackDecoder(peff::Alloc *allocator, size_t maxTableSize = HTTP2_DEFAULT_HEADER_TABLE_SIZE);
+
+		/// @brief Decode a complete header block.
+		/// The strings of the fields are allocated from the field allocator and never released one by one,
+		/// which is meant to be an arena dropped along with the fields.
+		/// The fields taken from the static table refer to it without being copied.
+		///
+		/// @param data Header block to be decoded.
+		/// @param size Size of the header block.
+		/// @param maxListSize Maximum size of the header list, counted in the same way as the dynamic table.
+		/// Nothing is allocated for the fields beyond it, zero to only update the dynamic table.
+		/// @param fieldAllocator Allocator of the strings of the fields.
+		/// @param fieldsOut Where to append the fields.
+		/// @return The decode result, the connection cannot go on if it is Malformed.
+		HpackDecodeResult decode(const char *data, size_t size, size_t maxListSize, peff::Alloc *fieldAllocator, peff::DynArray<HttpHeaderField> &fieldsOut) noexcept;
+	};
+
+	/// @brief Encoder of the header blocks of a connection.
+	/// The names are sent in lowercase, and the strings are Huffman-coded whenever it makes them shorter.
+	class HpackEncoder {
+	private:
+		HpackDynamicTable _table;
+		/// @brief Least maximum size set since the last header block, the next block shrinks the table to it first.
+		size_t _minPendingMaxSize = 0;
+		bool _isMaxSizeChanged = false;
+
+	public:
+		/// @brief Bound of the dynamic table of the encoder, whatever the peer allows.
+		constexpr static size_t MAX_TABLE_SIZE = HTTP2_DEFAULT_HEADER_TABLE_SIZE;
+
+		HpackEncoder(peff::Alloc *allocator);
+
+		/// @brief Change the maximum size of the dynamic table, as the peer has set its SETTINGS_HEADER_TABLE_SIZE.
+		void setMaxTableSize(size_t maxSize) noexcept;
+
+		/// @brief Begin a header block, which announces the changes of the table size.
+		///
+		/// @param out String which the block is appended to.
+		/// @return Whether the block is begun, false if out of memory.
+		[[nodiscard]] bool beginBlock(peff::String &out) noexcept;
+		/// @brief Encode a field into the header block.
+		///
+		/// @param name Name of the field, in any case.
+		/// @param value Value of the field.
+		/// @param isIndexable Whether the field may be added to the dynamic table, false for the values which seldom repeat.
+		/// @param out String which the block is appended to.
+		/// @return Whether the field is encoded, false if out of memory.
+		[[nodiscard]] bool encode(const std::string_view &name, const std::string_view &value, bool isIndexable, peff::String &out) noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,1748 @@
+#include "http2_session.h"
+#include <cstring>
+#include <new>
+
+using namespace http;
+
+using std::operator""sv;
+
+Http2Stream::Http2Stream(Http2Session *session, uint32_t id) noexcept
+	: session(session),
+	  id(id),
+	  requestArena(session->httpServer->allocator.get()),
+	  requestFields(&requestArena),
+	  requestHeaderView(&requestArena),
+	  handlerState{ session->httpServer, session->requestCallback->connection, this, {}, {}, {}, {}, requestHeaderView, {}, &requestArena, peff::String(&requestArena) },
+	  bodyPieces(session->httpServer->allocator.get()),
+	  receiveWindow(session->_localInitialWindowSize),
+	  sendWindow(session->_peerSettings.initialWindowSize),
+	  sendBuffer(session->httpServer->allocator.get()) {
+}
+
+Http2Stream::~Http2Stream() {
+}
+
+netknot::ExceptionPointer Http2Stream::pullRequestBody() {
+	if ((!currentHandler) || isBodyPulled || isRequestHandled)
+		return {};
+
+	Http2Session *s = session;
+
+	isBodyPulled = true;
+
+	// The piece taken by the handler is credited, so the peer sends the body as fast as the handler takes it.
+	NETKNOT_RETURN_IF_EXCEPT(s->_creditBody(this, szDeliveredBodyPiece));
+	szDeliveredBodyPiece = 0;
+
+	// Pulled from onRequestBody(), the body goes on when it returns.
+	NETKNOT_RETURN_IF_EXCEPT(s->_deliverBody(this));
+
+	return s->_sendPending();
+}
+
+netknot::ExceptionPointer Http2Stream::beginResponseStream(size_t szContentLength) {
+	if (szContentLength != HTTP_CONTENT_LENGTH_UNKNOWN) {
+		char contentLength[HTTP_DECIMAL_MAX_SIZE];
+
+		NETKNOT_RETURN_IF_EXCEPT(handlerState.writeHeader("Content-Length"sv, std::string_view(contentLength, formatHttpDecimal(contentLength, szContentLength))));
+
+		szResponseBodyLeft = szContentLength;
+	}
+
+	// HTTP/2 frames the body by itself, nothing is added but the end of the headers.
+	NETKNOT_RETURN_IF_EXCEPT(handlerState.endHeader());
+	handlerState.stage = HttpURLHandlerStateStage::ResponseStream;
+
+	Http2Session *s = session;
+
+	if (!isReset)
+		NETKNOT_RETURN_IF_EXCEPT(s->_queueResponseHead(this, std::string_view(handlerState.responseData.data(), handlerState.responseData.size()), false));
+	handlerState.responseData.clear();
+
+	// The headers go out at once for the peer to see the response started.
+	return s->_sendPending();
+}
+
+netknot::ExceptionPointer Http2Stream::writeResponseStream(const std::string_view &data) {
+	if (!data.size())
+		return {};
+
+	// The unsent data are bounded, the handler waits until the peer takes the data queued.
+	if ((!isReset) && (isResponsePieceQueued() || (sendBuffer.size() - offSendBuffer >= session->httpServer->maxPendingResponseSize))) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
+
+	// Nothing is sent on a reset stream, the data are discarded until the stream ends.
+	if (isReset)
+		return {};
+
+	if (szResponseBodyLeft != SIZE_MAX) {
+		if (data.size() > szResponseBodyLeft)
+			return _abortResponseStream();
+		szResponseBodyLeft -= data.size();
+	}
+
+	if (!sendBuffer.append(data))
+		return netknot::OutOfMemoryError::alloc();
+
+	session->_markReady(this);
+
+	return session->_sendPending();
+}
+
+netknot::ExceptionPointer Http2Stream::writeResponseStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) {
+	if (!size)
+		return {};
+
+	// Only one piece waits at a time, which is sent after the data queued before it.
+	if ((!isReset) && isResponsePieceQueued()) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
+
+	if (isReset)
+		return {};
+
+	if (szResponseBodyLeft != SIZE_MAX) {
+		if (size > szResponseBodyLeft)
+			return _abortResponseStream();
+		szResponseBodyLeft -= size;
+	}
+
+	sendFile = file;
+	sendFileOffset = offset;
+	szSendFile = size;
+
+	session->_markReady(this);
+
+	return session->_sendPending();
+}
+
+netknot::ExceptionPointer Http2Stream::writeResponseStreamBuffer(const netknot::RcBufferRef &buffer) {
+	if (!buffer.size)
+		return {};
+
+	if ((!isReset) && isResponsePieceQueued()) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
+
+	if (isReset)
+		return {};
+
+	if (szResponseBodyLeft != SIZE_MAX) {
+		if (buffer.size > szResponseBodyLeft)
+			return _abortResponseStream();
+		szResponseBodyLeft -= buffer.size;
+	}
+
+	sendPiece = buffer;
+
+	session->_markReady(this);
+
+	return session->_sendPending();
+}
+
+netknot::ExceptionPointer Http2Stream::_abortResponseStream() {
+	// The peer is told that the response is broken, the rest of the stream is discarded as the stream is reset.
+	NETKNOT_RETURN_IF_EXCEPT(session->_resetStream(this, Http2ErrorCode::InternalError));
+	NETKNOT_RETURN_IF_EXCEPT(session->_sendPending());
+
+	return netknot::InvalidArgsError::alloc();
+}
+
+netknot::ExceptionPointer Http2Stream::endResponseStream() {
+	// The body is shorter than the announced length, the stream is reset rather than ended so that the peer does not take it as complete.
+	const bool isAborted = (!isReset) && (szResponseBodyLeft != SIZE_MAX) && szResponseBodyLeft;
+
+	handlerState.stage = HttpURLHandlerStateStage::End;
+	isResponseBlocked = false;
+
+	Http2Session *s = session;
+
+	if (isAborted) {
+		NETKNOT_RETURN_IF_EXCEPT(s->_resetStream(this, Http2ErrorCode::InternalError));
+	} else if (!isReset) {
+		// The last frame tells the end, which is sent after the data queued.
+		isResponseEnding = true;
+		s->_markReady(this);
+	}
+
+	// Ended in handleURL(), the stream is checked when it returns.
+	if (!isInHandler)
+		NETKNOT_RETURN_IF_EXCEPT(s->_checkStream(this));
+
+	NETKNOT_RETURN_IF_EXCEPT(s->_sendPending());
+
+	if (isAborted)
+		return netknot::InvalidArgsError::alloc();
+
+	return {};
+}
+
+Http2Session::Http2Session(peff::Alloc *selfAllocator, HttpReadAsyncCallback *requestCallback) noexcept
+	: _framePayload(requestCallback->allocator.get()),
+	  _headerBlock(requestCallback->allocator.get()),
+	  _decoder(requestCallback->allocator.get()),
+	  _encoder(requestCallback->allocator.get()),
+	  _encodedBlock(requestCallback->allocator.get()),
+	  _scratchArena(requestCallback->allocator.get()),
+	  _streams(requestCallback->allocator.get()),
+	  selfAllocator(selfAllocator),
+	  httpServer(requestCallback->httpServer),
+	  requestCallback(requestCallback) {
+}
+
+Http2Session::~Http2Session() {
+	// Nothing can be sent anymore, the streams are released without being reset.
+	_isConnectionClosed = true;
+
+	while (_firstStream)
+		_releaseStream(_firstStream);
+}
+
+void Http2Session::dealloc() noexcept {
+	peff::destroyAndRelease<Http2Session>(selfAllocator.get(), this, alignof(Http2Session));
+}
+
+Http2Session *Http2Session::alloc(peff::Alloc *allocator, HttpReadAsyncCallback *requestCallback) noexcept {
+	return peff::allocAndConstruct<Http2Session>(allocator, alignof(Http2Session), allocator, requestCallback);
+}
+
+bool Http2Session::_queueFrame(Http2FrameType type, uint8_t flags, uint32_t streamId, const std::string_view &payload) noexcept {
+	return appendHttp2Frame(requestCallback->pendingResponses, type, flags, streamId, payload);
+}
+
+bool Http2Session::_queueWindowUpdate(uint32_t streamId, uint32_t increment) noexcept {
+	char payload[4];
+
+	writeHttp2Uint32(payload, increment);
+
+	return _queueFrame(Http2FrameType::WindowUpdate, 0, streamId, std::string_view(payload, sizeof(payload)));
+}
+
+bool Http2Session::_queueRstStream(uint32_t streamId, Http2ErrorCode errorCode) noexcept {
+	char payload[4];
+
+	writeHttp2Uint32(payload, (uint32_t)errorCode);
+
+	return _queueFrame(Http2FrameType::RstStream, 0, streamId, std::string_view(payload, sizeof(payload)));
+}
+
+bool Http2Session::_queueHeaderBlock(uint32_t streamId, bool isEndStream) noexcept {
+	const size_t szMaxFragment = _peerSettings.maxFrameSize;
+	std::string_view block(_encodedBlock.data(), _encodedBlock.size());
+	Http2FrameType type = Http2FrameType::Headers;
+	uint8_t flags = isEndStream ? HTTP2_FLAG_END_STREAM : 0;
+
+	// A block larger than a frame goes on in CONTINUATION frames, which follow at once.
+	for (;;) {
+		const std::string_view fragment = block.substr(0, szMaxFragment);
+
+		block.remove_prefix(fragment.size());
+		if (!block.size())
+			flags |= HTTP2_FLAG_END_HEADERS;
+
+		if (!_queueFrame(type, flags, streamId, fragment))
+			return false;
+
+		if (!block.size())
+			return true;
+
+		type = Http2FrameType::Continuation;
+		flags = 0;
+	}
+}
+
+netknot::ExceptionPointer Http2Session::_failConnection(Http2ErrorCode errorCode) {
+	if (_isFailed)
+		return {};
+
+	_isFailed = true;
+
+	char payload[8];
+
+	writeHttp2Uint32(payload, _lastPeerStreamId);
+	writeHttp2Uint32(payload + 4, (uint32_t)errorCode);
+
+	if (!_queueFrame(Http2FrameType::GoAway, 0, 0, std::string_view(payload, sizeof(payload))))
+		return netknot::OutOfMemoryError::alloc();
+
+	// The connection is closed once the GOAWAY is sent, the streams are dropped as soon as their handlers let go.
+	requestCallback->isKeepAlive = false;
+
+	for (Http2Stream *stream = _firstStream, *next; stream; stream = next) {
+		next = stream->next;
+
+		NETKNOT_RETURN_IF_EXCEPT(_closeStream(stream));
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_resetStream(Http2Stream *stream, Http2ErrorCode errorCode) {
+	if (stream->isReset)
+		return {};
+
+	if (!_queueRstStream(stream->id, errorCode))
+		return netknot::OutOfMemoryError::alloc();
+
+	return _closeStream(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_closeStream(Http2Stream *stream) {
+	if (stream->isReset)
+		return {};
+
+	stream->isReset = true;
+
+	// The body which the handler has not taken is given back to the window of the connection.
+	size_t szUntaken = 0;
+	for (size_t i = stream->iNextBodyPiece; i < stream->bodyPieces.size(); ++i)
+		szUntaken += stream->bodyPieces.at(i).size;
+	stream->bodyPieces.clear();
+	stream->iNextBodyPiece = 0;
+
+	stream->sendBuffer.clear();
+	stream->offSendBuffer = 0;
+	stream->sendFile.reset();
+	stream->sendPiece = {};
+
+	if (stream->isReady)
+		_unlinkReady(stream);
+
+	return _creditBody(nullptr, szUntaken);
+}
+
+netknot::ExceptionPointer Http2Session::_creditBody(Http2Stream *stream, size_t size) {
+	if ((!size) || _isFailed || _isConnectionClosed)
+		return {};
+
+	// The window is updated once half of it has been used, rather than by every piece.
+	const uint32_t connectionWindowSize = std::max(httpServer->connectionWindowSize, HTTP2_DEFAULT_WINDOW_SIZE);
+
+	if ((_szUnackedBody += size) >= connectionWindowSize / 2) {
+		if (!_queueWindowUpdate(0, (uint32_t)_szUnackedBody))
+			return netknot::OutOfMemoryError::alloc();
+
+		_receiveWindow += _szUnackedBody;
+		_szUnackedBody = 0;
+	}
+
+	// No more body comes after the end of the request, nothing is credited to the stream then.
+	if (stream && (!stream->isReset) && (!stream->isRequestEnded)) {
+		if ((stream->szUnackedBody += size) >= _localInitialWindowSize / 2) {
+			if (!_queueWindowUpdate(stream->id, (uint32_t)stream->szUnackedBody))
+				return netknot::OutOfMemoryError::alloc();
+
+			stream->receiveWindow += stream->szUnackedBody;
+			stream->szUnackedBody = 0;
+		}
+	}
+
+	return {};
+}
+
+Http2Stream *Http2Session::_allocStream(uint32_t id) noexcept {
+	HttpWorkerConnections *worker = requestCallback->connection->worker;
+	void *p;
+
+	{
+		std::lock_guard<HttpWorkerMutex> workerGuard(worker->mutex);
+
+		p = worker->streamSlab.alloc();
+	}
+
+	if (!p)
+		return nullptr;
+
+	Http2Stream *stream = new (p) Http2Stream(this, id);
+
+	if (!_streams.insert(std::move(id), std::move(stream))) {
+		stream->~Http2Stream();
+
+		std::lock_guard<HttpWorkerMutex> workerGuard(worker->mutex);
+
+		worker->streamSlab.release(stream);
+		return nullptr;
+	}
+
+	stream->prev = _lastStream;
+	if (_lastStream)
+		_lastStream->next = stream;
+	else
+		_firstStream = stream;
+	_lastStream = stream;
+
+	return stream;
+}
+
+void Http2Session::_releaseStream(Http2Stream *stream) noexcept {
+	// The response is done before the request, the rest of the request is not wanted.
+	if ((!stream->isReset) && (!stream->isRequestEnded) && (!_isFailed) && (!_isConnectionClosed)) {
+		if (!_queueRstStream(stream->id, Http2ErrorCode::NoError)) {
+			// The peer still sends the request, whose data are discarded as they arrive.
+		}
+	}
+
+	if (stream->isReady)
+		_unlinkReady(stream);
+
+	if (stream->prev)
+		stream->prev->next = stream->next;
+	else
+		_firstStream = stream->next;
+	if (stream->next)
+		stream->next->prev = stream->prev;
+	else
+		_lastStream = stream->prev;
+
+	_streams.remove(stream->id);
+
+	HttpWorkerConnections *worker = requestCallback->connection->worker;
+
+	stream->~Http2Stream();
+
+	std::lock_guard<HttpWorkerMutex> workerGuard(worker->mutex);
+
+	worker->streamSlab.release(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_checkStream(Http2Stream *stream) {
+	if (stream->isInHandler || stream->isHandlerInControl())
+		return {};
+
+	if ((!stream->isReset) && (!(stream->isRequestHandled && stream->isResponseEnded)))
+		return {};
+
+	_releaseStream(stream);
+
+	// The connection waits for the handlers to let go before it is released.
+	if (requestCallback->isClosed) {
+		if (!isHandlerInControl())
+			return requestCallback->closeConnection();
+		return {};
+	}
+
+	// The peer opens no more streams, the connection is closed after the responses are sent.
+	if (_isPeerGoingAway && (!_streams.size()))
+		requestCallback->isKeepAlive = false;
+
+	return {};
+}
+
+Http2Stream *Http2Session::_findStream(uint32_t id) const noexcept {
+	if (auto it = _streams.find(id); it != _streams.end())
+		return it.value();
+
+	return nullptr;
+}
+
+void Http2Session::_linkReady(Http2Stream *stream) noexcept {
+	stream->prevReady = _lastReady;
+	stream->nextReady = nullptr;
+
+	if (_lastReady)
+		_lastReady->nextReady = stream;
+	else
+		_firstReady = stream;
+
+	_lastReady = stream;
+	stream->isReady = true;
+	++_nReadyStreams;
+}
+
+void Http2Session::_unlinkReady(Http2Stream *stream) noexcept {
+	if (stream->prevReady)
+		stream->prevReady->nextReady = stream->nextReady;
+	else
+		_firstReady = stream->nextReady;
+
+	if (stream->nextReady)
+		stream->nextReady->prevReady = stream->prevReady;
+	else
+		_lastReady = stream->prevReady;
+
+	stream->prevReady = nullptr;
+	stream->nextReady = nullptr;
+	stream->isReady = false;
+	--_nReadyStreams;
+}
+
+void Http2Session::_markReady(Http2Stream *stream) noexcept {
+	if (stream->isReady || stream->isReset || stream->isResponseEnded)
+		return;
+
+	// The data wait for the window of the stream, the end of the response alone takes no window.
+	if (stream->hasResponseData() ? (stream->sendWindow > 0) : stream->isResponseEnding)
+		_linkReady(stream);
+}
+
+bool Http2Session::applyUpgradeSettings(const std::string_view &value) noexcept {
+	if (!_peerSettings.applyBase64(value))
+		return false;
+
+	_encoder.setMaxTableSize(_peerSettings.headerTableSize);
+
+	return true;
+}
+
+netknot::ExceptionPointer Http2Session::start(size_t szPrefaceReceived) {
+	_offPreface = szPrefaceReceived;
+
+	const uint32_t streamWindowSize = std::min(httpServer->streamWindowSize, HTTP2_MAX_WINDOW_SIZE);
+	const uint32_t maxHeaderListSize = (uint32_t)std::min(httpServer->maxRequestHeadSize, (size_t)UINT32_MAX);
+	const std::pair<Http2SettingId, uint32_t> settings[] = {
+		{ Http2SettingId::MaxConcurrentStreams, httpServer->maxConcurrentStreams },
+		{ Http2SettingId::InitialWindowSize, streamWindowSize },
+		{ Http2SettingId::MaxHeaderListSize, maxHeaderListSize }
+	};
+	char payload[sizeof(settings) / sizeof(*settings) * 6];
+
+	for (size_t i = 0; i < sizeof(settings) / sizeof(*settings); ++i) {
+		payload[i * 6] = (char)((uint16_t)settings[i].first >> 8);
+		payload[i * 6 + 1] = (char)settings[i].first;
+		writeHttp2Uint32(payload + i * 6 + 2, settings[i].second);
+	}
+
+	// The settings are the first frame which the server sends.
+	if (!_queueFrame(Http2FrameType::Settings, 0, 0, std::string_view(payload, sizeof(payload))))
+		return netknot::OutOfMemoryError::alloc();
+
+	// The window of the connection only grows by WINDOW_UPDATE.
+	if (httpServer->connectionWindowSize > HTTP2_DEFAULT_WINDOW_SIZE) {
+		const uint32_t increment = std::min(httpServer->connectionWindowSize, HTTP2_MAX_WINDOW_SIZE) - HTTP2_DEFAULT_WINDOW_SIZE;
+
+		if (!_queueWindowUpdate(0, increment))
+			return netknot::OutOfMemoryError::alloc();
+
+		_receiveWindow += increment;
+	}
+
+	return {};
+}
+
+static bool copyString(peff::Alloc *allocator, const std::string_view &s, std::string_view &sOut) noexcept {
+	if (!s.size()) {
+		sOut = ""sv;
+		return true;
+	}
+
+	char *p = (char *)allocator->alloc(s.size(), 1);
+
+	if (!p)
+		return false;
+
+	memcpy(p, s.data(), s.size());
+	sOut = std::string_view(p, s.size());
+
+	return true;
+}
+
+netknot::ExceptionPointer Http2Session::startUpgradedStream(const HttpRequestLineView &requestLineView, const HttpRequestHeaderView &requestHeaderView) {
+	Http2Stream *stream = _allocStream(1);
+
+	if (!stream)
+		return netknot::OutOfMemoryError::alloc();
+
+	_lastPeerStreamId = 1;
+
+	// The request has been sent in full as HTTP/1.1, the stream is half-closed on the side of the peer.
+	stream->isRequestEnded = true;
+
+	// The views refer to the receive buffers of the connection, which are reused for the frames.
+	HttpRequestLineView &lineView = stream->requestLineView;
+	HttpRequestHeaderView &headerView = stream->requestHeaderView;
+
+	if ((!copyString(&stream->requestArena, requestLineView.method, lineView.method)) ||
+		(!copyString(&stream->requestArena, requestLineView.path, lineView.path)) ||
+		(!copyString(&stream->requestArena, requestLineView.version, lineView.version))) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+		return netknot::OutOfMemoryError::alloc();
+	}
+
+	for (size_t i = 0; i < HTTP_HEADER_ID_COUNT; ++i) {
+		switch ((HttpHeaderId)i) {
+			// The headers of the upgrade are for the HTTP/1.1 connection only.
+			case HttpHeaderId::Connection:
+			case HttpHeaderId::Http2Settings:
+			case HttpHeaderId::KeepAlive:
+			case HttpHeaderId::Upgrade:
+				continue;
+			default:
+				break;
+		}
+
+		if (requestHeaderView.knownHeaders[i].data() && (!copyString(&stream->requestArena, requestHeaderView.knownHeaders[i], headerView.knownHeaders[i]))) {
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			return netknot::OutOfMemoryError::alloc();
+		}
+	}
+
+	for (size_t i = 0; i < requestHeaderView.otherHeaders.size(); ++i) {
+		const HttpHeaderField &field = requestHeaderView.otherHeaders.at(i);
+		HttpHeaderField fieldCopy;
+
+		if ((!copyString(&stream->requestArena, field.name, fieldCopy.name)) ||
+			(!copyString(&stream->requestArena, field.value, fieldCopy.value)) ||
+			(!headerView.otherHeaders.pushBack(std::move(fieldCopy)))) {
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			return netknot::OutOfMemoryError::alloc();
+		}
+	}
+
+	return _dispatchStream(stream);
+}
+
+
+netknot::ExceptionPointer Http2Session::processReceived(const char *data, size_t size) {
+	while (size && (!_isFailed)) {
+		switch (_inputState) {
+			case Http2InputState::Preface: {
+				const size_t n = std::min(size, HTTP2_CONNECTION_PREFACE.size() - _offPreface);
+
+				// The peer does not speak HTTP/2, it can only be told to go away.
+				if (memcmp(data, HTTP2_CONNECTION_PREFACE.data() + _offPreface, n)) {
+					NETKNOT_RETURN_IF_EXCEPT(_failConnection(Http2ErrorCode::ProtocolError));
+					break;
+				}
+
+				data += n;
+				size -= n;
+
+				if ((_offPreface += n) == HTTP2_CONNECTION_PREFACE.size())
+					_inputState = Http2InputState::FrameHeader;
+				break;
+			}
+			case Http2InputState::FrameHeader: {
+				const char *header;
+
+				// The header is only copied if it straddles reads.
+				if ((!_szFrameHeaderRead) && (size >= HTTP2_FRAME_HEADER_SIZE)) {
+					header = data;
+					data += HTTP2_FRAME_HEADER_SIZE;
+					size -= HTTP2_FRAME_HEADER_SIZE;
+				} else {
+					const size_t n = std::min(size, HTTP2_FRAME_HEADER_SIZE - _szFrameHeaderRead);
+
+					memcpy(_frameHeaderData + _szFrameHeaderRead, data, n);
+					data += n;
+					size -= n;
+
+					if ((_szFrameHeaderRead += n) < HTTP2_FRAME_HEADER_SIZE)
+						break;
+
+					_szFrameHeaderRead = 0;
+					header = _frameHeaderData;
+				}
+
+				parseHttp2FrameHeader(header, _frameHeader);
+
+				NETKNOT_RETURN_IF_EXCEPT(_onFrameHeader());
+				break;
+			}
+			case Http2InputState::FramePayload: {
+				std::string_view payload;
+
+				// The payload is only copied if it straddles reads.
+				if ((!_framePayload.size()) && (size >= _frameHeader.length)) {
+					payload = std::string_view(data, _frameHeader.length);
+					data += _frameHeader.length;
+					size -= _frameHeader.length;
+				} else {
+					const size_t n = std::min(size, _frameHeader.length - _framePayload.size());
+
+					if (!_framePayload.append(std::string_view(data, n)))
+						return netknot::OutOfMemoryError::alloc();
+					data += n;
+					size -= n;
+
+					if (_framePayload.size() < _frameHeader.length)
+						break;
+
+					payload = std::string_view(_framePayload.data(), _framePayload.size());
+				}
+
+				_inputState = Http2InputState::FrameHeader;
+
+				netknot::ExceptionPointer e = _onFrame(payload);
+				_framePayload.clear();
+				if (e)
+					return e;
+				break;
+			}
+			case Http2InputState::DataPadLength: {
+				const size_t szPadding = (uint8_t)*data;
+
+				++data;
+				--size;
+
+				if (szPadding >= _frameHeader.length) {
+					NETKNOT_RETURN_IF_EXCEPT(_failConnection(Http2ErrorCode::ProtocolError));
+					break;
+				}
+
+				_szDataLeft = _frameHeader.length - 1 - szPadding;
+				_szDataPadding = szPadding;
+
+				// The pad length and the padding are never taken by the handler, they are credited at once.
+				NETKNOT_RETURN_IF_EXCEPT(_creditBody(_findStream(_dataStreamId), 1 + szPadding));
+
+				if (_szDataLeft)
+					_inputState = Http2InputState::DataPayload;
+				else if (_szDataPadding)
+					_inputState = Http2InputState::DataPadding;
+				else
+					NETKNOT_RETURN_IF_EXCEPT(_onDataEnd());
+				break;
+			}
+			case Http2InputState::DataPayload: {
+				const size_t n = std::min(size, _szDataLeft);
+
+				// The data are passed to the stream as they arrive, which refers to the receive buffer without copying.
+				NETKNOT_RETURN_IF_EXCEPT(_onData(data, n));
+				data += n;
+				size -= n;
+
+				if ((_szDataLeft -= n))
+					break;
+
+				if (_szDataPadding)
+					_inputState = Http2InputState::DataPadding;
+				else
+					NETKNOT_RETURN_IF_EXCEPT(_onDataEnd());
+				break;
+			}
+			case Http2InputState::DataPadding: {
+				const size_t n = std::min(size, _szDataPadding);
+
+				data += n;
+				size -= n;
+
+				if (!(_szDataPadding -= n))
+					NETKNOT_RETURN_IF_EXCEPT(_onDataEnd());
+				break;
+			}
+		}
+	}
+
+	HttpReadAsyncCallback *callback = requestCallback;
+
+	// Nothing in the receive buffer is referred to by the session, it is reused from the beginning unless a body piece holds it.
+	if (callback->receiveBuffer && ((HttpReceiveBuffer *)callback->receiveBuffer.buffer.get())->isUniquelyReferenced())
+		callback->szReceiveBufferUsed = 0;
+
+	if (_isFailed)
+		return callback->_flushResponses();
+
+	NETKNOT_RETURN_IF_EXCEPT(_sendPending());
+
+	// The peer has gone away and every stream is done, the connection is closed after the responses are sent.
+	if (!callback->isKeepAlive)
+		return {};
+
+	return callback->_readMore();
+}
+
+netknot::ExceptionPointer Http2Session::_onFrameHeader() {
+	const Http2FrameHeader &header = _frameHeader;
+
+	// The default frame size is never raised, which every peer must support.
+	if (header.length > HTTP2_DEFAULT_MAX_FRAME_SIZE)
+		return _failConnection(Http2ErrorCode::FrameSizeError);
+
+	// A header block is continued by the CONTINUATION frames of the stream without anything in between.
+	if (_headerBlockStreamId && ((header.type != Http2FrameType::Continuation) || (header.streamId != _headerBlockStreamId)))
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	if (header.type == Http2FrameType::Data)
+		return _onDataHeader();
+
+	if (!header.length)
+		return _onFrame({});
+
+	_inputState = Http2InputState::FramePayload;
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_onFrame(const std::string_view &payload) {
+	const Http2FrameHeader &header = _frameHeader;
+
+	switch (header.type) {
+		case Http2FrameType::Headers:
+			return _onHeaders(payload);
+		case Http2FrameType::Priority: {
+			if (!header.streamId)
+				return _failConnection(Http2ErrorCode::ProtocolError);
+
+			// The priorities are not followed, the streams are served round-robin.
+			if (payload.size() != 5) {
+				if (Http2Stream *stream = _findStream(header.streamId); stream) {
+					NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::FrameSizeError));
+					return _checkStream(stream);
+				}
+			}
+			break;
+		}
+		case Http2FrameType::RstStream: {
+			if (payload.size() != 4)
+				return _failConnection(Http2ErrorCode::FrameSizeError);
+			if ((!header.streamId) || (header.streamId > _lastPeerStreamId))
+				return _failConnection(Http2ErrorCode::ProtocolError);
+
+			if (Http2Stream *stream = _findStream(header.streamId); stream) {
+				NETKNOT_RETURN_IF_EXCEPT(_closeStream(stream));
+				return _checkStream(stream);
+			}
+			break;
+		}
+		case Http2FrameType::Settings:
+			return _onSettings(payload);
+		case Http2FrameType::PushPromise:
+			// Only the servers push.
+			return _failConnection(Http2ErrorCode::ProtocolError);
+		case Http2FrameType::Ping: {
+			if (header.streamId)
+				return _failConnection(Http2ErrorCode::ProtocolError);
+			if (payload.size() != 8)
+				return _failConnection(Http2ErrorCode::FrameSizeError);
+
+			if (!(header.flags & HTTP2_FLAG_ACK)) {
+				if (!_queueFrame(Http2FrameType::Ping, HTTP2_FLAG_ACK, 0, payload))
+					return netknot::OutOfMemoryError::alloc();
+			}
+			break;
+		}
+		case Http2FrameType::GoAway: {
+			if (header.streamId)
+				return _failConnection(Http2ErrorCode::ProtocolError);
+			if (payload.size() < 8)
+				return _failConnection(Http2ErrorCode::FrameSizeError);
+
+			// The streams opened so far are still served.
+			_isPeerGoingAway = true;
+			if (!_streams.size())
+				requestCallback->isKeepAlive = false;
+			break;
+		}
+		case Http2FrameType::WindowUpdate:
+			return _onWindowUpdate(payload);
+		case Http2FrameType::Continuation:
+			return _onContinuation(payload);
+		default:
+			// The unknown frames are ignored.
+			break;
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_onDataHeader() {
+	const Http2FrameHeader &header = _frameHeader;
+
+	if ((!header.streamId) || (header.streamId > _lastPeerStreamId))
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	// The whole frame counts against the windows, the padding included.
+	if (header.length > _receiveWindow)
+		return _failConnection(Http2ErrorCode::FlowControlError);
+	_receiveWindow -= header.length;
+
+	Http2Stream *stream = _findStream(header.streamId);
+
+	if (stream && (!stream->isReset)) {
+		if (stream->isRequestEnded) {
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::StreamClosed));
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			stream = nullptr;
+		} else if (header.length > stream->receiveWindow) {
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::FlowControlError));
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			stream = nullptr;
+		} else {
+			stream->receiveWindow -= header.length;
+		}
+	} else {
+		// The frames of the closed streams are discarded, which may still be on their way after a reset.
+		stream = nullptr;
+	}
+
+	// The stream is looked up again for each piece, as it may be released meanwhile.
+	_dataStreamId = stream ? header.streamId : 0;
+
+	if (header.flags & HTTP2_FLAG_PADDED) {
+		if (!header.length)
+			return _failConnection(Http2ErrorCode::FrameSizeError);
+
+		_inputState = Http2InputState::DataPadLength;
+		return {};
+	}
+
+	_szDataLeft = header.length;
+	_szDataPadding = 0;
+
+	if (!_szDataLeft)
+		return _onDataEnd();
+
+	_inputState = Http2InputState::DataPayload;
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_onData(const char *data, size_t size) {
+	Http2Stream *stream = _findStream(_dataStreamId);
+
+	if ((!stream) || stream->isReset)
+		return _creditBody(nullptr, size);
+
+	// A body longer than announced is malformed, and one of unknown length is limited as it arrives.
+	if ((stream->szBodyRead += size) > stream->expectedBodySize) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+		return _creditBody(nullptr, size);
+	}
+	if (stream->szBodyRead > httpServer->maxRequestBodySize) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::Cancel));
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+		return _creditBody(nullptr, size);
+	}
+
+	// Nobody takes the body of a request answered with an error, it is discarded as it arrives.
+	if (!stream->currentHandler)
+		return _creditBody(stream, size);
+
+	HttpReadAsyncCallback *callback = requestCallback;
+
+	if (!stream->bodyPieces.pushBack(netknot::RcBufferRef(callback->receiveBuffer.buffer.get(), (size_t)(data - callback->receiveBuffer.buffer->data), size)))
+		return netknot::OutOfMemoryError::alloc();
+
+	return _deliverBody(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_onDataEnd() {
+	_inputState = Http2InputState::FrameHeader;
+
+	if (!(_frameHeader.flags & HTTP2_FLAG_END_STREAM))
+		return {};
+
+	Http2Stream *stream = _findStream(_dataStreamId);
+
+	if ((!stream) || stream->isReset)
+		return {};
+
+	return _endRequest(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_endRequest(Http2Stream *stream) {
+	stream->isRequestEnded = true;
+
+	if ((stream->expectedBodySize != SIZE_MAX) && (stream->szBodyRead != stream->expectedBodySize)) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+		return _checkStream(stream);
+	}
+
+	// The request answered with an error only waits for its end.
+	if (!stream->currentHandler)
+		return _checkStream(stream);
+
+	// The request is handled once the handler has taken the whole body.
+	return _deliverBody(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_onHeaders(const std::string_view &payload) {
+	const Http2FrameHeader &header = _frameHeader;
+	std::string_view fragment = payload;
+
+	if (!header.streamId)
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	if (header.flags & HTTP2_FLAG_PADDED) {
+		if (!fragment.size())
+			return _failConnection(Http2ErrorCode::FrameSizeError);
+
+		const size_t szPadding = (uint8_t)fragment[0];
+
+		fragment.remove_prefix(1);
+		if (szPadding > fragment.size())
+			return _failConnection(Http2ErrorCode::ProtocolError);
+		fragment.remove_suffix(szPadding);
+	}
+
+	// The priority is not followed.
+	if (header.flags & HTTP2_FLAG_PRIORITY) {
+		if (fragment.size() < 5)
+			return _failConnection(Http2ErrorCode::FrameSizeError);
+		fragment.remove_prefix(5);
+	}
+
+	if (header.flags & HTTP2_FLAG_END_HEADERS)
+		return _onHeaderBlock(header.streamId, header.flags, fragment);
+
+	// The block is completed by the CONTINUATION frames.
+	if (!_headerBlock.build(fragment))
+		return netknot::OutOfMemoryError::alloc();
+
+	_headerBlockStreamId = header.streamId;
+	_headerBlockFlags = header.flags;
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_onContinuation(const std::string_view &payload) {
+	if (!_headerBlockStreamId)
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	// Every field takes more room in the list than in the block, a block beyond the limit of the list is never accepted.
+	if (_headerBlock.size() + payload.size() > httpServer->maxRequestHeadSize)
+		return _failConnection(Http2ErrorCode::EnhanceYourCalm);
+
+	if (!_headerBlock.append(payload))
+		return netknot::OutOfMemoryError::alloc();
+
+	if (!(_frameHeader.flags & HTTP2_FLAG_END_HEADERS))
+		return {};
+
+	const uint32_t streamId = _headerBlockStreamId;
+
+	_headerBlockStreamId = 0;
+
+	netknot::ExceptionPointer e = _onHeaderBlock(streamId, _headerBlockFlags, std::string_view(_headerBlock.data(), _headerBlock.size()));
+	_headerBlock.clear();
+
+	return e;
+}
+
+bool Http2Session::_discardHeaderBlock(const std::string_view &block) noexcept {
+	HpackDecodeResult result;
+
+	{
+		peff::DynArray<HttpHeaderField> fields(&_scratchArena);
+
+		// Nothing is kept, only the dynamic table is updated.
+		result = _decoder.decode(block.data(), block.size(), 0, &_scratchArena, fields);
+	}
+	_scratchArena.reset();
+
+	return result != HpackDecodeResult::Malformed;
+}
+
+netknot::ExceptionPointer Http2Session::_onHeaderBlock(uint32_t streamId, uint8_t flags, const std::string_view &block) {
+	const bool isEndStream = flags & HTTP2_FLAG_END_STREAM;
+
+	if (streamId <= _lastPeerStreamId) {
+		// Every block is decoded to keep the dynamic table, the fields of the blocks on the closed streams are dropped.
+		if (!_discardHeaderBlock(block))
+			return _failConnection(Http2ErrorCode::CompressionError);
+
+		Http2Stream *stream = _findStream(streamId);
+
+		// The stream may have been reset while the peer sent its trailers.
+		if ((!stream) || stream->isReset)
+			return {};
+
+		// The trailers end the request, they are not passed to the handler.
+		if (stream->isRequestEnded)
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::StreamClosed));
+		else if (!isEndStream)
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+		else
+			return _endRequest(stream);
+
+		return _checkStream(stream);
+	}
+
+	// The stream IDs of the client are odd.
+	if (!(streamId & 1))
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	_lastPeerStreamId = streamId;
+
+	Http2Stream *stream = nullptr;
+
+	// The streams beyond the limit are refused, which the peer may try again.
+	if ((_streams.size() < httpServer->maxConcurrentStreams) && (!_isPeerGoingAway))
+		stream = _allocStream(streamId);
+
+	if (!stream) {
+		if (!_discardHeaderBlock(block))
+			return _failConnection(Http2ErrorCode::CompressionError);
+
+		if (!_queueRstStream(streamId, Http2ErrorCode::RefusedStream))
+			return netknot::OutOfMemoryError::alloc();
+		return {};
+	}
+
+	stream->isRequestEnded = isEndStream;
+
+	switch (_decoder.decode(block.data(), block.size(), httpServer->maxRequestHeadSize, &stream->requestArena, stream->requestFields)) {
+		case HpackDecodeResult::Done:
+			break;
+		case HpackDecodeResult::TooLarge:
+			// The dynamic table is still in sync, only the stream is answered with an error.
+			NETKNOT_RETURN_IF_EXCEPT(_queueErrorResponse(stream, HttpResponseStatus::RequestHeaderFieldsTooLarge));
+			return _checkStream(stream);
+		case HpackDecodeResult::Malformed:
+			stream->isReset = true;
+			_releaseStream(stream);
+			return _failConnection(Http2ErrorCode::CompressionError);
+		case HpackDecodeResult::OutOfMemory:
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	if (!_buildRequest(stream)) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+		return _checkStream(stream);
+	}
+
+	return _dispatchStream(stream);
+}
+
+/// @brief Append a field to a cookie header, the cookies of HTTP/2 come in separate fields but go to the handlers in one.
+static bool joinCookie(peff::Alloc *allocator, std::string_view &cookie, const std::string_view &value) noexcept {
+	const size_t szJoined = cookie.size() + 2 + value.size();
+	char *p = (char *)allocator->alloc(szJoined, 1);
+
+	if (!p)
+		return false;
+
+	memcpy(p, cookie.data(), cookie.size());
+	memcpy(p + cookie.size(), "; ", 2);
+	memcpy(p + cookie.size() + 2, value.data(), value.size());
+
+	cookie = std::string_view(p, szJoined);
+
+	return true;
+}
+
+bool Http2Session::_buildRequest(Http2Stream *stream) noexcept {
+	constexpr uint8_t PSEUDO_METHOD = 0x01, PSEUDO_SCHEME = 0x02, PSEUDO_PATH = 0x04, PSEUDO_AUTHORITY = 0x08;
+
+	HttpRequestHeaderView &headerView = stream->requestHeaderView;
+	std::string_view method, path, authority;
+	uint8_t seenPseudoHeaders = 0;
+	bool isRegularHeaderSeen = false;
+
+	for (size_t i = 0; i < stream->requestFields.size(); ++i) {
+		const HttpHeaderField &field = stream->requestFields.at(i);
+		const std::string_view name = field.name;
+		// An empty value must still be told from an absent one.
+		const std::string_view value = field.value.data() ? field.value : ""sv;
+
+		if (!name.size())
+			return false;
+
+		if (name[0] == ':') {
+			// The pseudo-headers come first, each one once.
+			if (isRegularHeaderSeen)
+				return false;
+
+			uint8_t pseudoHeader;
+
+			if (name == ":method"sv) {
+				pseudoHeader = PSEUDO_METHOD;
+				method = value;
+			} else if (name == ":scheme"sv) {
+				pseudoHeader = PSEUDO_SCHEME;
+			} else if (name == ":path"sv) {
+				pseudoHeader = PSEUDO_PATH;
+				path = value;
+			} else if (name == ":authority"sv) {
+				pseudoHeader = PSEUDO_AUTHORITY;
+				authority = value;
+			} else {
+				return false;
+			}
+
+			if (seenPseudoHeaders & pseudoHeader)
+				return false;
+			seenPseudoHeaders |= pseudoHeader;
+			continue;
+		}
+
+		isRegularHeaderSeen = true;
+
+		for (char c : name) {
+			if ((c >= 'A') && (c <= 'Z'))
+				return false;
+		}
+
+		const HttpHeaderId id = lookupHttpHeaderId(name);
+
+		switch (id) {
+			// The headers of the connection mean nothing in HTTP/2.
+			case HttpHeaderId::Connection:
+			case HttpHeaderId::Http2Settings:
+			case HttpHeaderId::KeepAlive:
+			case HttpHeaderId::TransferEncoding:
+			case HttpHeaderId::Upgrade:
+				return false;
+			case HttpHeaderId::TE:
+				if (value != "trailers"sv)
+					return false;
+				break;
+			case HttpHeaderId::Cookie:
+				if (headerView.has(HttpHeaderId::Cookie)) {
+					if (!joinCookie(&stream->requestArena, headerView.knownHeaders[(size_t)id], value))
+						return false;
+					continue;
+				}
+				break;
+			case HttpHeaderId::Unknown:
+				if (name == "proxy-connection"sv)
+					return false;
+				break;
+			default:
+				break;
+		}
+
+		if ((id != HttpHeaderId::Unknown) && (!headerView.has(id))) {
+			headerView.knownHeaders[(size_t)id] = value;
+		} else {
+			if (!headerView.otherHeaders.pushBack(HttpHeaderField{ name, value }))
+				return false;
+		}
+	}
+
+	if ((seenPseudoHeaders & (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH)) != (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH))
+		return false;
+	if ((!method.size()) || (!path.size()))
+		return false;
+
+	// The authority stands for the Host header of HTTP/1.1.
+	if ((seenPseudoHeaders & PSEUDO_AUTHORITY) && (!headerView.has(HttpHeaderId::Host)))
+		headerView.knownHeaders[(size_t)HttpHeaderId::Host] = authority;
+
+	stream->requestLineView = { method, path, "HTTP/2.0"sv };
+
+	return true;
+}
+
+/// @brief Parse the value of a Content-Length header.
+///
+/// @param value Value of the header.
+/// @param contentLengthOut Where to store the length, SIZE_MAX if it overflows.
+/// @return Whether the value is well-formed.
+static bool parseContentLength(const std::string_view &value, size_t &contentLengthOut) noexcept {
+	size_t contentLength = 0;
+
+	if (!value.size())
+		return false;
+
+	for (char c : value) {
+		if ((c < '0') || (c > '9'))
+			return false;
+
+		const size_t curDigit = c - '0';
+
+		if ((contentLength > (SIZE_MAX - curDigit) / 10) || (contentLength == SIZE_MAX)) {
+			contentLength = SIZE_MAX;
+			continue;
+		}
+		contentLength = contentLength * 10 + curDigit;
+	}
+
+	contentLengthOut = contentLength;
+
+	return true;
+}
+
+netknot::ExceptionPointer Http2Session::_dispatchStream(Http2Stream *stream) {
+	const HttpRequestHeaderView &headerView = stream->requestHeaderView;
+
+	if (headerView.has(HttpHeaderId::ContentLength)) {
+		size_t contentLength;
+
+		if ((!parseContentLength(headerView.get(HttpHeaderId::ContentLength), contentLength)) ||
+			(stream->isRequestEnded && contentLength)) {
+			NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+			return _checkStream(stream);
+		}
+
+		// The body is refused before any of it is received.
+		if (contentLength > httpServer->maxRequestBodySize) {
+			NETKNOT_RETURN_IF_EXCEPT(_queueErrorResponse(stream, HttpResponseStatus::PayloadTooLarge));
+			return _checkStream(stream);
+		}
+
+		stream->expectedBodySize = contentLength;
+	}
+
+	httpServer->routeRequest(stream->requestLineView.path, stream->requestLineView.method, stream->routeTable, stream->handlerState, stream->currentHandler, stream->routeStatus);
+
+	// The error is answered at once, the body is discarded as it arrives.
+	if (!stream->currentHandler) {
+		NETKNOT_RETURN_IF_EXCEPT(_queueErrorResponse(stream, stream->routeStatus));
+		return _checkStream(stream);
+	}
+
+	if (!stream->isRequestEnded)
+		return {};
+
+	return _handleRequest(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_deliverBody(Http2Stream *stream) {
+	// Pulled from onRequestBody(), the loop of the outer call goes on.
+	if (stream->isInHandler)
+		return {};
+
+	while (stream->isBodyPulled && (!stream->isReset)) {
+		if (stream->iNextBodyPiece < stream->bodyPieces.size()) {
+			netknot::RcBufferRef piece = std::move(stream->bodyPieces.at(stream->iNextBodyPiece++));
+
+			if (stream->iNextBodyPiece == stream->bodyPieces.size()) {
+				stream->bodyPieces.clear();
+				stream->iNextBodyPiece = 0;
+			}
+
+			stream->szDeliveredBodyPiece = piece.size;
+
+			// The handler may pull the next piece before returning.
+			stream->isBodyPulled = false;
+			stream->isInHandler = true;
+			netknot::ExceptionPointer e = stream->currentHandler->onRequestBody(stream->handlerState, piece);
+			stream->isInHandler = false;
+
+			if (e) {
+				NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+				NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+				return e;
+			}
+			continue;
+		}
+
+		if (stream->isRequestEnded && (!stream->isRequestHandled))
+			return _handleRequest(stream);
+		break;
+	}
+
+	return _checkStream(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_handleRequest(Http2Stream *stream) {
+	stream->isRequestHandled = true;
+
+	stream->isInHandler = true;
+	netknot::ExceptionPointer e = stream->currentHandler->handleURL(stream->handlerState);
+	stream->isInHandler = false;
+
+	if (e) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::InternalError));
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+		return e;
+	}
+
+	// A streamed response has sent its head already.
+	if ((!stream->isResponseStarted) && (!stream->isReset) && (stream->handlerState.stage != HttpURLHandlerStateStage::ResponseStream))
+		NETKNOT_RETURN_IF_EXCEPT(_queueResponse(stream));
+
+	return _checkStream(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_queueResponse(Http2Stream *stream) {
+	peff::String &responseData = stream->handlerState.responseData;
+
+	// A handler which has made nothing is answered for.
+	if (!responseData.size())
+		return _queueErrorResponse(stream, HttpResponseStatus::InternalServerError);
+
+	const std::string_view response(responseData.data(), responseData.size());
+	const size_t offHeadEnd = response.find("\r\n\r\n"sv);
+	const size_t offBody = offHeadEnd == std::string_view::npos ? response.size() : offHeadEnd + 4;
+	const bool hasBody = offBody < response.size();
+
+	NETKNOT_RETURN_IF_EXCEPT(_queueResponseHead(stream, response.substr(0, offBody), !hasBody));
+
+	if (hasBody) {
+		// The body is sent from the response itself, which is taken over by the stream.
+		std::swap(stream->sendBuffer, responseData);
+		stream->offSendBuffer = offBody;
+		stream->isResponseEnding = true;
+
+		_markReady(stream);
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_queueResponseHead(Http2Stream *stream, const std::string_view &head, bool isEndStream) {
+	// The head is the one of HTTP/1.1, starting with a status line such as "HTTP/1.1 200 OK".
+	if ((head.size() < 12) || (head.substr(0, 5) != "HTTP/"sv))
+		std::terminate();
+
+	_encodedBlock.clear();
+
+	if (!_encoder.beginBlock(_encodedBlock))
+		return netknot::OutOfMemoryError::alloc();
+
+	if (!_encoder.encode(":status"sv, head.substr(9, 3), true, _encodedBlock))
+		return netknot::OutOfMemoryError::alloc();
+
+	size_t offLine = head.find("\r\n"sv);
+
+	while ((offLine != std::string_view::npos) && ((offLine += 2) < head.size())) {
+		const size_t offLineEnd = head.find("\r\n"sv, offLine);
+		const std::string_view line = head.substr(offLine, offLineEnd == std::string_view::npos ? std::string_view::npos : offLineEnd - offLine);
+
+		offLine = offLineEnd;
+
+		const size_t offColon = line.find(':');
+
+		if (offColon == std::string_view::npos)
+			continue;
+
+		const std::string_view name = line.substr(0, offColon);
+		std::string_view value = line.substr(offColon + 1);
+
+		while (value.size() && ((value.front() == ' ') || (value.front() == '\t')))
+			value.remove_prefix(1);
+
+		bool isIndexable = true;
+
+		switch (lookupHttpHeaderId(name)) {
+			// The headers of the connection mean nothing in HTTP/2.
+			case HttpHeaderId::Connection:
+			case HttpHeaderId::KeepAlive:
+			case HttpHeaderId::TransferEncoding:
+			case HttpHeaderId::Upgrade:
+				continue;
+			// The values which seldom repeat are kept out of the dynamic table.
+			case HttpHeaderId::ContentLength:
+				isIndexable = false;
+				break;
+			case HttpHeaderId::Unknown:
+				if (isHttpHeaderNameEqual(name, "Proxy-Connection"sv))
+					continue;
+				isIndexable = !(isHttpHeaderNameEqual(name, "Content-Range"sv) ||
+								isHttpHeaderNameEqual(name, "ETag"sv) ||
+								isHttpHeaderNameEqual(name, "Last-Modified"sv) ||
+								isHttpHeaderNameEqual(name, "Set-Cookie"sv));
+				break;
+			default:
+				break;
+		}
+
+		if (!_encoder.encode(name, value, isIndexable, _encodedBlock))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	if (!_queueHeaderBlock(stream->id, isEndStream))
+		return netknot::OutOfMemoryError::alloc();
+
+	stream->isResponseStarted = true;
+	if (isEndStream)
+		stream->isResponseEnded = true;
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_queueErrorResponse(Http2Stream *stream, HttpResponseStatus status) {
+	HttpURLHandlerState &state = stream->handlerState;
+
+	stream->isRequestHandled = true;
+
+	state.stage = HttpURLHandlerStateStage::StatusLine;
+	state.responseData.clear();
+
+	NETKNOT_RETURN_IF_EXCEPT(state.writeResponse(status, "text/plain", ""));
+
+	return _queueResponse(stream);
+}
+
+netknot::ExceptionPointer Http2Session::_onSettings(const std::string_view &payload) {
+	if (_frameHeader.streamId)
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	if (_frameHeader.flags & HTTP2_FLAG_ACK) {
+		if (payload.size())
+			return _failConnection(Http2ErrorCode::FrameSizeError);
+
+		// The window of the streams which we have announced takes effect once the peer acknowledges it.
+		if (!_isSettingsAcked) {
+			const uint32_t streamWindowSize = std::min(httpServer->streamWindowSize, HTTP2_MAX_WINDOW_SIZE);
+			const int64_t delta = (int64_t)streamWindowSize - (int64_t)_localInitialWindowSize;
+
+			for (Http2Stream *stream = _firstStream; stream; stream = stream->next)
+				stream->receiveWindow += delta;
+
+			_localInitialWindowSize = streamWindowSize;
+			_isSettingsAcked = true;
+		}
+
+		return {};
+	}
+
+	const uint32_t oldInitialWindowSize = _peerSettings.initialWindowSize;
+	Http2ErrorCode errorCode;
+
+	if (!_peerSettings.apply(payload, errorCode))
+		return _failConnection(errorCode);
+
+	_encoder.setMaxTableSize(_peerSettings.headerTableSize);
+
+	// A change of the initial window applies to the windows of the open streams as well.
+	if (const int64_t delta = (int64_t)_peerSettings.initialWindowSize - (int64_t)oldInitialWindowSize; delta) {
+		for (Http2Stream *stream = _firstStream; stream; stream = stream->next) {
+			if ((stream->sendWindow += delta) > HTTP2_MAX_WINDOW_SIZE)
+				return _failConnection(Http2ErrorCode::FlowControlError);
+
+			// A shrunk window leaves the data of the stream waiting until the peer updates the window.
+			if (stream->isReady && stream->hasResponseData() && (stream->sendWindow <= 0))
+				_unlinkReady(stream);
+			else
+				_markReady(stream);
+		}
+	}
+
+	if (!_queueFrame(Http2FrameType::Settings, HTTP2_FLAG_ACK, 0, {}))
+		return netknot::OutOfMemoryError::alloc();
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_onWindowUpdate(const std::string_view &payload) {
+	const uint32_t streamId = _frameHeader.streamId;
+
+	if (payload.size() != 4)
+		return _failConnection(Http2ErrorCode::FrameSizeError);
+
+	const uint32_t increment = readHttp2Uint32(payload.data()) & 0x7fffffff;
+
+	if (!streamId) {
+		if (!increment)
+			return _failConnection(Http2ErrorCode::ProtocolError);
+
+		if ((_sendWindow += increment) > HTTP2_MAX_WINDOW_SIZE)
+			return _failConnection(Http2ErrorCode::FlowControlError);
+
+		return {};
+	}
+
+	if (streamId > _lastPeerStreamId)
+		return _failConnection(Http2ErrorCode::ProtocolError);
+
+	Http2Stream *stream = _findStream(streamId);
+
+	if ((!stream) || stream->isReset)
+		return {};
+
+	if (!increment) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::ProtocolError));
+		return _checkStream(stream);
+	}
+
+	if ((stream->sendWindow += increment) > HTTP2_MAX_WINDOW_SIZE) {
+		NETKNOT_RETURN_IF_EXCEPT(_resetStream(stream, Http2ErrorCode::FlowControlError));
+		return _checkStream(stream);
+	}
+
+	_markReady(stream);
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_queueData() {
+	HttpReadAsyncCallback *callback = requestCallback;
+	// Streams passed over in a row as they wait for the response piece of the connection.
+	size_t nSkipped = 0;
+
+	while (_firstReady && (nSkipped < _nReadyStreams) && (callback->pendingResponses.size() < httpServer->maxPendingResponseSize)) {
+		Http2Stream *stream = _firstReady;
+
+		_unlinkReady(stream);
+
+		const bool isFromBuffer = stream->offSendBuffer < stream->sendBuffer.size();
+		const size_t szAvailable = isFromBuffer ? stream->sendBuffer.size() - stream->offSendBuffer : (stream->sendFile ? stream->szSendFile : stream->sendPiece.size);
+
+		if (!szAvailable) {
+			// Only the end of the response is left, which takes no window.
+			if (!_queueFrame(Http2FrameType::Data, HTTP2_FLAG_END_STREAM, stream->id, {}))
+				return netknot::OutOfMemoryError::alloc();
+
+			stream->isResponseEnded = true;
+			nSkipped = 0;
+
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			continue;
+		}
+
+		// The piece goes out through the response piece of the connection, of which there is only one.
+		if ((!isFromBuffer) && callback->_isResponsePieceQueued()) {
+			_linkReady(stream);
+			++nSkipped;
+			continue;
+		}
+
+		// The stream waits for the peer to update its window, which a change of the settings may have made negative.
+		if (stream->sendWindow <= 0)
+			continue;
+
+		// Nothing can be sent before the peer updates the window of the connection.
+		if (_sendWindow <= 0) {
+			_linkReady(stream);
+			break;
+		}
+
+		// All of the operands are positive, so is the size.
+		const size_t szFrame = (size_t)std::min({ (int64_t)szAvailable, _sendWindow, stream->sendWindow, (int64_t)_peerSettings.maxFrameSize });
+
+		// The last frame of the data tells the end of the response.
+		const bool isEnd = stream->isResponseEnding && (szFrame == szAvailable) && (!isFromBuffer || !stream->isResponsePieceQueued());
+
+		char header[HTTP2_FRAME_HEADER_SIZE];
+		formatHttp2FrameHeader(header, (uint32_t)szFrame, Http2FrameType::Data, isEnd ? HTTP2_FLAG_END_STREAM : 0, stream->id);
+
+		if (!callback->pendingResponses.append(std::string_view(header, sizeof(header))))
+			return netknot::OutOfMemoryError::alloc();
+
+		if (isFromBuffer) {
+			if (!callback->pendingResponses.append(std::string_view(stream->sendBuffer.data() + stream->offSendBuffer, szFrame)))
+				return netknot::OutOfMemoryError::alloc();
+
+			// The buffer is reused from the beginning once it is drained.
+			if ((stream->offSendBuffer += szFrame) == stream->sendBuffer.size()) {
+				stream->sendBuffer.clear();
+				stream->offSendBuffer = 0;
+			}
+		} else {
+			// The frames queued so far, this header included, are sent ahead of the piece.
+			callback->responsePiecePrefix = std::move(callback->pendingResponses);
+			callback->pendingResponses.clear();
+
+			if (stream->sendFile) {
+				callback->responseFile = stream->sendFile;
+				callback->responseFileOffset = stream->sendFileOffset;
+				callback->szResponseFile = szFrame;
+
+				stream->sendFileOffset += szFrame;
+				if (!(stream->szSendFile -= szFrame))
+					stream->sendFile.reset();
+			} else {
+				callback->responseBuffer = netknot::RcBufferRef(stream->sendPiece.buffer.get(), stream->sendPiece.offset, szFrame);
+
+				stream->sendPiece.offset += szFrame;
+				if (!(stream->sendPiece.size -= szFrame))
+					stream->sendPiece = {};
+			}
+		}
+
+		_sendWindow -= szFrame;
+		stream->sendWindow -= szFrame;
+		nSkipped = 0;
+
+		if (isEnd) {
+			stream->isResponseEnded = true;
+			NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+			continue;
+		}
+
+		// The stream goes to the end of the list, so the streams take turns.
+		_markReady(stream);
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_notifyWritable() {
+	const size_t maxPendingResponseSize = httpServer->maxPendingResponseSize;
+
+	for (Http2Stream *stream = _firstStream, *next; stream; stream = next) {
+		next = stream->next;
+
+		if ((!stream->isResponseBlocked) || stream->isInHandler)
+			continue;
+
+		// A reset stream takes whatever the handler writes, which is discarded.
+		if ((!stream->isReset) && (stream->isResponsePieceQueued() || (stream->sendBuffer.size() - stream->offSendBuffer >= maxPendingResponseSize)))
+			continue;
+
+		stream->isResponseBlocked = false;
+
+		stream->isInHandler = true;
+		netknot::ExceptionPointer e = stream->currentHandler->onResponseWritable(stream->handlerState);
+		stream->isInHandler = false;
+
+		NETKNOT_RETURN_IF_EXCEPT(_checkStream(stream));
+
+		if (e)
+			return e;
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer Http2Session::_sendPending() {
+	// Called back by a handler while the frames are being scheduled, the outer call goes round again.
+	if (_isSending) {
+		_isSendRequested = true;
+		return {};
+	}
+
+	_isSending = true;
+
+	do {
+		_isSendRequested = false;
+
+		netknot::ExceptionPointer e = _queueData();
+
+		if (!e)
+			e = _notifyWritable();
+
+		if (e) {
+			_isSending = false;
+			return e;
+		}
+	} while (_isSendRequested);
+
+	_isSending = false;
+
+	// The connection is released by the last stream to be released.
+	if (_isConnectionClosed)
+		return {};
+
+	return requestCallback->_flushResponses();
+}
+
+netknot::ExceptionPointer Http2Session::onResponsesWritten() {
+	return _sendPending();
+}
+
+void Http2Session::onConnectionClosed() noexcept {
+	if (_isConnectionClosed)
+		return;
+
+	_isConnectionClosed = true;
+
+	for (Http2Stream *stream = _firstStream; stream; stream = stream->next) {
+		if (netknot::ExceptionPointer e = _closeStream(stream); e)
+			e.reset();
+	}
+
+	// The handlers waiting to stream more go on, the data they write are discarded until they end the streams.
+	if (netknot::ExceptionPointer e = _sendPending(); e)
+		e.reset();
+
+	for (Http2Stream *stream = _firstStream, *next; stream; stream = next) {
+		next = stream->next;
+
+		if (netknot::ExceptionPointer e = _checkStream(stream); e)
+			e.reset();
+	}
+}
+
+bool Http2Session::isHandlerInControl() const noexcept {
+	for (Http2Stream *stream = _firstStream; stream; stream = stream->next) {
+		if (stream->isInHandler || stream->isHandlerInControl())
+			return true;
+	}
+
+	return false;
+}
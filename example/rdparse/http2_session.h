@@ -0,0 +1,286 @@
+#ifndef _HTTP2_SESSION_H_
+#define _HTTP2_SESSION_H_
+
+#include "http2_frame.h"
+#include "http2_hpack.h"
+#include "server.h"
+#include <peff/containers/hashmap.h>
+
+namespace http {
+	class Http2Session;
+
+	/// @brief Stream of an HTTP/2 connection, which carries a request and its response.
+	/// A stream is allocated from the stream slab of the worker, and is released once both sides are done with it
+	/// and no handler is in control of it.
+	class Http2Stream final : public HttpExchange {
+	public:
+		Http2Session *session;
+		uint32_t id;
+		/// @brief Arena of the request, which the fields, the views and the response being built are allocated from.
+		/// It is declared first, so it is destroyed after everything allocated from it.
+		HttpArena requestArena;
+		peff::DynArray<HttpHeaderField> requestFields;
+		HttpRequestLineView requestLineView;
+		HttpRequestHeaderView requestHeaderView;
+
+		/// @brief Handler of the request, nullptr if the request is answered with routeStatus instead.
+		HttpRequestHandler *currentHandler = nullptr;
+		HttpResponseStatus routeStatus = HttpResponseStatus::NotFound;
+		HttpURLHandlerState handlerState;
+		/// @brief Route table which the stream has routed with, which keeps the handler and the route parameters valid.
+		peff::RcObjectPtr<HttpRouteTable> routeTable;
+
+		/// @brief Length of the request body announced by the peer, SIZE_MAX if unknown.
+		size_t expectedBodySize = SIZE_MAX;
+		size_t szBodyRead = 0;
+		/// @brief Pieces of the body which have arrived but not been passed to the handler, from iNextBodyPiece on.
+		peff::DynArray<netknot::RcBufferRef> bodyPieces;
+		size_t iNextBodyPiece = 0;
+		/// @brief Size of the piece which the handler has been given, which is credited to the peer when the handler pulls.
+		size_t szDeliveredBodyPiece = 0;
+		/// @brief Flow-control window which the peer may still send the body within.
+		int64_t receiveWindow;
+		/// @brief Size of the body taken by the handler but not credited to the peer yet.
+		size_t szUnackedBody = 0;
+		/// @brief Whether the handler has asked for the next piece of the body.
+		bool isBodyPulled = true;
+		/// @brief Whether the peer has ended the request.
+		bool isRequestEnded = false;
+		/// @brief Whether the request has been passed to the handler or answered with an error.
+		bool isRequestHandled = false;
+
+		/// @brief Flow-control window which the response body may still be sent within.
+		int64_t sendWindow;
+		/// @brief Data of the response body not sent yet, from offSendBuffer on.
+		peff::String sendBuffer;
+		size_t offSendBuffer = 0;
+		/// @brief Piece of the response body sent without copying after sendBuffer, either a file region or a buffer.
+		peff::RcObjectPtr<HttpResponseFile> sendFile;
+		uint64_t sendFileOffset = 0;
+		size_t szSendFile = 0;
+		netknot::RcBufferRef sendPiece;
+		/// @brief Size of the streamed body not sent yet, if the length is known.
+		size_t szResponseBodyLeft = SIZE_MAX;
+		/// @brief Whether the head of the response has been queued.
+		bool isResponseStarted = false;
+		/// @brief Whether the response ends after the data queued, which is told by the last frame.
+		bool isResponseEnding = false;
+		/// @brief Whether the last frame of the response has been queued.
+		bool isResponseEnded = false;
+		/// @brief Whether a piece of the streamed response has been refused, the handler is told when it can write again.
+		bool isResponseBlocked = false;
+		/// @brief Whether the stream has been reset by either side, nothing is sent or received on it anymore.
+		bool isReset = false;
+		/// @brief Whether a handler is being called, the stream is not released until it returns.
+		bool isInHandler = false;
+		/// @brief Whether the stream is in the ready list of the session.
+		bool isReady = false;
+
+		/// @brief Neighbours in the list of the streams of the session.
+		Http2Stream *prev = nullptr, *next = nullptr;
+		/// @brief Neighbours in the ready list of the session, whose streams have frames to send.
+		Http2Stream *prevReady = nullptr, *nextReady = nullptr;
+
+		Http2Stream(Http2Session *session, uint32_t id) noexcept;
+		Http2Stream(const Http2Stream &) = delete;
+		~Http2Stream();
+
+		NETKNOT_FORCEINLINE bool hasResponseData() const noexcept {
+			return (offSendBuffer < sendBuffer.size()) || sendFile || sendPiece.buffer;
+		}
+
+		NETKNOT_FORCEINLINE bool isResponsePieceQueued() const noexcept {
+			return sendFile || sendPiece.buffer;
+		}
+
+		/// @brief Check if the handler will call back on its own, to pull the body or to go on streaming the response.
+		NETKNOT_FORCEINLINE bool isHandlerInControl() const noexcept {
+			return (currentHandler && (!isBodyPulled)) || (handlerState.stage == HttpURLHandlerStateStage::ResponseStream);
+		}
+
+		virtual netknot::ExceptionPointer pullRequestBody() override;
+
+		virtual netknot::ExceptionPointer beginResponseStream(size_t szContentLength) override;
+		virtual netknot::ExceptionPointer writeResponseStream(const std::string_view &data) override;
+		virtual netknot::ExceptionPointer writeResponseStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) override;
+		virtual netknot::ExceptionPointer writeResponseStreamBuffer(const netknot::RcBufferRef &buffer) override;
+		virtual netknot::ExceptionPointer endResponseStream() override;
+
+	private:
+		/// @brief Abort the streamed response whose body exceeds the announced length, by resetting the stream.
+		netknot::ExceptionPointer _abortResponseStream();
+	};
+
+	enum class Http2InputState : uint8_t {
+		/// @brief Receiving the preface of the client.
+		Preface = 0,
+		FrameHeader,
+		/// @brief Receiving the payload of a frame other than DATA, which is handled when it is complete.
+		FramePayload,
+		/// @brief Receiving the pad length of a padded DATA frame.
+		DataPadLength,
+		/// @brief Receiving the data of a DATA frame, which are passed to the stream as they arrive.
+		DataPayload,
+		DataPadding
+	};
+
+	/// @brief HTTP/2 session of a connection, which the connection has switched to by the prior knowledge or an upgrade.
+	/// The frames are queued into the responses of the connection, so they are sent by its writes and bounded by its limits.
+	/// The response bodies are sent as DATA frames round-robin, one frame per stream at a time, within the flow-control
+	/// windows of the peer, and the files and the shared buffers are still sent without copying through the response piece
+	/// of the connection.
+	class Http2Session {
+	private:
+		friend class Http2Stream;
+
+		Http2InputState _inputState = Http2InputState::Preface;
+		size_t _offPreface = 0;
+		/// @brief Frame header being received, which is copied only if it straddles reads.
+		char _frameHeaderData[HTTP2_FRAME_HEADER_SIZE];
+		size_t _szFrameHeaderRead = 0;
+		Http2FrameHeader _frameHeader;
+		/// @brief Payload of the frame being received, which is copied only if it straddles reads.
+		peff::String _framePayload;
+		/// @brief Data and padding of the DATA frame being received not taken yet.
+		size_t _szDataLeft = 0;
+		size_t _szDataPadding = 0;
+		/// @brief Stream of the DATA frame being received, 0 if its data are discarded.
+		uint32_t _dataStreamId = 0;
+
+		/// @brief Header block being received across CONTINUATION frames, on the stream _headerBlockStreamId.
+		peff::String _headerBlock;
+		uint32_t _headerBlockStreamId = 0;
+		uint8_t _headerBlockFlags = 0;
+
+		HpackDecoder _decoder;
+		HpackEncoder _encoder;
+		/// @brief Header block being sent.
+		peff::String _encodedBlock;
+		/// @brief Arena of the header blocks whose fields are discarded, which are still decoded to keep the dynamic table.
+		HttpArena _scratchArena;
+
+		Http2Settings _peerSettings;
+		/// @brief Initial window of the streams which the peer has acknowledged.
+		uint32_t _localInitialWindowSize = HTTP2_DEFAULT_WINDOW_SIZE;
+		bool _isSettingsAcked = false;
+		/// @brief Flow-control window which the peer may still send the bodies of all streams within.
+		int64_t _receiveWindow = HTTP2_DEFAULT_WINDOW_SIZE;
+		size_t _szUnackedBody = 0;
+		/// @brief Flow-control window which the response bodies of all streams may still be sent within.
+		int64_t _sendWindow = HTTP2_DEFAULT_WINDOW_SIZE;
+
+		peff::HashMap<uint32_t, Http2Stream *> _streams;
+		Http2Stream *_firstStream = nullptr, *_lastStream = nullptr;
+		Http2Stream *_firstReady = nullptr, *_lastReady = nullptr;
+		size_t _nReadyStreams = 0;
+		/// @brief Greatest stream ID opened by the peer, the lower ones which are not in the streams are closed.
+		uint32_t _lastPeerStreamId = 0;
+
+		/// @brief Whether a connection error has occurred, the connection is closed after the GOAWAY is sent.
+		bool _isFailed = false;
+		/// @brief Whether the peer has sent GOAWAY, the connection is closed after the streams left are done.
+		bool _isPeerGoingAway = false;
+		/// @brief Whether the connection has been closed, the streams are dropped as soon as their handlers let go.
+		bool _isConnectionClosed = false;
+		/// @brief Whether the frames are being scheduled, a nested request is run by the outer one.
+		bool _isSending = false;
+		bool _isSendRequested = false;
+
+		[[nodiscard]] bool _queueFrame(Http2FrameType type, uint8_t flags, uint32_t streamId, const std::string_view &payload) noexcept;
+		[[nodiscard]] bool _queueWindowUpdate(uint32_t streamId, uint32_t increment) noexcept;
+		[[nodiscard]] bool _queueRstStream(uint32_t streamId, Http2ErrorCode errorCode) noexcept;
+		[[nodiscard]] bool _queueHeaderBlock(uint32_t streamId, bool isEndStream) noexcept;
+		netknot::ExceptionPointer _failConnection(Http2ErrorCode errorCode);
+		netknot::ExceptionPointer _resetStream(Http2Stream *stream, Http2ErrorCode errorCode);
+		/// @brief Stop sending and receiving on a stream, which is released once its handler lets go.
+		netknot::ExceptionPointer _closeStream(Http2Stream *stream);
+
+		netknot::ExceptionPointer _onFrameHeader();
+		netknot::ExceptionPointer _onFrame(const std::string_view &payload);
+		netknot::ExceptionPointer _onDataHeader();
+		netknot::ExceptionPointer _onData(const char *data, size_t size);
+		netknot::ExceptionPointer _onDataEnd();
+		/// @brief End the request of a stream, which is handled once the handler has taken the whole body.
+		netknot::ExceptionPointer _endRequest(Http2Stream *stream);
+		netknot::ExceptionPointer _onHeaders(const std::string_view &payload);
+		netknot::ExceptionPointer _onContinuation(const std::string_view &payload);
+		netknot::ExceptionPointer _onHeaderBlock(uint32_t streamId, uint8_t flags, const std::string_view &block);
+		/// @brief Decode a header block whose fields are not wanted, which keeps the dynamic table in sync.
+		///
+		/// @return Whether the block is well-formed.
+		[[nodiscard]] bool _discardHeaderBlock(const std::string_view &block) noexcept;
+		netknot::ExceptionPointer _onSettings(const std::string_view &payload);
+		netknot::ExceptionPointer _onWindowUpdate(const std::string_view &payload);
+		/// @brief Credit the peer for the body which has been taken, the window is updated once half of it is used.
+		netknot::ExceptionPointer _creditBody(Http2Stream *stream, size_t size);
+
+		Http2Stream *_allocStream(uint32_t id) noexcept;
+		void _releaseStream(Http2Stream *stream) noexcept;
+		/// @brief Release the stream if it is done, which must not be used after the call.
+		netknot::ExceptionPointer _checkStream(Http2Stream *stream);
+		Http2Stream *_findStream(uint32_t id) const noexcept;
+
+		void _linkReady(Http2Stream *stream) noexcept;
+		void _unlinkReady(Http2Stream *stream) noexcept;
+		/// @brief Put a stream with frames to send into the ready list.
+		void _markReady(Http2Stream *stream) noexcept;
+
+		/// @brief Build the request of a stream from the decoded fields.
+		///
+		/// @return Whether the request is well-formed.
+		[[nodiscard]] bool _buildRequest(Http2Stream *stream) noexcept;
+		/// @brief Route the request of a stream, and handle it if it has no body.
+		netknot::ExceptionPointer _dispatchStream(Http2Stream *stream);
+		netknot::ExceptionPointer _deliverBody(Http2Stream *stream);
+		netknot::ExceptionPointer _handleRequest(Http2Stream *stream);
+		/// @brief Queue the response which the handler has built in HTTP/1.1, the body after the head is sent from the send buffer.
+		netknot::ExceptionPointer _queueResponse(Http2Stream *stream);
+		/// @brief Queue the HTTP/1.1 head of a response as a header block.
+		netknot::ExceptionPointer _queueResponseHead(Http2Stream *stream, const std::string_view &head, bool isEndStream);
+		netknot::ExceptionPointer _queueErrorResponse(Http2Stream *stream, HttpResponseStatus status);
+
+		/// @brief Queue the frames of the ready streams and send them, then let the blocked handlers go on.
+		netknot::ExceptionPointer _sendPending();
+		/// @brief Queue the DATA frames of the ready streams round-robin, as far as the windows and the pending responses allow.
+		netknot::ExceptionPointer _queueData();
+		/// @brief Let the handlers whose streamed responses have been refused go on.
+		netknot::ExceptionPointer _notifyWritable();
+
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		HttpServer *httpServer;
+		HttpReadAsyncCallback *requestCallback;
+
+		Http2Session(peff::Alloc *selfAllocator, HttpReadAsyncCallback *requestCallback) noexcept;
+		Http2Session(const Http2Session &) = delete;
+		~Http2Session();
+
+		void dealloc() noexcept;
+
+		static Http2Session *alloc(peff::Alloc *allocator, HttpReadAsyncCallback *requestCallback) noexcept;
+
+		/// @brief Apply the settings sent by the HTTP2-Settings header of an upgrade.
+		///
+		/// @return Whether the settings are well-formed.
+		[[nodiscard]] bool applyUpgradeSettings(const std::string_view &value) noexcept;
+
+		/// @brief Start the session, which sends the settings of the server.
+		///
+		/// @param szPrefaceReceived Size of the preface which has been taken as an HTTP/1.1 request head.
+		netknot::ExceptionPointer start(size_t szPrefaceReceived);
+		/// @brief Open the stream 1 of an upgrade with the HTTP/1.1 request, whose views are copied.
+		netknot::ExceptionPointer startUpgradedStream(const HttpRequestLineView &requestLineView, const HttpRequestHeaderView &requestHeaderView);
+
+		/// @brief Take the data received, which must be in the receive buffer of the connection.
+		netknot::ExceptionPointer processReceived(const char *data, size_t size);
+		/// @brief Called when the writes in flight have been done, to fill the next one.
+		netknot::ExceptionPointer onResponsesWritten();
+		/// @brief Called when the connection is closed, the streams are dropped once their handlers let go.
+		void onConnectionClosed() noexcept;
+
+		/// @brief Check if a handler is in control of any stream, which keeps the connection.
+		bool isHandlerInControl() const noexcept;
+	};
+}
+
+#endif
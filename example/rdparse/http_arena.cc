@@ -0,0 +1,125 @@
+#include "http_arena.h"
+#include <cstring>
+#include <new>
+
+using namespace http;
+
+static NETKNOT_FORCEINLINE char *alignUp(char *p, size_t alignment) noexcept {
+	return (char *)(((uintptr_t)p + alignment - 1) / alignment * alignment);
+}
+
+HttpArena::HttpArena(peff::Alloc *upstream, size_t szChunk) noexcept : _upstream(upstream), _szChunk(szChunk) {
+}
+
+HttpArena::~HttpArena() {
+	reset();
+
+	if (_firstChunk)
+		_releaseChunk(_firstChunk);
+}
+
+bool HttpArena::_addChunk(size_t size, size_t alignment) noexcept {
+	// The objects larger than a chunk get a chunk of their own.
+	size_t szData = size + alignment - 1;
+	if (szData < _szChunk)
+		szData = _szChunk;
+
+	void *p = _upstream->alloc(sizeof(Chunk) + szData, alignof(Chunk));
+
+	if (!p)
+		return false;
+
+	Chunk *chunk = new (p) Chunk(szData);
+
+	if (_curChunk)
+		_curChunk->next = chunk;
+	else
+		_firstChunk = chunk;
+
+	_curChunk = chunk;
+	_cur = chunk->getData();
+	_end = _cur + szData;
+
+	return true;
+}
+
+void HttpArena::_releaseChunk(Chunk *chunk) noexcept {
+	const size_t szData = chunk->size;
+
+	chunk->~Chunk();
+	_upstream->release(chunk, sizeof(Chunk) + szData, alignof(Chunk));
+}
+
+void *HttpArena::alloc(size_t size, size_t alignment) noexcept {
+	char *p = alignUp(_cur, alignment);
+
+	if ((!_cur) || (p > _end) || ((size_t)(_end - p) < size)) {
+		// The rest of the current chunk is left unused.
+		if (!_addChunk(size, alignment))
+			return nullptr;
+
+		p = alignUp(_cur, alignment);
+	}
+
+	_cur = p + size;
+
+	return p;
+}
+
+void *HttpArena::realloc(void *p, size_t size, size_t alignment, size_t newSize, size_t newAlignment) noexcept {
+	if (!p)
+		return alloc(newSize, newAlignment);
+
+	// The last object is resized in place if it still fits in its chunk.
+	if (((char *)p + size == _cur) &&
+		(!((uintptr_t)p % newAlignment)) &&
+		((size_t)(_end - (char *)p) >= newSize)) {
+		_cur = (char *)p + newSize;
+		return p;
+	}
+
+	void *newP = alloc(newSize, newAlignment);
+
+	if (!newP)
+		return nullptr;
+
+	memcpy(newP, p, size < newSize ? size : newSize);
+
+	return newP;
+}
+
+void HttpArena::release(void *p, size_t size, size_t alignment) noexcept {
+	// The memory of the other objects is only reclaimed by reset().
+	if ((char *)p + size == _cur)
+		_cur = (char *)p;
+}
+
+void HttpArena::reset() noexcept {
+	if (!_firstChunk)
+		return;
+
+	Chunk *chunk = _firstChunk->next;
+
+	while (chunk) {
+		Chunk *next = chunk->next;
+		_releaseChunk(chunk);
+		chunk = next;
+	}
+
+	_firstChunk->next = nullptr;
+
+	// A first chunk made for a large object is not kept either.
+	if (_firstChunk->size != _szChunk) {
+		_releaseChunk(_firstChunk);
+
+		_firstChunk = nullptr;
+		_curChunk = nullptr;
+		_cur = nullptr;
+		_end = nullptr;
+		return;
+	}
+
+	_curChunk = _firstChunk;
+	_cur = _firstChunk->getData();
+	_end = _cur + _firstChunk->size;
+}
@@ -0,0 +1,54 @@
+#ifndef _HTTP_ARENA_H_
+#define _HTTP_ARENA_H_
+
+#include <netknot/basedefs.h>
+#include <peff/base/alloc.h>
+
+namespace http {
+	/// @brief Bump allocator of the objects which live as long as a request, they are all dropped at once by reset().
+	/// Releasing an object only gives its memory back if it is the last one allocated, and the last one grows in place,
+	/// so the containers which are built up by appending stay cheap.
+	/// The arena is not locked, it is meant to be owned by a single connection.
+	class HttpArena : public peff::StdAlloc {
+	private:
+		/// @brief Header of a chunk, followed by the data.
+		struct Chunk {
+			Chunk *next = nullptr;
+			size_t size;
+
+			NETKNOT_FORCEINLINE Chunk(size_t size) noexcept : size(size) {
+			}
+
+			NETKNOT_FORCEINLINE char *getData() noexcept {
+				return (char *)(this + 1);
+			}
+		};
+
+		peff::RcObjectPtr<peff::Alloc> _upstream;
+		size_t _szChunk;
+		/// @brief First chunk, which is kept by reset() if it is of the default size.
+		Chunk *_firstChunk = nullptr;
+		Chunk *_curChunk = nullptr;
+		char *_cur = nullptr, *_end = nullptr;
+
+		[[nodiscard]] bool _addChunk(size_t size, size_t alignment) noexcept;
+		void _releaseChunk(Chunk *chunk) noexcept;
+
+	public:
+		constexpr static size_t DEFAULT_CHUNK_SIZE = 4096;
+
+		HttpArena(peff::Alloc *upstream, size_t szChunk = DEFAULT_CHUNK_SIZE) noexcept;
+		HttpArena(const HttpArena &) = delete;
+		virtual ~HttpArena();
+
+		virtual void *alloc(size_t size, size_t alignment) noexcept override;
+		virtual void *realloc(void *p, size_t size, size_t alignment, size_t newSize, size_t newAlignment) noexcept override;
+		virtual void release(void *p, size_t size, size_t alignment) noexcept override;
+
+		/// @brief Drop every object allocated from the arena, which must not be used anymore.
+		/// Only the chunks beyond the first one are given back, so the requests which fit in a chunk never reach the upstream allocator.
+		void reset() noexcept;
+	};
+}
+
+#endif
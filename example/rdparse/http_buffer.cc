@@ -0,0 +1,64 @@
+#include "http_buffer.h"
+
+using namespace http;
+
+HttpReceiveBuffer::HttpReceiveBuffer(HttpReceiveBufferPool *pool, size_t size) : RcBuffer((char *)(this + 1), size), pool(pool) {
+}
+
+HttpReceiveBuffer::~HttpReceiveBuffer() {
+}
+
+size_t HttpReceiveBuffer::incRef(size_t globalRc) {
+	return ++refCount;
+}
+
+size_t HttpReceiveBuffer::decRef(size_t globalRc) {
+	if (!--refCount) {
+		pool->release(this);
+		return 0;
+	}
+
+	return refCount;
+}
+
+HttpReceiveBufferPool::HttpReceiveBufferPool(peff::Alloc *allocator, size_t szBuffer) : _allocator(allocator), _szBuffer(szBuffer) {
+}
+
+HttpReceiveBufferPool::~HttpReceiveBufferPool() {
+	HttpReceiveBuffer *buffer = _freeList.takeAll();
+
+	while (buffer) {
+		HttpReceiveBuffer *next = buffer->nextFree;
+
+		_destroyBuffer(buffer);
+
+		buffer = next;
+	}
+}
+
+void HttpReceiveBufferPool::_destroyBuffer(HttpReceiveBuffer *buffer) noexcept {
+	buffer->~HttpReceiveBuffer();
+	_allocator->release(buffer, sizeof(HttpReceiveBuffer) + _szBuffer, alignof(HttpReceiveBuffer));
+}
+
+HttpReceiveBuffer *HttpReceiveBufferPool::alloc() noexcept {
+	if (HttpReceiveBuffer *buffer = _freeList.pop(); buffer)
+		return buffer;
+
+	void *p = _allocator->alloc(sizeof(HttpReceiveBuffer) + _szBuffer, alignof(HttpReceiveBuffer));
+
+	if (!p)
+		return nullptr;
+
+	return peff::constructAt<HttpReceiveBuffer>((HttpReceiveBuffer *)p, this, _szBuffer);
+}
+
+void HttpReceiveBufferPool::release(HttpReceiveBuffer *buffer) noexcept {
+	// A buffer whose address does not fit beside the tag of the free list is not pooled.
+	if (!_freeList.isPushable(buffer)) {
+		_destroyBuffer(buffer);
+		return;
+	}
+
+	_freeList.push(buffer);
+}
@@ -0,0 +1,57 @@
+#ifndef _HTTP_BUFFER_H_
+#define _HTTP_BUFFER_H_
+
+#include <netknot/rc_buffer.h>
+#include <netknot/tagged_stack.h>
+#include <peff/base/alloc.h>
+
+namespace http {
+	class HttpReceiveBufferPool;
+
+	/// @brief Reference-counted receive buffer, which goes back to its pool when the last reference is dropped.
+	/// The storage follows the object in the same allocation.
+	class HttpReceiveBuffer final : public netknot::RcBuffer {
+	public:
+		HttpReceiveBufferPool *pool;
+		HttpReceiveBuffer *nextFree = nullptr;
+		netknot::MaybeAtomic<size_t> refCount = 0;
+
+		HttpReceiveBuffer(HttpReceiveBufferPool *pool, size_t size);
+		virtual ~HttpReceiveBuffer();
+
+		virtual size_t incRef(size_t globalRc) override;
+		virtual size_t decRef(size_t globalRc) override;
+
+		/// @brief Check if the only reference to the buffer is the one held by the caller.
+		NETKNOT_FORCEINLINE bool isUniquelyReferenced() const noexcept {
+			return refCount == 1;
+		}
+	};
+
+	/// @brief Pool of the receive buffers, which may be shared by the workers without a lock.
+	class HttpReceiveBufferPool {
+	private:
+		peff::RcObjectPtr<peff::Alloc> _allocator;
+		size_t _szBuffer;
+		netknot::TaggedStack<HttpReceiveBuffer, &HttpReceiveBuffer::nextFree> _freeList;
+
+		void _destroyBuffer(HttpReceiveBuffer *buffer) noexcept;
+
+	public:
+		HttpReceiveBufferPool(peff::Alloc *allocator, size_t szBuffer);
+		~HttpReceiveBufferPool();
+
+		/// @brief Take a buffer from the pool, a new buffer is allocated only if there is no free one.
+		///
+		/// @return The buffer without any reference, nullptr if out of memory.
+		HttpReceiveBuffer *alloc() noexcept;
+		/// @brief Put a buffer back, called when the last reference to the buffer is dropped.
+		void release(HttpReceiveBuffer *buffer) noexcept;
+
+		NETKNOT_FORCEINLINE size_t getBufferSize() const noexcept {
+			return _szBuffer;
+		}
+	};
+}
+
+#endif
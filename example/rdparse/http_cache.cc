@@ -0,0 +1,519 @@
+#include "http_cache.h"
+#include <cstring>
+
+#ifndef HTTP_HAS_ZLIB
+	#define HTTP_HAS_ZLIB 0
+#endif
+
+#ifndef HTTP_HAS_BROTLI
+	#define HTTP_HAS_BROTLI 0
+#endif
+
+#if HTTP_HAS_ZLIB
+	#include <zlib.h>
+	#include <climits>
+#endif
+
+#if HTTP_HAS_BROTLI
+	#include <brotli/encode.h>
+#endif
+
+using namespace http;
+
+using std::operator""sv;
+
+std::string_view http::getHttpContentCodingName(HttpContentCoding coding) noexcept {
+	switch (coding) {
+		case HttpContentCoding::Identity:
+			return "identity"sv;
+		case HttpContentCoding::Gzip:
+			return "gzip"sv;
+		case HttpContentCoding::Brotli:
+			return "br"sv;
+		default:
+			std::terminate();
+	}
+}
+
+bool http::isHttpContentCodingSupported(HttpContentCoding coding) noexcept {
+	switch (coding) {
+		case HttpContentCoding::Identity:
+			return true;
+		case HttpContentCoding::Gzip:
+			return HTTP_HAS_ZLIB;
+		case HttpContentCoding::Brotli:
+			return HTTP_HAS_BROTLI;
+		default:
+			std::terminate();
+	}
+}
+
+static NETKNOT_FORCEINLINE std::string_view trimHttpWhitespace(std::string_view text) noexcept {
+	while (text.size() && ((text.front() == ' ') || (text.front() == '\t')))
+		text.remove_prefix(1);
+	while (text.size() && ((text.back() == ' ') || (text.back() == '\t')))
+		text.remove_suffix(1);
+	return text;
+}
+
+// Check if the parameters of a list item have a zero weight, such as "q=0" or "q=0.000".
+static bool isZeroWeight(std::string_view params) noexcept {
+	while (params.size()) {
+		const size_t offSemicolon = params.find(';');
+		const std::string_view param = trimHttpWhitespace(params.substr(0, offSemicolon));
+
+		if ((param.size() > 2) && ((param[0] == 'q') || (param[0] == 'Q')) && (param[1] == '=')) {
+			const std::string_view weight = param.substr(2);
+
+			if (weight[0] != '0')
+				return false;
+
+			for (size_t i = 1; i < weight.size(); ++i) {
+				if ((weight[i] != '.') && (weight[i] != '0'))
+					return false;
+			}
+
+			return true;
+		}
+
+		if (offSemicolon == std::string_view::npos)
+			break;
+		params.remove_prefix(offSemicolon + 1);
+	}
+
+	return false;
+}
+
+uint32_t http::parseHttpAcceptEncoding(std::string_view value) noexcept {
+	constexpr uint32_t allCodings = (1 << HTTP_CONTENT_CODING_COUNT) - 1;
+	uint32_t acceptedCodings = 0, mentionedCodings = 0;
+	bool isWildcardAccepted = false;
+
+	while (value.size()) {
+		const size_t offComma = value.find(',');
+		const std::string_view item = value.substr(0, offComma);
+		const size_t offSemicolon = item.find(';');
+		const std::string_view coding = trimHttpWhitespace(item.substr(0, offSemicolon));
+		const bool isAccepted = (offSemicolon == std::string_view::npos) || (!isZeroWeight(item.substr(offSemicolon + 1)));
+
+		if (coding == "*"sv) {
+			isWildcardAccepted = isAccepted;
+		} else {
+			for (size_t i = 0; i < HTTP_CONTENT_CODING_COUNT; ++i) {
+				if (isHttpHeaderNameEqual(getHttpContentCodingName((HttpContentCoding)i), coding) ||
+					(((HttpContentCoding)i == HttpContentCoding::Gzip) && isHttpHeaderNameEqual("x-gzip"sv, coding))) {
+					mentionedCodings |= 1 << i;
+					if (isAccepted)
+						acceptedCodings |= 1 << i;
+					break;
+				}
+			}
+		}
+
+		if (offComma == std::string_view::npos)
+			break;
+		value.remove_prefix(offComma + 1);
+	}
+
+	if (isWildcardAccepted)
+		acceptedCodings |= allCodings & ~mentionedCodings;
+
+	return acceptedCodings | (1 << (size_t)HttpContentCoding::Identity);
+}
+
+HttpCachedBody::HttpCachedBody(peff::Alloc *selfAllocator, size_t size) noexcept : RcBuffer((char *)(this + 1), size), selfAllocator(selfAllocator) {
+}
+
+HttpCachedBody::~HttpCachedBody() {
+}
+
+size_t HttpCachedBody::incRef(size_t globalRc) {
+	return ++refCount;
+}
+
+size_t HttpCachedBody::decRef(size_t globalRc) {
+	if (!--refCount) {
+		// The allocator is kept alive until the storage is released.
+		peff::RcObjectPtr<peff::Alloc> allocator = std::move(selfAllocator);
+		const size_t szBody = size;
+
+		this->~HttpCachedBody();
+		allocator->release(this, sizeof(HttpCachedBody) + szBody, alignof(HttpCachedBody));
+		return 0;
+	}
+
+	return refCount;
+}
+
+HttpCachedBody *HttpCachedBody::alloc(peff::Alloc *allocator, const std::string_view &data) noexcept {
+	void *p = allocator->alloc(sizeof(HttpCachedBody) + data.size(), alignof(HttpCachedBody));
+
+	if (!p)
+		return nullptr;
+
+	HttpCachedBody *body = new (p) HttpCachedBody(allocator, data.size());
+
+	if (data.size())
+		memcpy(body->data, data.data(), data.size());
+
+	return body;
+}
+
+HttpCachedResponse::HttpCachedResponse(peff::Alloc *selfAllocator) noexcept : selfAllocator(selfAllocator), key(selfAllocator), contentType(selfAllocator) {
+}
+
+HttpCachedResponse::~HttpCachedResponse() {
+}
+
+void HttpCachedResponse::dealloc() noexcept {
+	peff::destroyAndRelease<HttpCachedResponse>(selfAllocator.get(), this, alignof(HttpCachedResponse));
+}
+
+size_t HttpCachedResponse::getMemorySize() const noexcept {
+	size_t size = sizeof(HttpCachedResponse) + key.size() + contentType.size();
+
+	for (const auto &i : bodies) {
+		if (i)
+			size += i->size;
+	}
+
+	return size;
+}
+
+#if HTTP_HAS_ZLIB
+static netknot::ExceptionPointer compressGzip(peff::Alloc *allocator, std::string_view data, peff::RcObjectPtr<HttpCachedBody> &bodyOut) noexcept {
+	// The whole body is deflated in one call, whose sizes are limited by zlib.
+	if (data.size() > UINT_MAX / 2)
+		return {};
+
+	z_stream stream = {};
+
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return netknot::OutOfMemoryError::alloc();
+
+	const size_t szBound = deflateBound(&stream, (uLong)data.size());
+	char *buffer = (char *)allocator->alloc(szBound, 1);
+
+	if (!buffer) {
+		deflateEnd(&stream);
+		return netknot::OutOfMemoryError::alloc();
+	}
+
+	stream.next_in = (Bytef *)data.data();
+	stream.avail_in = (uInt)data.size();
+	stream.next_out = (Bytef *)buffer;
+	stream.avail_out = (uInt)szBound;
+
+	const int result = deflate(&stream, Z_FINISH);
+	const size_t szCompressed = stream.total_out;
+
+	deflateEnd(&stream);
+
+	if (result == Z_STREAM_END)
+		bodyOut = HttpCachedBody::alloc(allocator, std::string_view(buffer, szCompressed));
+
+	allocator->release(buffer, szBound, 1);
+
+	if ((result == Z_STREAM_END) && (!bodyOut))
+		return netknot::OutOfMemoryError::alloc();
+
+	return {};
+}
+#endif
+
+#if HTTP_HAS_BROTLI
+static netknot::ExceptionPointer compressBrotli(peff::Alloc *allocator, std::string_view data, peff::RcObjectPtr<HttpCachedBody> &bodyOut) noexcept {
+	const size_t szBound = BrotliEncoderMaxCompressedSize(data.size());
+
+	if (!szBound)
+		return {};
+
+	char *buffer = (char *)allocator->alloc(szBound, 1);
+
+	if (!buffer)
+		return netknot::OutOfMemoryError::alloc();
+
+	size_t szCompressed = szBound;
+	const bool isCompressed = BrotliEncoderCompress(
+		BROTLI_MAX_QUALITY,
+		BROTLI_DEFAULT_WINDOW,
+		BROTLI_MODE_GENERIC,
+		data.size(),
+		(const uint8_t *)data.data(),
+		&szCompressed,
+		(uint8_t *)buffer);
+
+	if (isCompressed)
+		bodyOut = HttpCachedBody::alloc(allocator, std::string_view(buffer, szCompressed));
+
+	allocator->release(buffer, szBound, 1);
+
+	if (isCompressed && (!bodyOut))
+		return netknot::OutOfMemoryError::alloc();
+
+	return {};
+}
+#endif
+
+HttpResponseCache::HttpResponseCache(peff::Alloc *selfAllocator, netknot::IOService *ioService, size_t maxMemorySize) noexcept
+	: _selfAllocator(selfAllocator),
+	  _ioService(ioService),
+	  _responses(selfAllocator),
+	  _maxMemorySize(maxMemorySize) {
+}
+
+HttpResponseCache::~HttpResponseCache() {
+	while (_firstUsed)
+		_evictResponse(_firstUsed);
+}
+
+HttpResponseCache *HttpResponseCache::alloc(peff::Alloc *allocator, netknot::IOService *ioService, size_t maxMemorySize) noexcept {
+	return peff::allocAndConstruct<HttpResponseCache>(allocator, alignof(HttpResponseCache), allocator, ioService, maxMemorySize);
+}
+
+void HttpResponseCache::dealloc() noexcept {
+	peff::destroyAndRelease<HttpResponseCache>(_selfAllocator.get(), this, alignof(HttpResponseCache));
+}
+
+void HttpResponseCache::_unlinkResponse(HttpCachedResponse *response) noexcept {
+	if (response->prevUsed)
+		response->prevUsed->nextUsed = response->nextUsed;
+	else
+		_firstUsed = response->nextUsed;
+
+	if (response->nextUsed)
+		response->nextUsed->prevUsed = response->prevUsed;
+	else
+		_lastUsed = response->prevUsed;
+
+	response->prevUsed = nullptr;
+	response->nextUsed = nullptr;
+}
+
+void HttpResponseCache::_linkResponse(HttpCachedResponse *response) noexcept {
+	response->prevUsed = nullptr;
+	response->nextUsed = _firstUsed;
+
+	if (_firstUsed)
+		_firstUsed->prevUsed = response;
+	else
+		_lastUsed = response;
+
+	_firstUsed = response;
+}
+
+void HttpResponseCache::_evictResponse(HttpCachedResponse *response) noexcept {
+	_unlinkResponse(response);
+	_responses.remove(std::string_view(response->key.data(), response->key.size()));
+	_szMemory -= response->getMemorySize();
+	response->isCached = false;
+
+	// The cache's reference is dropped, the bodies are freed once the responses sending them are done.
+	response->decRef(0);
+}
+
+void HttpResponseCache::_shrinkToLimit() noexcept {
+	while ((_szMemory > _maxMemorySize) && _lastUsed)
+		_evictResponse(_lastUsed);
+}
+
+netknot::ExceptionPointer HttpResponseCache::_compress(HttpCachedResponse *response) noexcept {
+	// The identity body is never replaced, so it can be read without the lock.
+	const HttpCachedBody *source = response->bodies[(size_t)HttpContentCoding::Identity].get();
+	const std::string_view data(source->data, source->size);
+
+	for (size_t i = 0; i < HTTP_CONTENT_CODING_COUNT; ++i) {
+		peff::RcObjectPtr<HttpCachedBody> body;
+
+		switch ((HttpContentCoding)i) {
+#if HTTP_HAS_ZLIB
+			case HttpContentCoding::Gzip:
+				NETKNOT_RETURN_IF_EXCEPT(compressGzip(response->selfAllocator.get(), data, body));
+				break;
+#endif
+#if HTTP_HAS_BROTLI
+			case HttpContentCoding::Brotli:
+				NETKNOT_RETURN_IF_EXCEPT(compressBrotli(response->selfAllocator.get(), data, body));
+				break;
+#endif
+			default:
+				break;
+		}
+
+		// The bodies which are not smaller are not worth decoding.
+		if (body && (body->size < source->size))
+			response->compressedBodies[i] = std::move(body);
+	}
+
+	return {};
+}
+
+void HttpResponseCache::_attachCompressedBodies(HttpCachedResponse *response) noexcept {
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	if (response->isCached) {
+		_szMemory -= response->getMemorySize();
+		for (size_t i = 0; i < HTTP_CONTENT_CODING_COUNT; ++i) {
+			if (response->compressedBodies[i])
+				response->bodies[i] = std::move(response->compressedBodies[i]);
+		}
+		_szMemory += response->getMemorySize();
+
+		_shrinkToLimit();
+	}
+
+	for (auto &i : response->compressedBodies)
+		i.reset();
+}
+
+void HttpResponseCache::find(std::string_view key, uint32_t acceptedCodings, peff::RcObjectPtr<HttpCachedResponse> &responseOut, HttpContentCoding &codingOut, peff::RcObjectPtr<HttpCachedBody> &bodyOut) {
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	auto it = _responses.find(key);
+
+	if (it == _responses.end())
+		return;
+
+	HttpCachedResponse *response = it.value();
+
+	_unlinkResponse(response);
+	_linkResponse(response);
+
+	size_t bestCoding = (size_t)HttpContentCoding::Identity;
+
+	for (size_t i = 0; i < HTTP_CONTENT_CODING_COUNT; ++i) {
+		if ((acceptedCodings & (1 << i)) && response->bodies[i] && (response->bodies[i]->size < response->bodies[bestCoding]->size))
+			bestCoding = i;
+	}
+
+	responseOut = response;
+	codingOut = (HttpContentCoding)bestCoding;
+	bodyOut = response->bodies[bestCoding];
+}
+
+netknot::ExceptionPointer HttpResponseCache::insert(std::string_view key, std::string_view contentType, std::string_view body, peff::RcObjectPtr<HttpCachedResponse> &responseOut) {
+	// A response which would evict everything else is not cached.
+	if (sizeof(HttpCachedResponse) + key.size() + contentType.size() + body.size() > _maxMemorySize)
+		return {};
+
+	peff::RcObjectPtr<HttpCachedResponse> response = peff::allocAndConstruct<HttpCachedResponse>(_selfAllocator.get(), alignof(HttpCachedResponse), _selfAllocator.get());
+
+	if (!response)
+		return netknot::OutOfMemoryError::alloc();
+
+	if (!response->key.build(key))
+		return netknot::OutOfMemoryError::alloc();
+	if (!response->contentType.build(contentType))
+		return netknot::OutOfMemoryError::alloc();
+	if (!(response->bodies[(size_t)HttpContentCoding::Identity] = HttpCachedBody::alloc(_selfAllocator.get(), body)))
+		return netknot::OutOfMemoryError::alloc();
+
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+
+		// The one put by another worker meanwhile is replaced.
+		if (auto it = _responses.find(key); it != _responses.end())
+			_evictResponse(it.value());
+
+		if (!_responses.insert(std::string_view(response->key.data(), response->key.size()), response.get()))
+			return netknot::OutOfMemoryError::alloc();
+
+		response->incRef(0);
+		response->isCached = true;
+		_linkResponse(response.get());
+		_szMemory += response->getMemorySize();
+
+		_shrinkToLimit();
+	}
+
+	responseOut = response;
+
+	bool hasCompressedCoding = false;
+	for (size_t i = (size_t)HttpContentCoding::Identity + 1; i < HTTP_CONTENT_CODING_COUNT; ++i)
+		hasCompressedCoding |= isHttpContentCodingSupported((HttpContentCoding)i);
+
+	if ((!hasCompressedCoding) || (!body.size()))
+		return {};
+
+	// The identity body is served until the compressed ones are attached, the job and its continuation hold the references
+	// so that an evicted response or a dropped cache outlives them.
+	return _ioService->offload(
+		[response]() noexcept -> netknot::ExceptionPointer {
+			return _compress(response.get());
+		},
+		[cache = peff::RcObjectPtr<HttpResponseCache>(this), response](netknot::ExceptionPointer &&jobResult) noexcept -> netknot::ExceptionPointer {
+			// The response is served uncompressed if the compression has failed.
+			if (jobResult)
+				return {};
+
+			cache->_attachCompressedBodies(response.get());
+			return {};
+		});
+}
+
+void HttpResponseCache::remove(std::string_view key) noexcept {
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	if (auto it = _responses.find(key); it != _responses.end())
+		_evictResponse(it.value());
+}
+
+HttpCachedRequestHandler::HttpCachedRequestHandler(const std::string_view &methodName, HttpResponseCache *cache) noexcept : HttpRequestHandler(methodName), cache(cache) {
+}
+
+HttpCachedRequestHandler::~HttpCachedRequestHandler() {
+}
+
+netknot::ExceptionPointer HttpCachedRequestHandler::handleURL(const HttpURLHandlerState &state) {
+	HttpURLHandlerState &s = const_cast<HttpURLHandlerState &>(state);
+	peff::Alloc *allocator = state.requestAllocator;
+	peff::String key(allocator);
+
+	if (!key.build(state.urlPath))
+		return netknot::OutOfMemoryError::alloc();
+	if (state.urlQuery.size()) {
+		if (!key.append("?"sv))
+			return netknot::OutOfMemoryError::alloc();
+		if (!key.append(state.urlQuery))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	const uint32_t acceptedCodings = state.requestHeaderView.has(HttpHeaderId::AcceptEncoding)
+										 ? parseHttpAcceptEncoding(state.requestHeaderView.get(HttpHeaderId::AcceptEncoding))
+										 : (1 << (size_t)HttpContentCoding::Identity);
+
+	peff::RcObjectPtr<HttpCachedResponse> response;
+	HttpContentCoding coding = HttpContentCoding::Identity;
+	peff::RcObjectPtr<HttpCachedBody> body;
+
+	cache->find(std::string_view(key.data(), key.size()), acceptedCodings, response, coding, body);
+
+	if (!response) {
+		peff::String contentType(allocator), renderedBody(allocator);
+
+		NETKNOT_RETURN_IF_EXCEPT(render(state, contentType, renderedBody));
+
+		NETKNOT_RETURN_IF_EXCEPT(cache->insert(
+			std::string_view(key.data(), key.size()),
+			std::string_view(contentType.data(), contentType.size()),
+			std::string_view(renderedBody.data(), renderedBody.size()),
+			response));
+
+		// The response is sent as is if it cannot be cached.
+		if (!response)
+			return s.writeResponse(HttpResponseStatus::OK, std::string_view(contentType.data(), contentType.size()), std::string_view(renderedBody.data(), renderedBody.size()));
+
+		body = response->bodies[(size_t)HttpContentCoding::Identity];
+	}
+
+	NETKNOT_RETURN_IF_EXCEPT(s.writeStatusLine(HttpResponseStatus::OK));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Type"sv, std::string_view(response->contentType.data(), response->contentType.size())));
+	if (coding != HttpContentCoding::Identity) {
+		NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Encoding"sv, getHttpContentCodingName(coding)));
+	}
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Vary"sv, "Accept-Encoding"sv));
+
+	NETKNOT_RETURN_IF_EXCEPT(s.beginStream(body->size));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeStreamBuffer(netknot::RcBufferRef(body.get())));
+	return s.endStream();
+}
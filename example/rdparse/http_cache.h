@@ -0,0 +1,211 @@
+#ifndef _HTTP_CACHE_H_
+#define _HTTP_CACHE_H_
+
+#include "server.h"
+#include <peff/containers/hashmap.h>
+#include <mutex>
+
+namespace http {
+	/// @brief Content codings which the cached responses are stored in.
+	enum class HttpContentCoding : uint8_t {
+		Identity = 0,
+		Gzip,
+		Brotli,
+
+		Count
+	};
+
+	constexpr size_t HTTP_CONTENT_CODING_COUNT = (size_t)HttpContentCoding::Count;
+
+	/// @brief Get the token of a content coding, as in the Content-Encoding header.
+	std::string_view getHttpContentCodingName(HttpContentCoding coding) noexcept;
+	/// @brief Check if a content coding other than identity has been built in.
+	bool isHttpContentCodingSupported(HttpContentCoding coding) noexcept;
+	/// @brief Parse an Accept-Encoding header into the content codings accepted by the peer.
+	///
+	/// @param value Value of the header.
+	/// @return Mask of the accepted codings, in which each coding takes the bit (1 << coding).
+	/// The identity coding is always accepted, as the responses cannot be sent otherwise.
+	uint32_t parseHttpAcceptEncoding(std::string_view value) noexcept;
+
+	/// @brief Immutable reference-counted body of a cached response, shared by the cache and the responses sending it.
+	/// The storage follows the object in the same allocation.
+	class HttpCachedBody final : public netknot::RcBuffer {
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		netknot::MaybeAtomic<size_t> refCount = 0;
+
+		HttpCachedBody(peff::Alloc *selfAllocator, size_t size) noexcept;
+		virtual ~HttpCachedBody();
+
+		virtual size_t incRef(size_t globalRc) override;
+		virtual size_t decRef(size_t globalRc) override;
+
+		/// @brief Allocate a body with a copy of the data.
+		///
+		/// @return The body without any reference, nullptr if out of memory.
+		static HttpCachedBody *alloc(peff::Alloc *allocator, const std::string_view &data) noexcept;
+	};
+
+	/// @brief Cached response with its body in every content coding which has been built for it.
+	class HttpCachedResponse final {
+	private:
+		netknot::MaybeAtomic<size_t> _refCount = 0;
+
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		/// @brief Path and query of the response, by which it is cached.
+		peff::String key;
+		peff::String contentType;
+		/// @brief Bodies by their codings, a coding may be missing if it does not make the body smaller.
+		/// The identity body is set before the response is cached and never replaced, the others are guarded by the cache.
+		peff::RcObjectPtr<HttpCachedBody> bodies[HTTP_CONTENT_CODING_COUNT];
+		/// @brief Bodies built by the compression job, which are only touched by the job and then by its continuation.
+		peff::RcObjectPtr<HttpCachedBody> compressedBodies[HTTP_CONTENT_CODING_COUNT];
+		/// @brief Neighbours in the LRU list of the cache, the most recently used one is the first.
+		HttpCachedResponse *prevUsed = nullptr, *nextUsed = nullptr;
+		/// @brief Whether the response is still in the cache, the evicted ones are only kept by the jobs and the responses.
+		bool isCached = false;
+
+		HttpCachedResponse(peff::Alloc *selfAllocator) noexcept;
+		~HttpCachedResponse();
+
+		void dealloc() noexcept;
+
+		/// @brief Get the memory charged to the cache for the response.
+		size_t getMemorySize() const noexcept;
+
+		NETKNOT_FORCEINLINE size_t incRef(size_t globalRc) noexcept {
+			return ++_refCount;
+		}
+
+		NETKNOT_FORCEINLINE size_t decRef(size_t globalRc) noexcept {
+			if (!--_refCount) {
+				dealloc();
+				return 0;
+			}
+
+			return _refCount;
+		}
+	};
+
+	/// @brief Cache of the rendered responses, which compresses each of them once in the compute pool of the I/O service.
+	/// The cache may be shared by the workers, and is kept alive by the compression jobs in flight.
+	class HttpResponseCache final {
+	public:
+		constexpr static size_t DEFAULT_MAX_MEMORY_SIZE = 64 * 1024 * 1024;
+
+	private:
+		netknot::MaybeAtomic<size_t> _refCount = 0;
+		peff::RcObjectPtr<peff::Alloc> _selfAllocator;
+		netknot::IOService *_ioService;
+
+		std::mutex _mutex;
+		/// @brief Cached responses by their keys, the keys refer to the keys of the responses.
+		peff::HashMap<std::string_view, HttpCachedResponse *> _responses;
+		HttpCachedResponse *_firstUsed = nullptr, *_lastUsed = nullptr;
+		size_t _szMemory = 0, _maxMemorySize;
+
+		void _unlinkResponse(HttpCachedResponse *response) noexcept;
+		void _linkResponse(HttpCachedResponse *response) noexcept;
+		void _evictResponse(HttpCachedResponse *response) noexcept;
+		void _shrinkToLimit() noexcept;
+		/// @brief Attach the bodies built by the compression job, called by the continuation of the job.
+		void _attachCompressedBodies(HttpCachedResponse *response) noexcept;
+		/// @brief Build the compressed bodies of a response, called by the compression job.
+		static netknot::ExceptionPointer _compress(HttpCachedResponse *response) noexcept;
+
+	public:
+		HttpResponseCache(peff::Alloc *selfAllocator, netknot::IOService *ioService, size_t maxMemorySize) noexcept;
+		~HttpResponseCache();
+
+		static HttpResponseCache *alloc(peff::Alloc *allocator, netknot::IOService *ioService, size_t maxMemorySize = DEFAULT_MAX_MEMORY_SIZE) noexcept;
+		void dealloc() noexcept;
+
+		NETKNOT_FORCEINLINE size_t incRef(size_t globalRc) noexcept {
+			return ++_refCount;
+		}
+
+		NETKNOT_FORCEINLINE size_t decRef(size_t globalRc) noexcept {
+			if (!--_refCount) {
+				dealloc();
+				return 0;
+			}
+
+			return _refCount;
+		}
+
+		/// @brief Find a response and pick its smallest body among the accepted codings.
+		///
+		/// @param key Key of the response.
+		/// @param acceptedCodings Mask of the accepted codings, see parseHttpAcceptEncoding().
+		/// @param responseOut Where to store the response, nothing is stored if the response is not cached.
+		/// @param codingOut Where to store the coding of the body.
+		/// @param bodyOut Where to store the body.
+		void find(std::string_view key, uint32_t acceptedCodings, peff::RcObjectPtr<HttpCachedResponse> &responseOut, HttpContentCoding &codingOut, peff::RcObjectPtr<HttpCachedBody> &bodyOut);
+		/// @brief Put a response into the cache and start compressing it in the background,
+		/// the compressed bodies are served once they are ready.
+		///
+		/// @param key Key of the response.
+		/// @param contentType Content type of the response.
+		/// @param body Uncompressed body of the response.
+		/// @param responseOut Where to store the response, nothing is stored if the body cannot fit in the cache.
+		/// @return The exception occurred.
+		netknot::ExceptionPointer insert(std::string_view key, std::string_view contentType, std::string_view body, peff::RcObjectPtr<HttpCachedResponse> &responseOut);
+		/// @brief Drop a response from the cache, the responses in flight keep their own references.
+		void remove(std::string_view key) noexcept;
+	};
+
+	/// @brief Handler whose responses are rendered once, cached, and sent in the best coding accepted by each peer.
+	/// The cached bodies are sent by reference without being copied.
+	class HttpCachedRequestHandler : public HttpRequestHandler {
+	protected:
+		peff::RcObjectPtr<HttpResponseCache> cache;
+
+	public:
+		HttpCachedRequestHandler(const std::string_view &methodName, HttpResponseCache *cache) noexcept;
+		virtual ~HttpCachedRequestHandler();
+
+		/// @brief Render the response to be cached, called on the cache misses.
+		///
+		/// @param state State of the request.
+		/// @param contentTypeOut Where to store the content type.
+		/// @param bodyOut Where to store the uncompressed body.
+		/// @return The exception occurred.
+		virtual netknot::ExceptionPointer render(const HttpURLHandlerState &state, peff::String &contentTypeOut, peff::String &bodyOut) = 0;
+
+		virtual netknot::ExceptionPointer handleURL(const HttpURLHandlerState &state) override;
+	};
+
+	template <typename Fn>
+	class FnHttpCachedRequestHandler : public HttpCachedRequestHandler {
+	public:
+		using ThisType = FnHttpCachedRequestHandler<Fn>;
+
+		peff::RcObjectPtr<peff::Alloc> allocator;
+		Fn f;
+
+		static_assert(std::is_invocable_v<Fn, const HttpURLHandlerState &, peff::String &, peff::String &>, "The callback is malformed");
+		static_assert(std::is_same_v<std::invoke_result_t<Fn, const HttpURLHandlerState &, peff::String &, peff::String &>, netknot::ExceptionPointer>, "The callback is malformed");
+
+		FnHttpCachedRequestHandler(peff::Alloc *allocator, const std::string_view &methodName, HttpResponseCache *cache, Fn &&f) noexcept : HttpCachedRequestHandler(methodName, cache), allocator(allocator), f(std::move(f)) {
+		}
+		virtual ~FnHttpCachedRequestHandler() {
+		}
+
+		virtual void dealloc() noexcept override {
+			peff::destroyAndRelease<ThisType>(allocator.get(), this, alignof(ThisType));
+		}
+
+		virtual netknot::ExceptionPointer render(const HttpURLHandlerState &state, peff::String &contentTypeOut, peff::String &bodyOut) override {
+			return f(state, contentTypeOut, bodyOut);
+		}
+	};
+
+	template <typename Fn>
+	FnHttpCachedRequestHandler<Fn> *allocFnHttpCachedRequestHandler(peff::Alloc *allocator, const std::string_view &methodName, HttpResponseCache *cache, Fn &&f) noexcept {
+		return peff::allocAndConstruct<FnHttpCachedRequestHandler<Fn>>(allocator, alignof(FnHttpCachedRequestHandler<Fn>), allocator, methodName, cache, std::move(f));
+	}
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "http_chunked.h"
+#include <cstring>
+
+using namespace http;
+
+HttpChunkedDecoder::HttpChunkedDecoder(size_t maxFramingSize) noexcept : _maxFramingSize(maxFramingSize) {
+}
+
+static NETKNOT_FORCEINLINE int hexDigitValue(char c) noexcept {
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+HttpChunkedDecodeResult HttpChunkedDecoder::decode(const char *data, size_t size, size_t &szConsumedOut, const char *&chunkDataOut, size_t &szChunkDataOut) noexcept {
+	szConsumedOut = 0;
+	chunkDataOut = nullptr;
+	szChunkDataOut = 0;
+
+	if ((_state == State::Done) || (_state == State::Error))
+		std::terminate();
+
+	const char *p = data, *const end = data + size;
+
+	while (p < end) {
+		// The data are not framing, everything else is.
+		if (_state == State::Data) {
+			size_t szPiece = (size_t)(end - p);
+			if (szPiece > _szChunkLeft)
+				szPiece = (size_t)_szChunkLeft;
+
+			chunkDataOut = p;
+			szChunkDataOut = szPiece;
+
+			_szChunkLeft -= szPiece;
+			if (!_szChunkLeft)
+				_state = State::DataCR;
+
+			szConsumedOut = (size_t)(p + szPiece - data);
+			return HttpChunkedDecodeResult::Data;
+		}
+
+		if (++_szFraming > _maxFramingSize)
+			goto tooLarge;
+
+		switch (_state) {
+			case State::SizeStart:
+				if (hexDigitValue(*p) < 0)
+					goto malformed;
+				_state = State::Size;
+				[[fallthrough]];
+			case State::Size: {
+				int digit = hexDigitValue(*p);
+
+				if (digit >= 0) {
+					if (_szChunkLeft > (UINT64_MAX >> 4))
+						goto tooLarge;
+					_szChunkLeft = (_szChunkLeft << 4) | (uint64_t)digit;
+					++p;
+					break;
+				}
+
+				switch (*p) {
+					case '\r':
+						_state = State::SizeLF;
+						break;
+					case ';':
+					case ' ':
+					case '\t':
+						_state = State::Extension;
+						break;
+					default:
+						goto malformed;
+				}
+				++p;
+				break;
+			}
+			case State::Extension: {
+				// The extensions are not interpreted, skip to the end of the line.
+				const char *q = (const char *)memchr(p, '\r', (size_t)(end - p));
+				const char *lineEnd = q ? q : end;
+
+				if (memchr(p, '\n', (size_t)(lineEnd - p)))
+					goto malformed;
+				// The first byte has been counted already.
+				if ((_szFraming += (size_t)(lineEnd - p) + (q ? 1 : 0) - 1) > _maxFramingSize)
+					goto tooLarge;
+
+				if (!q) {
+					p = end;
+					break;
+				}
+				p = q + 1;
+				_state = State::SizeLF;
+				break;
+			}
+			case State::SizeLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_state = _szChunkLeft ? State::Data : State::TrailerLineStart;
+				break;
+			case State::DataCR:
+				if (*p != '\r')
+					goto malformed;
+				++p;
+				_state = State::DataLF;
+				break;
+			case State::DataLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_szFraming = 0;
+				_state = State::SizeStart;
+				break;
+			case State::TrailerLineStart:
+				if (*p == '\r') {
+					++p;
+					_state = State::EndLF;
+					break;
+				}
+				_state = State::TrailerLine;
+				[[fallthrough]];
+			case State::TrailerLine: {
+				// The trailers are discarded, only the line endings matter.
+				const char *q = (const char *)memchr(p, '\r', (size_t)(end - p));
+				const char *lineEnd = q ? q : end;
+
+				if (memchr(p, '\n', (size_t)(lineEnd - p)))
+					goto malformed;
+				// The first byte has been counted already.
+				if ((_szFraming += (size_t)(lineEnd - p) + (q ? 1 : 0) - 1) > _maxFramingSize)
+					goto tooLarge;
+
+				if (!q) {
+					p = end;
+					break;
+				}
+				p = q + 1;
+				_state = State::TrailerLF;
+				break;
+			}
+			case State::TrailerLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_state = State::TrailerLineStart;
+				break;
+			case State::EndLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_state = State::Done;
+
+				// The bytes after the body belong to the next request.
+				szConsumedOut = (size_t)(p - data);
+				return HttpChunkedDecodeResult::Done;
+			default:
+				std::terminate();
+		}
+	}
+
+	szConsumedOut = size;
+	return HttpChunkedDecodeResult::NeedMore;
+
+malformed:
+	_state = State::Error;
+	return HttpChunkedDecodeResult::Malformed;
+
+tooLarge:
+	_state = State::Error;
+	return HttpChunkedDecodeResult::TooLarge;
+}
+
+void HttpChunkedDecoder::reset() noexcept {
+	_state = State::SizeStart;
+	_szChunkLeft = 0;
+	_szFraming = 0;
+}
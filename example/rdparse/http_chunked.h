@@ -0,0 +1,75 @@
+#ifndef _HTTP_CHUNKED_H_
+#define _HTTP_CHUNKED_H_
+
+#include <netknot/basedefs.h>
+#include <cstdint>
+
+namespace http {
+	enum class HttpChunkedDecodeResult : uint8_t {
+		/// @brief All of the fed data have been consumed, feed more data.
+		NeedMore = 0,
+		/// @brief A piece of the chunk data is available.
+		Data,
+		/// @brief The last chunk and the trailers are done.
+		Done,
+		/// @brief The chunked body is malformed.
+		Malformed,
+		/// @brief A chunk size or the framing exceeds the limits.
+		TooLarge
+	};
+
+	/// @brief Resumable decoder of chunked request bodies.
+	/// The chunk data are never copied, each piece is returned as a range of the fed data.
+	/// Chunk extensions and trailers are validated for framing and discarded.
+	class HttpChunkedDecoder {
+	public:
+		enum class State : uint8_t {
+			/// @brief Expecting the first digit of a chunk size.
+			SizeStart = 0,
+			Size,
+			Extension,
+			SizeLF,
+			Data,
+			DataCR,
+			DataLF,
+			TrailerLineStart,
+			TrailerLine,
+			TrailerLF,
+			EndLF,
+			Done,
+			Error
+		};
+
+	private:
+		size_t _maxFramingSize;
+		State _state = State::SizeStart;
+		uint64_t _szChunkLeft = 0;
+		/// @brief Size of the framing since the last chunk data, including the chunk size lines and the trailers.
+		size_t _szFraming = 0;
+
+	public:
+		/// @brief Construct the decoder.
+		///
+		/// @param maxFramingSize Maximum size of a chunk size line with its extensions, or of the trailers.
+		HttpChunkedDecoder(size_t maxFramingSize = 4096) noexcept;
+
+		/// @brief Decode the fed data until a piece of chunk data, the end of the body, or the end of the data.
+		///
+		/// @param data Data to be decoded.
+		/// @param size Size of the data.
+		/// @param szConsumedOut Where to store the number of bytes consumed, including the returned piece.
+		/// @param chunkDataOut Where to store the start of the piece of chunk data.
+		/// @param szChunkDataOut Where to store the size of the piece of chunk data, 0 if no data.
+		/// @return The decode result, the decoder must be reset before feeding again if it is Done or an error.
+		HttpChunkedDecodeResult decode(const char *data, size_t size, size_t &szConsumedOut, const char *&chunkDataOut, size_t &szChunkDataOut) noexcept;
+
+		/// @brief Reset the decoder for the next body.
+		void reset() noexcept;
+
+		NETKNOT_FORCEINLINE State getState() const noexcept {
+			return _state;
+		}
+	};
+}
+
+#endif
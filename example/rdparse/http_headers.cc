@@ -0,0 +1,167 @@
+#include "http_headers.h"
+#include <iterator>
+
+using namespace http;
+
+using std::operator""sv;
+
+// Lowercase, indexed by HttpHeaderId.
+static constexpr std::string_view g_httpHeaderNames[] = {
+	"accept"sv,
+	"accept-charset"sv,
+	"accept-encoding"sv,
+	"accept-language"sv,
+	"authorization"sv,
+	"cache-control"sv,
+	"connection"sv,
+	"content-encoding"sv,
+	"content-length"sv,
+	"content-type"sv,
+	"cookie"sv,
+	"date"sv,
+	"expect"sv,
+	"forwarded"sv,
+	"host"sv,
+	"http2-settings"sv,
+	"if-match"sv,
+	"if-modified-since"sv,
+	"if-none-match"sv,
+	"if-range"sv,
+	"if-unmodified-since"sv,
+	"keep-alive"sv,
+	"origin"sv,
+	"pragma"sv,
+	"proxy-authorization"sv,
+	"range"sv,
+	"referer"sv,
+	"te"sv,
+	"trailer"sv,
+	"transfer-encoding"sv,
+	"upgrade"sv,
+	"user-agent"sv,
+	"via"sv,
+	"x-forwarded-for"sv,
+	"x-forwarded-proto"sv,
+	"x-request-id"sv
+};
+static_assert(std::size(g_httpHeaderNames) == HTTP_HEADER_ID_COUNT, "Header name table does not match the IDs");
+
+// The hash samples the length, the first, the middle and the last characters, and folds the case with 0x20.
+// Folding non-letters may collide them, which is fine since the hash is always followed by a full comparison.
+static constexpr size_t HEADER_HASH_BITS = 7;
+static constexpr size_t HEADER_HASH_SIZE = (size_t)1 << HEADER_HASH_BITS;
+// Found by searching for the first odd multiplier which maps all the names to distinct slots.
+// Search again if the names are changed, the assertion below catches any collision.
+static constexpr uint32_t HEADER_HASH_MULTIPLIER = 36299;
+
+static constexpr uint32_t hashHeaderName(std::string_view name) noexcept {
+	const size_t size = name.size();
+	const uint32_t key = (uint32_t)(uint8_t)size |
+						 ((uint32_t)((uint8_t)name[0] | 0x20) << 8) |
+						 ((uint32_t)((uint8_t)name[size >> 1] | 0x20) << 16) |
+						 ((uint32_t)((uint8_t)name[size - 1] | 0x20) << 24);
+	return (uint32_t)(key * HEADER_HASH_MULTIPLIER) >> (32 - HEADER_HASH_BITS);
+}
+
+struct HeaderHashTable {
+	uint8_t slots[HEADER_HASH_SIZE];
+	bool isPerfect;
+};
+
+static constexpr HeaderHashTable buildHeaderHashTable() noexcept {
+	HeaderHashTable table = {};
+
+	for (size_t i = 0; i < HEADER_HASH_SIZE; ++i)
+		table.slots[i] = (uint8_t)HttpHeaderId::Unknown;
+
+	table.isPerfect = true;
+	for (size_t i = 0; i < HTTP_HEADER_ID_COUNT; ++i) {
+		uint8_t &slot = table.slots[hashHeaderName(g_httpHeaderNames[i])];
+
+		if (slot != (uint8_t)HttpHeaderId::Unknown)
+			table.isPerfect = false;
+		slot = (uint8_t)i;
+	}
+
+	return table;
+}
+
+static constexpr HeaderHashTable g_headerHashTable = buildHeaderHashTable();
+static_assert(g_headerHashTable.isPerfect, "Header hash has collisions, search for another multiplier");
+
+static NETKNOT_FORCEINLINE char toLowerAscii(char c) noexcept {
+	return ((c >= 'A') && (c <= 'Z')) ? (char)(c | 0x20) : c;
+}
+
+bool http::isHttpHeaderNameEqual(std::string_view lhs, std::string_view rhs) noexcept {
+	if (lhs.size() != rhs.size())
+		return false;
+
+	for (size_t i = 0; i < lhs.size(); ++i) {
+		if (toLowerAscii(lhs[i]) != toLowerAscii(rhs[i]))
+			return false;
+	}
+
+	return true;
+}
+
+std::string_view http::getHttpHeaderName(HttpHeaderId id) noexcept {
+	if (id >= HttpHeaderId::Count)
+		std::terminate();
+
+	return g_httpHeaderNames[(size_t)id];
+}
+
+HttpHeaderId http::lookupHttpHeaderId(std::string_view name) noexcept {
+	if (!name.size())
+		return HttpHeaderId::Unknown;
+
+	const uint8_t id = g_headerHashTable.slots[hashHeaderName(name)];
+
+	if (id == (uint8_t)HttpHeaderId::Unknown)
+		return HttpHeaderId::Unknown;
+
+	// The names in the table are lowercase already.
+	const std::string_view candidate = g_httpHeaderNames[id];
+
+	if (candidate.size() != name.size())
+		return HttpHeaderId::Unknown;
+
+	for (size_t i = 0; i < name.size(); ++i) {
+		if (toLowerAscii(name[i]) != candidate[i])
+			return HttpHeaderId::Unknown;
+	}
+
+	return (HttpHeaderId)id;
+}
+
+HttpRequestHeaderView::HttpRequestHeaderView(peff::Alloc *allocator) : otherHeaders(allocator) {}
+
+bool HttpRequestHeaderView::find(std::string_view name, std::string_view &valueOut) const noexcept {
+	HttpHeaderId id = lookupHttpHeaderId(name);
+
+	if (id != HttpHeaderId::Unknown) {
+		// The first occurrence of a well-known header is always in its slot.
+		if (!has(id))
+			return false;
+		valueOut = get(id);
+		return true;
+	}
+
+	for (size_t i = 0; i < otherHeaders.size(); ++i) {
+		const HttpHeaderField &field = otherHeaders.at(i);
+
+		if (isHttpHeaderNameEqual(field.name, name)) {
+			valueOut = field.value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void HttpRequestHeaderView::clear() noexcept {
+	for (size_t i = 0; i < HTTP_HEADER_ID_COUNT; ++i)
+		knownHeaders[i] = {};
+	otherHeaders.clear();
+}
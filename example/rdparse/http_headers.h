@@ -0,0 +1,101 @@
+#ifndef _HTTP_HEADERS_H_
+#define _HTTP_HEADERS_H_
+
+#include <netknot/basedefs.h>
+#include <peff/containers/dynarray.h>
+#include <string_view>
+
+namespace http {
+	/// @brief Well-known header names, which are recognized by the parser and stored in fixed slots.
+	enum class HttpHeaderId : uint8_t {
+		Accept = 0,
+		AcceptCharset,
+		AcceptEncoding,
+		AcceptLanguage,
+		Authorization,
+		CacheControl,
+		Connection,
+		ContentEncoding,
+		ContentLength,
+		ContentType,
+		Cookie,
+		Date,
+		Expect,
+		Forwarded,
+		Host,
+		Http2Settings,
+		IfMatch,
+		IfModifiedSince,
+		IfNoneMatch,
+		IfRange,
+		IfUnmodifiedSince,
+		KeepAlive,
+		Origin,
+		Pragma,
+		ProxyAuthorization,
+		Range,
+		Referer,
+		TE,
+		Trailer,
+		TransferEncoding,
+		Upgrade,
+		UserAgent,
+		Via,
+		XForwardedFor,
+		XForwardedProto,
+		XRequestId,
+
+		Count,
+		/// @brief The name is not a well-known one.
+		Unknown = Count
+	};
+
+	constexpr size_t HTTP_HEADER_ID_COUNT = (size_t)HttpHeaderId::Count;
+
+	/// @brief Get the canonical name of a well-known header.
+	std::string_view getHttpHeaderName(HttpHeaderId id) noexcept;
+	/// @brief Look up a header name case-insensitively with a perfect hash.
+	///
+	/// @param name Name to be looked up.
+	/// @return ID of the header, HttpHeaderId::Unknown if the name is not a well-known one.
+	HttpHeaderId lookupHttpHeaderId(std::string_view name) noexcept;
+	/// @brief Compare two header names case-insensitively, the names must consist of token characters only.
+	bool isHttpHeaderNameEqual(std::string_view lhs, std::string_view rhs) noexcept;
+
+	struct HttpHeaderField {
+		std::string_view name;
+		std::string_view value;
+	};
+
+	/// @brief Headers of a request, the well-known ones are indexed by their IDs and the others are kept in order.
+	/// A repeated well-known header keeps the first value in its slot, the following ones go to the other headers.
+	struct HttpRequestHeaderView {
+		/// @brief Values of the well-known headers, a slot with null data means the header is absent.
+		std::string_view knownHeaders[HTTP_HEADER_ID_COUNT];
+		peff::DynArray<HttpHeaderField> otherHeaders;
+
+		HttpRequestHeaderView(peff::Alloc *allocator);
+		HttpRequestHeaderView(HttpRequestHeaderView &&) = default;
+
+		HttpRequestHeaderView &operator=(HttpRequestHeaderView &&) = default;
+
+		NETKNOT_FORCEINLINE bool has(HttpHeaderId id) const noexcept {
+			return knownHeaders[(size_t)id].data();
+		}
+
+		NETKNOT_FORCEINLINE std::string_view get(HttpHeaderId id) const noexcept {
+			return knownHeaders[(size_t)id];
+		}
+
+		/// @brief Find the first header with the name, case-insensitively.
+		///
+		/// @param name Name of the header.
+		/// @param valueOut Where to store the value.
+		/// @return Whether the header is found.
+		bool find(std::string_view name, std::string_view &valueOut) const noexcept;
+
+		void clear() noexcept;
+	};
+}
+
+#endif
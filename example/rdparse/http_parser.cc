@@ -0,0 +1,303 @@
+#include "http_parser.h"
+#include <cstring>
+
+using namespace http;
+
+static_assert(HTTP_HEADER_ID_COUNT <= 64, "Too many well-known headers for the seen mask");
+
+// Headers which must not be repeated, a repeated one may be interpreted differently by the intermediaries.
+static constexpr uint64_t SINGLETON_HEADERS_MASK =
+	((uint64_t)1 << (size_t)HttpHeaderId::ContentLength) |
+	((uint64_t)1 << (size_t)HttpHeaderId::TransferEncoding) |
+	((uint64_t)1 << (size_t)HttpHeaderId::Host);
+
+HttpRequestParser::HttpRequestParser(peff::Alloc *allocator, size_t maxHeadSize, const HttpScanner &scanner) : _scanner(&scanner), _maxHeadSize(maxHeadSize), _straddled(allocator), _headers(allocator) {
+}
+
+bool HttpRequestParser::_finishToken(const char *tokenBegin, const char *tokenEnd, Span &spanOut) noexcept {
+	if (!_isTokenStraddled) {
+		spanOut = { tokenBegin, 0, (size_t)(tokenEnd - tokenBegin) };
+		return true;
+	}
+
+	// The token began in an earlier feed, put the rest of it after the saved part.
+	size_t szStraddled = _straddled.size(), szRest = (size_t)(tokenEnd - tokenBegin);
+
+	if (!_straddled.resizeUninitialized(szStraddled + szRest))
+		return false;
+	memcpy(_straddled.data() + szStraddled, tokenBegin, szRest);
+
+	spanOut = { nullptr, _offStraddledToken, szStraddled + szRest - _offStraddledToken };
+	_isTokenStraddled = false;
+
+	return true;
+}
+
+bool HttpRequestParser::_saveStraddledToken(const char *tokenBegin, const char *end) noexcept {
+	if (tokenBegin == end)
+		return true;
+
+	size_t szStraddled = _straddled.size(), szPart = (size_t)(end - tokenBegin);
+
+	if (!_isTokenStraddled) {
+		_offStraddledToken = szStraddled;
+		_isTokenStraddled = true;
+	}
+
+	if (!_straddled.resizeUninitialized(szStraddled + szPart))
+		return false;
+	memcpy(_straddled.data() + szStraddled, tokenBegin, szPart);
+
+	return true;
+}
+
+HttpParseResult HttpRequestParser::parse(const char *data, size_t size, size_t &szConsumedOut) noexcept {
+	szConsumedOut = 0;
+
+	if ((_state == State::Done) || (_state == State::Error))
+		std::terminate();
+
+	// Never take more than the limit, the head is too large if it is not done within the limit.
+	const size_t szFed = size < _maxHeadSize - _szHead ? size : _maxHeadSize - _szHead;
+
+	const char *p = data, *const end = data + szFed;
+	// A token cut by the end of the last feed continues at the beginning of this one.
+	const char *tokenBegin = data;
+
+	while (p < end) {
+		switch (_state) {
+			case State::Start:
+				// Empty lines before the request line are ignored, as suggested by RFC 9112.
+				if ((*p == '\r') || (*p == '\n')) {
+					++p;
+					break;
+				}
+				tokenBegin = p;
+				_state = State::Method;
+				[[fallthrough]];
+			case State::Method: {
+				const char *q = _scanner->skipToken(p, end);
+
+				if (q == end) {
+					p = end;
+					break;
+				}
+				if (*q != ' ')
+					goto malformed;
+
+				if (!_finishToken(tokenBegin, q, _method))
+					goto outOfMemory;
+				if (!_method.size)
+					goto malformed;
+
+				p = q + 1;
+				tokenBegin = p;
+				_state = State::Target;
+				break;
+			}
+			case State::Target: {
+				const char *q = _scanner->skipVisible(p, end);
+
+				if (q == end) {
+					p = end;
+					break;
+				}
+				if (*q != ' ')
+					goto malformed;
+
+				if (!_finishToken(tokenBegin, q, _target))
+					goto outOfMemory;
+				if (!_target.size)
+					goto malformed;
+
+				p = q + 1;
+				tokenBegin = p;
+				_state = State::Version;
+				break;
+			}
+			case State::Version: {
+				const char *q = _scanner->skipVisible(p, end);
+
+				if (q == end) {
+					p = end;
+					break;
+				}
+				if (*q != '\r')
+					goto malformed;
+
+				if (!_finishToken(tokenBegin, q, _version))
+					goto outOfMemory;
+				if (!_version.size)
+					goto malformed;
+
+				p = q + 1;
+				_state = State::RequestLineLF;
+				break;
+			}
+			case State::RequestLineLF:
+			case State::HeaderLineLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_state = State::HeaderLineStart;
+				break;
+			case State::HeaderLineStart:
+				if (*p == '\r') {
+					++p;
+					_state = State::HeadEndLF;
+					break;
+				}
+				tokenBegin = p;
+				_state = State::HeaderName;
+				[[fallthrough]];
+			case State::HeaderName: {
+				const char *q = _scanner->skipToken(p, end);
+
+				if (q == end) {
+					p = end;
+					break;
+				}
+				if (*q != ':')
+					goto malformed;
+
+				if (!_finishToken(tokenBegin, q, _headerName))
+					goto outOfMemory;
+				if (!_headerName.size)
+					goto malformed;
+
+				_headerNameId = lookupHttpHeaderId(_resolve(_headerName));
+				if (_headerNameId != HttpHeaderId::Unknown) {
+					const uint64_t bit = (uint64_t)1 << (size_t)_headerNameId;
+
+					if ((_seenHeaders & bit) && (SINGLETON_HEADERS_MASK & bit))
+						goto malformed;
+					_seenHeaders |= bit;
+				}
+
+				p = q + 1;
+				_state = State::HeaderValueLeadingSpace;
+				[[fallthrough]];
+			}
+			case State::HeaderValueLeadingSpace:
+				while ((p < end) && ((*p == ' ') || (*p == '\t')))
+					++p;
+				if (p == end)
+					break;
+				tokenBegin = p;
+				_state = State::HeaderValue;
+				[[fallthrough]];
+			case State::HeaderValue: {
+				const char *q = _scanner->skipFieldValue(p, end);
+
+				if (q == end) {
+					p = end;
+					break;
+				}
+				if (*q != '\r')
+					goto malformed;
+
+				Span value;
+				if (!_finishToken(tokenBegin, q, value))
+					goto outOfMemory;
+
+				// The leading whitespaces have been skipped, only the trailing ones are left.
+				const char *valueData = value.data ? value.data : _straddled.data() + value.offset;
+				while (value.size && ((valueData[value.size - 1] == ' ') || (valueData[value.size - 1] == '\t')))
+					--value.size;
+
+				if (!_headers.pushBack({ _headerName, value, _headerNameId }))
+					goto outOfMemory;
+
+				p = q + 1;
+				_state = State::HeaderLineLF;
+				break;
+			}
+			case State::HeadEndLF:
+				if (*p != '\n')
+					goto malformed;
+				++p;
+				_state = State::Done;
+
+				// The bytes after the head are not consumed, they belong to the body or the next request.
+				szConsumedOut = (size_t)(p - data);
+				_szHead += szConsumedOut;
+
+				return HttpParseResult::Done;
+			default:
+				std::terminate();
+		}
+	}
+
+	switch (_state) {
+		case State::Method:
+		case State::Target:
+		case State::Version:
+		case State::HeaderName:
+		case State::HeaderValue:
+			// The token is cut by the end of the feed, it cannot be referenced in place.
+			if (!_saveStraddledToken(tokenBegin, end))
+				goto outOfMemory;
+			break;
+		default:
+			break;
+	}
+
+	szConsumedOut = szFed;
+	_szHead += szFed;
+
+	if (szFed < size) {
+		_state = State::Error;
+		return HttpParseResult::TooLarge;
+	}
+
+	return HttpParseResult::NeedMore;
+
+malformed:
+	_state = State::Error;
+	return HttpParseResult::Malformed;
+
+outOfMemory:
+	_state = State::Error;
+	return HttpParseResult::OutOfMemory;
+}
+
+void HttpRequestParser::reset() noexcept {
+	_state = State::Start;
+	_szHead = 0;
+	_straddled.clear();
+	_isTokenStraddled = false;
+	_offStraddledToken = 0;
+	_headers.clear();
+	_method = {};
+	_target = {};
+	_version = {};
+	_headerName = {};
+	_headerNameId = HttpHeaderId::Unknown;
+	_seenHeaders = 0;
+}
+
+HttpRequestLineView HttpRequestParser::getRequestLineView() const noexcept {
+	if (_state != State::Done)
+		std::terminate();
+
+	return { _resolve(_method), _resolve(_target), _resolve(_version) };
+}
+
+bool HttpRequestParser::buildRequestHeaderView(HttpRequestHeaderView &viewOut) const noexcept {
+	if (_state != State::Done)
+		std::terminate();
+
+	for (size_t i = 0; i < _headers.size(); ++i) {
+		const HeaderSpan &header = _headers.at(i);
+
+		if ((header.id != HttpHeaderId::Unknown) && (!viewOut.has(header.id))) {
+			viewOut.knownHeaders[(size_t)header.id] = _resolve(header.value);
+			continue;
+		}
+
+		if (!viewOut.otherHeaders.pushBack({ _resolve(header.name), _resolve(header.value) }))
+			return false;
+	}
+
+	return true;
+}
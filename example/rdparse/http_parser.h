@@ -0,0 +1,117 @@
+#ifndef _HTTP_PARSER_H_
+#define _HTTP_PARSER_H_
+
+#include "http_headers.h"
+#include "http_scan.h"
+#include <netknot/basedefs.h>
+#include <peff/containers/dynarray.h>
+#include <string_view>
+
+namespace http {
+	struct HttpRequestLineView {
+		std::string_view method;
+		std::string_view path;
+		std::string_view version;
+	};
+
+	enum class HttpParseResult : uint8_t {
+		/// @brief The request head is incomplete, feed more data.
+		NeedMore = 0,
+		/// @brief The request head is complete.
+		Done,
+		/// @brief The request head is malformed.
+		Malformed,
+		/// @brief The request head exceeds the size limit.
+		TooLarge,
+		OutOfMemory
+	};
+
+	/// @brief Resumable parser of HTTP/1.x request heads.
+	/// The parser keeps its state between feeds, so every byte is scanned exactly once however the head is fragmented.
+	/// Tokens are referenced in place, the fed data must stay valid until the views are no longer used.
+	/// Only a token cut by the end of a feed is copied into the parser.
+	class HttpRequestParser {
+	public:
+		enum class State : uint8_t {
+			/// @brief Skipping the empty lines before the request line.
+			Start = 0,
+			Method,
+			Target,
+			Version,
+			RequestLineLF,
+			HeaderLineStart,
+			HeaderName,
+			HeaderValueLeadingSpace,
+			HeaderValue,
+			HeaderLineLF,
+			HeadEndLF,
+			Done,
+			Error
+		};
+
+		struct Span {
+			/// @brief Start of the token in the fed data, nullptr if the token has been copied into the parser.
+			const char *data = nullptr;
+			/// @brief Offset of a copied token in the straddle storage.
+			size_t offset = 0;
+			size_t size = 0;
+		};
+
+		struct HeaderSpan {
+			Span name;
+			Span value;
+			HttpHeaderId id;
+		};
+
+	private:
+		const HttpScanner *_scanner;
+		size_t _maxHeadSize;
+		size_t _szHead = 0;
+		State _state = State::Start;
+		/// @brief Storage of the tokens which straddle feeds.
+		peff::DynArray<char> _straddled;
+		/// @brief Whether the beginning of the token being parsed is in the straddle storage.
+		bool _isTokenStraddled = false;
+		size_t _offStraddledToken = 0;
+		Span _method, _target, _version, _headerName;
+		HttpHeaderId _headerNameId = HttpHeaderId::Unknown;
+		/// @brief Bit mask of the well-known headers which have been seen, indexed by the IDs.
+		uint64_t _seenHeaders = 0;
+		peff::DynArray<HeaderSpan> _headers;
+
+		NETKNOT_FORCEINLINE std::string_view _resolve(const Span &span) const noexcept {
+			return span.data ? std::string_view(span.data, span.size) : std::string_view(_straddled.data() + span.offset, span.size);
+		}
+
+		[[nodiscard]] bool _finishToken(const char *tokenBegin, const char *tokenEnd, Span &spanOut) noexcept;
+		[[nodiscard]] bool _saveStraddledToken(const char *tokenBegin, const char *end) noexcept;
+
+	public:
+		HttpRequestParser(peff::Alloc *allocator, size_t maxHeadSize, const HttpScanner &scanner = getHttpScanner());
+
+		/// @brief Feed data to the parser, the parser stops right after the head.
+		///
+		/// @param data Data to be fed, which must stay valid until the parser is reset.
+		/// @param size Size of the data.
+		/// @param szConsumedOut Where to store the number of bytes consumed, the rest belong to the body or the next request.
+		/// @return The parse result, the parser must be reset before feeding again if it is not NeedMore.
+		HttpParseResult parse(const char *data, size_t size, size_t &szConsumedOut) noexcept;
+
+		/// @brief Reset the parser for the next request.
+		void reset() noexcept;
+
+		NETKNOT_FORCEINLINE State getState() const noexcept {
+			return _state;
+		}
+
+		/// @brief Get the request line, only valid after the head is done and before the parser is reset.
+		HttpRequestLineView getRequestLineView() const noexcept;
+		/// @brief Build the header view, only valid after the head is done and before the parser is reset.
+		///
+		/// @param viewOut Where to store the headers.
+		/// @return Whether the headers are built, false if out of memory.
+		[[nodiscard]] bool buildRequestHeaderView(HttpRequestHeaderView &viewOut) const noexcept;
+	};
+}
+
+#endif
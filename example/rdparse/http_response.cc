@@ -0,0 +1,287 @@
+#include "http_response.h"
+#include <cstring>
+#include <ctime>
+
+using namespace http;
+
+using std::operator""sv;
+
+struct HttpStatusLineEntry {
+	uint16_t code;
+	std::string_view line;
+};
+
+#define HTTP_STATUS_LINE(code, reason) \
+	{ code, "HTTP/1.1 " #code " " reason "\r\n"sv }
+
+static constexpr HttpStatusLineEntry g_httpStatusLineEntries[] = {
+	HTTP_STATUS_LINE(100, "Continue"),
+	HTTP_STATUS_LINE(101, "Switching Protocols"),
+	HTTP_STATUS_LINE(102, "Processing"),
+	HTTP_STATUS_LINE(103, "Early Hints"),
+	HTTP_STATUS_LINE(200, "OK"),
+	HTTP_STATUS_LINE(201, "Created"),
+	HTTP_STATUS_LINE(202, "Accepted"),
+	HTTP_STATUS_LINE(203, "Non-Authoritative Information"),
+	HTTP_STATUS_LINE(204, "No Content"),
+	HTTP_STATUS_LINE(205, "Reset Content"),
+	HTTP_STATUS_LINE(206, "Partial Content"),
+	HTTP_STATUS_LINE(207, "Multi-Status"),
+	HTTP_STATUS_LINE(208, "Already Reported"),
+	HTTP_STATUS_LINE(226, "IM Used"),
+	HTTP_STATUS_LINE(300, "Multiple Choice"),
+	HTTP_STATUS_LINE(301, "Moved Permanently"),
+	HTTP_STATUS_LINE(302, "Found"),
+	HTTP_STATUS_LINE(303, "See Other"),
+	HTTP_STATUS_LINE(304, "Not Modified"),
+	HTTP_STATUS_LINE(305, "Use Proxy"),
+	HTTP_STATUS_LINE(307, "Temporary Redirect"),
+	HTTP_STATUS_LINE(308, "Permanent Redirect"),
+	HTTP_STATUS_LINE(400, "Bad Request"),
+	HTTP_STATUS_LINE(401, "Unauthorized"),
+	HTTP_STATUS_LINE(402, "Payment Required"),
+	HTTP_STATUS_LINE(403, "Forbidden"),
+	HTTP_STATUS_LINE(404, "Not Found"),
+	HTTP_STATUS_LINE(405, "Method Not Allowed"),
+	HTTP_STATUS_LINE(406, "Not Acceptable"),
+	HTTP_STATUS_LINE(407, "Proxy Authentication Required"),
+	HTTP_STATUS_LINE(408, "Request Timeout"),
+	HTTP_STATUS_LINE(409, "Conflict"),
+	HTTP_STATUS_LINE(410, "Gone"),
+	HTTP_STATUS_LINE(411, "Length Required"),
+	HTTP_STATUS_LINE(412, "Precondition Failed"),
+	HTTP_STATUS_LINE(413, "Payload Too Large"),
+	HTTP_STATUS_LINE(414, "URI Too Long"),
+	HTTP_STATUS_LINE(415, "Unsupported Media Type"),
+	HTTP_STATUS_LINE(416, "Range Not Satisfiable"),
+	HTTP_STATUS_LINE(417, "Expectation Failed"),
+	HTTP_STATUS_LINE(418, "I'm a teapot"),
+	HTTP_STATUS_LINE(421, "Misdirected Request"),
+	HTTP_STATUS_LINE(422, "Unprocessable Entity"),
+	HTTP_STATUS_LINE(423, "Locked"),
+	HTTP_STATUS_LINE(424, "Failed Dependency"),
+	HTTP_STATUS_LINE(425, "Too Early"),
+	HTTP_STATUS_LINE(426, "Upgrade Required"),
+	HTTP_STATUS_LINE(428, "Precondition Required"),
+	HTTP_STATUS_LINE(429, "Too Many Requests"),
+	HTTP_STATUS_LINE(431, "Request Header Fields Too Large"),
+	HTTP_STATUS_LINE(451, "Unavailable For Legal Reasons"),
+	HTTP_STATUS_LINE(500, "Internal Server Error"),
+	HTTP_STATUS_LINE(501, "Not Implemented"),
+	HTTP_STATUS_LINE(502, "Bad Gateway"),
+	HTTP_STATUS_LINE(503, "Service Unavailable"),
+	HTTP_STATUS_LINE(504, "Gateway Timeout"),
+	HTTP_STATUS_LINE(505, "HTTP Version Not Supported"),
+	HTTP_STATUS_LINE(506, "Variant Also Negotiates"),
+	HTTP_STATUS_LINE(507, "Insufficient Storage"),
+	HTTP_STATUS_LINE(508, "Loop Detected"),
+	HTTP_STATUS_LINE(510, "Not Extended"),
+	HTTP_STATUS_LINE(511, "Network Authentication Required"),
+};
+
+#undef HTTP_STATUS_LINE
+
+constexpr uint16_t HTTP_STATUS_CODE_MIN = 100, HTTP_STATUS_CODE_MAX = 599;
+
+struct HttpStatusLineTable {
+	std::string_view lines[HTTP_STATUS_CODE_MAX - HTTP_STATUS_CODE_MIN + 1] = {};
+};
+
+// Indexed by the status codes so that a status line is found with a single load.
+static constexpr HttpStatusLineTable g_httpStatusLineTable = []() constexpr {
+	HttpStatusLineTable table;
+
+	for (const auto &i : g_httpStatusLineEntries)
+		table.lines[i.code - HTTP_STATUS_CODE_MIN] = i.line;
+
+	return table;
+}();
+
+std::string_view http::getHttpStatusLine(HttpResponseStatus status) noexcept {
+	const uint16_t code = (uint16_t)status;
+
+	if ((code < HTTP_STATUS_CODE_MIN) || (code > HTTP_STATUS_CODE_MAX))
+		std::terminate();
+
+	std::string_view line = g_httpStatusLineTable.lines[code - HTTP_STATUS_CODE_MIN];
+
+	if (!line.size())
+		std::terminate();
+
+	return line;
+}
+
+static constexpr char g_decimalDigitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static NETKNOT_FORCEINLINE size_t countDecimalDigits(uint64_t value) noexcept {
+	size_t nDigits = 1;
+
+	// Four digits are skipped at a time for the large values.
+	for (;;) {
+		if (value < 10)
+			return nDigits;
+		if (value < 100)
+			return nDigits + 1;
+		if (value < 1000)
+			return nDigits + 2;
+		if (value < 10000)
+			return nDigits + 3;
+		value /= 10000;
+		nDigits += 4;
+	}
+}
+
+size_t http::formatHttpDecimal(char *buffer, uint64_t value) noexcept {
+	const size_t nDigits = countDecimalDigits(value);
+	char *p = buffer + nDigits;
+
+	while (value >= 100) {
+		const size_t offPair = (size_t)(value % 100) * 2;
+		value /= 100;
+		p -= 2;
+		memcpy(p, g_decimalDigitPairs + offPair, 2);
+	}
+
+	if (value >= 10) {
+		p -= 2;
+		memcpy(p, g_decimalDigitPairs + value * 2, 2);
+	} else
+		*--p = (char)('0' + value);
+
+	return nDigits;
+}
+
+size_t http::formatHttpHex(char *buffer, uint64_t value) noexcept {
+	static constexpr char hexDigits[] = "0123456789abcdef";
+
+	size_t nDigits = 1;
+	while ((nDigits < HTTP_HEX_MAX_SIZE) && (value >> (nDigits * 4)))
+		++nDigits;
+
+	for (size_t i = nDigits; i; --i) {
+		buffer[i - 1] = hexDigits[value & 0xf];
+		value >>= 4;
+	}
+
+	return nDigits;
+}
+
+static constexpr std::string_view g_httpDateTemplate = "Thu, 01 Jan 1970 00:00:00 GMT"sv;
+static constexpr char g_weekDayNames[] = "SunMonTueWedThuFriSat";
+static constexpr char g_monthNames[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static NETKNOT_FORCEINLINE void formatTwoDigits(char *p, int value) noexcept {
+	memcpy(p, g_decimalDigitPairs + value * 2, 2);
+}
+
+void http::formatHttpDate(char *buffer, time_t time) noexcept {
+	struct tm t;
+#if defined(_MSC_VER)
+	gmtime_s(&t, &time);
+#else
+	gmtime_r(&time, &t);
+#endif
+
+	// The fields are put into the template at fixed places.
+	memcpy(buffer, g_httpDateTemplate.data(), g_httpDateTemplate.size());
+	memcpy(buffer, g_weekDayNames + t.tm_wday * 3, 3);
+	formatTwoDigits(buffer + 5, t.tm_mday);
+	memcpy(buffer + 8, g_monthNames + t.tm_mon * 3, 3);
+	formatTwoDigits(buffer + 12, (t.tm_year + 1900) / 100);
+	formatTwoDigits(buffer + 14, (t.tm_year + 1900) % 100);
+	formatTwoDigits(buffer + 17, t.tm_hour);
+	formatTwoDigits(buffer + 20, t.tm_min);
+	formatTwoDigits(buffer + 23, t.tm_sec);
+}
+
+static NETKNOT_FORCEINLINE bool parseTwoDigits(const char *p, int &valueOut) noexcept {
+	if ((p[0] < '0') || (p[0] > '9') || (p[1] < '0') || (p[1] > '9'))
+		return false;
+
+	valueOut = (p[0] - '0') * 10 + (p[1] - '0');
+	return true;
+}
+
+bool http::parseHttpDate(std::string_view date, time_t &timeOut) noexcept {
+	if (date.size() != g_httpDateTemplate.size())
+		return false;
+
+	// The separators and the zone are fixed, the week day is redundant and not checked.
+	static constexpr uint8_t fixedPlaces[] = { 3, 4, 7, 11, 16, 19, 22, 25, 26, 27, 28 };
+
+	for (uint8_t i : fixedPlaces) {
+		if (date[i] != g_httpDateTemplate[i])
+			return false;
+	}
+
+	int day, month = -1, century, yearOfCentury, hour, minute, second;
+
+	for (int i = 0; i < 12; ++i) {
+		if (!memcmp(date.data() + 8, g_monthNames + i * 3, 3)) {
+			month = i;
+			break;
+		}
+	}
+
+	if ((month < 0) ||
+		(!parseTwoDigits(date.data() + 5, day)) ||
+		(!parseTwoDigits(date.data() + 12, century)) ||
+		(!parseTwoDigits(date.data() + 14, yearOfCentury)) ||
+		(!parseTwoDigits(date.data() + 17, hour)) ||
+		(!parseTwoDigits(date.data() + 20, minute)) ||
+		(!parseTwoDigits(date.data() + 23, second)))
+		return false;
+
+	if ((!day) || (day > 31) || (hour > 23) || (minute > 59) || (second > 60))
+		return false;
+
+	// Days since the epoch of the civil date, with the years starting from March.
+	int64_t year = century * 100 + yearOfCentury;
+	const int64_t m = month + 1;
+
+	year -= m <= 2;
+	const int64_t era = year / 400;
+	const int64_t yearOfEra = year - era * 400;
+	const int64_t dayOfYear = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	const int64_t days = era * 146097 + dayOfEra - 719468;
+
+	timeOut = (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+	return true;
+}
+
+static constexpr std::string_view g_httpDateHeaderName = "Date: "sv;
+
+struct HttpDateHeaderCache {
+	time_t second = -1;
+	char line[g_httpDateHeaderName.size() + HTTP_DATE_SIZE + 2];
+};
+
+static thread_local HttpDateHeaderCache g_httpDateHeaderCache;
+
+std::string_view http::getHttpDateHeader() noexcept {
+	HttpDateHeaderCache &cache = g_httpDateHeaderCache;
+	const time_t now = time(nullptr);
+
+	if (now != cache.second) {
+		char *p = cache.line;
+
+		memcpy(p, g_httpDateHeaderName.data(), g_httpDateHeaderName.size());
+		formatHttpDate(p + g_httpDateHeaderName.size(), now);
+		memcpy(p + g_httpDateHeaderName.size() + HTTP_DATE_SIZE, "\r\n", 2);
+
+		cache.second = now;
+	}
+
+	return std::string_view(cache.line, sizeof(cache.line));
+}
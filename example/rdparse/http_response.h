@@ -0,0 +1,123 @@
+#ifndef _HTTP_RESPONSE_H_
+#define _HTTP_RESPONSE_H_
+
+#include <netknot/basedefs.h>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+
+namespace http {
+	enum class HttpResponseStatus : uint16_t {
+		Continue = 100,
+		SwitchingProtocols = 101,
+		Processing = 102,
+		EarlyHints = 103,
+
+		OK = 200,
+		Created = 201,
+		Accepted = 202,
+		NonAuthoritativeInformation = 203,
+		NoContent = 204,
+		ResetContent = 205,
+		PartialContent = 206,
+		MultiStatus = 207,
+		AlreadyReported = 208,
+		IMUsed = 226,
+
+		MultipleChoice = 300,
+		MovedPermanently = 301,
+		Found = 302,
+		SeeOther = 303,
+		NotModified = 304,
+		UseProxy = 305,
+		TemporaryRedirect = 307,
+		PermanentRedirect = 308,
+
+		BadRequest = 400,
+		Unauthorized = 401,
+		PaymentRequired = 402,
+		Forbidden = 403,
+		NotFound = 404,
+		MethodNotAllowed = 405,
+		NotAcceptable = 406,
+		ProxyAuthenticationRequired = 407,
+		RequestTimeout = 408,
+		Conflict = 409,
+		Gone = 410,
+		LengthRequired = 411,
+		PreconditionFailed = 412,
+		PayloadTooLarge = 413,
+		URITooLong = 414,
+		UnsupportedMediaType = 415,
+		RangeNotSatisfiable = 416,
+		ExpectationFailed = 417,
+		ImATeapot = 418,
+		MisdirectedRequest = 421,
+		UnprocessableEntity = 422,
+		Locked = 423,
+		FailedDependency = 424,
+		TooEarly = 425,
+		UpgradeRequired = 426,
+		PreconditionRequired = 428,
+		TooManyRequests = 429,
+		RequestHeaderFieldsTooLarge = 431,
+		UnavailableForLegalReasons = 451,
+
+		InternalServerError = 500,
+		NotImplemented = 501,
+		BadGateway = 502,
+		ServiceUnavailable = 503,
+		GatewayTimeout = 504,
+		HTTPVersionNotSupported = 505,
+		VariantAlsoNegotiates = 506,
+		InsufficientStorage = 507,
+		LoopDetected = 508,
+		NotExtended = 510,
+		NetworkAuthenticationRequired = 511
+	};
+
+	/// @brief Get the pre-rendered status line of a status, such as "HTTP/1.1 200 OK\r\n".
+	/// An unknown status is a misuse.
+	std::string_view getHttpStatusLine(HttpResponseStatus status) noexcept;
+
+	/// @brief Maximum number of the characters formatted by formatHttpDecimal().
+	constexpr size_t HTTP_DECIMAL_MAX_SIZE = 20;
+
+	/// @brief Format an integer in decimal, two digits at a time.
+	///
+	/// @param buffer Buffer to store the digits, which must hold HTTP_DECIMAL_MAX_SIZE characters.
+	/// @param value Value to be formatted.
+	/// @return Number of the characters stored.
+	size_t formatHttpDecimal(char *buffer, uint64_t value) noexcept;
+
+	/// @brief Maximum number of the characters formatted by formatHttpHex().
+	constexpr size_t HTTP_HEX_MAX_SIZE = 16;
+
+	/// @brief Format an integer in lowercase hexadecimal, such as a chunk size.
+	///
+	/// @param buffer Buffer to store the digits, which must hold HTTP_HEX_MAX_SIZE characters.
+	/// @param value Value to be formatted.
+	/// @return Number of the characters stored.
+	size_t formatHttpHex(char *buffer, uint64_t value) noexcept;
+
+	/// @brief Size of a date formatted by formatHttpDate().
+	constexpr size_t HTTP_DATE_SIZE = 29;
+
+	/// @brief Format a time as an IMF-fixdate, such as "Sun, 06 Nov 1994 08:49:37 GMT".
+	///
+	/// @param buffer Buffer to store the date, which must hold HTTP_DATE_SIZE characters.
+	/// @param time Time to be formatted.
+	void formatHttpDate(char *buffer, time_t time) noexcept;
+	/// @brief Parse an IMF-fixdate, the obsolete formats are not accepted.
+	///
+	/// @param date Date to be parsed.
+	/// @param timeOut Where to store the parsed time.
+	/// @return Whether the date is well-formed.
+	bool parseHttpDate(std::string_view date, time_t &timeOut) noexcept;
+
+	/// @brief Get the Date header line of the responses, such as "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n".
+	/// Each thread keeps its own copy, which is regenerated at most once a second.
+	std::string_view getHttpDateHeader() noexcept;
+}
+
+#endif
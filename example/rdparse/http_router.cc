@@ -0,0 +1,344 @@
+#include "http_router.h"
+#include "server.h"
+#include <peff/advutils/unique_ptr.h>
+#include <algorithm>
+
+using namespace http;
+
+bool HttpRouteParams::find(std::string_view name, std::string_view &valueOut) const noexcept {
+	for (size_t i = 0; i < nParams; ++i) {
+		if (params[i].name == name) {
+			valueOut = params[i].value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+HttpRouteTable::HttpRouteTable(peff::Alloc *selfAllocator) : _selfAllocator(selfAllocator), _strings(selfAllocator), _nodes(selfAllocator), _methods(selfAllocator) {
+}
+
+HttpRouteTable::~HttpRouteTable() {
+	if (_retiredHandler)
+		_retiredHandler->dealloc();
+}
+
+void HttpRouteTable::dealloc() noexcept {
+	peff::destroyAndRelease<HttpRouteTable>(_selfAllocator.get(), this, alignof(HttpRouteTable));
+}
+
+size_t HttpRouteTable::incRef(size_t globalRc) noexcept {
+	return ++_refCount;
+}
+
+size_t HttpRouteTable::decRef(size_t globalRc) noexcept {
+	if (!--_refCount) {
+		// The newer tables which are only kept by their predecessors are released in turn rather than recursively.
+		HttpRouteTable *table = this;
+
+		do {
+			HttpRouteTable *nextTable = table->_nextTable;
+
+			table->dealloc();
+			table = nextTable;
+		} while (table && (!--table->_refCount));
+
+		return 0;
+	}
+
+	return _refCount;
+}
+
+void HttpRouteTable::retire(HttpRouteTable *nextTable, HttpRequestHandler *retiredHandler) noexcept {
+	nextTable->incRef(0);
+	_nextTable = nextTable;
+	_retiredHandler = retiredHandler;
+}
+
+static NETKNOT_FORCEINLINE bool isRouteParamNameChar(char c) noexcept {
+	return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '_');
+}
+
+bool HttpRouteTable::isPatternValid(std::string_view pattern) noexcept {
+	if ((!pattern.size()) || (pattern[0] != '/'))
+		return false;
+
+	size_t nParams = 0;
+
+	for (size_t i = 0; i < pattern.size(); ++i) {
+		switch (pattern[i]) {
+			case '{': {
+				// A parameter takes a whole segment.
+				if (pattern[i - 1] != '/')
+					return false;
+
+				bool isWildcard = false;
+				if ((i + 1 < pattern.size()) && (pattern[i + 1] == '*')) {
+					isWildcard = true;
+					++i;
+				}
+
+				size_t offName = i + 1;
+				while ((++i < pattern.size()) && isRouteParamNameChar(pattern[i]))
+					;
+				if ((i == offName) || (i == pattern.size()) || (pattern[i] != '}'))
+					return false;
+
+				if (++nParams > HttpRouteParams::MAX_PARAMS)
+					return false;
+
+				if (i + 1 < pattern.size()) {
+					// The wildcard takes the rest of the path.
+					if (isWildcard || (pattern[i + 1] != '/'))
+						return false;
+				}
+				break;
+			}
+			case '}':
+				return false;
+			default:
+				break;
+		}
+	}
+
+	return true;
+}
+
+netknot::ExceptionPointer HttpRouteTable::alloc(peff::Alloc *allocator, const HttpRoute *routes, size_t nRoutes, HttpRouteTable *&tableOut) noexcept {
+	peff::UniquePtr<HttpRouteTable, peff::DeallocableDeleter<HttpRouteTable>> table(peff::allocAndConstruct<HttpRouteTable>(allocator, alignof(HttpRouteTable), allocator));
+
+	if (!table)
+		return netknot::OutOfMemoryError::alloc();
+
+	for (size_t i = 0; i < nRoutes; ++i) {
+		if (!isPatternValid(routes[i].pattern))
+			return netknot::InvalidArgsError::alloc();
+
+		if (!table->_strings.append(routes[i].pattern))
+			return netknot::OutOfMemoryError::alloc();
+		if (!table->_strings.append(routes[i].method))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	// The copies are referred to after all of them are made, as the storage may move while growing.
+	peff::DynArray<HttpRoute> sortedRoutes(allocator);
+
+	if (!sortedRoutes.resizeUninitialized(nRoutes))
+		return netknot::OutOfMemoryError::alloc();
+
+	for (size_t i = 0, offString = 0; i < nRoutes; ++i) {
+		HttpRoute &route = sortedRoutes.at(i);
+
+		route.pattern = std::string_view(table->_strings.data() + offString, routes[i].pattern.size());
+		offString += route.pattern.size();
+		route.method = std::string_view(table->_strings.data() + offString, routes[i].method.size());
+		offString += route.method.size();
+		route.handler = routes[i].handler;
+	}
+
+	// The routes sharing a prefix are adjacent after sorting, so each node is built from a range of them.
+	std::sort(sortedRoutes.data(), sortedRoutes.data() + nRoutes, [](const HttpRoute &lhs, const HttpRoute &rhs) noexcept {
+		if (lhs.pattern != rhs.pattern)
+			return lhs.pattern < rhs.pattern;
+		return lhs.method < rhs.method;
+	});
+
+	for (size_t i = 1; i < nRoutes; ++i) {
+		if ((sortedRoutes.at(i).pattern == sortedRoutes.at(i - 1).pattern) && (sortedRoutes.at(i).method == sortedRoutes.at(i - 1).method))
+			return netknot::InvalidArgsError::alloc();
+	}
+
+	// The root consumes nothing, all of the patterns are under its "/" child.
+	if (!table->_nodes.pushBack(Node()))
+		return netknot::OutOfMemoryError::alloc();
+
+	NETKNOT_RETURN_IF_EXCEPT(table->_buildNode(0, sortedRoutes.data(), 0, nRoutes, 0));
+
+	tableOut = table.release();
+
+	return {};
+}
+
+netknot::ExceptionPointer HttpRouteTable::_buildNode(uint32_t nodeIndex, const HttpRoute *routes, size_t begin, size_t end, size_t offset) noexcept {
+	size_t i = begin;
+
+	// The routes ending at the node are sorted first, they differ in the methods only.
+	_nodes.at(nodeIndex).firstMethod = (uint32_t)_methods.size();
+	for (; (i < end) && (routes[i].pattern.size() == offset); ++i) {
+		if (!_methods.pushBack({ routes[i].method, routes[i].handler }))
+			return netknot::OutOfMemoryError::alloc();
+	}
+	_nodes.at(nodeIndex).nMethods = (uint32_t)_methods.size() - _nodes.at(nodeIndex).firstMethod;
+
+	auto getGroupEnd = [routes, end, offset](size_t groupBegin) noexcept {
+		const char c = routes[groupBegin].pattern[offset];
+		size_t groupEnd = groupBegin + 1;
+
+		while ((groupEnd < end) && (routes[groupEnd].pattern[offset] == c))
+			++groupEnd;
+
+		return groupEnd;
+	};
+
+	// The static children are laid out contiguously before any of them is built.
+	uint32_t nStaticChildren = 0;
+	for (size_t j = i; j < end; j = getGroupEnd(j)) {
+		if (routes[j].pattern[offset] != '{')
+			++nStaticChildren;
+	}
+
+	_nodes.at(nodeIndex).firstChild = (uint32_t)_nodes.size();
+	_nodes.at(nodeIndex).nChildren = nStaticChildren;
+	for (uint32_t j = 0; j < nStaticChildren; ++j) {
+		if (!_nodes.pushBack(Node()))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	uint32_t childIndex = _nodes.at(nodeIndex).firstChild;
+
+	for (size_t j = i, k; j < end; j = k) {
+		k = getGroupEnd(j);
+
+		const std::string_view firstPattern = routes[j].pattern, lastPattern = routes[k - 1].pattern;
+
+		if (firstPattern[offset] != '{') {
+			// The common prefix of the first and the last routes is common to the whole range.
+			size_t szText = 0;
+			while ((offset + szText < firstPattern.size()) &&
+				   (offset + szText < lastPattern.size()) &&
+				   (firstPattern[offset + szText] == lastPattern[offset + szText]) &&
+				   (firstPattern[offset + szText] != '{'))
+				++szText;
+
+			_nodes.at(childIndex).text = firstPattern.substr(offset, szText);
+			NETKNOT_RETURN_IF_EXCEPT(_buildNode(childIndex, routes, j, k, offset + szText));
+			++childIndex;
+			continue;
+		}
+
+		// The wildcards are sorted before the parameters, as '*' is before the name characters.
+		size_t m = j;
+		while ((m < k) && (routes[m].pattern[offset + 1] == '*'))
+			++m;
+
+		if (m > j) {
+			// Different names cannot be told apart at the same place.
+			if (routes[j].pattern.substr(offset) != routes[m - 1].pattern.substr(offset))
+				return netknot::InvalidArgsError::alloc();
+
+			Node node;
+			node.kind = NodeKind::Wildcard;
+			node.text = firstPattern.substr(offset + 2, firstPattern.size() - offset - 3);
+
+			uint32_t wildcardIndex = (uint32_t)_nodes.size();
+			if (!_nodes.pushBack(std::move(node)))
+				return netknot::OutOfMemoryError::alloc();
+			_nodes.at(nodeIndex).wildcardChild = wildcardIndex;
+
+			NETKNOT_RETURN_IF_EXCEPT(_buildNode(wildcardIndex, routes, j, m, firstPattern.size()));
+		}
+
+		if (k > m) {
+			const std::string_view paramPattern = routes[m].pattern;
+			const size_t szParam = paramPattern.find('}', offset) + 1 - offset;
+
+			// Different names cannot be told apart at the same place.
+			if (paramPattern.substr(offset, szParam) != lastPattern.substr(offset, szParam))
+				return netknot::InvalidArgsError::alloc();
+
+			Node node;
+			node.kind = NodeKind::Param;
+			node.text = paramPattern.substr(offset + 1, szParam - 2);
+
+			uint32_t paramIndex = (uint32_t)_nodes.size();
+			if (!_nodes.pushBack(std::move(node)))
+				return netknot::OutOfMemoryError::alloc();
+			_nodes.at(nodeIndex).paramChild = paramIndex;
+
+			NETKNOT_RETURN_IF_EXCEPT(_buildNode(paramIndex, routes, m, k, offset + szParam));
+		}
+	}
+
+	return {};
+}
+
+bool HttpRouteTable::_matchNode(uint32_t nodeIndex, std::string_view path, size_t offset, std::string_view method, HttpRequestHandler *&handlerOut, HttpRouteParams &paramsOut, bool &isMethodMismatchedOut) const noexcept {
+	const Node &node = _nodes.at(nodeIndex);
+
+	if (offset == path.size()) {
+		for (uint32_t i = 0; i < node.nMethods; ++i) {
+			const MethodEntry &entry = _methods.at(node.firstMethod + i);
+
+			if (entry.method == method) {
+				handlerOut = entry.handler;
+				return true;
+			}
+		}
+
+		if (node.nMethods)
+			isMethodMismatchedOut = true;
+	} else {
+		const char c = path[offset];
+
+		for (uint32_t i = 0; i < node.nChildren; ++i) {
+			const Node &child = _nodes.at(node.firstChild + i);
+
+			if (child.text[0] != c)
+				continue;
+
+			if ((path.substr(offset, child.text.size()) == child.text) &&
+				_matchNode(node.firstChild + i, path, offset + child.text.size(), method, handlerOut, paramsOut, isMethodMismatchedOut))
+				return true;
+			break;
+		}
+
+		// Fall back to the parameter if the static text does not lead to a route.
+		if (node.paramChild != NO_NODE) {
+			size_t offSegmentEnd = path.find('/', offset);
+			if (offSegmentEnd == std::string_view::npos)
+				offSegmentEnd = path.size();
+
+			if (offSegmentEnd > offset) {
+				const size_t nParams = paramsOut.nParams;
+
+				paramsOut.params[paramsOut.nParams++] = { _nodes.at(node.paramChild).text, path.substr(offset, offSegmentEnd - offset) };
+
+				if (_matchNode(node.paramChild, path, offSegmentEnd, method, handlerOut, paramsOut, isMethodMismatchedOut))
+					return true;
+
+				paramsOut.nParams = nParams;
+			}
+		}
+	}
+
+	if (node.wildcardChild != NO_NODE) {
+		const Node &wildcard = _nodes.at(node.wildcardChild);
+
+		for (uint32_t i = 0; i < wildcard.nMethods; ++i) {
+			const MethodEntry &entry = _methods.at(wildcard.firstMethod + i);
+
+			if (entry.method == method) {
+				paramsOut.params[paramsOut.nParams++] = { wildcard.text, path.substr(offset) };
+				handlerOut = entry.handler;
+				return true;
+			}
+		}
+
+		if (wildcard.nMethods)
+			isMethodMismatchedOut = true;
+	}
+
+	return false;
+}
+
+HttpRouteResult HttpRouteTable::match(std::string_view path, std::string_view method, HttpRequestHandler *&handlerOut, HttpRouteParams &paramsOut) const noexcept {
+	bool isMethodMismatched = false;
+
+	paramsOut.nParams = 0;
+
+	if (_matchNode(0, path, 0, method, handlerOut, paramsOut, isMethodMismatched))
+		return HttpRouteResult::Found;
+
+	return isMethodMismatched ? HttpRouteResult::MethodNotAllowed : HttpRouteResult::NotFound;
+}
@@ -0,0 +1,135 @@
+#ifndef _HTTP_ROUTER_H_
+#define _HTTP_ROUTER_H_
+
+#include <netknot/except.h>
+#include <peff/base/alloc.h>
+#include <peff/containers/dynarray.h>
+#include <peff/containers/string.h>
+#include <string_view>
+
+namespace http {
+	class HttpRequestHandler;
+
+	struct HttpRouteParam {
+		std::string_view name;
+		std::string_view value;
+	};
+
+	/// @brief Parameters captured from a path, stored inline so that matching never allocates.
+	/// The names refer to the route table and the values refer to the path.
+	struct HttpRouteParams {
+		constexpr static size_t MAX_PARAMS = 8;
+
+		HttpRouteParam params[MAX_PARAMS];
+		size_t nParams = 0;
+
+		/// @brief Find a parameter by its name.
+		///
+		/// @param name Name of the parameter.
+		/// @param valueOut Where to store the captured value.
+		/// @return Whether the parameter is found.
+		bool find(std::string_view name, std::string_view &valueOut) const noexcept;
+	};
+
+	enum class HttpRouteResult : uint8_t {
+		Found = 0,
+		NotFound,
+		/// @brief The path matches a route but no handler is registered for the method.
+		MethodNotAllowed
+	};
+
+	/// @brief Route to be put into a route table.
+	///
+	/// A pattern consists of static text, parameters and a wildcard:
+	///   - `{name}` matches a non-empty segment, it must take a whole segment;
+	///   - `{*name}` matches the rest of the path including the slashes, it must be the last segment.
+	/// The parameters at the same place of different patterns must have the same name.
+	struct HttpRoute {
+		std::string_view pattern;
+		std::string_view method;
+		HttpRequestHandler *handler;
+	};
+
+	/// @brief Immutable snapshot of the routes in a compressed radix tree, with the handlers of each method stored in the nodes.
+	/// The snapshot is shared by the workers and replaced as a whole when the routes change.
+	class HttpRouteTable {
+	public:
+		constexpr static uint32_t NO_NODE = UINT32_MAX;
+
+		enum class NodeKind : uint8_t {
+			Static = 0,
+			Param,
+			Wildcard
+		};
+
+		struct Node {
+			/// @brief Static text of a static node, or name of a parameter or wildcard node.
+			std::string_view text;
+			NodeKind kind = NodeKind::Static;
+			/// @brief The static children are contiguous, none of them start with the same character.
+			uint32_t firstChild = 0, nChildren = 0;
+			uint32_t paramChild = NO_NODE, wildcardChild = NO_NODE;
+			uint32_t firstMethod = 0, nMethods = 0;
+		};
+
+		struct MethodEntry {
+			std::string_view method;
+			HttpRequestHandler *handler;
+		};
+
+	private:
+		peff::RcObjectPtr<peff::Alloc> _selfAllocator;
+		netknot::MaybeAtomic<size_t> _refCount = 0;
+		/// @brief Copies of the patterns and method names which the nodes refer to.
+		peff::String _strings;
+		peff::DynArray<Node> _nodes;
+		peff::DynArray<MethodEntry> _methods;
+		/// @brief Table published after this one, to which this one holds a reference,
+		/// so the handler retired with a table outlives every older table which may still refer to it.
+		HttpRouteTable *_nextTable = nullptr;
+		/// @brief Handler which the next table has replaced, released along with this table.
+		HttpRequestHandler *_retiredHandler = nullptr;
+
+		[[nodiscard]] netknot::ExceptionPointer _buildNode(uint32_t nodeIndex, const HttpRoute *routes, size_t begin, size_t end, size_t offset) noexcept;
+		bool _matchNode(uint32_t nodeIndex, std::string_view path, size_t offset, std::string_view method, HttpRequestHandler *&handlerOut, HttpRouteParams &paramsOut, bool &isMethodMismatchedOut) const noexcept;
+
+	public:
+		HttpRouteTable(peff::Alloc *selfAllocator);
+		~HttpRouteTable();
+
+		/// @brief Build a route table, the patterns and methods are copied.
+		/// A malformed pattern, a duplicated route, or parameters of different names at the same place are rejected with netknot::InvalidArgsError.
+		///
+		/// @param allocator Allocator of the table.
+		/// @param routes Routes to be put into the table.
+		/// @param nRoutes Number of the routes.
+		/// @param tableOut Where to receive the table without any reference.
+		/// @return The exception occurred.
+		[[nodiscard]] static netknot::ExceptionPointer alloc(peff::Alloc *allocator, const HttpRoute *routes, size_t nRoutes, HttpRouteTable *&tableOut) noexcept;
+		void dealloc() noexcept;
+
+		size_t incRef(size_t globalRc) noexcept;
+		size_t decRef(size_t globalRc) noexcept;
+
+		/// @brief Link the table published after this one, which is released after this table.
+		///
+		/// @param nextTable Table published after this one.
+		/// @param retiredHandler Handler which is in this table but not in the next one, or nullptr.
+		/// The table takes the ownership of it and releases it once neither this table nor an older one is in use.
+		void retire(HttpRouteTable *nextTable, HttpRequestHandler *retiredHandler) noexcept;
+
+		/// @brief Check if a pattern is well-formed.
+		static bool isPatternValid(std::string_view pattern) noexcept;
+
+		/// @brief Match a path against the routes, the static text takes precedence over the parameters and the parameters over the wildcards.
+		///
+		/// @param path Path to be matched.
+		/// @param method Method of the request.
+		/// @param handlerOut Where to store the handler of the matched route.
+		/// @param paramsOut Where to store the captured parameters.
+		/// @return The match result.
+		HttpRouteResult match(std::string_view path, std::string_view method, HttpRequestHandler *&handlerOut, HttpRouteParams &paramsOut) const noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include "http_scan.h"
+#include <exception>
+
+#ifdef HTTP_SCAN_X86
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#include <immintrin.h>
+
+		// MSVC allows the intrinsics of any instruction set without enabling it for the whole file.
+		#define HTTP_SCAN_TARGET(isa)
+	#else
+		#include <immintrin.h>
+
+		#define HTTP_SCAN_TARGET(isa) __attribute__((target(isa)))
+	#endif
+#endif
+
+using namespace http;
+
+enum : uint8_t {
+	BYTE_CLASS_TOKEN = 0x01,
+	BYTE_CLASS_VISIBLE = 0x02,
+	BYTE_CLASS_FIELD_VALUE = 0x04
+};
+
+static constexpr bool _isTokenChar(unsigned char c) noexcept {
+	if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+		return true;
+
+	for (const char *i = "!#$%&'*+-.^_`|~"; *i; ++i) {
+		if (c == (unsigned char)*i)
+			return true;
+	}
+
+	return false;
+}
+
+static constexpr bool _isVisibleChar(unsigned char c) noexcept {
+	return (c > 0x20) && (c != 0x7f);
+}
+
+static constexpr bool _isFieldValueChar(unsigned char c) noexcept {
+	return _isVisibleChar(c) || (c == ' ') || (c == '\t');
+}
+
+struct ByteClassTable {
+	uint8_t classes[256];
+
+	constexpr ByteClassTable() noexcept : classes() {
+		for (unsigned i = 0; i < 256; ++i) {
+			classes[i] = (_isTokenChar(i) ? BYTE_CLASS_TOKEN : 0) |
+						 (_isVisibleChar(i) ? BYTE_CLASS_VISIBLE : 0) |
+						 (_isFieldValueChar(i) ? BYTE_CLASS_FIELD_VALUE : 0);
+		}
+	}
+};
+
+static constexpr ByteClassTable g_byteClassTable;
+
+template <uint8_t byteClass>
+static const char *_skipScalar(const char *p, const char *end) noexcept {
+	const uint8_t *const classes = g_byteClassTable.classes;
+
+	while (end - p >= 8) {
+		for (size_t i = 0; i < 8; ++i) {
+			if (!(classes[(uint8_t)p[i]] & byteClass))
+				return p + i;
+		}
+		p += 8;
+	}
+
+	while ((p < end) && (classes[(uint8_t)*p] & byteClass))
+		++p;
+
+	return p;
+}
+
+#ifdef HTTP_SCAN_X86
+
+/// @brief Bitmaps for classifying bytes by their nibbles with PSHUFB.
+/// A byte is in the class if lo[low nibble] & hi[high nibble] is non-zero, bytes above 0x7f are never in the class.
+struct NibbleTable {
+	alignas(16) uint8_t lo[16];
+	alignas(16) uint8_t hi[16];
+
+	constexpr NibbleTable(uint8_t byteClass) noexcept : lo(), hi() {
+		for (unsigned i = 0; i < 0x80; ++i) {
+			if (g_byteClassTable.classes[i] & byteClass)
+				lo[i & 0x0f] |= (uint8_t)(1 << (i >> 4));
+		}
+		for (unsigned i = 0; i < 8; ++i)
+			hi[i] = (uint8_t)(1 << i);
+	}
+};
+
+static constexpr NibbleTable g_tokenNibbleTable(BYTE_CLASS_TOKEN);
+
+// Byte ranges rejected by the classes, in the format of the range mode of PCMPESTRI.
+alignas(16) static const char g_visibleRejectRanges[16] = "\x00\x20\x7f\x7f";
+constexpr static int VISIBLE_REJECT_RANGES_SIZE = 4;
+alignas(16) static const char g_fieldValueRejectRanges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+constexpr static int FIELD_VALUE_REJECT_RANGES_SIZE = 6;
+
+static inline unsigned _countTrailingZeros(uint32_t x) noexcept {
+	#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return (unsigned)index;
+	#else
+	return (unsigned)__builtin_ctz(x);
+	#endif
+}
+
+HTTP_SCAN_TARGET("sse4.2")
+static const char *_skipTokenSSE42(const char *p, const char *end) noexcept {
+	const __m128i lo = _mm_load_si128((const __m128i *)g_tokenNibbleTable.lo);
+	const __m128i hi = _mm_load_si128((const __m128i *)g_tokenNibbleTable.hi);
+	const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i bits = _mm_and_si128(
+			_mm_shuffle_epi8(lo, _mm_and_si128(v, nibbleMask)),
+			_mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask)));
+
+		if (uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())); mask)
+			return p + _countTrailingZeros(mask);
+
+		p += 16;
+	}
+
+	return _skipScalar<BYTE_CLASS_TOKEN>(p, end);
+}
+
+HTTP_SCAN_TARGET("sse4.2")
+static const char *_skipVisibleSSE42(const char *p, const char *end) noexcept {
+	const __m128i ranges = _mm_load_si128((const __m128i *)g_visibleRejectRanges);
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		int index = _mm_cmpestri(ranges, VISIBLE_REJECT_RANGES_SIZE, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+		if (index != 16)
+			return p + index;
+
+		p += 16;
+	}
+
+	return _skipScalar<BYTE_CLASS_VISIBLE>(p, end);
+}
+
+HTTP_SCAN_TARGET("sse4.2")
+static const char *_skipFieldValueSSE42(const char *p, const char *end) noexcept {
+	const __m128i ranges = _mm_load_si128((const __m128i *)g_fieldValueRejectRanges);
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		int index = _mm_cmpestri(ranges, FIELD_VALUE_REJECT_RANGES_SIZE, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+		if (index != 16)
+			return p + index;
+
+		p += 16;
+	}
+
+	return _skipScalar<BYTE_CLASS_FIELD_VALUE>(p, end);
+}
+
+HTTP_SCAN_TARGET("avx2")
+static const char *_skipTokenAVX2(const char *p, const char *end) noexcept {
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)g_tokenNibbleTable.lo));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)g_tokenNibbleTable.hi));
+	const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i bits = _mm256_and_si256(
+			_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibbleMask)),
+			_mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibbleMask)));
+
+		if (uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, _mm256_setzero_si256())); mask)
+			return p + _countTrailingZeros(mask);
+
+		p += 32;
+	}
+
+	return _skipScalar<BYTE_CLASS_TOKEN>(p, end);
+}
+
+HTTP_SCAN_TARGET("avx2")
+static const char *_skipVisibleAVX2(const char *p, const char *end) noexcept {
+	const __m256i space = _mm256_set1_epi8(0x20);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		// v <= 0x20 as unsigned bytes, or v == 0x7f.
+		__m256i rejected = _mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v),
+			_mm256_cmpeq_epi8(v, del));
+
+		if (uint32_t mask = (uint32_t)_mm256_movemask_epi8(rejected); mask)
+			return p + _countTrailingZeros(mask);
+
+		p += 32;
+	}
+
+	return _skipScalar<BYTE_CLASS_VISIBLE>(p, end);
+}
+
+HTTP_SCAN_TARGET("avx2")
+static const char *_skipFieldValueAVX2(const char *p, const char *end) noexcept {
+	const __m256i lastControl = _mm256_set1_epi8(0x1f);
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		// Control characters except HTAB, or DEL.
+		__m256i rejected = _mm256_or_si256(
+			_mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(_mm256_min_epu8(v, lastControl), v)),
+			_mm256_cmpeq_epi8(v, del));
+
+		if (uint32_t mask = (uint32_t)_mm256_movemask_epi8(rejected); mask)
+			return p + _countTrailingZeros(mask);
+
+		p += 32;
+	}
+
+	return _skipScalar<BYTE_CLASS_FIELD_VALUE>(p, end);
+}
+
+#endif
+
+static const HttpScanner g_httpScanners[] = {
+	{ HttpScanLevel::Scalar, _skipScalar<BYTE_CLASS_TOKEN>, _skipScalar<BYTE_CLASS_VISIBLE>, _skipScalar<BYTE_CLASS_FIELD_VALUE> },
+#ifdef HTTP_SCAN_X86
+	{ HttpScanLevel::SSE42, _skipTokenSSE42, _skipVisibleSSE42, _skipFieldValueSSE42 },
+	{ HttpScanLevel::AVX2, _skipTokenAVX2, _skipVisibleAVX2, _skipFieldValueAVX2 },
+#endif
+};
+
+HttpScanLevel http::getSupportedHttpScanLevel() noexcept {
+#ifdef HTTP_SCAN_X86
+	#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool hasSSE42 = info[2] & (1 << 20);
+	bool hasOSXSave = info[2] & (1 << 27);
+	bool hasAVX = info[2] & (1 << 28);
+
+	// AVX2 also requires the OS to save the YMM registers.
+	if (hasSSE42 && hasOSXSave && hasAVX && (maxLeaf >= 7) && ((_xgetbv(0) & 0x06) == 0x06)) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			return HttpScanLevel::AVX2;
+	}
+
+	if (hasSSE42)
+		return HttpScanLevel::SSE42;
+	#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return HttpScanLevel::AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return HttpScanLevel::SSE42;
+	#endif
+#endif
+
+	return HttpScanLevel::Scalar;
+}
+
+const HttpScanner &http::getHttpScanner() noexcept {
+	static const HttpScanner &scanner = getHttpScanner(getSupportedHttpScanLevel());
+
+	return scanner;
+}
+
+const HttpScanner &http::getHttpScanner(HttpScanLevel level) noexcept {
+	if ((size_t)level >= sizeof(g_httpScanners) / sizeof(*g_httpScanners))
+		std::terminate();
+
+	return g_httpScanners[(size_t)level];
+}
+
+const char *http::getHttpScanLevelName(HttpScanLevel level) noexcept {
+	switch (level) {
+		case HttpScanLevel::Scalar:
+			return "scalar";
+		case HttpScanLevel::SSE42:
+			return "sse4.2";
+		case HttpScanLevel::AVX2:
+			return "avx2";
+		default:
+			std::terminate();
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef _HTTP_SCAN_H_
+#define _HTTP_SCAN_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define HTTP_SCAN_X86 1
+#endif
+
+namespace http {
+	enum class HttpScanLevel : uint8_t {
+		Scalar = 0,
+		SSE42,
+		AVX2
+	};
+
+	/// @brief Set of the byte classifiers used by the HTTP parser.
+	/// Every classifier returns the first byte in [p, end) which is not in its class, or end if there is no such byte.
+	struct HttpScanner {
+		HttpScanLevel level;
+
+		/// @brief Skip the token characters (RFC 9110 tchar), used for methods and header names.
+		const char *(*skipToken)(const char *p, const char *end) noexcept;
+		/// @brief Skip the visible characters and obs-text, used for request targets and versions.
+		const char *(*skipVisible)(const char *p, const char *end) noexcept;
+		/// @brief Skip the header value characters, which are the visible characters, obs-text, SP and HTAB.
+		/// The scan stops at CR and LF.
+		const char *(*skipFieldValue)(const char *p, const char *end) noexcept;
+	};
+
+	/// @brief Get the highest scan level supported by the current CPU.
+	HttpScanLevel getSupportedHttpScanLevel() noexcept;
+
+	/// @brief Get the scanner for the current CPU, which is detected on the first call.
+	const HttpScanner &getHttpScanner() noexcept;
+
+	/// @brief Get the scanner of a specified level.
+	///
+	/// @param level Level of the scanner, must not be higher than the supported level.
+	const HttpScanner &getHttpScanner(HttpScanLevel level) noexcept;
+
+	const char *getHttpScanLevelName(HttpScanLevel level) noexcept;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "http_slab.h"
+#include <new>
+
+using namespace http;
+
+static NETKNOT_FORCEINLINE size_t alignUp(size_t size, size_t alignment) noexcept {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+HttpSlab::HttpSlab(peff::Alloc *allocator, size_t szObject, size_t alignment, size_t nSlotsPerBlock) noexcept
+	: _allocator(allocator),
+	  _alignment(alignment < alignof(Block *) ? alignof(Block *) : alignment),
+	  _nSlotsPerBlock(nSlotsPerBlock) {
+	// Every object is preceded by the pointer to its block, and the free list is kept in the objects.
+	_offObject = alignUp(sizeof(Block *), _alignment);
+	_szSlot = _offObject + alignUp(szObject < sizeof(FreeSlot) ? sizeof(FreeSlot) : szObject, _alignment);
+	_offSlots = alignUp(sizeof(Block), _alignment);
+}
+
+HttpSlab::~HttpSlab() {
+	// Every object must have been released.
+	if (_partialBlocks)
+		std::terminate();
+
+	if (_spareBlock)
+		_releaseBlock(_spareBlock);
+}
+
+void HttpSlab::_linkPartialBlock(Block *block) noexcept {
+	block->prev = nullptr;
+	block->next = _partialBlocks;
+
+	if (_partialBlocks)
+		_partialBlocks->prev = block;
+
+	_partialBlocks = block;
+}
+
+void HttpSlab::_unlinkPartialBlock(Block *block) noexcept {
+	if (block->prev)
+		block->prev->next = block->next;
+	else
+		_partialBlocks = block->next;
+
+	if (block->next)
+		block->next->prev = block->prev;
+
+	block->prev = nullptr;
+	block->next = nullptr;
+}
+
+void HttpSlab::_releaseBlock(Block *block) noexcept {
+	block->~Block();
+	_allocator->release(block, _getBlockSize(), _alignment);
+}
+
+void *HttpSlab::alloc() noexcept {
+	Block *block = _partialBlocks;
+
+	if (!block) {
+		if (_spareBlock) {
+			block = _spareBlock;
+			_spareBlock = nullptr;
+		} else {
+			void *p = _allocator->alloc(_getBlockSize(), _alignment);
+
+			if (!p)
+				return nullptr;
+
+			block = new (p) Block();
+
+			// The slots are pushed backwards, so they are handed out in the address order.
+			char *slots = (char *)block + _offSlots;
+			for (size_t i = _nSlotsPerBlock; i; --i) {
+				char *slot = slots + (i - 1) * _szSlot;
+				FreeSlot *freeSlot = (FreeSlot *)(slot + _offObject);
+
+				*(Block **)slot = block;
+				freeSlot->next = block->freeSlots;
+				block->freeSlots = freeSlot;
+			}
+		}
+
+		_linkPartialBlock(block);
+	}
+
+	FreeSlot *freeSlot = block->freeSlots;
+
+	block->freeSlots = freeSlot->next;
+	++block->nUsedSlots;
+
+	if (!block->freeSlots)
+		_unlinkPartialBlock(block);
+
+	return freeSlot;
+}
+
+void HttpSlab::release(void *p) noexcept {
+	Block *block = *(Block **)((char *)p - _offObject);
+	FreeSlot *freeSlot = (FreeSlot *)p;
+
+	// A full block has free slots again.
+	if (!block->freeSlots)
+		_linkPartialBlock(block);
+
+	freeSlot->next = block->freeSlots;
+	block->freeSlots = freeSlot;
+
+	if (--block->nUsedSlots)
+		return;
+
+	_unlinkPartialBlock(block);
+
+	if (_spareBlock)
+		_releaseBlock(block);
+	else
+		_spareBlock = block;
+}
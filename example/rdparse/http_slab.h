@@ -0,0 +1,63 @@
+#ifndef _HTTP_SLAB_H_
+#define _HTTP_SLAB_H_
+
+#include <netknot/basedefs.h>
+#include <peff/base/alloc.h>
+
+namespace http {
+	/// @brief Allocator of the objects of one size, which are carved from blocks of slots.
+	/// Allocating and releasing are O(1), and a block is given back once all of its slots are free,
+	/// so the memory follows the number of the live objects.
+	/// The slab is not locked, it is meant to be owned by a single worker.
+	class HttpSlab {
+	private:
+		struct FreeSlot {
+			FreeSlot *next;
+		};
+
+		/// @brief Header of a block, followed by the slots.
+		struct Block {
+			Block *prev = nullptr, *next = nullptr;
+			FreeSlot *freeSlots = nullptr;
+			size_t nUsedSlots = 0;
+		};
+
+		peff::RcObjectPtr<peff::Alloc> _allocator;
+		size_t _alignment;
+		/// @brief Size of a slot, which is the pointer to the owning block followed by the object.
+		size_t _szSlot;
+		/// @brief Offset of the object in a slot.
+		size_t _offObject;
+		/// @brief Offset of the first slot in a block.
+		size_t _offSlots;
+		size_t _nSlotsPerBlock;
+		/// @brief Blocks which have free slots and are in use.
+		Block *_partialBlocks = nullptr;
+		/// @brief A free block kept to avoid allocating again at once when the number of the objects swings around a block boundary.
+		Block *_spareBlock = nullptr;
+
+		NETKNOT_FORCEINLINE size_t _getBlockSize() const noexcept {
+			return _offSlots + _szSlot * _nSlotsPerBlock;
+		}
+
+		void _linkPartialBlock(Block *block) noexcept;
+		void _unlinkPartialBlock(Block *block) noexcept;
+		void _releaseBlock(Block *block) noexcept;
+
+	public:
+		constexpr static size_t DEFAULT_SLOTS_PER_BLOCK = 64;
+
+		HttpSlab(peff::Alloc *allocator, size_t szObject, size_t alignment, size_t nSlotsPerBlock = DEFAULT_SLOTS_PER_BLOCK) noexcept;
+		HttpSlab(const HttpSlab &) = delete;
+		~HttpSlab();
+
+		/// @brief Allocate storage of an object.
+		///
+		/// @return The storage, nullptr if out of memory.
+		void *alloc() noexcept;
+		/// @brief Give back the storage of an object allocated by the slab.
+		void release(void *p) noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,764 @@
+#include "http_static.h"
+#include <cstring>
+
+#ifdef _WIN32
+	#include <Windows.h>
+#else
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+using namespace http;
+
+using std::operator""sv;
+
+namespace {
+	/// @brief Metadata of a file, by which a cached file is told from a replaced or modified one.
+	struct FileInfo {
+		uint64_t size;
+		uint64_t device, inode;
+		int64_t modifiedTimeNs;
+		bool isRegular;
+	};
+}
+
+#ifdef _WIN32
+static NETKNOT_FORCEINLINE void closeFile(netknot::NativeFileHandle handle) noexcept {
+	CloseHandle((HANDLE)handle);
+}
+
+// Open a file by its UTF-8 path, which may still be renamed or deleted meanwhile.
+static netknot::ExceptionPointer openFile(peff::Alloc *allocator, const char *path, DWORD access, netknot::NativeFileHandle &handleOut, bool &isOpenedOut, HttpResponseStatus &errorStatusOut) {
+	isOpenedOut = false;
+
+	peff::DynArray<wchar_t> widePath(allocator);
+
+	const int szWidePath = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, nullptr, 0);
+
+	if (!szWidePath) {
+		errorStatusOut = HttpResponseStatus::NotFound;
+		return {};
+	}
+
+	if (!widePath.resizeUninitialized((size_t)szWidePath))
+		return netknot::OutOfMemoryError::alloc();
+
+	MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, widePath.data(), szWidePath);
+
+	HANDLE handle = CreateFileW(widePath.data(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (handle == INVALID_HANDLE_VALUE) {
+		switch (GetLastError()) {
+			case ERROR_ACCESS_DENIED:
+			case ERROR_SHARING_VIOLATION:
+				errorStatusOut = HttpResponseStatus::Forbidden;
+				return {};
+			case ERROR_FILE_NOT_FOUND:
+			case ERROR_PATH_NOT_FOUND:
+			case ERROR_INVALID_NAME:
+			case ERROR_FILENAME_EXCED_RANGE:
+				errorStatusOut = HttpResponseStatus::NotFound;
+				return {};
+			case ERROR_NOT_ENOUGH_MEMORY:
+			case ERROR_OUTOFMEMORY:
+				return netknot::OutOfMemoryError::alloc();
+			default:
+				errorStatusOut = HttpResponseStatus::InternalServerError;
+				return {};
+		}
+	}
+
+	handleOut = (netknot::NativeFileHandle)handle;
+	isOpenedOut = true;
+	return {};
+}
+
+static bool getFileInfo(netknot::NativeFileHandle handle, FileInfo &infoOut) noexcept {
+	BY_HANDLE_FILE_INFORMATION info;
+
+	if (!GetFileInformationByHandle((HANDLE)handle, &info))
+		return false;
+
+	// The file times count 100 nanoseconds since 1601-01-01.
+	constexpr uint64_t FILE_TIME_UNIX_EPOCH = 116444736000000000ull;
+	const uint64_t modifiedTime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+	infoOut.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	infoOut.device = info.dwVolumeSerialNumber;
+	infoOut.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	infoOut.modifiedTimeNs = ((int64_t)modifiedTime - (int64_t)FILE_TIME_UNIX_EPOCH) * 100;
+	infoOut.isRegular = !(info.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE));
+	return true;
+}
+
+static netknot::ExceptionPointer openFile(peff::Alloc *allocator, const char *path, netknot::NativeFileHandle &handleOut, bool &isOpenedOut, HttpResponseStatus &errorStatusOut) {
+	return openFile(allocator, path, GENERIC_READ, handleOut, isOpenedOut, errorStatusOut);
+}
+
+static bool getPathInfo(peff::Alloc *allocator, const char *path, FileInfo &infoOut) noexcept {
+	netknot::NativeFileHandle handle;
+	bool isOpened;
+	HttpResponseStatus errorStatus;
+
+	// The metadata are readable without the access to the content.
+	if (netknot::ExceptionPointer e = openFile(allocator, path, FILE_READ_ATTRIBUTES, handle, isOpened, errorStatus); e) {
+		// The file is opened again then, which tells the error.
+		e.reset();
+		return false;
+	}
+
+	if (!isOpened)
+		return false;
+
+	const bool result = getFileInfo(handle, infoOut);
+	closeFile(handle);
+	return result;
+}
+#else
+static NETKNOT_FORCEINLINE void closeFile(netknot::NativeFileHandle handle) noexcept {
+	::close(handle);
+}
+
+static NETKNOT_FORCEINLINE void toFileInfo(const struct stat &st, FileInfo &infoOut) noexcept {
+	infoOut.size = (uint64_t)st.st_size;
+	infoOut.device = (uint64_t)st.st_dev;
+	infoOut.inode = (uint64_t)st.st_ino;
+#if defined(__APPLE__)
+	infoOut.modifiedTimeNs = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	infoOut.modifiedTimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	infoOut.isRegular = S_ISREG(st.st_mode);
+}
+
+static netknot::ExceptionPointer openFile(peff::Alloc *allocator, const char *path, netknot::NativeFileHandle &handleOut, bool &isOpenedOut, HttpResponseStatus &errorStatusOut) {
+	isOpenedOut = false;
+
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		switch (errno) {
+			case EACCES:
+			case EPERM:
+				errorStatusOut = HttpResponseStatus::Forbidden;
+				return {};
+			case ENOENT:
+			case ENOTDIR:
+			case ENAMETOOLONG:
+			case ELOOP:
+				errorStatusOut = HttpResponseStatus::NotFound;
+				return {};
+			case ENOMEM:
+				return netknot::OutOfMemoryError::alloc();
+			default:
+				errorStatusOut = HttpResponseStatus::InternalServerError;
+				return {};
+		}
+	}
+
+	handleOut = fd;
+	isOpenedOut = true;
+	return {};
+}
+
+static bool getFileInfo(netknot::NativeFileHandle handle, FileInfo &infoOut) noexcept {
+	struct stat st;
+
+	if (fstat(handle, &st) < 0)
+		return false;
+
+	toFileInfo(st, infoOut);
+	return true;
+}
+
+static bool getPathInfo(peff::Alloc *allocator, const char *path, FileInfo &infoOut) noexcept {
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return false;
+
+	toFileInfo(st, infoOut);
+	return true;
+}
+#endif
+
+HttpStaticFile::HttpStaticFile(peff::Alloc *selfAllocator, netknot::NativeFileHandle handle) noexcept : HttpResponseFile(handle), selfAllocator(selfAllocator), path(selfAllocator) {
+}
+
+HttpStaticFile::~HttpStaticFile() {
+	closeFile(handle);
+}
+
+void HttpStaticFile::onRefZero() noexcept {
+	peff::destroyAndRelease<HttpStaticFile>(selfAllocator.get(), this, alignof(HttpStaticFile));
+}
+
+// Check if the file is still the one which has been opened, a replaced or modified file is opened again.
+static NETKNOT_FORCEINLINE bool isSameFile(const HttpStaticFile *file, const FileInfo &info) noexcept {
+	return (file->device == info.device) &&
+		   (file->inode == info.inode) &&
+		   (file->size == info.size) &&
+		   (file->modifiedTimeNs == info.modifiedTimeNs);
+}
+
+static std::string_view getContentType(std::string_view path) noexcept {
+	struct ContentTypeEntry {
+		std::string_view extension;
+		std::string_view contentType;
+	};
+
+	static constexpr ContentTypeEntry contentTypes[] = {
+		{ "html"sv, "text/html; charset=utf-8"sv },
+		{ "htm"sv, "text/html; charset=utf-8"sv },
+		{ "css"sv, "text/css; charset=utf-8"sv },
+		{ "js"sv, "text/javascript; charset=utf-8"sv },
+		{ "mjs"sv, "text/javascript; charset=utf-8"sv },
+		{ "json"sv, "application/json"sv },
+		{ "map"sv, "application/json"sv },
+		{ "txt"sv, "text/plain; charset=utf-8"sv },
+		{ "xml"sv, "application/xml"sv },
+		{ "svg"sv, "image/svg+xml"sv },
+		{ "png"sv, "image/png"sv },
+		{ "jpg"sv, "image/jpeg"sv },
+		{ "jpeg"sv, "image/jpeg"sv },
+		{ "gif"sv, "image/gif"sv },
+		{ "webp"sv, "image/webp"sv },
+		{ "ico"sv, "image/x-icon"sv },
+		{ "wasm"sv, "application/wasm"sv },
+		{ "woff"sv, "font/woff"sv },
+		{ "woff2"sv, "font/woff2"sv },
+		{ "pdf"sv, "application/pdf"sv }
+	};
+
+	const size_t offDot = path.rfind('.');
+
+	if ((offDot != std::string_view::npos) && (path.find('/', offDot) == std::string_view::npos)) {
+		const std::string_view extension = path.substr(offDot + 1);
+
+		for (const ContentTypeEntry &i : contentTypes) {
+			if (isHttpHeaderNameEqual(i.extension, extension))
+				return i.contentType;
+		}
+	}
+
+	return "application/octet-stream"sv;
+}
+
+static NETKNOT_FORCEINLINE int decodeHexDigit(char c) noexcept {
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Decode the percent-encoded path, the paths which may escape the root are refused.
+static bool decodeFilePath(std::string_view path, peff::String &decodedOut, bool &isMalformedOut) noexcept {
+	isMalformedOut = false;
+
+	for (size_t i = 0; i < path.size(); ++i) {
+		char c = path[i];
+
+		if (c == '%') {
+			int high, low;
+
+			if ((i + 2 >= path.size()) || ((high = decodeHexDigit(path[i + 1])) < 0) || ((low = decodeHexDigit(path[i + 2])) < 0)) {
+				isMalformedOut = true;
+				return true;
+			}
+
+			c = (char)((high << 4) | low);
+			i += 2;
+		}
+
+#ifdef _WIN32
+		// The drive letters and the alternate data streams are refused as well.
+		if ((c == '\0') || (c == '\\') || (c == ':')) {
+#else
+		if ((c == '\0') || (c == '\\')) {
+#endif
+			isMalformedOut = true;
+			return true;
+		}
+
+		if (!decodedOut.append(std::string_view(&c, 1)))
+			return false;
+	}
+
+	// Every segment is checked after decoding, so the encoded dots are caught as well.
+	std::string_view decoded(decodedOut.data(), decodedOut.size());
+
+	if (decoded.size() && (decoded[0] == '/')) {
+		isMalformedOut = true;
+		return true;
+	}
+
+	while (decoded.size()) {
+		const size_t offSlash = decoded.find('/');
+		const std::string_view segment = decoded.substr(0, offSlash);
+
+		if ((segment == "."sv) || (segment == ".."sv)) {
+			isMalformedOut = true;
+			return true;
+		}
+
+		if (offSlash == std::string_view::npos)
+			break;
+		decoded.remove_prefix(offSlash + 1);
+	}
+
+	return true;
+}
+
+// Check if an entity tag is in a list of the If-None-Match header, compared weakly.
+static bool isEtagInList(std::string_view list, std::string_view etag) noexcept {
+	auto stripWeak = [](std::string_view tag) noexcept {
+		if ((tag.size() >= 2) && (tag[0] == 'W') && (tag[1] == '/'))
+			tag.remove_prefix(2);
+		return tag;
+	};
+
+	etag = stripWeak(etag);
+
+	while (list.size()) {
+		size_t offSeparator = list.find(',');
+		std::string_view item = list.substr(0, offSeparator);
+
+		while (item.size() && ((item.front() == ' ') || (item.front() == '\t')))
+			item.remove_prefix(1);
+		while (item.size() && ((item.back() == ' ') || (item.back() == '\t')))
+			item.remove_suffix(1);
+
+		if ((item == "*"sv) || (stripWeak(item) == etag))
+			return true;
+
+		if (offSeparator == std::string_view::npos)
+			break;
+		list.remove_prefix(offSeparator + 1);
+	}
+
+	return false;
+}
+
+static NETKNOT_FORCEINLINE bool parseRangeNumber(std::string_view text, uint64_t &valueOut) noexcept {
+	if (!text.size())
+		return false;
+
+	uint64_t value = 0;
+
+	for (char c : text) {
+		if ((c < '0') || (c > '9'))
+			return false;
+		if (value > (UINT64_MAX - 9) / 10)
+			return false;
+		value = value * 10 + (uint64_t)(c - '0');
+	}
+
+	valueOut = value;
+	return true;
+}
+
+enum class HttpRangeResult : uint8_t {
+	/// @brief The header is ignored and the whole file is sent, e.g. for multiple ranges.
+	Ignored = 0,
+	Satisfiable,
+	Unsatisfiable
+};
+
+// Parse a Range header of a single byte range, the multiple ranges are not supported and the whole file is sent for them.
+static HttpRangeResult parseRange(std::string_view range, uint64_t szFile, uint64_t &offsetOut, uint64_t &sizeOut) noexcept {
+	constexpr std::string_view unit = "bytes"sv;
+
+	if ((range.size() <= unit.size()) || (!isHttpHeaderNameEqual(range.substr(0, unit.size()), unit)) || (range[unit.size()] != '='))
+		return HttpRangeResult::Ignored;
+	range.remove_prefix(unit.size() + 1);
+
+	while (range.size() && ((range.front() == ' ') || (range.front() == '\t')))
+		range.remove_prefix(1);
+	while (range.size() && ((range.back() == ' ') || (range.back() == '\t')))
+		range.remove_suffix(1);
+
+	if (range.find(',') != std::string_view::npos)
+		return HttpRangeResult::Ignored;
+
+	const size_t offDash = range.find('-');
+	if (offDash == std::string_view::npos)
+		return HttpRangeResult::Ignored;
+
+	const std::string_view firstText = range.substr(0, offDash), lastText = range.substr(offDash + 1);
+	uint64_t first, last;
+
+	if (!firstText.size()) {
+		// A suffix range, which takes the last bytes.
+		if (!parseRangeNumber(lastText, last))
+			return HttpRangeResult::Ignored;
+
+		if ((!last) || (!szFile))
+			return HttpRangeResult::Unsatisfiable;
+
+		if (last > szFile)
+			last = szFile;
+
+		offsetOut = szFile - last;
+		sizeOut = last;
+		return HttpRangeResult::Satisfiable;
+	}
+
+	if (!parseRangeNumber(firstText, first))
+		return HttpRangeResult::Ignored;
+
+	if (!lastText.size())
+		last = UINT64_MAX;
+	else if ((!parseRangeNumber(lastText, last)) || (last < first))
+		return HttpRangeResult::Ignored;
+
+	if (first >= szFile)
+		return HttpRangeResult::Unsatisfiable;
+
+	if (last >= szFile)
+		last = szFile - 1;
+
+	offsetOut = first;
+	sizeOut = last - first + 1;
+	return HttpRangeResult::Satisfiable;
+}
+
+HttpStaticFileHandler::HttpStaticFileHandler(peff::Alloc *selfAllocator, size_t maxCachedFiles, std::chrono::steady_clock::duration ttl) noexcept
+	: HttpRequestHandler("GET"sv),
+	  _selfAllocator(selfAllocator),
+	  _rootPath(selfAllocator),
+	  _paramName(selfAllocator),
+	  _maxCachedFiles(maxCachedFiles),
+	  _ttl(ttl),
+	  _cachedFiles(selfAllocator) {
+}
+
+HttpStaticFileHandler::~HttpStaticFileHandler() {
+	// The responses in flight keep their own references.
+	while (_firstUsed)
+		_evictCachedFile(_firstUsed);
+}
+
+HttpStaticFileHandler *HttpStaticFileHandler::alloc(
+	peff::Alloc *allocator,
+	const std::string_view &rootPath,
+	const std::string_view &paramName,
+	size_t maxCachedFiles,
+	std::chrono::steady_clock::duration ttl) noexcept {
+	peff::UniquePtr<HttpStaticFileHandler, peff::DeallocableDeleter<HttpStaticFileHandler>> handler(
+		peff::allocAndConstruct<HttpStaticFileHandler>(allocator, alignof(HttpStaticFileHandler), allocator, maxCachedFiles, ttl));
+
+	if (!handler)
+		return nullptr;
+
+	if (!handler->_rootPath.build(rootPath))
+		return nullptr;
+	if ((!rootPath.size()) || (rootPath.back() != '/')) {
+		if (!handler->_rootPath.append("/"sv))
+			return nullptr;
+	}
+
+	if (!handler->_paramName.build(paramName))
+		return nullptr;
+
+	return handler.release();
+}
+
+void HttpStaticFileHandler::dealloc() noexcept {
+	peff::destroyAndRelease<HttpStaticFileHandler>(_selfAllocator.get(), this, alignof(HttpStaticFileHandler));
+}
+
+void HttpStaticFileHandler::_unlinkCachedFile(HttpStaticFile *file) noexcept {
+	if (file->prevUsed)
+		file->prevUsed->nextUsed = file->nextUsed;
+	else
+		_firstUsed = file->nextUsed;
+
+	if (file->nextUsed)
+		file->nextUsed->prevUsed = file->prevUsed;
+	else
+		_lastUsed = file->prevUsed;
+
+	file->prevUsed = nullptr;
+	file->nextUsed = nullptr;
+}
+
+void HttpStaticFileHandler::_linkCachedFile(HttpStaticFile *file) noexcept {
+	file->prevUsed = nullptr;
+	file->nextUsed = _firstUsed;
+
+	if (_firstUsed)
+		_firstUsed->prevUsed = file;
+	else
+		_lastUsed = file;
+
+	_firstUsed = file;
+}
+
+void HttpStaticFileHandler::_evictCachedFile(HttpStaticFile *file) noexcept {
+	_unlinkCachedFile(file);
+	_cachedFiles.remove(std::string_view(file->path.data(), file->path.size()));
+	--_nCachedFiles;
+
+	// The cache's reference is dropped, the file is closed once the responses sending it are done.
+	file->decRef(0);
+}
+
+netknot::ExceptionPointer HttpStaticFileHandler::_openFile(std::string_view path, peff::RcObjectPtr<HttpStaticFile> &fileOut, HttpResponseStatus &errorStatusOut) {
+	peff::String fullPath(_selfAllocator.get());
+
+	if (!fullPath.build(std::string_view(_rootPath.data(), _rootPath.size())))
+		return netknot::OutOfMemoryError::alloc();
+	if (!fullPath.append(path))
+		return netknot::OutOfMemoryError::alloc();
+	if (!fullPath.append("\0"sv))
+		return netknot::OutOfMemoryError::alloc();
+
+	netknot::NativeFileHandle handle;
+	bool isOpened;
+
+	NETKNOT_RETURN_IF_EXCEPT(openFile(_selfAllocator.get(), fullPath.data(), handle, isOpened, errorStatusOut));
+
+	if (!isOpened)
+		return {};
+
+	peff::RcObjectPtr<HttpStaticFile> file = peff::allocAndConstruct<HttpStaticFile>(_selfAllocator.get(), alignof(HttpStaticFile), _selfAllocator.get(), handle);
+
+	if (!file) {
+		closeFile(handle);
+		return netknot::OutOfMemoryError::alloc();
+	}
+
+	// The metadata are taken from the opened file, which stays the same even if the path is replaced meanwhile.
+	FileInfo info;
+
+	if (!getFileInfo(handle, info)) {
+		errorStatusOut = HttpResponseStatus::InternalServerError;
+		return {};
+	}
+
+	if (!info.isRegular) {
+		errorStatusOut = HttpResponseStatus::NotFound;
+		return {};
+	}
+
+	if (!file->path.build(path))
+		return netknot::OutOfMemoryError::alloc();
+
+	file->size = info.size;
+	file->device = info.device;
+	file->inode = info.inode;
+	file->modifiedTimeNs = info.modifiedTimeNs;
+	file->contentType = getContentType(path);
+
+	// The validators are rendered once for all of the responses.
+	char *p = file->etag;
+	*p++ = '"';
+	p += formatHttpHex(p, file->size);
+	*p++ = '-';
+	p += formatHttpHex(p, (uint64_t)file->modifiedTimeNs);
+	*p++ = '"';
+	file->szEtag = (size_t)(p - file->etag);
+
+	formatHttpDate(file->lastModified, file->getModifiedTime());
+
+	file->validatedAt = std::chrono::steady_clock::now();
+
+	fileOut = std::move(file);
+	return {};
+}
+
+netknot::ExceptionPointer HttpStaticFileHandler::_acquireFile(std::string_view path, peff::RcObjectPtr<HttpStaticFile> &fileOut, HttpResponseStatus &errorStatusOut) {
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	peff::RcObjectPtr<HttpStaticFile> staleFile;
+
+	{
+		std::lock_guard<std::mutex> cacheGuard(_cacheMutex);
+
+		if (auto it = _cachedFiles.find(path); it != _cachedFiles.end()) {
+			HttpStaticFile *file = it.value();
+
+			_unlinkCachedFile(file);
+			_linkCachedFile(file);
+
+			if (now - file->validatedAt < _ttl) {
+				fileOut = file;
+				return {};
+			}
+
+			staleFile = file;
+		}
+	}
+
+	// The file system is only touched outside the lock.
+	if (staleFile) {
+		peff::String fullPath(_selfAllocator.get());
+
+		if (!fullPath.build(std::string_view(_rootPath.data(), _rootPath.size())))
+			return netknot::OutOfMemoryError::alloc();
+		if (!fullPath.append(path))
+			return netknot::OutOfMemoryError::alloc();
+		if (!fullPath.append("\0"sv))
+			return netknot::OutOfMemoryError::alloc();
+
+		FileInfo info;
+
+		if (getPathInfo(_selfAllocator.get(), fullPath.data(), info) && isSameFile(staleFile.get(), info)) {
+			std::lock_guard<std::mutex> cacheGuard(_cacheMutex);
+
+			staleFile->validatedAt = now;
+
+			fileOut = std::move(staleFile);
+			return {};
+		}
+	}
+
+	peff::RcObjectPtr<HttpStaticFile> file;
+
+	NETKNOT_RETURN_IF_EXCEPT(_openFile(path, file, errorStatusOut));
+
+	{
+		std::lock_guard<std::mutex> cacheGuard(_cacheMutex);
+
+		// The stale one or the one put by another worker meanwhile is replaced.
+		if (auto it = _cachedFiles.find(path); it != _cachedFiles.end())
+			_evictCachedFile(it.value());
+
+		if (file) {
+			const std::string_view key(file->path.data(), file->path.size());
+
+			if (!_cachedFiles.insert(std::string_view(key), file.get()))
+				return netknot::OutOfMemoryError::alloc();
+
+			file->incRef(0);
+			_linkCachedFile(file.get());
+			++_nCachedFiles;
+
+			while (_nCachedFiles > _maxCachedFiles)
+				_evictCachedFile(_lastUsed);
+		}
+	}
+
+	fileOut = std::move(file);
+	return {};
+}
+
+netknot::ExceptionPointer HttpStaticFileHandler::handleURL(const HttpURLHandlerState &state) {
+	HttpURLHandlerState &s = const_cast<HttpURLHandlerState &>(state);
+	std::string_view pathParam;
+
+	// The handler is registered for a route without the parameter.
+	if (!state.routeParams.find(std::string_view(_paramName.data(), _paramName.size()), pathParam))
+		return s.writeResponse(HttpResponseStatus::InternalServerError, "text/plain"sv, ""sv);
+
+	peff::String path(state.requestAllocator);
+	bool isMalformed;
+
+	if (!decodeFilePath(pathParam, path, isMalformed))
+		return netknot::OutOfMemoryError::alloc();
+	if (isMalformed)
+		return s.writeResponse(HttpResponseStatus::BadRequest, "text/plain"sv, ""sv);
+
+	// A directory is served by its index.
+	if ((!path.size()) || (path.at(path.size() - 1) == '/')) {
+		if (!path.append("index.html"sv))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	peff::RcObjectPtr<HttpStaticFile> file;
+	HttpResponseStatus errorStatus;
+
+	NETKNOT_RETURN_IF_EXCEPT(_acquireFile(std::string_view(path.data(), path.size()), file, errorStatus));
+
+	if (!file)
+		return s.writeResponse(errorStatus, "text/plain"sv, ""sv);
+
+	const HttpRequestHeaderView &headers = state.requestHeaderView;
+
+	// If-Modified-Since is only considered without If-None-Match.
+	bool isNotModified = false;
+
+	if (headers.has(HttpHeaderId::IfNoneMatch)) {
+		isNotModified = isEtagInList(headers.get(HttpHeaderId::IfNoneMatch), file->getEtag());
+	} else if (headers.has(HttpHeaderId::IfModifiedSince)) {
+		time_t ifModifiedSince;
+
+		if (parseHttpDate(headers.get(HttpHeaderId::IfModifiedSince), ifModifiedSince))
+			isNotModified = file->getModifiedTime() <= ifModifiedSince;
+	}
+
+	if (isNotModified) {
+		NETKNOT_RETURN_IF_EXCEPT(s.writeStatusLine(HttpResponseStatus::NotModified));
+		NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("ETag"sv, file->getEtag()));
+		NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Last-Modified"sv, file->getLastModified()));
+		return s.endHeader();
+	}
+
+	uint64_t offset = 0, size = file->size;
+	HttpRangeResult rangeResult = HttpRangeResult::Ignored;
+
+	if (headers.has(HttpHeaderId::Range)) {
+		bool isRangeApplicable = true;
+
+		// The range is only applied to the representation which the peer has, the whole file is sent otherwise.
+		if (headers.has(HttpHeaderId::IfRange)) {
+			const std::string_view ifRange = headers.get(HttpHeaderId::IfRange);
+			time_t ifRangeTime;
+
+			if (ifRange.size() && ((ifRange[0] == '"') || (ifRange[0] == 'W')))
+				isRangeApplicable = ifRange == file->getEtag();
+			else
+				isRangeApplicable = parseHttpDate(ifRange, ifRangeTime) && (ifRangeTime == file->getModifiedTime());
+		}
+
+		if (isRangeApplicable)
+			rangeResult = parseRange(headers.get(HttpHeaderId::Range), file->size, offset, size);
+	}
+
+	char contentRange[sizeof("bytes -/") - 1 + 3 * HTTP_DECIMAL_MAX_SIZE];
+	char *p = contentRange;
+	auto put = [&p](const std::string_view &data) noexcept {
+		memcpy(p, data.data(), data.size());
+		p += data.size();
+	};
+
+	switch (rangeResult) {
+		case HttpRangeResult::Ignored:
+			NETKNOT_RETURN_IF_EXCEPT(s.writeStatusLine(HttpResponseStatus::OK));
+			break;
+		case HttpRangeResult::Satisfiable:
+			NETKNOT_RETURN_IF_EXCEPT(s.writeStatusLine(HttpResponseStatus::PartialContent));
+
+			put("bytes "sv);
+			p += formatHttpDecimal(p, offset);
+			put("-"sv);
+			p += formatHttpDecimal(p, offset + size - 1);
+			put("/"sv);
+			p += formatHttpDecimal(p, file->size);
+
+			NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Range"sv, std::string_view(contentRange, (size_t)(p - contentRange))));
+			break;
+		case HttpRangeResult::Unsatisfiable:
+			NETKNOT_RETURN_IF_EXCEPT(s.writeStatusLine(HttpResponseStatus::RangeNotSatisfiable));
+
+			put("bytes */"sv);
+			p += formatHttpDecimal(p, file->size);
+
+			NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Range"sv, std::string_view(contentRange, (size_t)(p - contentRange))));
+			NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Length"sv, "0"sv));
+			return s.endHeader();
+	}
+
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Content-Type"sv, file->contentType));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("ETag"sv, file->getEtag()));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Last-Modified"sv, file->getLastModified()));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeHeader("Accept-Ranges"sv, "bytes"sv));
+
+	NETKNOT_RETURN_IF_EXCEPT(s.beginStream((size_t)size));
+	NETKNOT_RETURN_IF_EXCEPT(s.writeStreamFile(file.get(), offset, (size_t)size));
+	return s.endStream();
+}
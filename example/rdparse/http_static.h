@@ -0,0 +1,116 @@
+#ifndef _HTTP_STATIC_H_
+#define _HTTP_STATIC_H_
+
+#include "server.h"
+#include <peff/containers/hashmap.h>
+#include <chrono>
+#include <mutex>
+
+namespace http {
+	class HttpStaticFileHandler;
+
+	/// @brief Opened file with its metadata and validators, shared by the cache and the responses sending it.
+	class HttpStaticFile final : public HttpResponseFile {
+	public:
+		/// @brief Maximum size of an entity tag, such as "\"ffffffffffffffff-ffffffffffffffff\"".
+		constexpr static size_t MAX_ETAG_SIZE = 2 * HTTP_HEX_MAX_SIZE + 3;
+
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		/// @brief Path relative to the root, by which the file is cached.
+		peff::String path;
+
+		uint64_t size = 0;
+		uint64_t device = 0, inode = 0;
+		int64_t modifiedTimeNs = 0;
+		std::string_view contentType;
+		char etag[MAX_ETAG_SIZE];
+		size_t szEtag = 0;
+		char lastModified[HTTP_DATE_SIZE];
+
+		/// @brief When the file has been checked against the file system for the last time.
+		std::chrono::steady_clock::time_point validatedAt;
+		/// @brief Neighbours in the LRU list of the cache, the most recently used one is the first.
+		HttpStaticFile *prevUsed = nullptr, *nextUsed = nullptr;
+
+		HttpStaticFile(peff::Alloc *selfAllocator, netknot::NativeFileHandle handle) noexcept;
+		virtual ~HttpStaticFile();
+
+		virtual void onRefZero() noexcept override;
+
+		NETKNOT_FORCEINLINE std::string_view getEtag() const noexcept {
+			return std::string_view(etag, szEtag);
+		}
+
+		NETKNOT_FORCEINLINE std::string_view getLastModified() const noexcept {
+			return std::string_view(lastModified, sizeof(lastModified));
+		}
+
+		NETKNOT_FORCEINLINE time_t getModifiedTime() const noexcept {
+			return (time_t)(modifiedTimeNs / 1000000000);
+		}
+	};
+
+	/// @brief Handler serving the files under a directory, with the path taken from a route parameter, e.g. "/static/{*path}".
+	///
+	/// The opened files and their metadata are kept in an LRU cache and checked against the file system again once they have
+	/// been cached for longer than the TTL, so the repeated requests touch neither the disk nor the file system metadata.
+	/// The conditional requests are answered from the cached validators, and the bodies, whole or a single range of them,
+	/// are sent by the kernel from the page cache directly.
+	/// The files are opened on the workers, which is expected to be quick for the local file systems.
+	class HttpStaticFileHandler : public HttpRequestHandler {
+	public:
+		constexpr static size_t DEFAULT_MAX_CACHED_FILES = 1024;
+		constexpr static std::chrono::steady_clock::duration DEFAULT_TTL = std::chrono::seconds(2);
+
+	private:
+		peff::RcObjectPtr<peff::Alloc> _selfAllocator;
+		/// @brief The root directory, which ends with a slash.
+		peff::String _rootPath;
+		peff::String _paramName;
+		size_t _maxCachedFiles;
+		std::chrono::steady_clock::duration _ttl;
+
+		/// @brief Guards the cache, which is shared by the workers.
+		std::mutex _cacheMutex;
+		/// @brief Cached files by their paths, the keys refer to the paths of the files.
+		peff::HashMap<std::string_view, HttpStaticFile *> _cachedFiles;
+		HttpStaticFile *_firstUsed = nullptr, *_lastUsed = nullptr;
+		size_t _nCachedFiles = 0;
+
+		void _unlinkCachedFile(HttpStaticFile *file) noexcept;
+		void _linkCachedFile(HttpStaticFile *file) noexcept;
+		void _evictCachedFile(HttpStaticFile *file) noexcept;
+		/// @brief Get a file from the cache, or open it and put it into the cache.
+		///
+		/// @param path Path of the file relative to the root.
+		/// @param fileOut Where to store the file.
+		/// @param errorStatusOut Where to store the status to answer with if the file cannot be served.
+		/// @return The exception occurred, nothing is stored to fileOut if the file cannot be served.
+		netknot::ExceptionPointer _acquireFile(std::string_view path, peff::RcObjectPtr<HttpStaticFile> &fileOut, HttpResponseStatus &errorStatusOut);
+		netknot::ExceptionPointer _openFile(std::string_view path, peff::RcObjectPtr<HttpStaticFile> &fileOut, HttpResponseStatus &errorStatusOut);
+
+	public:
+		HttpStaticFileHandler(peff::Alloc *selfAllocator, size_t maxCachedFiles, std::chrono::steady_clock::duration ttl) noexcept;
+		virtual ~HttpStaticFileHandler();
+
+		/// @brief Allocate a handler for the GET requests.
+		///
+		/// @param allocator Allocator of the handler and the cache.
+		/// @param rootPath Directory where the files are.
+		/// @param paramName Name of the route parameter which contains the path of the file.
+		/// @param maxCachedFiles Maximum number of the files to be kept open.
+		/// @param ttl How long the cached files are trusted before being checked again.
+		/// @return The handler, nullptr if out of memory.
+		static HttpStaticFileHandler *alloc(
+			peff::Alloc *allocator,
+			const std::string_view &rootPath,
+			const std::string_view &paramName,
+			size_t maxCachedFiles = DEFAULT_MAX_CACHED_FILES,
+			std::chrono::steady_clock::duration ttl = DEFAULT_TTL) noexcept;
+		virtual void dealloc() noexcept override;
+
+		virtual netknot::ExceptionPointer handleURL(const HttpURLHandlerState &state) override;
+	};
+}
+
+#endif
@@ -1,5 +1,7 @@
-#include "server.h"
+#include "http_cache.h"
+#include "http_static.h"
 #include <map>
+#include <csignal>
 
 class MyAllocator : public peff::StdAlloc {
 public:
@@ -56,6 +58,10 @@ public:
 int main() {
 #ifdef _MSC_VER
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+#endif
+#ifndef _WIN32
+	// Sending to a connection which has been shut down must fail instead of killing the process.
+	signal(SIGPIPE, SIG_IGN);
 #endif
 	peff::StdAlloc myAlloc;
 	{
@@ -64,7 +70,14 @@ int main() {
 		peff::UniquePtr<netknot::IOService, peff::DeallocableDeleter<netknot::IOService>> ioService;
 		{
 			netknot::IOServiceCreationParams params(&myAlloc, &myAlloc);
+#if NETKNOT_SINGLE_THREADED
+			// The single-threaded build runs everything on the thread calling run().
+			params.nWorkerThreads = 0;
+			params.nComputeThreads = 0;
+#else
 			params.nWorkerThreads = 1;
+			params.nComputeThreads = 1;
+#endif
 
 			if ((e = netknot::createDefaultIOService(ioService.getRef(), params))) {
 				std::terminate();
@@ -98,13 +111,7 @@ int main() {
 		{
 			http::HttpServer httpServer(&myAlloc, ioService.get(), socket.release());
 
-			peff::RcObjectPtr<http::HttpAcceptAsyncCallback> callback;
-
-			if (!(callback = peff::allocAndConstruct<http::HttpAcceptAsyncCallback>(&myAlloc, alignof(http::HttpAcceptAsyncCallback), &httpServer, &myAlloc)))
-				std::terminate();
-
-			peff::RcObjectPtr<netknot::AcceptAsyncTask> acceptAsyncTask;
-			if ((e = httpServer.serverSocket->acceptAsync(&myAlloc, callback.get(), acceptAsyncTask.getRef()))) {
+			if ((e = httpServer.start())) {
 				std::terminate();
 			}
 
@@ -121,6 +128,40 @@ int main() {
 				std::terminate();
 			}
 
+			peff::UniquePtr<http::HttpRequestHandler, peff::DeallocableDeleter<http::HttpRequestHandler>> staticGetHandler = http::HttpStaticFileHandler::alloc(&myAlloc, ".", "path");
+			if (!staticGetHandler)
+				std::terminate();
+
+			if ((e = httpServer.registerHandler("/static/{*path}", staticGetHandler.release()))) {
+				std::terminate();
+			}
+
+			peff::RcObjectPtr<http::HttpResponseCache> responseCache = http::HttpResponseCache::alloc(&myAlloc, ioService.get());
+			if (!responseCache)
+				std::terminate();
+
+			peff::UniquePtr<http::HttpRequestHandler, peff::DeallocableDeleter<http::HttpRequestHandler>> reportGetHandler = http::allocFnHttpCachedRequestHandler(
+				&myAlloc,
+				"GET",
+				responseCache.get(),
+				[](const http::HttpURLHandlerState &state, peff::String &contentTypeOut, peff::String &bodyOut) -> netknot::ExceptionPointer {
+					if (!contentTypeOut.build("text/plain; charset=utf-8"))
+						return netknot::OutOfMemoryError::alloc();
+
+					for (size_t i = 0; i < 256; ++i) {
+						if (!bodyOut.append("The report is rendered once and then served from the cache.\n"))
+							return netknot::OutOfMemoryError::alloc();
+					}
+
+					return {};
+				});
+			if (!reportGetHandler)
+				std::terminate();
+
+			if ((e = httpServer.registerHandler("/report", reportGetHandler.release()))) {
+				std::terminate();
+			}
+
 			if ((e = ioService->run()))
 				std::terminate();
 		}
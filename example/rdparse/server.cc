@@ -1,18 +1,143 @@
 #include "server.h"
+#include "http2_session.h"
+#include <cstring>
+#include <utility>
 
 using namespace http;
 
 using std::operator""sv;
 
-Connection::Connection(peff::Alloc *allocator, HttpServer *httpServer, netknot::Socket *socket) noexcept : selfAllocator(allocator), httpServer(httpServer), socket(socket) {
+Connection::Connection(HttpServer *httpServer, HttpWorkerConnections *worker, netknot::Socket *socket) noexcept : httpServer(httpServer), worker(worker), socket(socket), lastActiveTime(std::chrono::steady_clock::now()) {
 }
 Connection::~Connection() {
 }
-void Connection::dealloc() noexcept {
-	peff::destroyAndRelease<Connection>(selfAllocator.get(), this, alignof(Connection));
+
+HttpWorkerConnections::HttpWorkerConnections(peff::Alloc *selfAllocator, HttpServer *httpServer, size_t workerId) noexcept
+	: selfAllocator(selfAllocator),
+	  httpServer(httpServer),
+	  workerId(workerId),
+	  connectionSlab(httpServer->allocator.get(), sizeof(Connection), alignof(Connection)),
+	  streamSlab(httpServer->allocator.get(), sizeof(Http2Stream), alignof(Http2Stream)) {
+}
+HttpWorkerConnections::~HttpWorkerConnections() {
+	// The connections whose releases have not been run are released along with the others.
+	while (firstActive)
+		releaseConnection(firstActive);
+}
+void HttpWorkerConnections::dealloc() noexcept {
+	peff::destroyAndRelease<HttpWorkerConnections>(selfAllocator.get(), this, alignof(HttpWorkerConnections));
+}
+HttpWorkerConnections *HttpWorkerConnections::alloc(peff::Alloc *allocator, HttpServer *httpServer, size_t workerId) noexcept {
+	return peff::allocAndConstruct<HttpWorkerConnections>(allocator, alignof(HttpWorkerConnections), allocator, httpServer, workerId);
+}
+
+void HttpWorkerConnections::_linkConnection(Connection *connection) noexcept {
+	connection->prevActive = lastActive;
+	connection->nextActive = nullptr;
+
+	if (lastActive)
+		lastActive->nextActive = connection;
+	else
+		firstActive = connection;
+
+	lastActive = connection;
+}
+
+void HttpWorkerConnections::_unlinkConnection(Connection *connection) noexcept {
+	if (connection->prevActive)
+		connection->prevActive->nextActive = connection->nextActive;
+	else
+		firstActive = connection->nextActive;
+
+	if (connection->nextActive)
+		connection->nextActive->prevActive = connection->prevActive;
+	else
+		lastActive = connection->prevActive;
+
+	connection->prevActive = nullptr;
+	connection->nextActive = nullptr;
+}
+
+netknot::ExceptionPointer HttpWorkerConnections::startConnection(netknot::Socket *socket) {
+	peff::UniquePtr<netknot::Socket, peff::DeallocableDeleter<netknot::Socket>> s(socket);
+	Connection *connection;
+
+	{
+		std::lock_guard<HttpWorkerMutex> workerGuard(mutex);
+
+		void *p = connectionSlab.alloc();
+
+		if (!p)
+			return netknot::OutOfMemoryError::alloc();
+
+		connection = new (p) Connection(httpServer, this, s.release());
+
+		_linkConnection(connection);
+		++nConnections;
+	}
+
+	if (!(connection->requestCallback = peff::allocAndConstruct<HttpReadAsyncCallback>(
+			  httpServer->allocator.get(), alignof(HttpReadAsyncCallback),
+			  httpServer,
+			  connection,
+			  httpServer->allocator.get(),
+			  httpServer->allocator.get()))) {
+		releaseConnection(connection);
+		return netknot::OutOfMemoryError::alloc();
+	}
+
+	// Nothing is in flight if the first read cannot be issued.
+	if (netknot::ExceptionPointer e = connection->requestCallback->start(); e) {
+		releaseConnection(connection);
+		return e;
+	}
+
+	return {};
+}
+
+void HttpWorkerConnections::releaseConnection(Connection *connection) noexcept {
+	std::lock_guard<HttpWorkerMutex> workerGuard(mutex);
+
+	_unlinkConnection(connection);
+	--nConnections;
+
+	connection->~Connection();
+	connectionSlab.release(connection);
+}
+
+void HttpWorkerConnections::touchConnection(Connection *connection) noexcept {
+	std::lock_guard<HttpWorkerMutex> workerGuard(mutex);
+
+	connection->lastActiveTime = std::chrono::steady_clock::now();
+
+	if (connection == lastActive)
+		return;
+
+	_unlinkConnection(connection);
+	_linkConnection(connection);
 }
-Connection *Connection::alloc(peff::Alloc *allocator, HttpServer *httpServer, netknot::Socket *socket) {
-	return peff::allocAndConstruct<Connection>(allocator, alignof(Connection), allocator, httpServer, socket);
+
+netknot::ExceptionPointer HttpWorkerConnections::closeIdleConnections(std::chrono::steady_clock::time_point deadline) noexcept {
+	std::lock_guard<HttpWorkerMutex> workerGuard(mutex);
+
+	Connection *connection = firstActive;
+
+	while (connection && (connection->lastActiveTime < deadline)) {
+		Connection *next = connection->nextActive;
+		HttpReadAsyncCallback *requestCallback = connection->requestCallback.get();
+
+		if (requestCallback->isWaitingForPeer()) {
+			// Nothing is released here, the release is posted once the read or the write in flight returns.
+			NETKNOT_RETURN_IF_EXCEPT(requestCallback->closeConnection());
+		} else if (!requestCallback->isClosed) {
+			// A connection left to its handler is not idle, it is checked again after another timeout.
+			touchConnection(connection);
+		}
+
+		connection = next;
+	}
+
+	return {};
 }
 
 HandlerURL::HandlerURL(peff::Alloc *selfAllocator) noexcept : selfAllocator(selfAllocator) {
@@ -27,15 +152,10 @@ netknot::ExceptionPointer HttpURLHandlerState::writeStatusLine(HttpResponseStatu
 	if (this->stage != HttpURLHandlerStateStage::StatusLine)
 		std::terminate();
 
-	std::string_view httpVersion = "HTTP/1,1 "sv;
-
-	if (!responseData.build(httpVersion))
-		return netknot::OutOfMemoryError::alloc();
-
-	if (!responseData.append(HttpServer::getHttpResponseMessage(status)))
+	if (!responseData.build(getHttpStatusLine(status)))
 		return netknot::OutOfMemoryError::alloc();
 
-	if (!responseData.append("\r\n"))
+	if (!responseData.append(getHttpDateHeader()))
 		return netknot::OutOfMemoryError::alloc();
 
 	this->stage = HttpURLHandlerStateStage::ResponseHeaders;
@@ -66,6 +186,9 @@ netknot::ExceptionPointer HttpURLHandlerState::endHeader() {
 	if (this->stage != HttpURLHandlerStateStage::ResponseHeaders)
 		std::terminate();
 
+	if (connectionOption.size())
+		NETKNOT_RETURN_IF_EXCEPT(writeHeader("Connection"sv, connectionOption));
+
 	if (!responseData.append("\r\n"))
 		return netknot::OutOfMemoryError::alloc();
 
@@ -81,77 +204,115 @@ netknot::ExceptionPointer HttpURLHandlerState::writeBody(const std::string_view
 	if (!responseData.append(data))
 		return netknot::OutOfMemoryError::alloc();
 
-	if (!responseData.append("\r\n"))
-		return netknot::OutOfMemoryError::alloc();
-
 	return {};
 }
 
 netknot::ExceptionPointer HttpURLHandlerState::writeResponse(HttpResponseStatus status, const std::string_view &contentType, const std::string_view &body) {
-	NETKNOT_RETURN_IF_EXCEPT(writeStatusLine(status));
-	NETKNOT_RETURN_IF_EXCEPT(writeHeader("Content-Type", contentType));
+	if (this->stage != HttpURLHandlerStateStage::StatusLine)
+		std::terminate();
 
-	char lenStr[sizeof(size_t) / 3 + 1];
+	const std::string_view statusLine = getHttpStatusLine(status), dateHeader = getHttpDateHeader();
 
-	sprintf(lenStr, "%zu", body.size());
+	char contentLength[HTTP_DECIMAL_MAX_SIZE];
+	const size_t szContentLength = formatHttpDecimal(contentLength, body.size());
 
-	NETKNOT_RETURN_IF_EXCEPT(writeHeader("Content-Length", lenStr));
-	NETKNOT_RETURN_IF_EXCEPT(endHeader());
-	NETKNOT_RETURN_IF_EXCEPT(writeBody(body));
+	constexpr std::string_view contentTypeName = "Content-Type: "sv, contentLengthName = "\r\nContent-Length: "sv, connectionName = "\r\nConnection: "sv, headerEnd = "\r\n\r\n"sv;
+
+	size_t szResponse = statusLine.size() + dateHeader.size() +
+						contentTypeName.size() + contentType.size() +
+						contentLengthName.size() + szContentLength +
+						headerEnd.size() + body.size();
+	if (connectionOption.size())
+		szResponse += connectionName.size() + connectionOption.size();
+
+	// The whole response is sized up front and copied in piece by piece.
+	if (!responseData.resizeUninitialized(szResponse))
+		return netknot::OutOfMemoryError::alloc();
+
+	char *p = responseData.data();
+	auto put = [&p](const std::string_view &data) noexcept {
+		memcpy(p, data.data(), data.size());
+		p += data.size();
+	};
+
+	put(statusLine);
+	put(dateHeader);
+	put(contentTypeName);
+	put(contentType);
+	put(contentLengthName);
+	put(std::string_view(contentLength, szContentLength));
+	if (connectionOption.size()) {
+		put(connectionName);
+		put(connectionOption);
+	}
+	put(headerEnd);
+	put(body);
 
 	this->stage = HttpURLHandlerStateStage::End;
 
 	return {};
 }
 
-HttpRequestHandler::HttpRequestHandler(const std::string_view &methodName) noexcept : _methodName(methodName) {}
-HttpRequestHandler::~HttpRequestHandler() {}
-
-HttpRequestHandlerRegistry::HttpRequestHandlerRegistry(peff::Alloc *allocator) : allocator(allocator), baseUrl(allocator), handlers(allocator) {
+netknot::ExceptionPointer HttpURLHandlerState::pullRequestBody() const {
+	return exchange->pullRequestBody();
 }
 
-HttpRequestHandlerRegistry::~HttpRequestHandlerRegistry() {
-}
+netknot::ExceptionPointer HttpURLHandlerState::beginStream(size_t szContentLength) {
+	if (this->stage != HttpURLHandlerStateStage::ResponseHeaders)
+		std::terminate();
 
-HttpAcceptAsyncCallback::HttpAcceptAsyncCallback(HttpServer *httpServer, peff::Alloc *selfAllocator) noexcept : httpServer(httpServer), selfAllocator(selfAllocator) {
-}
-HttpAcceptAsyncCallback::~HttpAcceptAsyncCallback() {
+	return exchange->beginResponseStream(szContentLength);
 }
-void HttpAcceptAsyncCallback::onRefZero() noexcept {
-	peff::destroyAndRelease<HttpAcceptAsyncCallback>(selfAllocator.get(), this, alignof(HttpAcceptAsyncCallback));
+
+netknot::ExceptionPointer HttpURLHandlerState::writeStream(const std::string_view &data) {
+	if (this->stage != HttpURLHandlerStateStage::ResponseStream)
+		std::terminate();
+
+	return exchange->writeResponseStream(data);
 }
-netknot::ExceptionPointer HttpAcceptAsyncCallback::onAccepted(netknot::Socket *socket) noexcept {
-	peff::UniquePtr<netknot::Socket, peff::DeallocableDeleter<netknot::Socket>> s(socket);
 
-	peff::UniquePtr<Connection, peff::DeallocableDeleter<Connection>> conn(Connection::alloc(selfAllocator.get(), httpServer, socket));
+netknot::ExceptionPointer HttpURLHandlerState::writeStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) {
+	if (this->stage != HttpURLHandlerStateStage::ResponseStream)
+		std::terminate();
 
-	if (!conn)
-		return netknot::OutOfMemoryError::alloc();
+	return exchange->writeResponseStreamFile(file, offset, size);
+}
 
-	s.release();
+netknot::ExceptionPointer HttpURLHandlerState::writeStreamBuffer(const netknot::RcBufferRef &buffer) {
+	if (this->stage != HttpURLHandlerStateStage::ResponseStream)
+		std::terminate();
 
-	if (!httpServer->addConnection(conn.get()))
-		return netknot::OutOfMemoryError::alloc();
+	return exchange->writeResponseStreamBuffer(buffer);
+}
 
-	netknot::ReadAsyncTask *task;
+netknot::ExceptionPointer HttpURLHandlerState::endStream() {
+	if (this->stage != HttpURLHandlerStateStage::ResponseStream)
+		std::terminate();
 
-	EmplaceBuffer bb(buffer, sizeof(buffer));
-	netknot::RcBufferRef bufferRef(&*(emplaceBuffer = peff::Option<EmplaceBuffer>(std::move(bb))));
+	return exchange->endResponseStream();
+}
 
-	if (!(conn->requestCallback = peff::allocAndConstruct<HttpReadAsyncCallback>(
-			  httpServer->allocator.get(), alignof(HttpReadAsyncCallback),
-			  httpServer,
-			  conn.get(),
-			  &peff::g_nullAlloc,
-			  httpServer->allocator.get())))
-		return netknot::OutOfMemoryError::alloc();
-	NETKNOT_RETURN_IF_EXCEPT(conn->socket->readAsync(
-		selfAllocator.get(),
-		bufferRef,
-		conn->requestCallback.get(),
-		task));
+HttpResponseFile::HttpResponseFile(netknot::NativeFileHandle handle) noexcept : handle(handle) {}
+HttpResponseFile::~HttpResponseFile() {}
 
-	conn.release();
+HttpRequestHandler::HttpRequestHandler(const std::string_view &methodName) noexcept : _methodName(methodName) {}
+HttpRequestHandler::~HttpRequestHandler() {}
+netknot::ExceptionPointer HttpRequestHandler::onRequestBody(const HttpURLHandlerState &state, const netknot::RcBufferRef &data) {
+	return state.pullRequestBody();
+}
+netknot::ExceptionPointer HttpRequestHandler::onResponseWritable(const HttpURLHandlerState &state) {
+	return {};
+}
+
+HttpAcceptAsyncCallback::HttpAcceptAsyncCallback(HttpServer *httpServer, peff::Alloc *selfAllocator) noexcept : httpServer(httpServer), selfAllocator(selfAllocator) {
+}
+HttpAcceptAsyncCallback::~HttpAcceptAsyncCallback() {
+}
+void HttpAcceptAsyncCallback::onRefZero() noexcept {
+	peff::destroyAndRelease<HttpAcceptAsyncCallback>(selfAllocator.get(), this, alignof(HttpAcceptAsyncCallback));
+}
+netknot::ExceptionPointer HttpAcceptAsyncCallback::onAccepted(netknot::Socket *socket) noexcept {
+	NETKNOT_RETURN_IF_EXCEPT(httpServer->addConnection(socket));
 
 	peff::RcObjectPtr<netknot::AcceptAsyncTask> acceptAsyncTask;
 	if (auto e = httpServer->serverSocket->acceptAsync(peff::getDefaultAlloc(), this, acceptAsyncTask.getRef()); e) {
@@ -170,9 +331,18 @@ size_t EmplaceBuffer::decRef(size_t globalRc) {
 	return 0;
 }
 
-HttpRequestHeaderView::HttpRequestHeaderView(peff::Alloc *allocator) : headers(allocator) {}
-
-HttpReadAsyncCallback::HttpReadAsyncCallback(HttpServer *httpServer, Connection *connection, peff::Alloc *selfAllocator, peff::Alloc *allocator) : httpServer(httpServer), connection(connection), selfAllocator(selfAllocator), allocator(allocator), requestLine(allocator), requestHeader(allocator), body(allocator), requestHeaderView(allocator) {
+HttpReadAsyncCallback::HttpReadAsyncCallback(HttpServer *httpServer, Connection *connection, peff::Alloc *selfAllocator, peff::Alloc *allocator)
+	: httpServer(httpServer),
+	  connection(connection),
+	  selfAllocator(selfAllocator),
+	  allocator(allocator),
+	  requestArena(allocator),
+	  parser(&requestArena, httpServer->maxRequestHeadSize),
+	  requestHeaderView(&requestArena),
+	  handlerState{ httpServer, connection, this, {}, {}, {}, {}, requestHeaderView, {}, &requestArena, peff::String(&requestArena) },
+	  pinnedBuffers(&requestArena),
+	  pendingResponses(allocator),
+	  responsePiecePrefix(allocator) {
 }
 
 HttpReadAsyncCallback::~HttpReadAsyncCallback() {
@@ -182,264 +352,882 @@ void HttpReadAsyncCallback::onRefZero() noexcept {
 	peff::destroyAndRelease<HttpReadAsyncCallback>(selfAllocator.get(), this, alignof(HttpReadAsyncCallback));
 }
 
-peff::Option<HttpRequestLineView> HttpReadAsyncCallback::parseHttpRequestLine(std::string_view requestLine) {
-	std::string_view sv = requestLine;
-	HttpRequestLineView view;
+netknot::ExceptionPointer HttpReadAsyncCallback::start() {
+	return _readReceiveBuffer();
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_readReceiveBuffer() {
+	if (isClosed)
+		return closeConnection();
+
+	if ((!receiveBuffer) || (szReceiveBufferUsed == receiveBuffer.size)) {
+		HttpReceiveBuffer *buffer = httpServer->receiveBufferPool.alloc();
 
-	size_t separator;
+		if (!buffer)
+			return netknot::OutOfMemoryError::alloc();
 
-	if ((separator = sv.find(' ')) == std::string_view::npos) {
+		netknot::RcBufferRef newBuffer(buffer);
+
+		// The filled buffer stays pinned if the parser may have views into it,
+		// a buffer with body data only is kept alive by the handler as needed.
+		if (receiveBuffer && isReceiveBufferReferenced) {
+			if (!pinnedBuffers.pushBack(std::move(receiveBuffer)))
+				return netknot::OutOfMemoryError::alloc();
+		}
+
+		receiveBuffer = std::move(newBuffer);
+		szReceiveBufferUsed = 0;
+		isReceiveBufferReferenced = false;
+	}
+
+	// The read may complete inline, the state is updated before it is issued.
+	isReading = true;
+
+	peff::RcObjectPtr<netknot::ReadAsyncTask> task;
+	if (netknot::ExceptionPointer e = connection->socket->readAsync(
+			httpServer->allocator.get(),
+			netknot::RcBufferRef(receiveBuffer.buffer.get(), szReceiveBufferUsed, receiveBuffer.size - szReceiveBufferUsed),
+			this,
+			task.getRef());
+		e) {
+		isReading = false;
+		return e;
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_readMore() {
+	// Nothing can be handled until more data arrive, send what have been answered so far.
+	NETKNOT_RETURN_IF_EXCEPT(_flushResponses());
+
+	// The peer is not taking the responses, stop taking its requests until the write is done.
+	if (isWriting && (pendingResponses.size() >= httpServer->maxPendingResponseSize)) {
+		isReadSuspended = true;
 		return {};
 	}
-	view.method = sv.substr(0, separator);
 
-	sv = sv.substr(separator + 1);
+	return _readReceiveBuffer();
+}
+
+void HttpReadAsyncCallback::_releaseRequest(bool hasPipelinedData) noexcept {
+	// The views are dropped before the buffers they point into.
+	// Everything on the arena is replaced with empty objects, so nothing refers to the arena when it is reset.
+	requestLineView = {};
+	requestHeaderView = HttpRequestHeaderView(&requestArena);
+	parser = HttpRequestParser(&requestArena, httpServer->maxRequestHeadSize);
+	pinnedBuffers = peff::DynArray<netknot::RcBufferRef>(&requestArena);
+	isReceiveBufferReferenced = false;
+
+	// Nothing in the receive buffer is referenced anymore, reuse it from the beginning.
+	if ((!hasPipelinedData) && receiveBuffer && ((HttpReceiveBuffer *)receiveBuffer.buffer.get())->isUniquelyReferenced())
+		szReceiveBufferUsed = 0;
+
+	currentHandler = nullptr;
+	handlerState.responseData = peff::String(&requestArena);
+
+	parseStatus = HttpParseStatus::Head;
+	expectedBodySize = 0;
+	szBodyRead = 0;
+	isChunked = false;
+	chunkedDecoder.reset();
+	isBodyPulled = true;
+	isProcessingPaused = false;
+	pausedData = nullptr;
+	szPausedData = 0;
+	responseFraming = HttpResponseStreamFraming::ContentLength;
+	szResponseBodyLeft = 0;
+	isResponseBlocked = false;
+
+	requestArena.reset();
+}
 
-	if ((separator = sv.find(' ')) == std::string_view::npos) {
+// Check if a comma-separated list of the Connection header contains the option.
+static bool hasConnectionOption(std::string_view value, std::string_view option) noexcept {
+	while (value.size()) {
+		size_t offSeparator = value.find(',');
+		std::string_view item = value.substr(0, offSeparator);
+
+		while (item.size() && ((item.front() == ' ') || (item.front() == '\t')))
+			item.remove_prefix(1);
+		while (item.size() && ((item.back() == ' ') || (item.back() == '\t')))
+			item.remove_suffix(1);
+
+		if (isHttpHeaderNameEqual(item, option))
+			return true;
+
+		if (offSeparator == std::string_view::npos)
+			break;
+		value.remove_prefix(offSeparator + 1);
+	}
+
+	return false;
+}
+
+bool HttpReadAsyncCallback::_isHttp2Preface() const noexcept {
+	// The preface is taken as a request head "PRI * HTTP/2.0" without any header, "SM" and the empty line after it are left.
+	if ((requestLineView.method != "PRI"sv) || (requestLineView.path != "*"sv) || (requestLineView.version != "HTTP/2.0"sv))
+		return false;
+
+	if (requestHeaderView.otherHeaders.size())
+		return false;
+
+	for (size_t i = 0; i < HTTP_HEADER_ID_COUNT; ++i) {
+		if (requestHeaderView.has((HttpHeaderId)i))
+			return false;
+	}
+
+	return true;
+}
+
+bool HttpReadAsyncCallback::_isHttp2Upgrade() const noexcept {
+	// The body of a request would be received before the switch, only the requests without a body are upgraded.
+	if (isHttp10 || (!isKeepAlive) || isChunked || expectedBodySize)
+		return false;
+
+	if ((!requestHeaderView.has(HttpHeaderId::Upgrade)) || (!hasConnectionOption(requestHeaderView.get(HttpHeaderId::Upgrade), "h2c"sv)))
+		return false;
+
+	// The upgrade carries exactly one HTTP2-Settings header, which must be listed by Connection along with Upgrade.
+	if (!requestHeaderView.has(HttpHeaderId::Http2Settings))
+		return false;
+
+	for (size_t i = 0; i < requestHeaderView.otherHeaders.size(); ++i) {
+		if (isHttpHeaderNameEqual(requestHeaderView.otherHeaders.at(i).name, "HTTP2-Settings"sv))
+			return false;
+	}
+
+	if (!requestHeaderView.has(HttpHeaderId::Connection))
+		return false;
+
+	const std::string_view connectionValue = requestHeaderView.get(HttpHeaderId::Connection);
+
+	return hasConnectionOption(connectionValue, "Upgrade"sv) && hasConnectionOption(connectionValue, "HTTP2-Settings"sv);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_startHttp2(const char *data, size_t size, bool isUpgrade) {
+	Http2Session *session = Http2Session::alloc(allocator.get(), this);
+
+	if (!session)
+		return netknot::OutOfMemoryError::alloc();
+
+	http2Session = decltype(http2Session)(session);
+
+	if (isUpgrade) {
+		if (!session->applyUpgradeSettings(requestHeaderView.get(HttpHeaderId::Http2Settings))) {
+			http2Session.reset();
+			return _rejectRequest(HttpResponseStatus::BadRequest);
+		}
+
+		// The switch is answered in HTTP/1.1, the frames of the server follow at once.
+		if (!pendingResponses.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"sv))
+			return netknot::OutOfMemoryError::alloc();
+	}
+
+	NETKNOT_RETURN_IF_EXCEPT(session->start(isUpgrade ? 0 : HTTP2_CONNECTION_PREFACE.size() - "SM\r\n\r\n"sv.size()));
+
+	// The request of the upgrade becomes the stream 1, which is answered in HTTP/2.
+	if (isUpgrade)
+		NETKNOT_RETURN_IF_EXCEPT(session->startUpgradedStream(requestLineView, requestHeaderView));
+
+	_releaseRequest(size != 0);
+
+	return session->processReceived(data, size);
+}
+
+void HttpReadAsyncCallback::_updateKeepAlive() noexcept {
+	// HTTP/1.0 connections are closed after the response by default.
+	isHttp10 = requestLineView.version == "HTTP/1.0"sv;
+	isKeepAlive = !isHttp10;
+
+	if (requestHeaderView.has(HttpHeaderId::Connection)) {
+		std::string_view connectionValue = requestHeaderView.get(HttpHeaderId::Connection);
+
+		if (hasConnectionOption(connectionValue, "close"sv))
+			isKeepAlive = false;
+		else if (hasConnectionOption(connectionValue, "keep-alive"sv))
+			isKeepAlive = true;
+	}
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_queueResponse(const peff::String &responseData) {
+	if (!pendingResponses.append(std::string_view(responseData.data(), responseData.size())))
+		return netknot::OutOfMemoryError::alloc();
+
+	return {};
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_flushResponses() {
+	// The responses queued meanwhile are sent when the write in flight is done.
+	if (isWriting)
+		return {};
+
+	// Nothing can be sent anymore, the responses are dropped.
+	if (isClosed) {
+		_discardResponses();
+		return closeConnection();
+	}
+
+	if (_isResponsePieceQueued()) {
+		if (responsePiecePrefix.size())
+			return _writeResponses(responsePiecePrefix);
+		return _sendResponsePiece();
+	}
+
+	if (!pendingResponses.size()) {
+		// Every response has been written, unless a streamed one is still going on.
+		if ((!isKeepAlive) && (handlerState.stage != HttpURLHandlerStateStage::ResponseStream))
+			return closeConnection();
+		return {};
+	}
+
+	return _writeResponses(pendingResponses);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_writeResponses(peff::String &responses) {
+	if (!connection->responseCallback) {
+		if (!(connection->responseCallback = peff::allocAndConstruct<HttpWriteAsyncCallback>(
+				  httpServer->allocator.get(), alignof(HttpWriteAsyncCallback),
+				  httpServer, connection, httpServer->allocator.get(), httpServer->allocator.get())))
+			return netknot::OutOfMemoryError::alloc();
+	}
+	HttpWriteAsyncCallback *callback = connection->responseCallback.get();
+
+	// All the responses queued so far go out in one write.
+	// The buffers are swapped rather than moved, so the queue reuses the storage of the last write.
+	std::swap(callback->bufferData, responses);
+	responses.clear();
+	callback->buffer = EmplaceBuffer(callback->bufferData.data(), callback->bufferData.size());
+	netknot::RcBufferRef bufferRef(&*callback->buffer);
+
+	// The write may complete inline, the state is updated before it is issued.
+	isWriting = true;
+
+	peff::RcObjectPtr<netknot::WriteAsyncTask> task;
+	if (netknot::ExceptionPointer e = connection->socket->writeAsync(httpServer->allocator.get(), bufferRef, callback, task.getRef()); e) {
+		isWriting = false;
+		return e;
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_sendResponsePiece() {
+	isWriting = true;
+
+	// The piece is released even if the connection is broken.
+	auto onPieceWritten = [this](netknot::AsyncTaskStatus status, size_t szWritten, const netknot::RcBufferRef &buffer, netknot::ExceptionPointer &exception) noexcept -> netknot::ExceptionPointer {
+		responseFile.reset();
+		responseBuffer = {};
+
+		if (status != netknot::AsyncTaskStatus::Done) {
+			exception.reset();
+			return onResponsesFailed();
+		}
+
+		return onResponsesWritten();
+	};
+
+	peff::RcObjectPtr<netknot::WriteAsyncTask> task;
+	netknot::ExceptionPointer e;
+
+	if (responseFile)
+		e = connection->socket->sendFileAsync(httpServer->allocator.get(), responseFile->handle, responseFileOffset, szResponseFile, onPieceWritten, task.getRef());
+	else
+		e = connection->socket->writeAsync(httpServer->allocator.get(), responseBuffer, onPieceWritten, task.getRef());
+
+	if (e) {
+		isWriting = false;
+		return e;
+	}
+
+	return {};
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::onResponsesWritten() {
+	isWriting = false;
+
+	connection->worker->touchConnection(connection);
+
+	if (http2Session) {
+		// The session fills the next write with the frames of its streams.
+		NETKNOT_RETURN_IF_EXCEPT(http2Session->onResponsesWritten());
+	} else {
+		NETKNOT_RETURN_IF_EXCEPT(_flushResponses());
+	}
+
+	// The streamed response has been refused, let the handler go on.
+	if (isResponseBlocked && (!_isResponsePieceQueued()) && (pendingResponses.size() < httpServer->maxPendingResponseSize)) {
+		isResponseBlocked = false;
+		NETKNOT_RETURN_IF_EXCEPT(currentHandler->onResponseWritable(handlerState));
+	}
+
+	if (isReadSuspended) {
+		isReadSuspended = false;
+		return _readReceiveBuffer();
+	}
+
+	return {};
+}
+
+void HttpReadAsyncCallback::_discardResponses() noexcept {
+	pendingResponses.clear();
+	responsePiecePrefix.clear();
+	responseFile.reset();
+	responseBuffer = {};
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::onResponsesFailed() {
+	isWriting = false;
+	isKeepAlive = false;
+
+	_discardResponses();
+	NETKNOT_RETURN_IF_EXCEPT(closeConnection());
+
+	// The handler waiting to stream more goes on, the data it writes are discarded until it ends the stream.
+	if (isResponseBlocked) {
+		isResponseBlocked = false;
+		NETKNOT_RETURN_IF_EXCEPT(currentHandler->onResponseWritable(handlerState));
+	}
+
+	return {};
+}
+
+/// @brief Release of a connection, posted to its worker as the callbacks returning may still refer to the connection.
+class ConnectionRelease {
+public:
+	Connection *connection;
+
+	NETKNOT_FORCEINLINE ConnectionRelease(Connection *connection) noexcept : connection(connection) {
+	}
+
+	NETKNOT_FORCEINLINE netknot::ExceptionPointer operator()() noexcept {
+		connection->worker->releaseConnection(connection);
 		return {};
 	}
-	view.path = sv.substr(0, separator);
+};
+
+netknot::ExceptionPointer HttpReadAsyncCallback::closeConnection() {
+	isClosed = true;
+
+	// The operations in flight fail once the connection is shut down, the connection is released when they return.
+	if (isReading || isWriting) {
+		connection->socket->shutdown();
+		return {};
+	}
+
+	// The streams are dropped, the handlers waiting to stream more are told to go on.
+	if (http2Session)
+		http2Session->onConnectionClosed();
+
+	// The handler in control still refers to the connection, it is released after the handler lets go.
+	if (isHandlerInControl() || isReleasing)
+		return {};
+
+	isReleasing = true;
+
+	return httpServer->ioService->post(connection->worker->workerId, ConnectionRelease(connection));
+}
+
+bool HttpReadAsyncCallback::isHandlerInControl() const noexcept {
+	if (http2Session)
+		return http2Session->isHandlerInControl();
+
+	return isProcessingPaused;
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_queueErrorResponse(HttpResponseStatus status) {
+	HttpURLHandlerState urlHandlerState = {
+		httpServer,
+		connection,
+		this,
+		{},
+		{},
+		{},
+		{},
+		requestHeaderView,
+		_getConnectionOption(),
+		&requestArena,
+		peff::String(&requestArena)
+	};
+
+	NETKNOT_RETURN_IF_EXCEPT(urlHandlerState.writeResponse(status, "text/plain", ""));
+
+	return _queueResponse(urlHandlerState.responseData);
+}
 
-	sv = sv.substr(separator + 1);
-	view.version = sv;
+netknot::ExceptionPointer HttpReadAsyncCallback::_rejectRequest(HttpResponseStatus status) {
+	// Where the next request begins is unknown, the connection is closed after the response.
+	isKeepAlive = false;
 
-	return std::move(view);
+	NETKNOT_RETURN_IF_EXCEPT(_queueErrorResponse(status));
+
+	_releaseRequest(false);
+
+	return _flushResponses();
 }
 
-peff::Option<HttpRequestHeaderView> HttpReadAsyncCallback::parseHttpRequestHeader(std::string_view requestHeader, peff::Alloc *allocator) {
-	std::string_view sv = requestHeader;
-	HttpRequestHeaderView view(allocator);
+bool HttpReadAsyncCallback::_parseBodyLength(HttpResponseStatus &errorStatusOut) noexcept {
+	if (requestHeaderView.has(HttpHeaderId::TransferEncoding)) {
+		// A length along with the chunked coding may be interpreted differently by the intermediaries.
+		if (requestHeaderView.has(HttpHeaderId::ContentLength)) {
+			errorStatusOut = HttpResponseStatus::BadRequest;
+			return false;
+		}
 
-	size_t separator;
+		// Only the chunked coding alone is supported.
+		if (!isHttpHeaderNameEqual(requestHeaderView.get(HttpHeaderId::TransferEncoding), "chunked"sv)) {
+			errorStatusOut = HttpResponseStatus::NotImplemented;
+			return false;
+		}
 
-	std::string_view name;
-	std::string_view content;
+		isChunked = true;
+		return true;
+	}
 
-	while (sv.size()) {
-		name = {};
-		content = {};
+	if (requestHeaderView.has(HttpHeaderId::ContentLength)) {
+		std::string_view contentLengthValue = requestHeaderView.get(HttpHeaderId::ContentLength);
+		size_t contentLength = 0, curDigit;
 
-		if ((separator = sv.find(':')) == std::string_view::npos) {
-			return {};
+		if (!contentLengthValue.size()) {
+			errorStatusOut = HttpResponseStatus::BadRequest;
+			return false;
 		}
-		name = sv.substr(0, separator);
 
-		sv = sv.substr(separator + 1);
+		for (auto i : contentLengthValue) {
+			if ((i < '0' || i > '9')) {
+				errorStatusOut = HttpResponseStatus::BadRequest;
+				return false;
+			}
+
+			if (SIZE_MAX / 10 < contentLength) {
+				errorStatusOut = HttpResponseStatus::PayloadTooLarge;
+				return false;
+			}
+			contentLength *= 10;
 
-		if ((separator = sv.find_first_not_of(' ')) == std::string_view::npos) {
-			return {};
+			curDigit = i - '0';
+			if (SIZE_MAX - curDigit < contentLength) {
+				errorStatusOut = HttpResponseStatus::PayloadTooLarge;
+				return false;
+			}
+			contentLength += curDigit;
 		}
-		sv = sv.substr(separator + 1);
 
-		size_t endOfLine;
-		if ((endOfLine = sv.find("\r\n")) == std::string_view::npos) {
-			return {};
+		// The body is refused before any of it is received.
+		if (contentLength > httpServer->maxRequestBodySize) {
+			errorStatusOut = HttpResponseStatus::PayloadTooLarge;
+			return false;
 		}
 
-		content = sv.substr(0, endOfLine);
-		sv = sv.substr(endOfLine + 2);
+		expectedBodySize = contentLength;
+	}
+
+	return true;
+}
+
+void HttpReadAsyncCallback::_routeRequest() noexcept {
+	handlerState.connectionOption = _getConnectionOption();
+
+	httpServer->routeRequest(requestLineView.path, requestLineView.method, routeTable, handlerState, currentHandler, routeStatus);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_deliverBody(const char *data, size_t size) {
+	// Nobody takes the body of a request answered with an error, it is discarded as it arrives.
+	if (!currentHandler)
+		return {};
+
+	// The data are always in the receive buffer, which the piece refers to without copying.
+	netknot::RcBufferRef piece(receiveBuffer.buffer.get(), (size_t)(data - receiveBuffer.buffer->data), size);
+
+	// The handler may pull the next piece before returning.
+	isBodyPulled = false;
+
+	return currentHandler->onRequestBody(handlerState, piece);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_pauseProcessing(const char *data, size_t size) {
+	// The rest of the data stay in the receive buffer, which is not read into until the handler
+	// pulls the body or ends the streamed response.
+	isProcessingPaused = true;
+	pausedData = data;
+	szPausedData = size;
+
+	// Send what have been answered so far while waiting.
+	return _flushResponses();
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::pullRequestBody() {
+	if (parseStatus != HttpParseStatus::Body)
+		return {};
+
+	isBodyPulled = true;
+
+	// Pulled from onRequestBody(), the body goes on when it returns.
+	if (!isProcessingPaused)
+		return {};
+
+	isProcessingPaused = false;
+	return _processReceived(pausedData, szPausedData);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::beginResponseStream(size_t szContentLength) {
+	if (szContentLength != HTTP_CONTENT_LENGTH_UNKNOWN) {
+		char contentLength[HTTP_DECIMAL_MAX_SIZE];
+
+		NETKNOT_RETURN_IF_EXCEPT(handlerState.writeHeader("Content-Length"sv, std::string_view(contentLength, formatHttpDecimal(contentLength, szContentLength))));
+
+		responseFraming = HttpResponseStreamFraming::ContentLength;
+		szResponseBodyLeft = szContentLength;
+	} else if (isHttp10) {
+		// HTTP/1.0 has no chunked coding, the body ends when the connection is closed.
+		isKeepAlive = false;
+		handlerState.connectionOption = _getConnectionOption();
+
+		responseFraming = HttpResponseStreamFraming::ConnectionClose;
+	} else {
+		NETKNOT_RETURN_IF_EXCEPT(handlerState.writeHeader("Transfer-Encoding"sv, "chunked"sv));
 
-		if (!view.headers.insert(std::move(name), std::move(content)))
-			return {};
+		responseFraming = HttpResponseStreamFraming::Chunked;
 	}
 
-	return std::move(view);
+	NETKNOT_RETURN_IF_EXCEPT(handlerState.endHeader());
+	handlerState.stage = HttpURLHandlerStateStage::ResponseStream;
+
+	// The headers go out at once for the peer to see the response started.
+	NETKNOT_RETURN_IF_EXCEPT(_queueResponse(handlerState.responseData));
+	handlerState.responseData.clear();
+
+	return _flushResponses();
 }
 
-netknot::ExceptionPointer HttpReadAsyncCallback::onStatusChanged(netknot::ReadAsyncTask *task) noexcept {
-	switch (task->getStatus()) {
-		case netknot::AsyncTaskStatus::Done: {
-			const char *const p = task->getBuffer();
-			const size_t realSize = task->getCurrentReadSize();
-			std::string_view sv(p, realSize);
-			size_t offNext = 0;
-
-			auto readNext = [this, task]() -> netknot::ExceptionPointer {
-				peff::RcObjectPtr<netknot::ReadAsyncTask> taskReceiver;
-				return connection->socket->readAsync(httpServer->allocator.get(), task->getBufferRef(), this, taskReceiver.getRef());
-			};
-
-			switch (parseStatus) {
-				case HttpParseStatus::Initial: {
-					size_t offSeparator = sv.find("\r\n");
-
-					if (offSeparator != std::string_view::npos) {
-						std::string_view requestLineSv = sv.substr(0, offSeparator);
-						if (!requestLine.append(requestLineSv)) {
-							return netknot::OutOfMemoryError::alloc();
-						}
-
-						offNext = offSeparator + 2;
-
-						if (offNext >= sv.size())
-							return readNext();
-
-						sv = sv.substr(offNext);
-					} else {
-						if (!requestLine.append(sv)) {
-							return netknot::OutOfMemoryError::alloc();
-						}
-						std::string_view combinedSv = requestLine;
-						if ((offSeparator = combinedSv.find("\r\n")) == std::string_view::npos)
-							return readNext();
-					}
+netknot::ExceptionPointer HttpReadAsyncCallback::writeResponseStream(const std::string_view &data) {
+	if (!data.size())
+		return {};
 
-					if (auto result = parseHttpRequestLine(requestLine); result.hasValue()) {
-						requestLineView = result.move();
-					} else {
-						std::terminate();
-					}
+	// The unsent data are bounded, the handler waits until the peer takes the data in flight.
+	if (_isResponsePieceQueued() || (pendingResponses.size() >= httpServer->maxPendingResponseSize)) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
 
-					parseStatus = HttpParseStatus::Header;
-					[[fallthrough]];
-				}
-				case HttpParseStatus::Header: {
-					size_t offSeparator = sv.find("\r\n\r\n");
+	switch (responseFraming) {
+		case HttpResponseStreamFraming::ContentLength:
+			if (data.size() > szResponseBodyLeft)
+				return _abortResponseStream();
+			szResponseBodyLeft -= data.size();
 
-					if (offSeparator != std::string_view::npos) {
-						if (!requestHeader.append(sv.substr(0, offSeparator + 2)))
-							return netknot::OutOfMemoryError::alloc();
-						offNext = offSeparator + 4;
+			if (!pendingResponses.append(data))
+				return netknot::OutOfMemoryError::alloc();
+			break;
+		case HttpResponseStreamFraming::Chunked: {
+			char chunkSize[HTTP_HEX_MAX_SIZE];
+			const size_t szChunkSize = formatHttpHex(chunkSize, data.size());
+
+			if (!pendingResponses.append(std::string_view(chunkSize, szChunkSize)))
+				return netknot::OutOfMemoryError::alloc();
+			if (!pendingResponses.append("\r\n"sv))
+				return netknot::OutOfMemoryError::alloc();
+			if (!pendingResponses.append(data))
+				return netknot::OutOfMemoryError::alloc();
+			if (!pendingResponses.append("\r\n"sv))
+				return netknot::OutOfMemoryError::alloc();
+			break;
+		}
+		case HttpResponseStreamFraming::ConnectionClose:
+			if (!pendingResponses.append(data))
+				return netknot::OutOfMemoryError::alloc();
+			break;
+	}
 
-						sv = sv.substr(offNext);
-					} else {
-						if (!requestHeader.append(sv))
-							return netknot::OutOfMemoryError::alloc();
+	return _flushResponses();
+}
 
-						std::string_view combinedSv = requestHeader;
+netknot::ExceptionPointer HttpReadAsyncCallback::_queueResponsePiece(size_t size) {
+	char chunkSize[HTTP_HEX_MAX_SIZE];
 
-						size_t off = combinedSv.find("\r\n\r\n");
-						if (off == std::string_view::npos)
-							return readNext();
-					}
+	switch (responseFraming) {
+		case HttpResponseStreamFraming::ContentLength:
+			if (size > szResponseBodyLeft)
+				return _abortResponseStream();
+			szResponseBodyLeft -= size;
+			break;
+		case HttpResponseStreamFraming::Chunked:
+			if (!pendingResponses.append(std::string_view(chunkSize, formatHttpHex(chunkSize, size))))
+				return netknot::OutOfMemoryError::alloc();
+			if (!pendingResponses.append("\r\n"sv))
+				return netknot::OutOfMemoryError::alloc();
+			break;
+		case HttpResponseStreamFraming::ConnectionClose:
+			break;
+	}
 
-					if (auto result = parseHttpRequestHeader(requestHeader, allocator.get()); result.hasValue()) {
-						requestHeaderView = result.move();
-					} else {
-						std::terminate();
-					}
+	responsePiecePrefix = std::move(pendingResponses);
+	pendingResponses.clear();
 
-					if (auto it = requestHeaderView.headers.find("Transfer-Encoding"); it != requestHeaderView.headers.end()) {
-						transferEncoding = it.value();
+	// The end of the chunk follows the piece.
+	if (responseFraming == HttpResponseStreamFraming::Chunked) {
+		if (!pendingResponses.append("\r\n"sv))
+			return netknot::OutOfMemoryError::alloc();
+	}
 
-						if (transferEncoding == "chunked") {
-							isChunked = true;
-							goto noContentLength;
-						}
-					}
-					if (auto it = requestHeaderView.headers.find("Content-Length"); it != requestHeaderView.headers.end()) {
-						size_t contentLength = 0, curDigit;
+	return {};
+}
 
-						for (auto i : it.value()) {
-							if ((i < '0' || i > '9'))
-								std::terminate();
+netknot::ExceptionPointer HttpReadAsyncCallback::writeResponseStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) {
+	if (!size)
+		return {};
 
-							if (SIZE_MAX / 10 < contentLength)
-								std::terminate();
-							contentLength *= 10;
+	// Only one piece waits at a time, so it only needs to be ordered with the responses around it.
+	if (_isResponsePieceQueued()) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
 
-							curDigit = i - '0';
-							if (SIZE_MAX - curDigit < contentLength)
-								std::terminate();
-							contentLength += curDigit;
-						}
+	NETKNOT_RETURN_IF_EXCEPT(_queueResponsePiece(size));
 
-						if (!body.resizeUninitialized(contentLength)) {
-							return netknot::OutOfMemoryError::alloc();
-						}
+	responseFile = file;
+	responseFileOffset = offset;
+	szResponseFile = size;
 
-						expectedBodySize = contentLength;
+	return _flushResponses();
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::writeResponseStreamBuffer(const netknot::RcBufferRef &buffer) {
+	if (!buffer.size)
+		return {};
+
+	if (_isResponsePieceQueued()) {
+		isResponseBlocked = true;
+		return netknot::WouldBlockError::alloc();
+	}
+
+	NETKNOT_RETURN_IF_EXCEPT(_queueResponsePiece(buffer.size));
+
+	responseBuffer = buffer;
+
+	return _flushResponses();
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_abortResponseStream() {
+	// The peer cannot find the end of the body anymore, it sees the connection closed before the announced length.
+	// The rest of the stream is taken as if it was ended by closing the connection, which discards it.
+	responseFraming = HttpResponseStreamFraming::ConnectionClose;
+	isKeepAlive = false;
+
+	NETKNOT_RETURN_IF_EXCEPT(closeConnection());
+
+	return netknot::InvalidArgsError::alloc();
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::endResponseStream() {
+	netknot::ExceptionPointer abortExcept;
+
+	switch (responseFraming) {
+		case HttpResponseStreamFraming::ContentLength:
+			// The stream is ended anyway, so the handler lets go of the connection.
+			if (szResponseBodyLeft)
+				abortExcept = _abortResponseStream();
+			break;
+		case HttpResponseStreamFraming::Chunked:
+			if (!pendingResponses.append("0\r\n\r\n"sv))
+				return netknot::OutOfMemoryError::alloc();
+			break;
+		case HttpResponseStreamFraming::ConnectionClose:
+			break;
+	}
+
+	handlerState.stage = HttpURLHandlerStateStage::End;
+	isResponseBlocked = false;
+
+	// Ended in handleURL(), the request is finished when it returns.
+	if (parseStatus != HttpParseStatus::Response)
+		return abortExcept;
+
+	isProcessingPaused = false;
+
+	if (netknot::ExceptionPointer e = _processReceived(pausedData, szPausedData); e) {
+		abortExcept.reset();
+		return e;
+	}
+
+	return abortExcept;
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_handleRequest() {
+	if (!currentHandler)
+		return _queueErrorResponse(routeStatus);
+
+	NETKNOT_RETURN_IF_EXCEPT(currentHandler->handleURL(handlerState));
+
+	return _queueResponse(handlerState.responseData);
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::_processReceived(const char *data, size_t size) {
+	// The connection has switched to HTTP/2, the frames are taken by the session.
+	if (http2Session)
+		return http2Session->processReceived(data, size);
+
+	// Every request completed by the data is handled before reading again,
+	// so the responses of the pipelined requests are sent by one write.
+	for (;;) {
+		// The requests after the connection has been closed are not handled.
+		if (isClosed)
+			return _flushResponses();
+
+		if (parseStatus == HttpParseStatus::Head) {
+			size_t szConsumed;
+
+			isReceiveBufferReferenced = true;
+
+			// Only the new bytes are scanned, the parser resumes from where the last read ended.
+			switch (parser.parse(data, size, szConsumed)) {
+				case HttpParseResult::NeedMore:
+					return _readMore();
+				case HttpParseResult::Done:
+					break;
+				case HttpParseResult::Malformed:
+					return _rejectRequest(HttpResponseStatus::BadRequest);
+				case HttpParseResult::TooLarge:
+					return _rejectRequest(HttpResponseStatus::RequestHeaderFieldsTooLarge);
+				case HttpParseResult::OutOfMemory:
+					return netknot::OutOfMemoryError::alloc();
+			}
+
+			data += szConsumed;
+			size -= szConsumed;
+
+			requestLineView = parser.getRequestLineView();
+			if (!parser.buildRequestHeaderView(requestHeaderView))
+				return netknot::OutOfMemoryError::alloc();
+
+			// The preface of HTTP/2 by the prior knowledge begins like a request head, it is only expected first.
+			if (isFirstRequest) {
+				isFirstRequest = false;
+
+				if (_isHttp2Preface())
+					return _startHttp2(data, size, false);
+			}
+
+			_updateKeepAlive();
+
+			HttpResponseStatus errorStatus;
+			if (!_parseBodyLength(errorStatus))
+				return _rejectRequest(errorStatus);
+
+			if (_isHttp2Upgrade())
+				return _startHttp2(data, size, true);
+
+			_routeRequest();
+			parseStatus = HttpParseStatus::Body;
+		}
+
+		if (parseStatus == HttpParseStatus::Body) {
+			// The body is passed to the handler piece by piece as it arrives.
+			bool isBodyDone = false;
+
+			if (isChunked) {
+				while (size) {
+					size_t szConsumed, szChunkData;
+					const char *chunkData;
+
+					HttpChunkedDecodeResult result = chunkedDecoder.decode(data, size, szConsumed, chunkData, szChunkData);
+
+					data += szConsumed;
+					size -= szConsumed;
+
+					if (szChunkData) {
+						// The size of a chunked body is unknown until its end, it is checked piece by piece.
+						if ((szBodyRead += szChunkData) > httpServer->maxRequestBodySize)
+							return _rejectRequest(HttpResponseStatus::PayloadTooLarge);
+
+						NETKNOT_RETURN_IF_EXCEPT(_deliverBody(chunkData, szChunkData));
+
+						if (!isBodyPulled)
+							return _pauseProcessing(data, size);
 					}
-				noContentLength:
-
-					parseStatus = HttpParseStatus::Body;
-					if (!isChunked) {
-						if (expectedBodySize) {
-							EmplaceBuffer bb(body.data(), expectedBodySize);
-							netknot::RcBufferRef bufferRef(&*(bodyBuffer = peff::Option<EmplaceBuffer>(std::move(bb))));
-
-							netknot::ReadAsyncTask *task;
-							return connection->socket->readAsync(httpServer->allocator.get(), bufferRef, this, task);
-						}
-					} else {
-						std::terminate();
+
+					if (result == HttpChunkedDecodeResult::Done) {
+						isBodyDone = true;
+						break;
 					}
-					[[fallthrough]];
+					if (result == HttpChunkedDecodeResult::Malformed)
+						return _rejectRequest(HttpResponseStatus::BadRequest);
+					if (result == HttpChunkedDecodeResult::TooLarge)
+						return _rejectRequest(HttpResponseStatus::PayloadTooLarge);
 				}
-				case HttpParseStatus::Body: {
-					if (isChunked) {
-						std::terminate();
-					} else {
-						std::string_view rawPath = requestLineView.path;
-						std::string_view pathView, queryView, fragmentView;
-
-						HttpURLHandlerState urlHandlerState = {
-							httpServer,
-							connection,
-							pathView,
-							queryView,
-							fragmentView,
-							requestHeaderView,
-							peff::String(httpServer->allocator.get())
-						};
-
-						size_t offQuery = rawPath.find_first_of('?', 0);
-						size_t offFragment = rawPath.find_first_of('#', 0);
-
-						if (offFragment != std::string_view::npos) {
-							if (offQuery != std::string_view::npos) {
-								if (offQuery > offFragment) {
-									urlHandlerState.writeResponse(HttpResponseStatus::BadRequest, "text/plain", "");
-									goto writeResponse;
-								}
-								queryView = rawPath.substr(offQuery, offFragment - offQuery);
-								fragmentView = rawPath.substr(offFragment);
-								pathView = rawPath.substr(0, offQuery);
-							} else {
-								pathView = rawPath.substr(0, offFragment);
-								fragmentView = rawPath.substr(offFragment);
-							}
-						} else {
-							if (offQuery != std::string_view::npos) {
-								pathView = rawPath.substr(0, offQuery);
-								queryView = rawPath.substr(offQuery);
-							} else {
-								pathView = rawPath;
-							}
-						}
-
-						if (auto it = httpServer->handlerRegistries.find(pathView); it != httpServer->handlerRegistries.end()) {
-							const auto &registry = it.value();
-							if (auto jt = registry.handlers.find(requestLineView.method); jt != registry.handlers.end())
-								NETKNOT_RETURN_IF_EXCEPT(jt.value()->handleURL(urlHandlerState));
-							else
-								urlHandlerState.writeResponse(HttpResponseStatus::MethodNotAllowed, "text/plain", "");
-						} else
-							urlHandlerState.writeResponse(HttpResponseStatus::NotFound, "text/plain", "");
-
-					writeResponse:
-						if (!(connection->responseCallback = peff::allocAndConstruct<HttpWriteAsyncCallback>(
-							httpServer->allocator.get(), alignof(HttpWriteAsyncCallback),
-								  httpServer, connection, httpServer->allocator.get(), httpServer->allocator.get())))
-							return netknot::OutOfMemoryError::alloc();
-						HttpWriteAsyncCallback *callback = connection->responseCallback.get();
-
-						callback->bufferData = std::move(urlHandlerState.responseData);
-						callback->buffer = EmplaceBuffer(callback->bufferData.data(), callback->bufferData.size());
-						netknot::RcBufferRef bufferRef(&*callback->buffer);
-
-						netknot::WriteAsyncTask *task;
-						NETKNOT_RETURN_IF_EXCEPT(connection->socket->writeAsync(httpServer->allocator.get(), bufferRef, callback, task));
-					}
+			} else {
+				size_t szPiece = expectedBodySize - szBodyRead;
+				if (szPiece > size)
+					szPiece = size;
 
-					break;
-				}
+				if (szPiece)
+					NETKNOT_RETURN_IF_EXCEPT(_deliverBody(data, szPiece));
+
+				data += szPiece;
+				size -= szPiece;
+				szBodyRead += szPiece;
+
+				isBodyDone = szBodyRead == expectedBodySize;
+
+				if ((!isBodyDone) && (!isBodyPulled))
+					return _pauseProcessing(data, size);
 			}
 
-			break;
+			if (!isBodyDone)
+				return _readMore();
+
+			NETKNOT_RETURN_IF_EXCEPT(_handleRequest());
+
+			// A streamed response goes on after the handler returns, the next request waits for its end.
+			if (handlerState.stage == HttpURLHandlerStateStage::ResponseStream) {
+				parseStatus = HttpParseStatus::Response;
+				return _pauseProcessing(data, size);
+			}
+		}
+
+		// The rest of the data stay in the receive buffer, which is kept.
+		_releaseRequest(size != 0);
+
+		// The requests after the last one are discarded.
+		if (!isKeepAlive)
+			return _flushResponses();
+
+		if (!size)
+			return _readMore();
+	}
+}
+
+netknot::ExceptionPointer HttpReadAsyncCallback::onStatusChanged(netknot::ReadAsyncTask *task) noexcept {
+	isReading = false;
+
+	// The read has been woken up by closing the connection.
+	if (isClosed) {
+		task->getException().reset();
+		return closeConnection();
+	}
+
+	switch (task->getStatus()) {
+		case netknot::AsyncTaskStatus::Done: {
+			const size_t szRead = task->getCurrentReadSize();
+
+			connection->worker->touchConnection(connection);
+
+			// The peer has closed the connection, close our side after the responses are written.
+			if (!szRead) {
+				isKeepAlive = false;
+				_releaseRequest(false);
+				return _flushResponses();
+			}
+
+			szReceiveBufferUsed += szRead;
+			return _processReceived(task->getBuffer(), szRead);
 		}
 		case netknot::AsyncTaskStatus::Interrupted: {
-			break;
+			// The connection is broken, the write in flight fails as well and the rest of the responses are dropped.
+			task->getException().reset();
+			isKeepAlive = false;
+			return closeConnection();
 		}
 		default:
 			break;
@@ -458,10 +1246,12 @@ void HttpWriteAsyncCallback::onRefZero() noexcept {
 netknot::ExceptionPointer HttpWriteAsyncCallback::onStatusChanged(netknot::WriteAsyncTask *task) noexcept {
 	switch (task->getStatus()) {
 		case netknot::AsyncTaskStatus::Done: {
-			break;
+			return connection->requestCallback->onResponsesWritten();
 		}
 		case netknot::AsyncTaskStatus::Interrupted: {
-			break;
+			// Only the connection is broken, which is closed.
+			task->getException().reset();
+			return connection->requestCallback->onResponsesFailed();
 		}
 		default:
 			std::terminate();
@@ -470,178 +1260,306 @@ netknot::ExceptionPointer HttpWriteAsyncCallback::onStatusChanged(netknot::Write
 	return {};
 }
 
-netknot::ExceptionPointer HttpServer::_reserveHandlerRegistry(const std::string_view &name) {
-	HttpRequestHandlerRegistry registry(allocator.get());
+HttpServer::HttpServer(peff::Alloc *allocator, netknot::IOService *ioService, netknot::Socket *serverSocket) : allocator(allocator), ioService(ioService), receiveBufferPool(allocator, DEFAULT_RECEIVE_BUFFER_SIZE), handlers(allocator), routePatterns(allocator), routeHandlers(allocator), workers(allocator), serverSocket(serverSocket) {}
 
-	if (!registry.baseUrl.build(name))
-		return netknot::OutOfMemoryError::alloc();
+HttpServer::~HttpServer() {
+	_stopReaper();
 
-	if (!handlerRegistries.insert(registry.baseUrl, std::move(registry)))
+	// The workers have stopped, the connections left are released along with the sockets.
+	workers.clear();
+
+	if (HttpRouteTable *routeTable = _routeTable.exchange(nullptr, std::memory_order_acq_rel); routeTable)
+		routeTable->decRef(0);
+}
+
+netknot::ExceptionPointer HttpServer::_publishRouteTable(HttpRequestHandler *replacedHandler) {
+	peff::DynArray<HttpRoute> newRoutes(allocator.get());
+
+	if (!newRoutes.resizeUninitialized(routePatterns.size()))
 		return netknot::OutOfMemoryError::alloc();
 
+	for (size_t i = 0; i < routePatterns.size(); ++i) {
+		const peff::String &pattern = routePatterns.at(i);
+		HttpRequestHandler *handler = routeHandlers.at(i);
+
+		newRoutes.at(i) = { std::string_view(pattern.data(), pattern.size()), handler->_methodName, handler };
+	}
+
+	HttpRouteTable *newRouteTable;
+
+	NETKNOT_RETURN_IF_EXCEPT(HttpRouteTable::alloc(allocator.get(), newRoutes.data(), newRoutes.size(), newRouteTable));
+
+	newRouteTable->incRef(0);
+
+	HttpRouteTable *oldRouteTable;
+
+	{
+		std::lock_guard<std::mutex> routeTableGuard(_routeTableMutex);
+
+		oldRouteTable = _routeTable.exchange(newRouteTable, std::memory_order_acq_rel);
+	}
+
+	// The requests in flight keep references to the tables which they have been routed by,
+	// the replaced handler is released along with the old table after they are done.
+	if (oldRouteTable) {
+		if (replacedHandler) {
+			for (size_t i = 0; i < handlers.size(); ++i) {
+				if (handlers.at(i).get() == replacedHandler) {
+					handlers.at(i).release();
+					handlers.at(i) = std::move(handlers.at(handlers.size() - 1));
+					handlers.popBack();
+					break;
+				}
+			}
+		}
+
+		oldRouteTable->retire(newRouteTable, replacedHandler);
+		oldRouteTable->decRef(0);
+	}
+
 	return {};
 }
 
-void HttpServer::_removeHandlerRegistry(const std::string_view &name) {
-	assert(handlerRegistries.contains(name));
+void HttpServer::getRouteTable(peff::RcObjectPtr<HttpRouteTable> &routeTableOut) noexcept {
+	// The table held already cannot be released, so it is compared without the lock.
+	if (routeTableOut.get() == _routeTable.load(std::memory_order_acquire))
+		return;
+
+	std::lock_guard<std::mutex> routeTableGuard(_routeTableMutex);
 
-	handlerRegistries.remove(name);
+	routeTableOut = _routeTable.load(std::memory_order_acquire);
 }
 
-HttpServer::HttpServer(peff::Alloc *allocator, netknot::IOService *ioService, netknot::Socket *serverSocket) : allocator(allocator), ioService(ioService), connections(allocator), serverSocket(serverSocket), handlerRegistries(allocator) {}
+void HttpServer::routeRequest(
+	const std::string_view &target,
+	const std::string_view &method,
+	peff::RcObjectPtr<HttpRouteTable> &routeTable,
+	HttpURLHandlerState &state,
+	HttpRequestHandler *&handlerOut,
+	HttpResponseStatus &errorStatusOut) noexcept {
+	state.urlPath = {};
+	state.urlQuery = {};
+	state.urlFragment = {};
+	state.routeParams.nParams = 0;
+	state.stage = HttpURLHandlerStateStage::StatusLine;
+	handlerOut = nullptr;
+
+	size_t offQuery = target.find_first_of('?', 0);
+	size_t offFragment = target.find_first_of('#', 0);
+
+	if (offFragment != std::string_view::npos) {
+		if (offQuery != std::string_view::npos) {
+			if (offQuery > offFragment) {
+				errorStatusOut = HttpResponseStatus::BadRequest;
+				return;
+			}
+			state.urlQuery = target.substr(offQuery, offFragment - offQuery);
+			state.urlFragment = target.substr(offFragment);
+			state.urlPath = target.substr(0, offQuery);
+		} else {
+			state.urlPath = target.substr(0, offFragment);
+			state.urlFragment = target.substr(offFragment);
+		}
+	} else {
+		if (offQuery != std::string_view::npos) {
+			state.urlPath = target.substr(0, offQuery);
+			state.urlQuery = target.substr(offQuery);
+		} else {
+			state.urlPath = target;
+		}
+	}
+
+	// A reference is taken only when the routes have changed since the last request of the connection.
+	getRouteTable(routeTable);
+
+	if (!routeTable) {
+		errorStatusOut = HttpResponseStatus::NotFound;
+		return;
+	}
+
+	switch (routeTable->match(state.urlPath, method, handlerOut, state.routeParams)) {
+		case HttpRouteResult::Found:
+			break;
+		case HttpRouteResult::NotFound:
+			errorStatusOut = HttpResponseStatus::NotFound;
+			break;
+		case HttpRouteResult::MethodNotAllowed:
+			errorStatusOut = HttpResponseStatus::MethodNotAllowed;
+			break;
+	}
+}
 
 std::string_view HttpServer::getHttpResponseMessage(HttpResponseStatus status) {
-	switch (status) {
-		case HttpResponseStatus::Continue:
-			return "100 Continue"sv;
-		case HttpResponseStatus::SwitchingProtocols:
-			return "101 Switching Protocols"sv;
-		case HttpResponseStatus::Processing:
-			return "102 Processing"sv;
-		case HttpResponseStatus::EarlyHints:
-			return "103 Early Hints"sv;
-		case HttpResponseStatus::OK:
-			return "200 OK"sv;
-		case HttpResponseStatus::Created:
-			return "201 Created"sv;
-		case HttpResponseStatus::Accepted:
-			return "202 Accepted"sv;
-		case HttpResponseStatus::NonAuthoritativeInformation:
-			return "203 Non-Authoritative Information"sv;
-		case HttpResponseStatus::NoContent:
-			return "204 No Content"sv;
-		case HttpResponseStatus::ResetContent:
-			return "205 Reset Content"sv;
-		case HttpResponseStatus::PartialContent:
-			return "206 Partial Content"sv;
-		case HttpResponseStatus::MultiStatus:
-			return "207 Multi-Status"sv;
-		case HttpResponseStatus::AlreadyReported:
-			return "208 Already Reported"sv;
-		case HttpResponseStatus::IMUsed:
-			return "226 IM Used"sv;
-		case HttpResponseStatus::MultipleChoice:
-			return "300 Multiple Choice"sv;
-		case HttpResponseStatus::MovedPermanently:
-			return "301 Moved Permanently"sv;
-		case HttpResponseStatus::Found:
-			return "302 Found"sv;
-		case HttpResponseStatus::SeeOther:
-			return "303 See Other"sv;
-		case HttpResponseStatus::NotModified:
-			return "304 Not Modified"sv;
-		case HttpResponseStatus::UseProxy:
-			return "305 Use Proxy"sv;
-		case HttpResponseStatus::TemporaryRedirect:
-			return "307 Temporary Redirect"sv;
-		case HttpResponseStatus::PermanentRedirect:
-			return "308 Permanent Redirect"sv;
-		case HttpResponseStatus::BadRequest:
-			return "400 Bad Request"sv;
-		case HttpResponseStatus::Unauthorized:
-			return "401 Unauthorized"sv;
-		case HttpResponseStatus::PaymentRequired:
-			return "402 Payment Required"sv;
-		case HttpResponseStatus::Forbidden:
-			return "403 Forbidden"sv;
-		case HttpResponseStatus::NotFound:
-			return "404 Not Found"sv;
-		case HttpResponseStatus::MethodNotAllowed:
-			return "405 Method Not Allowed"sv;
-		case HttpResponseStatus::NotAcceptable:
-			return "406 Not Acceptable"sv;
-		case HttpResponseStatus::ProxyAuthenticationRequired:
-			return "407 Proxy Authentication Required"sv;
-		case HttpResponseStatus::RequestTimeout:
-			return "408 Request Timeout"sv;
-		case HttpResponseStatus::Conflict:
-			return "409 Conflict"sv;
-		case HttpResponseStatus::Gone:
-			return "410 Gone"sv;
-		case HttpResponseStatus::LengthRequired:
-			return "411 Length Required"sv;
-		case HttpResponseStatus::PreconditionFailed:
-			return "412 Precondition Failed"sv;
-		case HttpResponseStatus::PayloadTooLarge:
-			return "413 Payload Too Large"sv;
-		case HttpResponseStatus::URITooLong:
-			return "414 URI Too Long"sv;
-		case HttpResponseStatus::UnsupportedMediaType:
-			return "415 Unsupported Media Type"sv;
-		case HttpResponseStatus::RangeNotSatisfiable:
-			return "416 Range Not Satisfiable"sv;
-		case HttpResponseStatus::ExpectationFailed:
-			return "417 Expectation Failed"sv;
-		case HttpResponseStatus::ImATeapot:
-			return "418 I'm a teapot"sv;
-		case HttpResponseStatus::MisdirectedRequest:
-			return "421 Misdirected Request"sv;
-		case HttpResponseStatus::UnprocessableEntity:
-			return "422 Unprocessable Entity"sv;
-		case HttpResponseStatus::Locked:
-			return "423 Locked"sv;
-		case HttpResponseStatus::FailedDependency:
-			return "424 Failed Dependency"sv;
-		case HttpResponseStatus::TooEarly:
-			return "425 Too Early"sv;
-		case HttpResponseStatus::UpgradeRequired:
-			return "426 Upgrade Required"sv;
-		case HttpResponseStatus::PreconditionRequired:
-			return "428 Precondition Required"sv;
-		case HttpResponseStatus::TooManyRequests:
-			return "429 Too Many Requests"sv;
-		case HttpResponseStatus::RequestHeaderFieldsTooLarge:
-			return "431 Request Header Fields Too Large"sv;
-		case HttpResponseStatus::UnavailableForLegalReasons:
-			return "451 Unavailable For Legal Reasons"sv;
-		case HttpResponseStatus::InternalServerError:
-			return "500 Internal Server Error"sv;
-		case HttpResponseStatus::NotImplemented:
-			return "501 Not Implemented"sv;
-		case HttpResponseStatus::BadGateway:
-			return "502 Bad Gateway"sv;
-		case HttpResponseStatus::ServiceUnavailable:
-			return "503 Service Unavailable"sv;
-		case HttpResponseStatus::GatewayTimeout:
-			return "504 Gateway Timeout"sv;
-		case HttpResponseStatus::HTTPVersionNotSupported:
-			return "505 HTTP Version Not Supported"sv;
-		case HttpResponseStatus::VariantAlsoNegotiates:
-			return "506 Variant Also Negotiates"sv;
-		case HttpResponseStatus::InsufficientStorage:
-			return "507 Insufficient Storage"sv;
-		case HttpResponseStatus::LoopDetected:
-			return "508 Loop Detected"sv;
-		case HttpResponseStatus::NotExtended:
-			return "510 Not Extended"sv;
-		case HttpResponseStatus::NetworkAuthenticationRequired:
-			return "511 Netowkr Authentication Required"sv;
-		default:
-			std::terminate();
+	std::string_view statusLine = getHttpStatusLine(status);
+
+	// Strip "HTTP/1.1 " and the line break.
+	return statusLine.substr(9, statusLine.size() - 11);
+}
+
+netknot::ExceptionPointer HttpServer::start() {
+	const size_t nWorkers = ioService->getWorkerCount();
+
+	if (!workers.resize(nWorkers))
+		return netknot::OutOfMemoryError::alloc();
+
+	for (size_t i = 0; i < nWorkers; ++i) {
+		if (!(workers.at(i) = HttpWorkerConnections::alloc(allocator.get(), this, i)))
+			return netknot::OutOfMemoryError::alloc();
 	}
+
+	// The I/O service has no timers, the idle connections are looked for by a thread of the server.
+	if (keepAliveTimeout.count()) {
+		_isReaperStopping = false;
+		_reaperThread = std::thread([this]() noexcept {
+			_runReaper();
+		});
+	}
+
+	peff::RcObjectPtr<HttpAcceptAsyncCallback> callback;
+
+	if (!(callback = peff::allocAndConstruct<HttpAcceptAsyncCallback>(allocator.get(), alignof(HttpAcceptAsyncCallback), this, allocator.get())))
+		return netknot::OutOfMemoryError::alloc();
+
+	peff::RcObjectPtr<netknot::AcceptAsyncTask> acceptAsyncTask;
+	return serverSocket->acceptAsync(allocator.get(), callback.get(), acceptAsyncTask.getRef());
 }
 
-bool HttpServer::addConnection(Connection *conn) noexcept {
-	if (!connections.insert({ conn }))
-		return false;
-	return true;
+/// @brief Sweep of the idle connections of a worker, posted to the worker by the reaper.
+class IdleConnectionSweep {
+public:
+	HttpWorkerConnections *worker;
+	std::chrono::steady_clock::duration keepAliveTimeout;
+
+	NETKNOT_FORCEINLINE IdleConnectionSweep(HttpWorkerConnections *worker, std::chrono::steady_clock::duration keepAliveTimeout) noexcept : worker(worker), keepAliveTimeout(keepAliveTimeout) {
+	}
+
+	NETKNOT_FORCEINLINE netknot::ExceptionPointer operator()() noexcept {
+		return worker->closeIdleConnections(std::chrono::steady_clock::now() - keepAliveTimeout);
+	}
+};
+
+void HttpServer::_runReaper() noexcept {
+	// A connection is closed at most a quarter of the timeout late.
+	const std::chrono::steady_clock::duration interval = keepAliveTimeout / 4;
+
+	std::unique_lock<std::mutex> lock(_reaperMutex);
+
+	while (!_reaperCondVar.wait_for(lock, interval, [this]() noexcept { return _isReaperStopping; })) {
+		for (size_t i = 0; i < workers.size(); ++i) {
+			// Nobody takes the exceptions of the reaper, the failure is counted and the sweep is tried again by the next round.
+			if (netknot::ExceptionPointer e = ioService->post(i, IdleConnectionSweep(workers.at(i).get(), keepAliveTimeout)); e) {
+				nFailedIdleSweeps.fetch_add(1, std::memory_order_relaxed);
+				e.reset();
+			}
+		}
+	}
+}
+
+void HttpServer::_stopReaper() noexcept {
+	if (!_reaperThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_reaperMutex);
+		_isReaperStopping = true;
+	}
+	_reaperCondVar.notify_one();
+
+	_reaperThread.join();
 }
 
-netknot::ExceptionPointer HttpServer::registerHandler(const std::string_view &name, HttpRequestHandler *handler) {
+/// @brief Start of a connection, posted to the worker which the connection is given to.
+class ConnectionStart {
+public:
+	HttpWorkerConnections *worker;
+	netknot::Socket *socket;
+
+	NETKNOT_FORCEINLINE ConnectionStart(HttpWorkerConnections *worker, netknot::Socket *socket) noexcept : worker(worker), socket(socket) {
+	}
+	NETKNOT_FORCEINLINE ConnectionStart(ConnectionStart &&rhs) noexcept : worker(rhs.worker), socket(rhs.socket) {
+		rhs.socket = nullptr;
+	}
+	NETKNOT_FORCEINLINE ~ConnectionStart() {
+		// Never run, the socket is dropped along with the work.
+		if (socket)
+			socket->dealloc();
+	}
+
+	NETKNOT_FORCEINLINE netknot::ExceptionPointer operator()() noexcept {
+		netknot::Socket *s = socket;
+
+		socket = nullptr;
+		return worker->startConnection(s);
+	}
+};
+
+netknot::ExceptionPointer HttpServer::addConnection(netknot::Socket *socket) {
+	ConnectionStart connectionStart(nullptr, socket);
+
+	const size_t workerId = _nextWorkerId.fetch_add(1, std::memory_order_relaxed) % workers.size();
+	HttpWorkerConnections *worker = workers.at(workerId).get();
+
+	connectionStart.worker = worker;
+
+	// The socket is not steered on the backends without per-worker sockets, its callbacks may be run by any worker then.
+	socket->setWorkerId(workerId);
+
+	size_t currentWorkerId;
+	if (ioService->getCurrentWorkerId(currentWorkerId) && (currentWorkerId == workerId))
+		return connectionStart();
+
+	return ioService->post(workerId, std::move(connectionStart));
+}
+
+netknot::ExceptionPointer HttpServer::registerHandler(const std::string_view &pattern, HttpRequestHandler *handler) {
 	peff::UniquePtr<HttpRequestHandler, peff::DeallocableDeleter<HttpRequestHandler>> handlerPtr(handler);
 
-	peff::ScopeGuard removeHandlerGuard([this, name]() noexcept {
-		_removeHandlerRegistry(name);
-	});
-	if (!handlerRegistries.contains(name))
-		NETKNOT_RETURN_IF_EXCEPT(_reserveHandlerRegistry(name));
-	else
-		removeHandlerGuard.release();
+	if (!HttpRouteTable::isPatternValid(pattern))
+		return netknot::InvalidArgsError::alloc();
 
-	if(!handlerRegistries.at(name).handlers.insert(std::string_view(handlerPtr->_methodName), std::move(handlerPtr)))
+	std::lock_guard<std::mutex> routeUpdateLock(_routeUpdateMutex);
+
+	if (!handlers.pushBack(std::move(handlerPtr)))
 		return netknot::OutOfMemoryError::alloc();
 
-	removeHandlerGuard.release();
+	size_t index = 0;
+	while ((index < routePatterns.size()) &&
+		   ((std::string_view(routePatterns.at(index).data(), routePatterns.at(index).size()) != pattern) ||
+			   (routeHandlers.at(index)->_methodName != handler->_methodName)))
+		++index;
+
+	if (index < routePatterns.size()) {
+		// The replaced handler is retired with the old table, it may still be handling a request.
+		HttpRequestHandler *replacedHandler = routeHandlers.at(index);
+
+		routeHandlers.at(index) = handler;
+
+		if (netknot::ExceptionPointer e = _publishRouteTable(replacedHandler); e) {
+			routeHandlers.at(index) = replacedHandler;
+			return e;
+		}
+
+		return {};
+	}
+
+	peff::String patternCopy(allocator.get());
+
+	if (!patternCopy.build(pattern))
+		return netknot::OutOfMemoryError::alloc();
+
+	if (!routeHandlers.pushBack(std::move(handler)))
+		return netknot::OutOfMemoryError::alloc();
+
+	if (!routePatterns.pushBack(std::move(patternCopy))) {
+		routeHandlers.popBack();
+		return netknot::OutOfMemoryError::alloc();
+	}
+
+	if (netknot::ExceptionPointer e = _publishRouteTable(nullptr); e) {
+		routePatterns.popBack();
+		routeHandlers.popBack();
+		return e;
+	}
 
 	return {};
 }
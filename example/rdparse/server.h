@@ -1,90 +1,37 @@
 #ifndef _HTTP_SERVER_H_
 #define _HTTP_SERVER_H_
 
+#include "http2_frame.h"
+#include "http_arena.h"
+#include "http_buffer.h"
+#include "http_chunked.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "http_router.h"
+#include "http_slab.h"
 #include <netknot/io_service.h>
 #include <peff/base/deallocable.h>
 #include <peff/advutils/unique_ptr.h>
-#include <peff/containers/hashmap.h>
 #include <peff/containers/string.h>
-#include <peff/containers/set.h>
+#include <peff/containers/dynarray.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace http {
 	class HttpServer;
 	class Connection;
-
-	enum class HttpResponseStatus : uint16_t {
-		Continue = 100,
-		SwitchingProtocols = 101,
-		Processing = 102,
-		EarlyHints = 103,
-
-		OK = 200,
-		Created = 201,
-		Accepted = 202,
-		NonAuthoritativeInformation = 203,
-		NoContent = 204,
-		ResetContent = 205,
-		PartialContent = 206,
-		MultiStatus = 207,
-		AlreadyReported = 208,
-		IMUsed = 226,
-
-		MultipleChoice = 300,
-		MovedPermanently = 301,
-		Found = 302,
-		SeeOther = 303,
-		NotModified = 304,
-		UseProxy = 305,
-		TemporaryRedirect = 307,
-		PermanentRedirect = 308,
-
-		BadRequest = 400,
-		Unauthorized = 401,
-		PaymentRequired = 402,
-		Forbidden = 403,
-		NotFound = 404,
-		MethodNotAllowed = 405,
-		NotAcceptable = 406,
-		ProxyAuthenticationRequired = 407,
-		RequestTimeout = 408,
-		Conflict = 409,
-		Gone = 410,
-		LengthRequired = 411,
-		PreconditionFailed = 412,
-		PayloadTooLarge = 413,
-		URITooLong = 414,
-		UnsupportedMediaType = 415,
-		RangeNotSatisfiable = 416,
-		ExpectationFailed = 417,
-		ImATeapot = 418,
-		MisdirectedRequest = 421,
-		UnprocessableEntity = 422,
-		Locked = 423,
-		FailedDependency = 424,
-		TooEarly = 425,
-		UpgradeRequired = 426,
-		PreconditionRequired = 428,
-		TooManyRequests = 429,
-		RequestHeaderFieldsTooLarge = 431,
-		UnavailableForLegalReasons = 451,
-
-		InternalServerError = 500,
-		NotImplemented = 501,
-		BadGateway = 502,
-		ServiceUnavailable = 503,
-		GatewayTimeout = 504,
-		HTTPVersionNotSupported = 505,
-		VariantAlsoNegotiates = 506,
-		InsufficientStorage = 507,
-		LoopDetected = 508,
-		NotExtended = 510,
-		NetworkAuthenticationRequired = 511
-	};
+	class HttpWorkerConnections;
+	class HttpReadAsyncCallback;
+	class Http2Session;
 
 	enum class HttpParseStatus : uint8_t {
-		Initial = 0,
-		Header,
-		Body
+		Head = 0,
+		Body,
+		/// @brief The response is being streamed, the next request waits for its end.
+		Response
 	};
 
 	class EmplaceBuffer : public netknot::RcBuffer {
@@ -101,8 +48,6 @@ namespace http {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		HttpServer *httpServer;
-		char buffer[4096];
-		peff::Option<EmplaceBuffer> emplaceBuffer;
 
 		HttpAcceptAsyncCallback(HttpServer *httpServer, peff::Alloc *selfAllocator) noexcept;
 
@@ -113,54 +58,6 @@ namespace http {
 		virtual netknot::ExceptionPointer onAccepted(netknot::Socket *socket) noexcept override;
 	};
 
-	struct HttpRequestLineView {
-		std::string_view method;
-		std::string_view path;
-		std::string_view version;
-	};
-
-	struct HttpRequestHeaderView {
-		peff::HashMap<std::string_view, std::string_view> headers;
-
-		HttpRequestHeaderView(peff::Alloc *allocator);
-		HttpRequestHeaderView(HttpRequestHeaderView &&) = default;
-
-		HttpRequestHeaderView &operator=(HttpRequestHeaderView &&) = default;
-	};
-
-	class HttpReadAsyncCallback final : public netknot::ReadAsyncCallback {
-	public:
-		peff::RcObjectPtr<peff::Alloc> selfAllocator, allocator;
-		HttpServer *httpServer;
-		Connection *connection;
-		HttpParseStatus parseStatus = HttpParseStatus::Initial;
-		peff::String requestLine, requestHeader;
-		HttpRequestLineView requestLineView;
-		HttpRequestHeaderView requestHeaderView;
-
-		size_t expectedBodySize = 0;
-		size_t szRead = 0;
-		std::string_view transferEncoding;
-		bool isChunked = false;
-		peff::DynArray<char> body;
-
-		peff::Option<EmplaceBuffer> bodyBuffer;
-		peff::Option<EmplaceBuffer> responseBuffer;
-
-		HttpReadAsyncCallback(HttpServer *httpServer, Connection *connection, peff::Alloc *selfAllocator, peff::Alloc *allocator);
-		HttpReadAsyncCallback(const HttpReadAsyncCallback &) = delete;
-
-		virtual ~HttpReadAsyncCallback();
-
-		void onRefZero() noexcept override;
-
-		static peff::Option<HttpRequestLineView> parseHttpRequestLine(std::string_view requestLine);
-
-		static peff::Option<HttpRequestHeaderView> parseHttpRequestHeader(std::string_view requestHeader, peff::Alloc *allocator);
-
-		virtual netknot::ExceptionPointer onStatusChanged(netknot::ReadAsyncTask *task) noexcept override;
-	};
-
 	class HttpWriteAsyncCallback final : public netknot::WriteAsyncCallback {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator, allocator;
@@ -179,36 +76,153 @@ namespace http {
 		virtual netknot::ExceptionPointer onStatusChanged(netknot::WriteAsyncTask *task) noexcept override;
 	};
 
+	/// @brief Connection owned by a worker, which is allocated from the slab of the worker, see HttpWorkerConnections.
 	class Connection {
 	public:
 		HttpServer *httpServer;
+		HttpWorkerConnections *worker;
 		std::unique_ptr<netknot::Socket, peff::DeallocableDeleter<netknot::Socket>> socket;
-		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		peff::RcObjectPtr<HttpReadAsyncCallback> requestCallback;
 		peff::RcObjectPtr<HttpWriteAsyncCallback> responseCallback;
+		/// @brief Neighbours in the activity list of the worker, the least recently active one is the first.
+		Connection *prevActive = nullptr, *nextActive = nullptr;
+		std::chrono::steady_clock::time_point lastActiveTime;
 
-		Connection(peff::Alloc *allocator, HttpServer *httpServer, netknot::Socket *socket) noexcept;
+		Connection(HttpServer *httpServer, HttpWorkerConnections *worker, netknot::Socket *socket) noexcept;
 		~Connection();
+	};
+
+#ifdef _WIN32
+	/// @brief Lock of the state of a worker. The workers share the completion port,
+	/// so the callbacks of the connections of a worker may run on any of them.
+	/// It is recursive as a sweep closing a connection drops its streams with the lock held.
+	using HttpWorkerMutex = std::recursive_mutex;
+#else
+	/// @brief Lock of the state of a worker, which does nothing as the callbacks of a worker only run on it.
+	class HttpWorkerMutex {
+	public:
+		NETKNOT_FORCEINLINE void lock() noexcept {
+		}
+		NETKNOT_FORCEINLINE void unlock() noexcept {
+		}
+	};
+#endif
+
+	/// @brief Connections of a worker, which are only touched by the worker, see HttpWorkerMutex.
+	/// The connections are kept in a list ordered by their last activity, so the idle ones are found from the head.
+	class HttpWorkerConnections {
+	private:
+		void _linkConnection(Connection *connection) noexcept;
+		void _unlinkConnection(Connection *connection) noexcept;
+
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		HttpServer *httpServer;
+		size_t workerId;
+		HttpSlab connectionSlab;
+		/// @brief Slab of the HTTP/2 streams of the connections.
+		HttpSlab streamSlab;
+		Connection *firstActive = nullptr, *lastActive = nullptr;
+		size_t nConnections = 0;
+		/// @brief Lock of the slabs and the activity list.
+		HttpWorkerMutex mutex;
+
+		HttpWorkerConnections(peff::Alloc *selfAllocator, HttpServer *httpServer, size_t workerId) noexcept;
+		~HttpWorkerConnections();
 
 		void dealloc() noexcept;
 
-		static Connection *alloc(peff::Alloc *allocator, HttpServer *httpServer, netknot::Socket *socket);
+		static HttpWorkerConnections *alloc(peff::Alloc *allocator, HttpServer *httpServer, size_t workerId) noexcept;
+
+		/// @brief Make a connection of an accepted socket and start reading its first request.
+		///
+		/// @param socket Socket of the connection, the worker takes the ownership of it whether it succeeds or not.
+		/// @return The exception occurred.
+		netknot::ExceptionPointer startConnection(netknot::Socket *socket);
+		/// @brief Release a connection which has nothing in flight, see HttpReadAsyncCallback::closeConnection().
+		void releaseConnection(Connection *connection) noexcept;
+		/// @brief Mark a connection as just active, which moves it to the tail of the activity list.
+		void touchConnection(Connection *connection) noexcept;
+		/// @brief Close the connections which have been idle since the deadline.
+		///
+		/// @return The exception occurred during closing a connection, the rest are left to the next sweep.
+		[[nodiscard]] netknot::ExceptionPointer closeIdleConnections(std::chrono::steady_clock::time_point deadline) noexcept;
 	};
 
 	enum class HttpURLHandlerStateStage : uint8_t {
 		StatusLine = 0,
 		ResponseHeaders,
 		ResponseBody,
+		/// @brief The body is being streamed, see HttpURLHandlerState::beginStream().
+		ResponseStream,
 		End
 	};
 
+	/// @brief Content length of a streamed response whose length is unknown, which is sent chunked.
+	constexpr size_t HTTP_CONTENT_LENGTH_UNKNOWN = SIZE_MAX;
+
+	enum class HttpResponseStreamFraming : uint8_t {
+		ContentLength = 0,
+		Chunked,
+		/// @brief The end of the body is told by closing the connection, for the HTTP/1.0 peers.
+		ConnectionClose
+	};
+
+	/// @brief Opened file which response bodies are sent from, it is kept open by the responses sending it.
+	class HttpResponseFile {
+	private:
+		netknot::MaybeAtomic<size_t> _refCount = 0;
+
+	public:
+		netknot::NativeFileHandle handle;
+
+		HttpResponseFile(netknot::NativeFileHandle handle) noexcept;
+		virtual ~HttpResponseFile();
+
+		virtual void onRefZero() noexcept = 0;
+
+		NETKNOT_FORCEINLINE size_t incRef(size_t globalRc) noexcept {
+			return ++_refCount;
+		}
+
+		NETKNOT_FORCEINLINE size_t decRef(size_t globalRc) noexcept {
+			if (!--_refCount) {
+				onRefZero();
+				return 0;
+			}
+
+			return _refCount;
+		}
+	};
+
+	/// @brief Carrier of a request and its response, which is either an HTTP/1.x connection or an HTTP/2 stream.
+	/// The handlers reach it through HttpURLHandlerState, which checks the stages before forwarding the calls.
+	class HttpExchange {
+	public:
+		virtual netknot::ExceptionPointer pullRequestBody() = 0;
+
+		virtual netknot::ExceptionPointer beginResponseStream(size_t szContentLength) = 0;
+		virtual netknot::ExceptionPointer writeResponseStream(const std::string_view &data) = 0;
+		virtual netknot::ExceptionPointer writeResponseStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) = 0;
+		virtual netknot::ExceptionPointer writeResponseStreamBuffer(const netknot::RcBufferRef &buffer) = 0;
+		virtual netknot::ExceptionPointer endResponseStream() = 0;
+	};
+
 	struct HttpURLHandlerState {
 		HttpServer *httpServer;
 		Connection *connection;
-		const std::string_view &urlPath;
-		const std::string_view &urlQuery;
-		const std::string_view &urlFragment;
+		/// @brief Exchange which the request has come from, the connection itself for HTTP/1.x.
+		HttpExchange *exchange;
+		std::string_view urlPath;
+		std::string_view urlQuery;
+		std::string_view urlFragment;
+		/// @brief Parameters captured by the route pattern.
+		HttpRouteParams routeParams;
 		const HttpRequestHeaderView &requestHeaderView;
+		/// @brief Value of the Connection header to be sent, nothing is sent if empty.
+		std::string_view connectionOption;
+		/// @brief Allocator of the objects which live as long as the request, they are all dropped when the request is done.
+		peff::Alloc *requestAllocator;
 		peff::String responseData;
 
 		HttpURLHandlerStateStage stage = HttpURLHandlerStateStage::StatusLine;
@@ -218,6 +232,43 @@ namespace http {
 		netknot::ExceptionPointer endHeader();
 		netknot::ExceptionPointer writeBody(const std::string_view &data);
 		netknot::ExceptionPointer writeResponse(HttpResponseStatus status, const std::string_view &contentType, const std::string_view &body);
+
+		/// @brief Ask for the next piece of the request body, see HttpRequestHandler::onRequestBody().
+		netknot::ExceptionPointer pullRequestBody() const;
+
+		/// @brief End the headers and start streaming the body, which is sent piece by piece with writeStream().
+		/// The stream may go on after handleURL() returns, the connection takes the next request after endStream().
+		///
+		/// @param szContentLength Length of the body, HTTP_CONTENT_LENGTH_UNKNOWN to send the body chunked.
+		/// @return The exception occurred during sending the headers.
+		netknot::ExceptionPointer beginStream(size_t szContentLength = HTTP_CONTENT_LENGTH_UNKNOWN);
+		/// @brief Send a piece of the streamed body, the data are copied.
+		///
+		/// @param data Data to be sent.
+		/// @return WouldBlockError if the unsent data of the connection have reached the limit, in which case nothing is sent
+		/// and HttpRequestHandler::onResponseWritable() is called when more can be sent.
+		/// InvalidArgsError if the body would exceed the announced length, in which case the response is aborted,
+		/// the pieces written afterwards are discarded until endStream().
+		netknot::ExceptionPointer writeStream(const std::string_view &data);
+		/// @brief Send a region of a file as a piece of the streamed body, the data are sent by the kernel without being copied.
+		///
+		/// @param file File to be sent, which is referenced until the region has been sent.
+		/// @param offset Offset of the region in the file.
+		/// @param size Size of the region.
+		/// @return WouldBlockError if another file is still waiting to be sent, in which case nothing is sent
+		/// and HttpRequestHandler::onResponseWritable() is called when more can be sent.
+		/// InvalidArgsError if the body would exceed the announced length, the same as writeStream().
+		netknot::ExceptionPointer writeStreamFile(HttpResponseFile *file, uint64_t offset, size_t size);
+		/// @brief Send a shared buffer as a piece of the streamed body by reference, the buffer must not be modified until it is sent.
+		///
+		/// @param buffer Buffer to be sent, which is referenced until it has been sent.
+		/// @return WouldBlockError if another piece is still waiting to be sent, or InvalidArgsError, the same as writeStreamFile().
+		netknot::ExceptionPointer writeStreamBuffer(const netknot::RcBufferRef &buffer);
+		/// @brief End the streamed body.
+		///
+		/// @return InvalidArgsError if the body is shorter than the announced length, in which case the response is aborted
+		/// so that the peer does not take it as complete, the stream is ended anyway.
+		netknot::ExceptionPointer endStream();
 	};
 
 	class HttpRequestHandler {
@@ -231,7 +282,171 @@ namespace http {
 
 		virtual void dealloc() noexcept = 0;
 
+		/// @brief Called with each piece of the request body as it arrives, before handleURL().
+		/// The piece refers to a receive buffer, keep a copy of the reference to use the data after the call.
+		/// The connection stops reading after each piece, until the handler calls HttpURLHandlerState::pullRequestBody(),
+		/// either in the call or later when it is ready for more, so the body is received as fast as the handler takes it.
+		/// An HTTP/2 stream keeps the pieces which arrive meanwhile and holds back the flow-control credit of the peer instead.
+		/// The body is discarded by default.
+		virtual netknot::ExceptionPointer onRequestBody(const HttpURLHandlerState &state, const netknot::RcBufferRef &data);
+		/// @brief Called when the request body is complete, to make the response.
 		virtual netknot::ExceptionPointer handleURL(const HttpURLHandlerState &state) = 0;
+		/// @brief Called when a streamed response which has been refused by HttpURLHandlerState::writeStream() can be written again.
+		/// It is also called if the connection is closed meanwhile, after which the written data are discarded until the stream ends.
+		virtual netknot::ExceptionPointer onResponseWritable(const HttpURLHandlerState &state);
+	};
+
+	class HttpReadAsyncCallback final : public netknot::ReadAsyncCallback, public HttpExchange {
+	private:
+		friend class Http2Session;
+
+		netknot::ExceptionPointer _readReceiveBuffer();
+		netknot::ExceptionPointer _readMore();
+		netknot::ExceptionPointer _processReceived(const char *data, size_t size);
+		[[nodiscard]] bool _parseBodyLength(HttpResponseStatus &errorStatusOut) noexcept;
+		void _routeRequest() noexcept;
+		netknot::ExceptionPointer _deliverBody(const char *data, size_t size);
+		netknot::ExceptionPointer _pauseProcessing(const char *data, size_t size);
+		bool _isHttp2Preface() const noexcept;
+		bool _isHttp2Upgrade() const noexcept;
+		/// @brief Switch the connection to HTTP/2, the data after the current request head are handed to the session.
+		netknot::ExceptionPointer _startHttp2(const char *data, size_t size, bool isUpgrade);
+		netknot::ExceptionPointer _handleRequest();
+		netknot::ExceptionPointer _queueResponse(const peff::String &responseData);
+		netknot::ExceptionPointer _queueErrorResponse(HttpResponseStatus status);
+		netknot::ExceptionPointer _rejectRequest(HttpResponseStatus status);
+		netknot::ExceptionPointer _flushResponses();
+		netknot::ExceptionPointer _writeResponses(peff::String &responses);
+		netknot::ExceptionPointer _sendResponsePiece();
+		netknot::ExceptionPointer _queueResponsePiece(size_t size);
+		/// @brief Abort the streamed response whose body does not match the announced length, by closing the connection.
+		netknot::ExceptionPointer _abortResponseStream();
+
+		NETKNOT_FORCEINLINE bool _isResponsePieceQueued() const noexcept {
+			return responseFile || responseBuffer.buffer;
+		}
+		void _updateKeepAlive() noexcept;
+		/// @brief Drop the responses not sent yet, which must not be called with a write in flight.
+		void _discardResponses() noexcept;
+		void _releaseRequest(bool hasPipelinedData) noexcept;
+
+		NETKNOT_FORCEINLINE std::string_view _getConnectionOption() const noexcept {
+			using std::operator""sv;
+
+			if (!isKeepAlive)
+				return "close"sv;
+			// HTTP/1.1 connections are persistent by default.
+			return isHttp10 ? "keep-alive"sv : std::string_view();
+		}
+
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator, allocator;
+		HttpServer *httpServer;
+		Connection *connection;
+		/// @brief Arena of the current request, which the parser, the request views and the response being built are allocated from.
+		/// It is reset when the request is done, so the requests which fit in a chunk of the arena never reach the general allocator.
+		HttpArena requestArena;
+		HttpParseStatus parseStatus = HttpParseStatus::Head;
+		HttpRequestParser parser;
+		HttpRequestLineView requestLineView;
+		HttpRequestHeaderView requestHeaderView;
+
+		/// @brief Handler of the current request, nullptr if the request is answered with routeStatus instead.
+		HttpRequestHandler *currentHandler = nullptr;
+		HttpResponseStatus routeStatus = HttpResponseStatus::NotFound;
+		HttpURLHandlerState handlerState;
+		/// @brief Route table which the connection has routed with, which keeps the handler and the route parameters valid.
+		peff::RcObjectPtr<HttpRouteTable> routeTable;
+
+		size_t expectedBodySize = 0;
+		size_t szBodyRead = 0;
+		bool isChunked = false;
+		HttpChunkedDecoder chunkedDecoder;
+		/// @brief Whether the handler has asked for the next piece of the body.
+		bool isBodyPulled = true;
+		/// @brief Whether the received data after pausedData wait for the handler, to pull the body or to end the streamed response.
+		bool isProcessingPaused = false;
+		const char *pausedData = nullptr;
+		size_t szPausedData = 0;
+
+		HttpResponseStreamFraming responseFraming = HttpResponseStreamFraming::ContentLength;
+		/// @brief Size of the streamed body not sent yet, if the length is known.
+		size_t szResponseBodyLeft = 0;
+		/// @brief Whether a piece of the streamed response has been refused, the handler is told when it can write again.
+		bool isResponseBlocked = false;
+
+		/// @brief Receive buffer being filled, which also holds the pipelined requests not handled yet.
+		netknot::RcBufferRef receiveBuffer;
+		size_t szReceiveBufferUsed = 0;
+		/// @brief Whether the parser may refer to the receive buffer.
+		bool isReceiveBufferReferenced = false;
+		/// @brief Filled receive buffers which the request views may point into, pinned until the handler finishes.
+		peff::DynArray<netknot::RcBufferRef> pinnedBuffers;
+
+		/// @brief Responses which have been made but not sent yet, they are sent together by the next write.
+		peff::String pendingResponses;
+		/// @brief Piece of a response sent without copying, after responsePiecePrefix and before pendingResponses.
+		/// At most one piece is queued at a time, which is either a file region or a buffer.
+		peff::RcObjectPtr<HttpResponseFile> responseFile;
+		uint64_t responseFileOffset = 0;
+		size_t szResponseFile = 0;
+		netknot::RcBufferRef responseBuffer;
+		/// @brief Responses queued before the piece, which are sent ahead of it.
+		peff::String responsePiecePrefix;
+		/// @brief Whether the connection persists after the current request.
+		bool isKeepAlive = true;
+		bool isHttp10 = false;
+		/// @brief Whether a write of the responses is in flight.
+		bool isWriting = false;
+		/// @brief Whether reading is suspended until the in-flight write is done.
+		bool isReadSuspended = false;
+		/// @brief Whether a read is in flight.
+		bool isReading = false;
+		/// @brief Whether the connection has been closed, nothing is read or written anymore.
+		bool isClosed = false;
+		/// @brief Whether the release of the connection has been posted to the worker.
+		bool isReleasing = false;
+		/// @brief Whether no request has been taken yet, only the first one may be the HTTP/2 preface.
+		bool isFirstRequest = true;
+		/// @brief HTTP/2 session which the connection has switched to, all the received data go to it.
+		peff::UniquePtr<Http2Session, peff::DeallocableDeleter<Http2Session>> http2Session;
+
+		HttpReadAsyncCallback(HttpServer *httpServer, Connection *connection, peff::Alloc *selfAllocator, peff::Alloc *allocator);
+		HttpReadAsyncCallback(const HttpReadAsyncCallback &) = delete;
+
+		virtual ~HttpReadAsyncCallback();
+
+		void onRefZero() noexcept override;
+
+		/// @brief Start reading the first request of the connection.
+		netknot::ExceptionPointer start();
+
+		/// @brief Called by the write callback when the responses in flight have been written.
+		netknot::ExceptionPointer onResponsesWritten();
+		/// @brief Called by the write callback when the responses in flight cannot be written, the connection is closed.
+		netknot::ExceptionPointer onResponsesFailed();
+
+		/// @brief Close the connection, which is released once nothing is in flight and no handler is in control of it.
+		/// A read in flight is woken up by shutting the connection down, a write in flight is waited for.
+		netknot::ExceptionPointer closeConnection();
+
+		/// @brief Check if a handler is in control of the connection or of one of its streams, which keeps the connection.
+		bool isHandlerInControl() const noexcept;
+		/// @brief Check if the connection is waiting for the peer rather than for its handlers, so it may be closed when idle.
+		NETKNOT_FORCEINLINE bool isWaitingForPeer() const noexcept {
+			return (!isClosed) && (isReading || isWriting) && (!isHandlerInControl());
+		}
+
+		/// @brief Called by the handler when it is ready for the next piece of the body.
+		virtual netknot::ExceptionPointer pullRequestBody() override;
+
+		virtual netknot::ExceptionPointer beginResponseStream(size_t szContentLength) override;
+		virtual netknot::ExceptionPointer writeResponseStream(const std::string_view &data) override;
+		virtual netknot::ExceptionPointer writeResponseStreamFile(HttpResponseFile *file, uint64_t offset, size_t size) override;
+		virtual netknot::ExceptionPointer writeResponseStreamBuffer(const netknot::RcBufferRef &buffer) override;
+		virtual netknot::ExceptionPointer endResponseStream() override;
+
+		virtual netknot::ExceptionPointer onStatusChanged(netknot::ReadAsyncTask *task) noexcept override;
 	};
 
 	template <typename Fn>
@@ -274,35 +489,112 @@ namespace http {
 		void dealloc() noexcept;
 	};
 
-	struct HttpRequestHandlerRegistry {
-		peff::RcObjectPtr<peff::Alloc> allocator;
-		peff::String baseUrl;
-		peff::HashMap<std::string_view, peff::UniquePtr<HttpRequestHandler, peff::DeallocableDeleter<HttpRequestHandler>>> handlers;
-
-		HttpRequestHandlerRegistry(peff::Alloc *allocator);
-		HttpRequestHandlerRegistry(HttpRequestHandlerRegistry &&) = default;
-		~HttpRequestHandlerRegistry();
-	};
-
 	class HttpServer {
+	public:
+		constexpr static size_t DEFAULT_RECEIVE_BUFFER_SIZE = 16384;
+
 	private:
-		[[nodiscard]] netknot::ExceptionPointer _reserveHandlerRegistry(const std::string_view &name);
-		void _removeHandlerRegistry(const std::string_view &name);
+		/// @brief Current route table, to which the server holds a reference.
+		std::atomic<HttpRouteTable *> _routeTable = nullptr;
+		/// @brief Held while the current route table is replaced or a reference is taken to it,
+		/// so the replaced table is not released between loading it and taking a reference.
+		std::mutex _routeTableMutex;
+		/// @brief Serializes the updates of the routes.
+		std::mutex _routeUpdateMutex;
+
+		/// @brief Worker which the next connection is given to.
+		std::atomic<size_t> _nextWorkerId = 0;
+
+		/// @brief Thread which asks the workers to close their idle connections periodically.
+		std::thread _reaperThread;
+		std::mutex _reaperMutex;
+		std::condition_variable _reaperCondVar;
+		bool _isReaperStopping = false;
+
+		[[nodiscard]] netknot::ExceptionPointer _publishRouteTable(HttpRequestHandler *replacedHandler);
+		void _runReaper() noexcept;
+		void _stopReaper() noexcept;
 
 	public:
 		peff::RcObjectPtr<peff::Alloc> allocator;
 		netknot::IOService *ioService;
 		peff::UniquePtr<netknot::Socket, peff::DeallocableDeleter<netknot::Socket>> serverSocket;
-		peff::Set<peff::UniquePtr<Connection, peff::DeallocableDeleter<Connection>>> connections;
-		peff::HashMap<std::string_view, HttpRequestHandlerRegistry> handlerRegistries;
+		/// @brief Pool of the receive buffers, which outlives the connections.
+		HttpReceiveBufferPool receiveBufferPool;
+		/// @brief Connections of each worker, indexed by the worker IDs.
+		peff::DynArray<peff::UniquePtr<HttpWorkerConnections, peff::DeallocableDeleter<HttpWorkerConnections>>> workers;
+		/// @brief Handlers of the routes, and those which have not been registered successfully.
+		/// The replaced ones are handed over to the retired route tables, which release them after the requests in flight are done.
+		peff::DynArray<peff::UniquePtr<HttpRequestHandler, peff::DeallocableDeleter<HttpRequestHandler>>> handlers;
+		/// @brief Patterns of the routes and their handlers, from which the route tables are built, only accessed by the updates.
+		peff::DynArray<peff::String> routePatterns;
+		peff::DynArray<HttpRequestHandler *> routeHandlers;
+		/// @brief Maximum size of a request line and its headers.
+		size_t maxRequestHeadSize = 64 * 1024;
+		/// @brief Size of the unsent responses of a connection, beyond which the connection stops reading
+		/// requests until the responses in flight are written.
+		size_t maxPendingResponseSize = 64 * 1024;
+		/// @brief Maximum size of a request body, the larger ones are rejected before any of the body is taken.
+		size_t maxRequestBodySize = 16 * 1024 * 1024;
+		/// @brief Maximum number of the concurrent streams of an HTTP/2 connection, the streams beyond it are refused.
+		uint32_t maxConcurrentStreams = 100;
+		/// @brief Flow-control window of the request body of an HTTP/2 stream, which bounds the body received ahead of its handler.
+		uint32_t streamWindowSize = HTTP2_DEFAULT_WINDOW_SIZE;
+		/// @brief Flow-control window of an HTTP/2 connection, which is shared by the request bodies of all its streams.
+		uint32_t connectionWindowSize = 1024 * 1024;
+		/// @brief Time after which a connection waiting for the peer is closed, zero to keep the connections open,
+		/// which must be set before start().
+		std::chrono::steady_clock::duration keepAliveTimeout = std::chrono::seconds(5);
+		/// @brief Number of the sweeps of the idle connections which the reaper has failed to post to the workers,
+		/// each of which is retried by the next round.
+		std::atomic<size_t> nFailedIdleSweeps = 0;
 
 		HttpServer(peff::Alloc *allocator, netknot::IOService *ioService, netknot::Socket *serverSocket);
+		~HttpServer();
 
 		static std::string_view getHttpResponseMessage(HttpResponseStatus status);
 
-		[[nodiscard]] bool addConnection(Connection *conn) noexcept;
-
-		[[nodiscard]] netknot::ExceptionPointer registerHandler(const std::string_view &name, HttpRequestHandler *handler);
+		/// @brief Split the target of a request into the state and look up its handler in the current route table.
+		///
+		/// @param target Target of the request.
+		/// @param method Method of the request.
+		/// @param routeTable Route table of the connection, which is replaced if the routes have changed.
+		/// @param state Where to store the path, the query, the fragment and the route parameters.
+		/// @param handlerOut Where to store the handler, nullptr if there is none.
+		/// @param errorStatusOut Where to store the status to answer with if there is no handler.
+		void routeRequest(
+			const std::string_view &target,
+			const std::string_view &method,
+			peff::RcObjectPtr<HttpRouteTable> &routeTable,
+			HttpURLHandlerState &state,
+			HttpRequestHandler *&handlerOut,
+			HttpResponseStatus &errorStatusOut) noexcept;
+
+		/// @brief Set up the connections of the workers and start accepting the connections.
+		///
+		/// @return The exception occurred.
+		[[nodiscard]] netknot::ExceptionPointer start();
+
+		/// @brief Give an accepted socket to one of the workers, in turn.
+		/// The backends whose sockets cannot be bound to workers (see netknot::Socket::setWorkerId()) must have a single worker.
+		///
+		/// @param socket Accepted socket, the server takes the ownership of it whether it succeeds or not.
+		/// @return The exception occurred.
+		[[nodiscard]] netknot::ExceptionPointer addConnection(netknot::Socket *socket);
+
+		/// @brief Register a handler for a route pattern and the method of the handler, see HttpRoute for the patterns.
+		/// A handler registered for the same pattern and method is replaced.
+		/// The routes are published as a new route table, so the handlers may be registered while the requests are being handled.
+		///
+		/// @param pattern Route pattern, a malformed one, or one whose parameters are named differently from those of a registered pattern at the same place, is rejected with netknot::InvalidArgsError.
+		/// @param handler Handler to be registered, the server takes the ownership of it whether it succeeds or not.
+		/// @return The exception occurred during registering, the registered routes are unchanged then.
+		[[nodiscard]] netknot::ExceptionPointer registerHandler(const std::string_view &pattern, HttpRequestHandler *handler);
+
+		/// @brief Get the current route table.
+		///
+		/// @param routeTableOut Where to store the reference to the table, which is left unchanged if it is the current one already.
+		void getRouteTable(peff::RcObjectPtr<HttpRouteTable> &routeTableOut) noexcept;
 	};
 }
 
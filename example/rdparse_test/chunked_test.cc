@@ -0,0 +1,158 @@
+#include "test.h"
+#include <http_chunked.h>
+#include <string>
+
+using namespace http;
+
+using std::operator""sv;
+
+/// @brief Feed a chunked body to the decoder in pieces of a fixed size, as the receive buffers would.
+static HttpChunkedDecodeResult decodeInPieces(HttpChunkedDecoder &decoder, std::string_view input, size_t szPiece, std::string &bodyOut, size_t &szConsumedOut) {
+	bodyOut.clear();
+	szConsumedOut = 0;
+
+	while (szConsumedOut < input.size()) {
+		const size_t szFed = std::min(szPiece, input.size() - szConsumedOut);
+		const char *data = input.data() + szConsumedOut;
+		size_t offPiece = 0;
+
+		// A piece is decoded until all of it is consumed, as every call stops after a piece of the chunk data.
+		while (offPiece < szFed) {
+			size_t szConsumed, szChunkData;
+			const char *chunkData;
+
+			HttpChunkedDecodeResult result = decoder.decode(data + offPiece, szFed - offPiece, szConsumed, chunkData, szChunkData);
+
+			bodyOut.append(chunkData ? chunkData : "", szChunkData);
+			offPiece += szConsumed;
+
+			switch (result) {
+				case HttpChunkedDecodeResult::NeedMore:
+				case HttpChunkedDecodeResult::Data:
+					break;
+				default:
+					szConsumedOut += offPiece;
+					return result;
+			}
+		}
+
+		szConsumedOut += offPiece;
+	}
+
+	return HttpChunkedDecodeResult::NeedMore;
+}
+
+static void testSplitAtEveryOffset() {
+	constexpr std::string_view input = "4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\n\r\nGET / HTTP/1.1\r\n"sv;
+	constexpr std::string_view expectedBody = "Wikipedia in\r\n\r\nchunks."sv;
+
+	for (size_t szPiece = 1; szPiece <= input.size(); ++szPiece) {
+		HttpChunkedDecoder decoder;
+		std::string body;
+		size_t szConsumed;
+
+		TEST_CHECK(decodeInPieces(decoder, input, szPiece, body, szConsumed) == HttpChunkedDecodeResult::Done);
+		TEST_CHECK(body == expectedBody);
+		// The next request is left untouched.
+		TEST_CHECK(input.substr(szConsumed) == "GET / HTTP/1.1\r\n"sv);
+	}
+}
+
+static void testChunkSizeOverflow() {
+	std::string body;
+	size_t szConsumed;
+
+	{
+		// The largest size which fits is accepted, the data are expected then.
+		HttpChunkedDecoder decoder;
+
+		TEST_CHECK(decodeInPieces(decoder, "ffffffffffffffff\r\n"sv, 1, body, szConsumed) == HttpChunkedDecodeResult::NeedMore);
+		TEST_CHECK(decoder.getState() == HttpChunkedDecoder::State::Data);
+	}
+
+	for (size_t szPiece : { (size_t)1, (size_t)64 }) {
+		// One more digit would wrap around.
+		HttpChunkedDecoder decoder;
+
+		TEST_CHECK(decodeInPieces(decoder, "10000000000000000\r\n"sv, szPiece, body, szConsumed) == HttpChunkedDecodeResult::TooLarge);
+	}
+
+	{
+		// The leading zeros do not count towards the overflow.
+		HttpChunkedDecoder decoder;
+
+		TEST_CHECK(decodeInPieces(decoder, "000000000000000000000001\r\nx\r\n0\r\n\r\n"sv, 3, body, szConsumed) == HttpChunkedDecodeResult::Done);
+		TEST_CHECK(body == "x"sv);
+	}
+}
+
+static void testFramingLimits() {
+	std::string body;
+	size_t szConsumed;
+
+	for (size_t szPiece : { (size_t)1, (size_t)7, (size_t)4096 }) {
+		{
+			HttpChunkedDecoder decoder(64);
+			const std::string input = "1;" + std::string(32, 'e') + "\r\nx\r\n0\r\n\r\n";
+
+			TEST_CHECK(decodeInPieces(decoder, input, szPiece, body, szConsumed) == HttpChunkedDecodeResult::Done);
+			TEST_CHECK(body == "x"sv);
+		}
+		{
+			// An extension never ending is refused once it passes the limit, rather than when its line ends.
+			HttpChunkedDecoder decoder(64);
+			const std::string input = "1;" + std::string(1024, 'e');
+
+			TEST_CHECK(decodeInPieces(decoder, input, szPiece, body, szConsumed) == HttpChunkedDecodeResult::TooLarge);
+			TEST_CHECK(szConsumed <= 64 + szPiece);
+		}
+		{
+			// The limit is for the framing since the last data, so a long body of small chunks is fine.
+			HttpChunkedDecoder decoder(64);
+			std::string input;
+
+			for (int i = 0; i < 100; ++i)
+				input += "1;ext\r\nx\r\n";
+			input += "0\r\n\r\n";
+
+			TEST_CHECK(decodeInPieces(decoder, input, szPiece, body, szConsumed) == HttpChunkedDecodeResult::Done);
+			TEST_CHECK(body == std::string(100, 'x'));
+		}
+		{
+			HttpChunkedDecoder decoder(64);
+			std::string input = "0\r\n";
+
+			for (int i = 0; i < 8; ++i)
+				input += "X-Trailer: 0123456789\r\n";
+			input += "\r\n";
+
+			TEST_CHECK(decodeInPieces(decoder, input, szPiece, body, szConsumed) == HttpChunkedDecodeResult::TooLarge);
+		}
+	}
+}
+
+static void testMalformedBodies() {
+	for (std::string_view input : {
+			 "g\r\n"sv,
+			 "\r\n"sv,
+			 "1\nx\r\n"sv,
+			 "1\r\nxy\r\n"sv,
+			 "1;ext\ny\r\nx\r\n"sv,
+			 "0\r\nX-Trailer: a\nb\r\n\r\n"sv,
+			 "0\r\n\rX"sv }) {
+		HttpChunkedDecoder decoder;
+		std::string body;
+		size_t szConsumed;
+
+		TEST_CHECK(decodeInPieces(decoder, input, 1, body, szConsumed) == HttpChunkedDecodeResult::Malformed);
+	}
+}
+
+int main() {
+	testSplitAtEveryOffset();
+	testChunkSizeOverflow();
+	testFramingLimits();
+	testMalformedBodies();
+
+	return test::getExitCode();
+}
@@ -0,0 +1,186 @@
+#include "test.h"
+#include <http2_hpack.h>
+#include <http_arena.h>
+#include <initializer_list>
+#include <string>
+
+using namespace http;
+
+using std::operator""sv;
+
+struct ExpectedField {
+	std::string_view name;
+	std::string_view value;
+};
+
+static std::string fromHex(std::string_view hex) {
+	std::string bytes;
+
+	for (size_t i = 0; i + 1 < hex.size();) {
+		if (hex[i] == ' ') {
+			++i;
+			continue;
+		}
+
+		bytes.push_back((char)std::stoi(std::string(hex.substr(i, 2)), nullptr, 16));
+		i += 2;
+	}
+
+	return bytes;
+}
+
+static void checkBlock(HpackDecoder &decoder, std::string_view hex, std::initializer_list<ExpectedField> expectedFields) {
+	peff::StdAlloc allocator;
+	peff::DynArray<HttpHeaderField> fields(&allocator);
+	const std::string block = fromHex(hex);
+
+	{
+		HttpArena fieldAllocator(&allocator);
+
+		TEST_CHECK(decoder.decode(block.data(), block.size(), 64 * 1024, &fieldAllocator, fields) == HpackDecodeResult::Done);
+		TEST_CHECK(fields.size() == expectedFields.size());
+
+		size_t i = 0;
+		for (const ExpectedField &expected : expectedFields) {
+			if (i < fields.size()) {
+				TEST_CHECK(fields.at(i).name == expected.name);
+				TEST_CHECK(fields.at(i).value == expected.value);
+			}
+			++i;
+		}
+	}
+}
+
+// RFC 7541 C.3, requests without Huffman coding, which share the dynamic table.
+static void testRequestsWithoutHuffman() {
+	peff::StdAlloc allocator;
+	HpackDecoder decoder(&allocator);
+
+	checkBlock(decoder, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, "/"sv }, { ":authority"sv, "www.example.com"sv } });
+	checkBlock(decoder, "8286 84be 5808 6e6f 2d63 6163 6865",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, "/"sv }, { ":authority"sv, "www.example.com"sv }, { "cache-control"sv, "no-cache"sv } });
+	checkBlock(decoder, "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "https"sv }, { ":path"sv, "/index.html"sv }, { ":authority"sv, "www.example.com"sv }, { "custom-key"sv, "custom-value"sv } });
+}
+
+// RFC 7541 C.4, the same requests with Huffman coding.
+static void testRequestsWithHuffman() {
+	peff::StdAlloc allocator;
+	HpackDecoder decoder(&allocator);
+
+	checkBlock(decoder, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, "/"sv }, { ":authority"sv, "www.example.com"sv } });
+	checkBlock(decoder, "8286 84be 5886 a8eb 1064 9cbf",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, "/"sv }, { ":authority"sv, "www.example.com"sv }, { "cache-control"sv, "no-cache"sv } });
+	checkBlock(decoder, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+		{ { ":method"sv, "GET"sv }, { ":scheme"sv, "https"sv }, { ":path"sv, "/index.html"sv }, { ":authority"sv, "www.example.com"sv }, { "custom-key"sv, "custom-value"sv } });
+}
+
+static void testMalformedBlocks() {
+	peff::StdAlloc allocator;
+	HpackDecoder decoder(&allocator);
+	HttpArena fieldAllocator(&allocator);
+	peff::DynArray<HttpHeaderField> fields(&allocator);
+
+	auto decode = [&decoder, &fieldAllocator, &fields](std::string_view hex) {
+		const std::string block = fromHex(hex);
+		fields.clear();
+		return decoder.decode(block.data(), block.size(), 64 * 1024, &fieldAllocator, fields);
+	};
+
+	// Index 0, and an index beyond the empty dynamic table.
+	TEST_CHECK(decode("80") == HpackDecodeResult::Malformed);
+	TEST_CHECK(decode("be") == HpackDecodeResult::Malformed);
+	// A string longer than the block.
+	TEST_CHECK(decode("400a 6375") == HpackDecodeResult::Malformed);
+	// A table size update after a field, and one beyond the announced bound.
+	TEST_CHECK(decode("82 20") == HpackDecodeResult::Malformed);
+	TEST_CHECK(decode("3fe2 1f") == HpackDecodeResult::Malformed);
+	// A Huffman-coded string padded with more than 7 bits.
+	TEST_CHECK(decode("4082 ffff 00") == HpackDecodeResult::Malformed);
+}
+
+static void testEncoderRoundTrip() {
+	peff::StdAlloc allocator;
+	HpackEncoder encoder(&allocator);
+	HpackDecoder decoder(&allocator);
+
+	for (int round = 0; round < 3; ++round) {
+		peff::String block(&allocator);
+
+		TEST_CHECK(encoder.beginBlock(block));
+		TEST_CHECK(encoder.encode(":status"sv, "200"sv, true, block));
+		TEST_CHECK(encoder.encode("Content-Type"sv, "text/plain"sv, true, block));
+		TEST_CHECK(encoder.encode("x-request-id"sv, "0123456789"sv, false, block));
+
+		peff::DynArray<HttpHeaderField> fields(&allocator);
+		HttpArena fieldAllocator(&allocator);
+
+		TEST_CHECK(decoder.decode(block.data(), block.size(), 64 * 1024, &fieldAllocator, fields) == HpackDecodeResult::Done);
+		TEST_CHECK(fields.size() == 3);
+		if (fields.size() == 3) {
+			TEST_CHECK((fields.at(0).name == ":status"sv) && (fields.at(0).value == "200"sv));
+			TEST_CHECK((fields.at(1).name == "content-type"sv) && (fields.at(1).value == "text/plain"sv));
+			TEST_CHECK((fields.at(2).name == "x-request-id"sv) && (fields.at(2).value == "0123456789"sv));
+		}
+
+		// The repeated fields are indexed, so the later blocks are shorter.
+		if (round)
+			TEST_CHECK(block.size() < 24);
+	}
+}
+
+// A field of the dynamic table referred to over and over must not be copied beyond the size limit.
+static void testRepeatedLargeEntry() {
+	constexpr size_t MAX_LIST_SIZE = 64 * 1024;
+
+	peff::StdAlloc allocator;
+	HpackDecoder decoder(&allocator);
+	std::string block;
+
+	// A literal with incremental indexing, whose value is about 4 KB.
+	const std::string value(4000, 'v');
+	block += "\x40\x01x"sv;
+	block += "\x7f"sv;
+	for (size_t n = value.size() - 127; ; n >>= 7) {
+		if (n < 128) {
+			block.push_back((char)n);
+			break;
+		}
+		block.push_back((char)(0x80 | (n & 0x7f)));
+	}
+	block += value;
+
+	// The newest entry of the dynamic table is index 62, which takes a byte.
+	block.append(60000, '\xbe');
+
+	for (int round = 0; round < 2; ++round) {
+		test::CountingAlloc upstream;
+		HttpArena fieldAllocator(&upstream);
+		peff::DynArray<HttpHeaderField> fields(&allocator);
+
+		TEST_CHECK(decoder.decode(block.data(), block.size(), round ? 0 : MAX_LIST_SIZE, &fieldAllocator, fields) == HpackDecodeResult::TooLarge);
+
+		// The list is within the limit, and the strings dropped with the rest of the fields are never copied.
+		size_t szList = 0;
+		for (size_t i = 0; i < fields.size(); ++i)
+			szList += fields.at(i).name.size() + fields.at(i).value.size() + HPACK_ENTRY_OVERHEAD;
+
+		TEST_CHECK(szList <= (round ? 0 : MAX_LIST_SIZE));
+		TEST_CHECK(upstream.szAllocated <= (round ? 0 : MAX_LIST_SIZE) + value.size() + 2 * HttpArena::DEFAULT_CHUNK_SIZE);
+	}
+
+	// The table is still in sync, the entry is at index 62 for the next block.
+	checkBlock(decoder, "be", { { "x"sv, std::string_view(value) } });
+}
+
+int main() {
+	testRequestsWithoutHuffman();
+	testRequestsWithHuffman();
+	testMalformedBlocks();
+	testEncoderRoundTrip();
+	testRepeatedLargeEntry();
+
+	return test::getExitCode();
+}
@@ -0,0 +1,637 @@
+#include "test.h"
+#include <http2_frame.h>
+#include <http2_hpack.h>
+#include <http_arena.h>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+
+#ifndef _WIN32
+	#include <server.h>
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/socket.h>
+	#include <sys/time.h>
+	#include <unistd.h>
+	#include <csignal>
+	#include <thread>
+#endif
+
+using namespace http;
+
+using std::operator""sv;
+
+static std::string toString(const peff::String &s) {
+	return std::string(s.data(), s.size());
+}
+
+static std::string makeFrame(Http2FrameType type, uint8_t flags, uint32_t streamId, std::string_view payload) {
+	peff::StdAlloc allocator;
+	peff::String frame(&allocator);
+
+	TEST_CHECK(appendHttp2Frame(frame, type, flags, streamId, payload));
+
+	return toString(frame);
+}
+
+static std::string makeSetting(Http2SettingId id, uint32_t value) {
+	char setting[6];
+
+	setting[0] = (char)((uint16_t)id >> 8);
+	setting[1] = (char)id;
+	writeHttp2Uint32(setting + 2, value);
+
+	return std::string(setting, sizeof(setting));
+}
+
+static std::string makeUint32(uint32_t value) {
+	char buffer[4];
+
+	writeHttp2Uint32(buffer, value);
+
+	return std::string(buffer, sizeof(buffer));
+}
+
+static void testFrameHeaders() {
+	char buffer[HTTP2_FRAME_HEADER_SIZE];
+	Http2FrameHeader header;
+
+	formatHttp2FrameHeader(buffer, 0xabcdef, Http2FrameType::Headers, HTTP2_FLAG_END_STREAM | HTTP2_FLAG_END_HEADERS, 0x12345678);
+	TEST_CHECK(std::string_view(buffer, sizeof(buffer)) == "\xab\xcd\xef\x01\x05\x12\x34\x56\x78"sv);
+
+	parseHttp2FrameHeader(buffer, header);
+	TEST_CHECK(header.length == 0xabcdef);
+	TEST_CHECK(header.type == Http2FrameType::Headers);
+	TEST_CHECK(header.flags == (HTTP2_FLAG_END_STREAM | HTTP2_FLAG_END_HEADERS));
+	TEST_CHECK(header.streamId == 0x12345678);
+
+	// The reserved bit of the stream ID is ignored.
+	parseHttp2FrameHeader("\x00\x00\x00\x08\x00\xff\xff\xff\xff", header);
+	TEST_CHECK(header.length == 0);
+	TEST_CHECK(header.type == Http2FrameType::WindowUpdate);
+	TEST_CHECK(header.streamId == 0x7fffffff);
+
+	// The unknown frame types are kept as they are, to be ignored by the session.
+	parseHttp2FrameHeader("\x00\x00\x01\xfa\x00\x00\x00\x00\x01", header);
+	TEST_CHECK((uint8_t)header.type == 0xfa);
+
+	const std::string frame = makeFrame(Http2FrameType::Ping, HTTP2_FLAG_ACK, 0, "12345678"sv);
+	TEST_CHECK(frame == "\x00\x00\x08\x06\x01\x00\x00\x00\x00"
+						"12345678"sv);
+
+	TEST_CHECK(readHttp2Uint32("\x80\x00\x00\x01") == 0x80000001);
+	TEST_CHECK(makeUint32(0xdeadbeef) == "\xde\xad\xbe\xef"sv);
+}
+
+static void testSettings() {
+	{
+		Http2Settings settings;
+		Http2ErrorCode errorCode;
+
+		const std::string payload = makeSetting(Http2SettingId::HeaderTableSize, 256) +
+									makeSetting(Http2SettingId::EnablePush, 0) +
+									makeSetting(Http2SettingId::MaxConcurrentStreams, 10) +
+									makeSetting(Http2SettingId::InitialWindowSize, HTTP2_MAX_WINDOW_SIZE) +
+									makeSetting(Http2SettingId::MaxFrameSize, HTTP2_MAX_MAX_FRAME_SIZE) +
+									makeSetting(Http2SettingId::MaxHeaderListSize, 8192) +
+									makeSetting((Http2SettingId)0x1234, 1);
+
+		TEST_CHECK(settings.apply(payload, errorCode));
+		TEST_CHECK(settings.headerTableSize == 256);
+		TEST_CHECK(!settings.isPushEnabled);
+		TEST_CHECK(settings.maxConcurrentStreams == 10);
+		TEST_CHECK(settings.initialWindowSize == HTTP2_MAX_WINDOW_SIZE);
+		TEST_CHECK(settings.maxFrameSize == HTTP2_MAX_MAX_FRAME_SIZE);
+		TEST_CHECK(settings.maxHeaderListSize == 8192);
+
+		// An empty payload changes nothing.
+		TEST_CHECK(settings.apply({}, errorCode));
+		TEST_CHECK(settings.headerTableSize == 256);
+	}
+
+	struct MalformedSettings {
+		std::string payload;
+		Http2ErrorCode errorCode;
+	};
+
+	for (const MalformedSettings &i : {
+			 MalformedSettings{ makeSetting(Http2SettingId::EnablePush, 0).substr(0, 5), Http2ErrorCode::FrameSizeError },
+			 MalformedSettings{ makeSetting(Http2SettingId::EnablePush, 0) + std::string(1, '\0'), Http2ErrorCode::FrameSizeError },
+			 MalformedSettings{ makeSetting(Http2SettingId::EnablePush, 2), Http2ErrorCode::ProtocolError },
+			 MalformedSettings{ makeSetting(Http2SettingId::InitialWindowSize, HTTP2_MAX_WINDOW_SIZE + 1), Http2ErrorCode::FlowControlError },
+			 MalformedSettings{ makeSetting(Http2SettingId::MaxFrameSize, HTTP2_DEFAULT_MAX_FRAME_SIZE - 1), Http2ErrorCode::ProtocolError },
+			 MalformedSettings{ makeSetting(Http2SettingId::MaxFrameSize, HTTP2_MAX_MAX_FRAME_SIZE + 1), Http2ErrorCode::ProtocolError } }) {
+		Http2Settings settings;
+		Http2ErrorCode errorCode = Http2ErrorCode::NoError;
+
+		TEST_CHECK(!settings.apply(i.payload, errorCode));
+		TEST_CHECK(errorCode == i.errorCode);
+	}
+
+	{
+		Http2Settings settings;
+
+		// SETTINGS_MAX_CONCURRENT_STREAMS = 100 and SETTINGS_INITIAL_WINDOW_SIZE = 65536, without the padding of base64url.
+		TEST_CHECK(settings.applyBase64("AAMAAABkAAQAAQAA"sv));
+		TEST_CHECK(settings.maxConcurrentStreams == 100);
+		TEST_CHECK(settings.initialWindowSize == 65536);
+
+		TEST_CHECK(settings.applyBase64(""sv));
+		TEST_CHECK(!settings.applyBase64("AAMAAABk+AQAAQAA"sv));
+		TEST_CHECK(!settings.applyBase64("AAMAAABkAA"sv));
+		TEST_CHECK(!settings.applyBase64("AAIAAAAC"sv));
+	}
+}
+
+#ifndef _WIN32
+namespace {
+	/// @brief Client of the HTTP/2 tests over a loopback connection, the frames are built and checked by hand.
+	class TestClient {
+	public:
+		int fd = -1;
+		std::string received;
+		peff::StdAlloc allocator;
+		HpackEncoder encoder;
+		HpackDecoder decoder;
+
+		TestClient() : encoder(&allocator), decoder(&allocator) {
+		}
+
+		~TestClient() {
+			if (fd != -1)
+				close(fd);
+		}
+
+		bool connect(uint16_t port) {
+			if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+				return false;
+
+			// The frames sent byte by byte must not be coalesced.
+			int isNoDelay = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &isNoDelay, sizeof(isNoDelay));
+
+			timeval timeout = { 5, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			return ::connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+		}
+
+		bool send(std::string_view data, size_t szPiece = SIZE_MAX) {
+			while (data.size()) {
+				const ssize_t n = ::send(fd, data.data(), std::min(data.size(), szPiece), 0);
+
+				if (n <= 0)
+					return false;
+				data.remove_prefix(n);
+			}
+
+			return true;
+		}
+
+		/// @brief Receive more data, false if the connection is closed or nothing comes in time.
+		bool receiveMore() {
+			char buffer[4096];
+			const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+
+			if (n <= 0)
+				return false;
+			received.append(buffer, n);
+
+			return true;
+		}
+
+		bool readFrame(Http2FrameHeader &headerOut, std::string &payloadOut) {
+			while (received.size() < HTTP2_FRAME_HEADER_SIZE) {
+				if (!receiveMore())
+					return false;
+			}
+
+			parseHttp2FrameHeader(received.data(), headerOut);
+
+			while (received.size() < HTTP2_FRAME_HEADER_SIZE + headerOut.length) {
+				if (!receiveMore())
+					return false;
+			}
+
+			payloadOut = received.substr(HTTP2_FRAME_HEADER_SIZE, headerOut.length);
+			received.erase(0, HTTP2_FRAME_HEADER_SIZE + headerOut.length);
+
+			return true;
+		}
+
+		/// @brief Check if the server has closed the connection, after the frames left are skipped.
+		bool isClosedByPeer() {
+			Http2FrameHeader header;
+			std::string payload;
+
+			while (readFrame(header, payload))
+				;
+
+			char c;
+			return recv(fd, &c, 1, 0) == 0;
+		}
+
+		std::string makeRequest(uint32_t streamId, std::initializer_list<std::pair<std::string_view, std::string_view>> fields) {
+			peff::String block(&allocator);
+
+			TEST_CHECK(encoder.beginBlock(block));
+			for (const auto &i : fields)
+				TEST_CHECK(encoder.encode(i.first, i.second, true, block));
+
+			return makeFrame(Http2FrameType::Headers, HTTP2_FLAG_END_STREAM | HTTP2_FLAG_END_HEADERS, streamId, toString(block));
+		}
+
+		std::string makeGet(uint32_t streamId, std::string_view path) {
+			return makeRequest(streamId, { { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, path }, { ":authority"sv, "localhost"sv } });
+		}
+
+		/// @brief Read the response of a stream, the other frames are checked on the way.
+		///
+		/// @return Whether the whole response is received.
+		bool readResponse(uint32_t streamId, std::string &statusOut, std::string &bodyOut) {
+			Http2FrameHeader header;
+			std::string payload;
+
+			for (;;) {
+				if (!readFrame(header, payload))
+					return false;
+
+				switch (header.type) {
+					case Http2FrameType::Settings:
+						if (!(header.flags & HTTP2_FLAG_ACK)) {
+							if (!send(makeFrame(Http2FrameType::Settings, HTTP2_FLAG_ACK, 0, {})))
+								return false;
+						}
+						continue;
+					case Http2FrameType::WindowUpdate:
+						TEST_CHECK(header.streamId == 0);
+						continue;
+					case Http2FrameType::Headers: {
+						TEST_CHECK(header.streamId == streamId);
+						TEST_CHECK(header.flags & HTTP2_FLAG_END_HEADERS);
+
+						HttpArena fieldAllocator(&allocator);
+						peff::DynArray<HttpHeaderField> fields(&allocator);
+
+						TEST_CHECK(decoder.decode(payload.data(), payload.size(), 64 * 1024, &fieldAllocator, fields) == HpackDecodeResult::Done);
+						TEST_CHECK(fields.size() && (fields.at(0).name == ":status"sv));
+						if (fields.size())
+							statusOut = std::string(fields.at(0).value);
+
+						if (header.flags & HTTP2_FLAG_END_STREAM)
+							return true;
+						continue;
+					}
+					case Http2FrameType::Data:
+						TEST_CHECK(header.streamId == streamId);
+						bodyOut += payload;
+
+						if (header.flags & HTTP2_FLAG_END_STREAM)
+							return true;
+						continue;
+					default:
+						fprintf(stderr, "unexpected frame of type %u on stream %u\n", (unsigned)header.type, header.streamId);
+						return false;
+				}
+			}
+		}
+	};
+}
+
+static const std::string g_prefaceAndSettings = std::string(HTTP2_CONNECTION_PREFACE) + makeFrame(Http2FrameType::Settings, 0, 0, {});
+
+/// @brief Send a request with the data split into pieces of a size, and check the frames which the session sends back.
+static void testRequests(uint16_t port, size_t szPiece) {
+	TestClient client;
+
+	if (!client.connect(port)) {
+		TEST_CHECK(!"cannot connect to the server");
+		return;
+	}
+
+	const std::string ping = makeFrame(Http2FrameType::Ping, 0, 0, "pingpong"sv);
+	TEST_CHECK(client.send(g_prefaceAndSettings + ping + client.makeGet(1, "/hello"), szPiece));
+
+	Http2FrameHeader header;
+	std::string payload;
+
+	// The settings of the server come first, and ours are acknowledged before the ping is answered.
+	TEST_CHECK(client.readFrame(header, payload));
+	TEST_CHECK((header.type == Http2FrameType::Settings) && (!header.flags) && (!header.streamId));
+	TEST_CHECK(client.send(makeFrame(Http2FrameType::Settings, HTTP2_FLAG_ACK, 0, {}), szPiece));
+
+	bool isSettingsAcked = false, isPingAcked = false;
+	while ((!isSettingsAcked) || (!isPingAcked)) {
+		if (!client.readFrame(header, payload)) {
+			TEST_CHECK(!"no acknowledgement of the settings or the ping");
+			return;
+		}
+
+		if (header.type == Http2FrameType::Settings) {
+			TEST_CHECK(header.flags == HTTP2_FLAG_ACK);
+			TEST_CHECK(payload.empty());
+			isSettingsAcked = true;
+		} else if (header.type == Http2FrameType::Ping) {
+			TEST_CHECK(isSettingsAcked);
+			TEST_CHECK(header.flags == HTTP2_FLAG_ACK);
+			TEST_CHECK(payload == "pingpong"sv);
+			isPingAcked = true;
+		} else
+			TEST_CHECK(header.type == Http2FrameType::WindowUpdate);
+	}
+
+	std::string status, body;
+	TEST_CHECK(client.readResponse(1, status, body));
+	TEST_CHECK(status == "200"sv);
+	TEST_CHECK(body == "hello"sv);
+
+	// The second request refers to the fields which the first one has added to the dynamic table of the server.
+	status.clear();
+	body.clear();
+	TEST_CHECK(client.send(client.makeGet(3, "/hello"), szPiece));
+	TEST_CHECK(client.readResponse(3, status, body));
+	TEST_CHECK(status == "200"sv);
+	TEST_CHECK(body == "hello"sv);
+
+	status.clear();
+	body.clear();
+	TEST_CHECK(client.send(client.makeGet(5, "/missing"), szPiece));
+	TEST_CHECK(client.readResponse(5, status, body));
+	TEST_CHECK(status == "404"sv);
+
+	// The connection is closed once the client goes away with no stream left.
+	TEST_CHECK(client.send(makeFrame(Http2FrameType::GoAway, 0, 0, makeUint32(0) + makeUint32((uint32_t)Http2ErrorCode::NoError))));
+	TEST_CHECK(client.isClosedByPeer());
+}
+
+/// @brief Send frames after the preface, which must fail the stream with RST_STREAM.
+static void checkStreamError(uint16_t port, const char *name, std::string_view frames, uint32_t streamId, Http2ErrorCode expectedErrorCode) {
+	TestClient client;
+
+	if (!client.connect(port)) {
+		TEST_CHECK(!"cannot connect to the server");
+		return;
+	}
+
+	TEST_CHECK(client.send(g_prefaceAndSettings + std::string(frames)));
+
+	Http2FrameHeader header;
+	std::string payload;
+
+	while (client.readFrame(header, payload)) {
+		if (header.type == Http2FrameType::RstStream) {
+			TEST_CHECK(header.streamId == streamId);
+			TEST_CHECK(payload.size() == 4);
+			if (readHttp2Uint32(payload.data()) != (uint32_t)expectedErrorCode)
+				fprintf(stderr, "%s: stream reset with %u\n", name, readHttp2Uint32(payload.data()));
+			TEST_CHECK(readHttp2Uint32(payload.data()) == (uint32_t)expectedErrorCode);
+
+			// The connection goes on.
+			TEST_CHECK(client.send(makeFrame(Http2FrameType::Ping, 0, 0, "stillup!"sv)));
+			while (client.readFrame(header, payload) && (header.type != Http2FrameType::Ping))
+				;
+			TEST_CHECK((header.type == Http2FrameType::Ping) && (header.flags == HTTP2_FLAG_ACK));
+			return;
+		}
+
+		TEST_CHECK(header.type != Http2FrameType::GoAway);
+	}
+
+	fprintf(stderr, "%s: no RST_STREAM\n", name);
+	TEST_CHECK(!"no RST_STREAM");
+}
+
+/// @brief Send data after the connection is set up, which must fail the connection with GOAWAY before it is closed.
+static void checkConnectionError(uint16_t port, const char *name, std::string_view data, Http2ErrorCode expectedErrorCode, bool isPrefaceSent = true) {
+	TestClient client;
+
+	if (!client.connect(port)) {
+		TEST_CHECK(!"cannot connect to the server");
+		return;
+	}
+
+	TEST_CHECK(client.send((isPrefaceSent ? g_prefaceAndSettings : std::string()) + std::string(data)));
+
+	Http2FrameHeader header;
+	std::string payload;
+
+	while (client.readFrame(header, payload)) {
+		if (header.type != Http2FrameType::GoAway)
+			continue;
+
+		TEST_CHECK(header.streamId == 0);
+		TEST_CHECK(payload.size() == 8);
+		if (payload.size() >= 8) {
+			if (readHttp2Uint32(payload.data() + 4) != (uint32_t)expectedErrorCode)
+				fprintf(stderr, "%s: GOAWAY with %u\n", name, readHttp2Uint32(payload.data() + 4));
+			TEST_CHECK(readHttp2Uint32(payload.data() + 4) == (uint32_t)expectedErrorCode);
+		}
+
+		TEST_CHECK(client.isClosedByPeer());
+		return;
+	}
+
+	fprintf(stderr, "%s: no GOAWAY\n", name);
+	TEST_CHECK(!"no GOAWAY");
+}
+
+static void testErrors(uint16_t port) {
+	{
+		TestClient client;
+		checkStreamError(port, "missing :path", client.makeRequest(1, { { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv } }), 1, Http2ErrorCode::ProtocolError);
+	}
+	{
+		TestClient client;
+		checkStreamError(port, "te other than trailers", client.makeRequest(1, { { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { ":path"sv, "/hello"sv }, { "te"sv, "gzip"sv } }), 1, Http2ErrorCode::ProtocolError);
+	}
+	{
+		TestClient client;
+		checkStreamError(port, "pseudo-header after a field", client.makeRequest(1, { { ":method"sv, "GET"sv }, { ":scheme"sv, "http"sv }, { "accept"sv, "*/*"sv }, { ":path"sv, "/hello"sv } }), 1, Http2ErrorCode::ProtocolError);
+	}
+
+	{
+		TestClient client;
+		checkConnectionError(port, "even stream", client.makeGet(2, "/hello"), Http2ErrorCode::ProtocolError);
+	}
+	{
+		TestClient client;
+		const std::string headers = client.makeGet(1, "/hello");
+
+		// HEADERS without END_HEADERS must be followed by CONTINUATION of the same stream.
+		std::string unfinished = headers;
+		unfinished[4] = (char)HTTP2_FLAG_END_STREAM;
+		checkConnectionError(port, "interleaved header block", unfinished + makeFrame(Http2FrameType::Ping, 0, 0, "12345678"sv), Http2ErrorCode::ProtocolError);
+		checkConnectionError(port, "continuation of another stream", unfinished + makeFrame(Http2FrameType::Continuation, HTTP2_FLAG_END_HEADERS, 3, {}), Http2ErrorCode::ProtocolError);
+	}
+
+	checkConnectionError(port, "bad preface", "PRI * HTTP/2.0\r\n\r\nXX\r\n\r\n"sv, Http2ErrorCode::ProtocolError, false);
+	checkConnectionError(port, "data on stream 0", makeFrame(Http2FrameType::Data, 0, 0, "x"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "data on idle stream", makeFrame(Http2FrameType::Data, 0, 7, "x"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "headers on stream 0", makeFrame(Http2FrameType::Headers, HTTP2_FLAG_END_HEADERS, 0, "\x82"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "malformed header block", makeFrame(Http2FrameType::Headers, HTTP2_FLAG_END_HEADERS, 1, "\x80"sv), Http2ErrorCode::CompressionError);
+	checkConnectionError(port, "padding beyond headers", makeFrame(Http2FrameType::Headers, HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_PADDED, 1, "\x05\x82"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "continuation without headers", makeFrame(Http2FrameType::Continuation, HTTP2_FLAG_END_HEADERS, 1, "\x82"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "truncated settings", makeFrame(Http2FrameType::Settings, 0, 0, "\x00\x02\x00\x00\x00"sv), Http2ErrorCode::FrameSizeError);
+	checkConnectionError(port, "settings on a stream", makeFrame(Http2FrameType::Settings, 0, 1, {}), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "settings ack with payload", makeFrame(Http2FrameType::Settings, HTTP2_FLAG_ACK, 0, makeSetting(Http2SettingId::EnablePush, 0)), Http2ErrorCode::FrameSizeError);
+	checkConnectionError(port, "push enabled twice", makeFrame(Http2FrameType::Settings, 0, 0, makeSetting(Http2SettingId::EnablePush, 2)), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "window beyond limit", makeFrame(Http2FrameType::Settings, 0, 0, makeSetting(Http2SettingId::InitialWindowSize, 0x80000000)), Http2ErrorCode::FlowControlError);
+	checkConnectionError(port, "ping on a stream", makeFrame(Http2FrameType::Ping, 0, 1, "12345678"sv), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "short ping", makeFrame(Http2FrameType::Ping, 0, 0, "1234567"sv), Http2ErrorCode::FrameSizeError);
+	checkConnectionError(port, "push promise", makeFrame(Http2FrameType::PushPromise, HTTP2_FLAG_END_HEADERS, 1, makeUint32(2)), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "reset of idle stream", makeFrame(Http2FrameType::RstStream, 0, 5, makeUint32(0)), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "zero window update", makeFrame(Http2FrameType::WindowUpdate, 0, 0, makeUint32(0)), Http2ErrorCode::ProtocolError);
+	checkConnectionError(port, "window overflow", makeFrame(Http2FrameType::WindowUpdate, 0, 0, makeUint32(HTTP2_MAX_WINDOW_SIZE)), Http2ErrorCode::FlowControlError);
+
+	{
+		// The frames beyond the default size are refused from their headers.
+		char header[HTTP2_FRAME_HEADER_SIZE];
+
+		formatHttp2FrameHeader(header, HTTP2_DEFAULT_MAX_FRAME_SIZE + 1, Http2FrameType::Ping, 0, 0);
+		checkConnectionError(port, "oversized frame", std::string_view(header, sizeof(header)), Http2ErrorCode::FrameSizeError);
+	}
+}
+
+/// @brief Get a free port on the loopback from the system.
+static uint16_t pickPort() {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd == -1)
+		return 0;
+
+	sockaddr_in addr = {};
+	socklen_t szAddr = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	uint16_t port = 0;
+	if ((!bind(fd, (sockaddr *)&addr, sizeof(addr))) && (!getsockname(fd, (sockaddr *)&addr, &szAddr)))
+		port = ntohs(addr.sin_port);
+	close(fd);
+
+	return port;
+}
+
+/// @brief Run a server on the loopback, and drive its sessions from another thread.
+static void testSessions() {
+	// Sending to a connection which has been shut down must fail instead of killing the process.
+	signal(SIGPIPE, SIG_IGN);
+
+	peff::StdAlloc allocator;
+	netknot::ExceptionPointer e;
+
+	peff::UniquePtr<netknot::IOService, peff::DeallocableDeleter<netknot::IOService>> ioService;
+	{
+		netknot::IOServiceCreationParams params(&allocator, &allocator);
+	#if NETKNOT_SINGLE_THREADED
+		params.nWorkerThreads = 0;
+		params.nComputeThreads = 0;
+	#else
+		params.nWorkerThreads = 1;
+		params.nComputeThreads = 1;
+	#endif
+
+		if ((e = netknot::createDefaultIOService(ioService.getRef(), params))) {
+			TEST_CHECK(!"cannot create the I/O service");
+			return;
+		}
+	}
+
+	peff::UniquePtr<netknot::Socket, peff::DeallocableDeleter<netknot::Socket>> socket;
+	if ((e = ioService->createSocket(&allocator, netknot::ADDRFAM_IPV4, netknot::SOCKET_TCP, socket.getRef()))) {
+		TEST_CHECK(!"cannot create the socket");
+		return;
+	}
+
+	// The binding of the server cannot fail gracefully, a port which the system has just handed out is taken.
+	const uint16_t port = pickPort();
+	if (!port) {
+		TEST_CHECK(!"no port is available");
+		return;
+	}
+
+	{
+		peff::UniquePtr<netknot::TranslatedAddress, peff::DeallocableDeleter<netknot::TranslatedAddress>> compiledAddr;
+		netknot::IPv4Address addr(127, 0, 0, 1, port);
+
+		if ((e = ioService->translateAddress(&allocator, &addr, compiledAddr.getAddressOf()))) {
+			TEST_CHECK(!"cannot translate the address");
+			return;
+		}
+
+		if ((e = socket->bind(compiledAddr.get()))) {
+			TEST_CHECK(!"cannot bind the socket");
+			return;
+		}
+	}
+
+	if ((e = socket->listen(16))) {
+		TEST_CHECK(!"cannot listen");
+		return;
+	}
+
+	HttpServer httpServer(&allocator, ioService.get(), socket.release());
+
+	if ((e = httpServer.start())) {
+		TEST_CHECK(!"cannot start the server");
+		return;
+	}
+
+	peff::UniquePtr<HttpRequestHandler, peff::DeallocableDeleter<HttpRequestHandler>> helloGetHandler = allocFnHttpRequestHandler(
+		&allocator,
+		"GET",
+		[](const HttpURLHandlerState &state) -> netknot::ExceptionPointer {
+			return const_cast<HttpURLHandlerState &>(state).writeResponse(HttpResponseStatus::OK, "text/plain", "hello");
+		});
+	peff::UniquePtr<HttpRequestHandler, peff::DeallocableDeleter<HttpRequestHandler>> stopGetHandler = allocFnHttpRequestHandler(
+		&allocator,
+		"GET",
+		[](const HttpURLHandlerState &state) -> netknot::ExceptionPointer {
+			return state.httpServer->ioService->stop();
+		});
+	if ((!helloGetHandler) || (!stopGetHandler)) {
+		TEST_CHECK(!"out of memory");
+		return;
+	}
+
+	if ((e = httpServer.registerHandler("/hello", helloGetHandler.release())) ||
+		(e = httpServer.registerHandler("/stop", stopGetHandler.release()))) {
+		TEST_CHECK(!"cannot register the handlers");
+		return;
+	}
+
+	std::thread clientThread([port]() {
+		testRequests(port, SIZE_MAX);
+		testRequests(port, 1);
+		testErrors(port);
+
+		// The server is stopped by a request, which is only handled while it runs.
+		TestClient client;
+		if (client.connect(port))
+			client.send("GET /stop HTTP/1.1\r\nHost: localhost\r\n\r\n"sv);
+		else
+			TEST_CHECK(!"cannot connect to the server");
+	});
+
+	if ((e = ioService->run()))
+		TEST_CHECK(!"the server has failed");
+
+	clientThread.join();
+}
+#endif
+
+int main() {
+	testFrameHeaders();
+	testSettings();
+#ifndef _WIN32
+	testSessions();
+#endif
+
+	return test::getExitCode();
+}
@@ -0,0 +1,166 @@
+#include "test.h"
+#include <http_parser.h>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+using namespace http;
+
+using std::operator""sv;
+
+constexpr std::string_view g_head =
+	"\r\nPOST /upload/files?name=a%20b HTTP/1.1\r\n"
+	"Host: example.com\r\n"
+	"Content-Length:  11 \r\n"
+	"X-Custom-Header: \tsome value\r\n"
+	"Accept: text/html\r\n"
+	"X-Empty:\r\n"
+	"x-custom-header: second\r\n"
+	"\r\n"sv;
+constexpr std::string_view g_body = "hello world"sv;
+
+struct ParsedHead {
+	HttpParseResult result;
+	size_t szConsumed = 0;
+	std::string method, path, version;
+	std::vector<std::string> knownHeaders;
+	std::vector<std::pair<std::string, std::string>> otherHeaders;
+};
+
+/// @brief Parse the input fed in pieces which end at the offsets, the views are copied before the parser is dropped.
+static ParsedHead parseInPieces(const HttpScanner &scanner, std::string_view input, std::initializer_list<size_t> offSplits, size_t maxHeadSize = 64 * 1024) {
+	peff::StdAlloc allocator;
+	HttpRequestParser parser(&allocator, maxHeadSize, scanner);
+	ParsedHead parsed;
+	size_t offPiece = 0;
+
+	parsed.result = HttpParseResult::NeedMore;
+
+	auto feed = [&](size_t offEnd) {
+		if ((parsed.result != HttpParseResult::NeedMore) || (offEnd <= offPiece))
+			return;
+
+		size_t szConsumed;
+
+		parsed.result = parser.parse(input.data() + offPiece, offEnd - offPiece, szConsumed);
+		parsed.szConsumed += szConsumed;
+		offPiece = offEnd;
+	};
+
+	for (size_t offSplit : offSplits)
+		feed(offSplit);
+	feed(input.size());
+
+	if (parsed.result != HttpParseResult::Done)
+		return parsed;
+
+	const HttpRequestLineView requestLine = parser.getRequestLineView();
+	parsed.method = requestLine.method;
+	parsed.path = requestLine.path;
+	parsed.version = requestLine.version;
+
+	HttpRequestHeaderView headerView(&allocator);
+
+	TEST_CHECK(parser.buildRequestHeaderView(headerView));
+
+	for (size_t i = 0; i < HTTP_HEADER_ID_COUNT; ++i) {
+		const std::string_view value = headerView.knownHeaders[i];
+		parsed.knownHeaders.push_back(value.data() ? "=" + std::string(value) : "");
+	}
+	for (size_t i = 0; i < headerView.otherHeaders.size(); ++i)
+		parsed.otherHeaders.emplace_back(std::string(headerView.otherHeaders.at(i).name), std::string(headerView.otherHeaders.at(i).value));
+
+	return parsed;
+}
+
+static bool isSameHead(const ParsedHead &lhs, const ParsedHead &rhs) {
+	return (lhs.result == rhs.result) &&
+		   (lhs.szConsumed == rhs.szConsumed) &&
+		   (lhs.method == rhs.method) &&
+		   (lhs.path == rhs.path) &&
+		   (lhs.version == rhs.version) &&
+		   (lhs.knownHeaders == rhs.knownHeaders) &&
+		   (lhs.otherHeaders == rhs.otherHeaders);
+}
+
+static void testWholeHead(const HttpScanner &scanner) {
+	const std::string input = std::string(g_head) + std::string(g_body);
+	const ParsedHead parsed = parseInPieces(scanner, input, {});
+
+	TEST_CHECK(parsed.result == HttpParseResult::Done);
+	// The parser stops right after the head, the body is left alone.
+	TEST_CHECK(parsed.szConsumed == g_head.size());
+	TEST_CHECK(parsed.method == "POST"sv);
+	TEST_CHECK(parsed.path == "/upload/files?name=a%20b"sv);
+	TEST_CHECK(parsed.version == "HTTP/1.1"sv);
+
+	if (parsed.result == HttpParseResult::Done) {
+		TEST_CHECK(parsed.knownHeaders[(size_t)HttpHeaderId::Host] == "=example.com"sv);
+		TEST_CHECK(parsed.knownHeaders[(size_t)HttpHeaderId::ContentLength] == "=11"sv);
+		TEST_CHECK(parsed.knownHeaders[(size_t)HttpHeaderId::Accept] == "=text/html"sv);
+		TEST_CHECK(parsed.knownHeaders[(size_t)HttpHeaderId::Cookie].empty());
+	}
+}
+
+static void testSplitAtEveryOffset(const HttpScanner &scanner) {
+	const std::string input = std::string(g_head) + std::string(g_body);
+	const ParsedHead expected = parseInPieces(scanner, input, {});
+
+	// Every pair of cuts, so each token is cut at each of its bytes, and twice within the same token.
+	for (size_t i = 1; i < input.size(); ++i) {
+		TEST_CHECK(isSameHead(parseInPieces(scanner, input, { i }), expected));
+
+		for (size_t j = i + 1; j < g_head.size(); ++j)
+			TEST_CHECK(isSameHead(parseInPieces(scanner, input, { i, j }), expected));
+	}
+
+	// A byte at a time.
+	peff::StdAlloc allocator;
+	HttpRequestParser parser(&allocator, 64 * 1024, scanner);
+	size_t offFed = 0;
+	HttpParseResult result = HttpParseResult::NeedMore;
+
+	while ((result == HttpParseResult::NeedMore) && (offFed < input.size())) {
+		size_t szConsumed;
+
+		result = parser.parse(input.data() + offFed, 1, szConsumed);
+		offFed += szConsumed;
+	}
+
+	TEST_CHECK(result == HttpParseResult::Done);
+	TEST_CHECK(offFed == g_head.size());
+}
+
+static void testLimitsAtEveryOffset(const HttpScanner &scanner) {
+	// The limit is the same however the head is cut.
+	for (size_t i = 1; i < g_head.size(); ++i) {
+		TEST_CHECK(parseInPieces(scanner, g_head, { i }, g_head.size()).result == HttpParseResult::Done);
+		TEST_CHECK(parseInPieces(scanner, g_head, { i }, g_head.size() - 1).result == HttpParseResult::TooLarge);
+	}
+
+	for (std::string_view head : {
+			 "GET /\r\n\r\n"sv,
+			 "GET / HTTP/1.1\nHost: a\r\n\r\n"sv,
+			 "GET / HTTP/1.1\r\nHost : a\r\n\r\n"sv,
+			 "GET / HTTP/1.1\r\nBad Name: a\r\n\r\n"sv,
+			 "GET / HTTP/1.1\r\nHost: a\rb\r\n\r\n"sv,
+			 "GET / HTTP/1.1\r\n: a\r\n\r\n"sv,
+			 "G(T / HTTP/1.1\r\n\r\n"sv }) {
+		for (size_t i = 1; i < head.size(); ++i)
+			TEST_CHECK(parseInPieces(scanner, head, { i }).result == HttpParseResult::Malformed);
+	}
+}
+
+int main() {
+	const HttpScanLevel supportedLevel = getSupportedHttpScanLevel();
+
+	for (uint8_t level = 0; level <= (uint8_t)supportedLevel; ++level) {
+		const HttpScanner &scanner = getHttpScanner((HttpScanLevel)level);
+
+		testWholeHead(scanner);
+		testSplitAtEveryOffset(scanner);
+		testLimitsAtEveryOffset(scanner);
+	}
+
+	return test::getExitCode();
+}
@@ -0,0 +1,182 @@
+#include "test.h"
+#include <http_router.h>
+#include <initializer_list>
+
+using namespace http;
+
+using std::operator""sv;
+
+/// @brief Handlers which are only compared by their addresses.
+static char g_handlerTokens[16];
+
+static HttpRequestHandler *getHandler(size_t index) {
+	return reinterpret_cast<HttpRequestHandler *>(&g_handlerTokens[index]);
+}
+
+struct RouteTableRef {
+	HttpRouteTable *table = nullptr;
+
+	~RouteTableRef() {
+		if (table)
+			table->decRef(0);
+	}
+};
+
+static netknot::ExceptionPointer buildTable(peff::Alloc *allocator, std::initializer_list<HttpRoute> routes, RouteTableRef &tableOut) {
+	HttpRouteTable *table;
+
+	NETKNOT_RETURN_IF_EXCEPT(HttpRouteTable::alloc(allocator, routes.begin(), routes.size(), table));
+
+	table->incRef(0);
+	tableOut.table = table;
+
+	return {};
+}
+
+static bool isInvalidArgs(netknot::ExceptionPointer &&e) {
+	if (!e)
+		return false;
+
+	const bool isInvalid = e->kind == netknot::EXCEPT_INVALID_ARGS;
+
+	e.reset();
+	return isInvalid;
+}
+
+static void checkMatch(const HttpRouteTable *table, std::string_view path, std::string_view method, HttpRouteResult expectedResult, HttpRequestHandler *expectedHandler = nullptr, std::initializer_list<HttpRouteParam> expectedParams = {}) {
+	HttpRequestHandler *handler = nullptr;
+	HttpRouteParams params;
+
+	const HttpRouteResult result = table->match(path, method, handler, params);
+
+	TEST_CHECK(result == expectedResult);
+	if ((result != HttpRouteResult::Found) || (expectedResult != HttpRouteResult::Found))
+		return;
+
+	TEST_CHECK(handler == expectedHandler);
+	TEST_CHECK(params.nParams == expectedParams.size());
+
+	size_t i = 0;
+	for (const HttpRouteParam &expected : expectedParams) {
+		if (i < params.nParams) {
+			TEST_CHECK(params.params[i].name == expected.name);
+			TEST_CHECK(params.params[i].value == expected.value);
+		}
+		++i;
+	}
+}
+
+static void testConflicts() {
+	peff::StdAlloc allocator;
+	RouteTableRef table;
+
+	// Parameters at the same place must share the name, the rest of the patterns does not matter.
+	TEST_CHECK(isInvalidArgs(buildTable(&allocator, { { "/users/{id}"sv, "GET"sv, getHandler(0) }, { "/users/{name}/posts"sv, "GET"sv, getHandler(1) } }, table)));
+	TEST_CHECK(isInvalidArgs(buildTable(&allocator, { { "/files/{*path}"sv, "GET"sv, getHandler(0) }, { "/files/{*rest}"sv, "POST"sv, getHandler(1) } }, table)));
+	// The same pattern and method twice.
+	TEST_CHECK(isInvalidArgs(buildTable(&allocator, { { "/a"sv, "GET"sv, getHandler(0) }, { "/a"sv, "GET"sv, getHandler(1) } }, table)));
+
+	for (std::string_view pattern : { ""sv, "a"sv, "/a{b}"sv, "/{}"sv, "/{a"sv, "/a}"sv, "/{*rest}/x"sv, "/{a}b"sv, "/{a-b}"sv, "/{a}/{b}/{c}/{d}/{e}/{f}/{g}/{h}/{i}"sv }) {
+		TEST_CHECK(!HttpRouteTable::isPatternValid(pattern));
+		TEST_CHECK(isInvalidArgs(buildTable(&allocator, { { pattern, "GET"sv, getHandler(0) } }, table)));
+	}
+
+	// Nothing conflicts here.
+	TEST_CHECK(!buildTable(&allocator, { { "/a"sv, "GET"sv, getHandler(0) }, { "/a"sv, "POST"sv, getHandler(1) }, { "/{id}"sv, "GET"sv, getHandler(2) }, { "/{id}/x"sv, "GET"sv, getHandler(3) } }, table));
+	TEST_CHECK(table.table != nullptr);
+}
+
+static void testBacktracking() {
+	peff::StdAlloc allocator;
+	RouteTableRef table;
+
+	TEST_CHECK(!buildTable(&allocator,
+		{ { "/users/new"sv, "GET"sv, getHandler(0) },
+			{ "/users/{id}"sv, "GET"sv, getHandler(1) },
+			{ "/users/new/edit"sv, "POST"sv, getHandler(2) },
+			{ "/users/{id}/edit"sv, "GET"sv, getHandler(3) },
+			{ "/users/{id}/posts/{post}"sv, "GET"sv, getHandler(4) },
+			{ "/{a}/q"sv, "GET"sv, getHandler(5) },
+			{ "/{a}/{b}/z"sv, "GET"sv, getHandler(6) } },
+		table));
+	if (!table.table)
+		return;
+
+	// The static text takes precedence over the parameter.
+	checkMatch(table.table, "/users/new"sv, "GET"sv, HttpRouteResult::Found, getHandler(0));
+	checkMatch(table.table, "/users/42"sv, "GET"sv, HttpRouteResult::Found, getHandler(1), { { "id"sv, "42"sv } });
+	// The static branch only has POST, the parameter branch takes GET.
+	checkMatch(table.table, "/users/new/edit"sv, "POST"sv, HttpRouteResult::Found, getHandler(2));
+	checkMatch(table.table, "/users/new/edit"sv, "GET"sv, HttpRouteResult::Found, getHandler(3), { { "id"sv, "new"sv } });
+	// A prefix of a static node is not a match of it.
+	checkMatch(table.table, "/users/newer"sv, "GET"sv, HttpRouteResult::Found, getHandler(1), { { "id"sv, "newer"sv } });
+	checkMatch(table.table, "/users/new/posts/7"sv, "GET"sv, HttpRouteResult::Found, getHandler(4), { { "id"sv, "new"sv }, { "post"sv, "7"sv } });
+	// The parameter captured by a branch which has failed is dropped.
+	checkMatch(table.table, "/1/q"sv, "GET"sv, HttpRouteResult::Found, getHandler(5), { { "a"sv, "1"sv } });
+	checkMatch(table.table, "/1/q/z"sv, "GET"sv, HttpRouteResult::Found, getHandler(6), { { "a"sv, "1"sv }, { "b"sv, "q"sv } });
+
+	// A parameter takes a non-empty segment.
+	checkMatch(table.table, "/users//edit"sv, "GET"sv, HttpRouteResult::NotFound);
+	checkMatch(table.table, "/users/"sv, "GET"sv, HttpRouteResult::NotFound);
+	checkMatch(table.table, "/users/1/posts"sv, "GET"sv, HttpRouteResult::NotFound);
+	checkMatch(table.table, "/users/1"sv, "DELETE"sv, HttpRouteResult::MethodNotAllowed);
+	checkMatch(table.table, "/users/new/edit"sv, "PUT"sv, HttpRouteResult::MethodNotAllowed);
+}
+
+static void testWildcards() {
+	peff::StdAlloc allocator;
+	RouteTableRef table;
+
+	TEST_CHECK(!buildTable(&allocator,
+		{ { "/static/css/site.css"sv, "GET"sv, getHandler(0) },
+			{ "/static/{*path}"sv, "GET"sv, getHandler(1) },
+			{ "/static/{*path}"sv, "HEAD"sv, getHandler(2) },
+			{ "/static/{dir}/index"sv, "GET"sv, getHandler(3) },
+			{ "/"sv, "GET"sv, getHandler(4) } },
+		table));
+	if (!table.table)
+		return;
+
+	checkMatch(table.table, "/static/css/site.css"sv, "GET"sv, HttpRouteResult::Found, getHandler(0));
+	// The wildcard takes the rest of the path with its slashes, after the static text and the parameters fail.
+	checkMatch(table.table, "/static/css/other.css"sv, "GET"sv, HttpRouteResult::Found, getHandler(1), { { "path"sv, "css/other.css"sv } });
+	checkMatch(table.table, "/static/css/site.css"sv, "HEAD"sv, HttpRouteResult::Found, getHandler(2), { { "path"sv, "css/site.css"sv } });
+	checkMatch(table.table, "/static/docs/index"sv, "GET"sv, HttpRouteResult::Found, getHandler(3), { { "dir"sv, "docs"sv } });
+	checkMatch(table.table, "/static/docs/index"sv, "HEAD"sv, HttpRouteResult::Found, getHandler(2), { { "path"sv, "docs/index"sv } });
+	checkMatch(table.table, "/static/a/b/c"sv, "GET"sv, HttpRouteResult::Found, getHandler(1), { { "path"sv, "a/b/c"sv } });
+	checkMatch(table.table, "/static/a/b/c"sv, "POST"sv, HttpRouteResult::MethodNotAllowed);
+	checkMatch(table.table, "/"sv, "GET"sv, HttpRouteResult::Found, getHandler(4));
+	checkMatch(table.table, "/other"sv, "GET"sv, HttpRouteResult::NotFound);
+}
+
+static void testRetiredTables() {
+	peff::StdAlloc allocator;
+	HttpRouteTable *tables[3];
+
+	for (HttpRouteTable *&table : tables) {
+		const HttpRoute route = { "/a"sv, "GET"sv, getHandler(0) };
+
+		TEST_CHECK(!HttpRouteTable::alloc(&allocator, &route, 1, table));
+		table->incRef(0);
+	}
+
+	// Each table keeps the next one, so the newer tables go only after the older ones.
+	tables[0]->retire(tables[1], nullptr);
+	tables[1]->retire(tables[2], nullptr);
+
+	TEST_CHECK(tables[2]->decRef(0) == 1);
+	TEST_CHECK(tables[1]->decRef(0) == 1);
+
+	checkMatch(tables[2], "/a"sv, "GET"sv, HttpRouteResult::Found, getHandler(0));
+
+	TEST_CHECK(tables[0]->decRef(0) == 0);
+}
+
+int main() {
+	testConflicts();
+	testBacktracking();
+	testWildcards();
+	testRetiredTables();
+
+	return test::getExitCode();
+}
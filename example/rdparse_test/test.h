@@ -0,0 +1,44 @@
+#ifndef _RDPARSE_TEST_TEST_H_
+#define _RDPARSE_TEST_TEST_H_
+
+#include <peff/base/alloc.h>
+#include <cstdio>
+#include <string_view>
+
+namespace test {
+	/// @brief Number of the checks which have failed, the test fails if any of them has.
+	inline size_t g_nFailures = 0;
+
+	/// @brief Allocator which counts the bytes it has handed out, to check that the untrusted input cannot make the parsers allocate without bound.
+	class CountingAlloc : public peff::StdAlloc {
+	public:
+		size_t szAllocated = 0;
+
+		virtual void *alloc(size_t size, size_t alignment) noexcept override {
+			szAllocated += size;
+			return this->StdAlloc::alloc(size, alignment);
+		}
+
+		virtual void *realloc(void *p, size_t size, size_t alignment, size_t newSize, size_t newAlignment) noexcept override {
+			if (newSize > size)
+				szAllocated += newSize - size;
+			return this->StdAlloc::realloc(p, size, alignment, newSize, newAlignment);
+		}
+	};
+
+	inline int getExitCode() noexcept {
+		if (g_nFailures)
+			fprintf(stderr, "%zu check(s) failed\n", g_nFailures);
+		return g_nFailures ? 1 : 0;
+	}
+}
+
+#define TEST_CHECK(expr)                                                               \
+	do {                                                                               \
+		if (!(expr)) {                                                                 \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			++test::g_nFailures;                                                       \
+		}                                                                              \
+	} while (0)
+
+#endif
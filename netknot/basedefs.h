@@ -38,4 +38,53 @@
 	#endif
 #endif
 
+#include <atomic>
+
+namespace netknot {
+#if NETKNOT_SINGLE_THREADED
+	/// @brief Non-atomic stand-in for std::atomic in single-threaded builds, where every object is confined to one thread.
+	template <typename T>
+	class MaybeAtomic {
+	private:
+		T _value;
+
+	public:
+		constexpr MaybeAtomic(T value) noexcept : _value(value) {}
+
+		NETKNOT_FORCEINLINE operator T() const noexcept {
+			return _value;
+		}
+
+		NETKNOT_FORCEINLINE T operator=(T value) noexcept {
+			return _value = value;
+		}
+
+		NETKNOT_FORCEINLINE T operator++() noexcept {
+			return ++_value;
+		}
+
+		NETKNOT_FORCEINLINE T operator--() noexcept {
+			return --_value;
+		}
+
+		NETKNOT_FORCEINLINE T operator+=(T value) noexcept {
+			return _value += value;
+		}
+
+		NETKNOT_FORCEINLINE T operator-=(T value) noexcept {
+			return _value -= value;
+		}
+
+		NETKNOT_FORCEINLINE T exchange(T value) noexcept {
+			T oldValue = _value;
+			_value = value;
+			return oldValue;
+		}
+	};
+#else
+	template <typename T>
+	using MaybeAtomic = std::atomic<T>;
+#endif
+}
+
 #endif
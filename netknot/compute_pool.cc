@@ -0,0 +1,168 @@
+#include "compute_pool.h"
+#include <peff/utils/scope_guard.h>
+#include <system_error>
+
+using namespace netknot;
+
+static thread_local ComputePool::ComputeThread *g_currentComputeThread = nullptr;
+
+NETKNOT_API ComputePool::ComputePool(peff::Alloc *selfAllocator, PostedWorkPool *workPool)
+	: selfAllocator(selfAllocator),
+	  workPool(workPool),
+	  threads(selfAllocator) {
+}
+
+NETKNOT_API ComputePool::~ComputePool() {
+	stop();
+}
+
+NETKNOT_API ComputePool *ComputePool::alloc(peff::Alloc *selfAllocator, PostedWorkPool *workPool) {
+	return peff::allocAndConstruct<ComputePool>(selfAllocator, alignof(ComputePool), selfAllocator, workPool);
+}
+
+NETKNOT_API void ComputePool::dealloc() noexcept {
+	peff::destroyAndRelease<ComputePool>(selfAllocator.get(), this, alignof(ComputePool));
+}
+
+NETKNOT_API ExceptionPointer ComputePool::start(size_t nThreads) noexcept {
+	peff::ScopeGuard stopGuard([this]() noexcept {
+		stop();
+	});
+
+	for (size_t i = 0; i < nThreads; ++i) {
+		ComputeThread *thread = peff::allocAndConstruct<ComputeThread>(selfAllocator.get(), alignof(ComputeThread), this, i);
+
+		if (!thread)
+			return OutOfMemoryError::alloc();
+
+		if (!threads.pushBack(std::move(thread))) {
+			peff::destroyAndRelease<ComputeThread>(selfAllocator.get(), thread, alignof(ComputeThread));
+			return OutOfMemoryError::alloc();
+		}
+	}
+
+	// Every thread is started after the array is complete, because the threads steal from each other.
+	for (auto i : threads) {
+		try {
+			i->thread = std::thread([this, i]() noexcept {
+				_threadProc(i);
+			});
+		} catch (std::system_error &) {
+			return OutOfMemoryError::alloc();
+		}
+	}
+
+	stopGuard.release();
+
+	return {};
+}
+
+NETKNOT_API void ComputePool::stop() noexcept {
+	{
+		std::lock_guard sleepGuard(_sleepMutex);
+		_terminate = true;
+	}
+	_sleepCond.notify_all();
+
+	for (auto i : threads) {
+		if (i->thread.joinable())
+			i->thread.join();
+	}
+
+	for (auto i : threads) {
+		while (PostedWork *job = i->deque.steal())
+			workPool->discardChain(job);
+		peff::destroyAndRelease<ComputeThread>(selfAllocator.get(), i, alignof(ComputeThread));
+	}
+	threads.clear();
+
+	while (PostedWork *job = _takeInjectedJob())
+		workPool->discardChain(job);
+}
+
+NETKNOT_API void ComputePool::submit(PostedWork *job) noexcept {
+	job->next = nullptr;
+
+	ComputeThread *current = g_currentComputeThread;
+
+	if (!(current && (current->pool == this) && current->deque.push(job)))
+		_inject(job);
+
+	_notifyJob();
+}
+
+NETKNOT_API void ComputePool::_inject(PostedWork *job) noexcept {
+	std::lock_guard injectionGuard(_injectionMutex);
+
+	if (_injectionTail)
+		_injectionTail->next = job;
+	else
+		_injectionHead = job;
+	_injectionTail = job;
+}
+
+NETKNOT_API PostedWork *ComputePool::_takeInjectedJob() noexcept {
+	std::lock_guard injectionGuard(_injectionMutex);
+
+	PostedWork *job = _injectionHead;
+
+	if (job) {
+		if (!(_injectionHead = job->next))
+			_injectionTail = nullptr;
+		job->next = nullptr;
+	}
+
+	return job;
+}
+
+NETKNOT_API void ComputePool::_notifyJob() noexcept {
+	// Pairs with the check in _threadProc(), either a sleeping thread is seen or the thread sees the job.
+	_nPendingJobs.fetch_add(1, std::memory_order_seq_cst);
+
+	if (_nSleeping.load(std::memory_order_seq_cst)) {
+		std::lock_guard sleepGuard(_sleepMutex);
+		_sleepCond.notify_one();
+	}
+}
+
+NETKNOT_API PostedWork *ComputePool::_takeJob(ComputeThread *thread) noexcept {
+	if (PostedWork *job = thread->deque.pop())
+		return job;
+
+	if (PostedWork *job = _takeInjectedJob())
+		return job;
+
+	// Steal from the other threads, starting from the next one to spread the thieves.
+	size_t nThreads = threads.size();
+	for (size_t i = 1; i < nThreads; ++i) {
+		if (PostedWork *job = threads.at((thread->threadId + i) % nThreads)->deque.steal())
+			return job;
+	}
+
+	return nullptr;
+}
+
+NETKNOT_API void ComputePool::_threadProc(ComputeThread *thread) noexcept {
+	g_currentComputeThread = thread;
+
+	while (!_terminate.load(std::memory_order_relaxed)) {
+		if (PostedWork *job = _takeJob(thread)) {
+			_nPendingJobs.fetch_sub(1, std::memory_order_relaxed);
+			// The continuation which failed to be posted has been released by the service, the compute thread goes on.
+			if (ExceptionPointer e = workPool->runChain(job); e) {
+				e.reset();
+				nFailedJobs.fetch_add(1, std::memory_order_relaxed);
+			}
+			continue;
+		}
+
+		std::unique_lock sleepGuard(_sleepMutex);
+
+		_nSleeping.fetch_add(1, std::memory_order_seq_cst);
+		if ((!_nPendingJobs.load(std::memory_order_seq_cst)) && (!_terminate))
+			_sleepCond.wait(sleepGuard);
+		_nSleeping.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	g_currentComputeThread = nullptr;
+}
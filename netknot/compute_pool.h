@@ -0,0 +1,147 @@
+#ifndef _NETKNOT_COMPUTE_POOL_H_
+#define _NETKNOT_COMPUTE_POOL_H_
+
+#include "posted_work.h"
+#include <peff/containers/dynarray.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace netknot {
+	/// @brief Chase-Lev work-stealing deque of compute jobs with a fixed capacity.
+	/// Only the owner thread pushes and pops at the bottom, other threads steal from the top.
+	class ComputeJobDeque {
+	public:
+		constexpr static size_t CAPACITY = 1024;
+
+	private:
+		alignas(64) std::atomic<int64_t> _top = 0;
+		alignas(64) std::atomic<int64_t> _bottom = 0;
+		std::atomic<PostedWork *> _slots[CAPACITY] = {};
+
+	public:
+		/// @brief Push a job at the bottom, only the owner is allowed to call it.
+		///
+		/// @param job Job to be pushed.
+		/// @return Whether the job is pushed, false if the deque is full.
+		NETKNOT_FORCEINLINE bool push(PostedWork *job) noexcept {
+			int64_t b = _bottom.load(std::memory_order_relaxed);
+			int64_t t = _top.load(std::memory_order_acquire);
+
+			if (b - t >= (int64_t)CAPACITY)
+				return false;
+
+			_slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			_bottom.store(b + 1, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		/// @brief Pop a job from the bottom, only the owner is allowed to call it.
+		///
+		/// @return The popped job, nullptr if the deque is empty or the last job was stolen.
+		NETKNOT_FORCEINLINE PostedWork *pop() noexcept {
+			int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+			_bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = _top.load(std::memory_order_relaxed);
+
+			if (t > b) {
+				_bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			PostedWork *job = _slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+
+			if (t == b) {
+				// Race against the thieves for the last job.
+				if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					job = nullptr;
+				_bottom.store(b + 1, std::memory_order_relaxed);
+			}
+
+			return job;
+		}
+
+		/// @brief Steal a job from the top, any thread is allowed to call it.
+		///
+		/// @return The stolen job, nullptr if the deque is empty or another thread has won the race.
+		NETKNOT_FORCEINLINE PostedWork *steal() noexcept {
+			int64_t t = _top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = _bottom.load(std::memory_order_acquire);
+
+			if (t >= b)
+				return nullptr;
+
+			PostedWork *job = _slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+
+			if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return nullptr;
+
+			return job;
+		}
+	};
+
+	/// @brief Pool of compute threads for CPU-heavy jobs, which keeps them off the I/O workers.
+	/// Jobs submitted by a compute thread go to its own deque, the others go to a shared injection queue.
+	class ComputePool {
+	public:
+		struct ComputeThread {
+			ComputePool *pool;
+			size_t threadId;
+			ComputeJobDeque deque;
+			std::thread thread;
+
+			NETKNOT_FORCEINLINE ComputeThread(ComputePool *pool, size_t threadId) : pool(pool), threadId(threadId) {}
+		};
+
+	private:
+		std::mutex _injectionMutex;
+		PostedWork *_injectionHead = nullptr, *_injectionTail = nullptr;
+
+		std::mutex _sleepMutex;
+		std::condition_variable _sleepCond;
+		std::atomic_size_t _nSleeping = 0;
+		/// @brief Number of the jobs which are queued and not taken yet.
+		std::atomic_size_t _nPendingJobs = 0;
+		std::atomic_bool _terminate = false;
+
+		NETKNOT_API void _threadProc(ComputeThread *thread) noexcept;
+		NETKNOT_API PostedWork *_takeJob(ComputeThread *thread) noexcept;
+		NETKNOT_API PostedWork *_takeInjectedJob() noexcept;
+		NETKNOT_API void _inject(PostedWork *job) noexcept;
+		NETKNOT_API void _notifyJob() noexcept;
+
+	public:
+		peff::RcObjectPtr<peff::Alloc> selfAllocator;
+		PostedWorkPool *workPool;
+		peff::DynArray<ComputeThread *> threads;
+		/// @brief Number of the jobs which have returned an exception, such as those whose continuations could not be posted back,
+		/// the exceptions are dropped.
+		std::atomic_size_t nFailedJobs = 0;
+
+		NETKNOT_API ComputePool(peff::Alloc *selfAllocator, PostedWorkPool *workPool);
+		NETKNOT_API ~ComputePool();
+
+		NETKNOT_API static ComputePool *alloc(peff::Alloc *selfAllocator, PostedWorkPool *workPool);
+		NETKNOT_API void dealloc() noexcept;
+
+		/// @brief Start the compute threads.
+		///
+		/// @param nThreads Number of the compute threads.
+		/// @return The exception occurred during starting.
+		[[nodiscard]] NETKNOT_API ExceptionPointer start(size_t nThreads) noexcept;
+		/// @brief Stop the compute threads and discard the jobs which have not been run.
+		NETKNOT_API void stop() noexcept;
+
+		/// @brief Submit a job from any thread, the pool takes the ownership of the node.
+		/// An exception returned by the job is dropped and counted in nFailedJobs.
+		///
+		/// @param job Job to be submitted.
+		NETKNOT_API void submit(PostedWork *job) noexcept;
+	};
+}
+
+#endif
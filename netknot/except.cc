@@ -26,8 +26,32 @@ NETKNOT_API BufferIsTooBigError *BufferIsTooBigError::alloc() noexcept {
 	return &g_bufferIsTooBigError;
 }
 
+WouldBlockError netknot::g_wouldBlockError;
+
+NETKNOT_API WouldBlockError::WouldBlockError() noexcept : Exception(EXCEPT_WOULD_BLOCK) {}
+NETKNOT_API WouldBlockError::~WouldBlockError() {}
+
+NETKNOT_API void WouldBlockError::dealloc() {
+}
+
+NETKNOT_API WouldBlockError *WouldBlockError::alloc() noexcept {
+	return &g_wouldBlockError;
+}
+
+InvalidArgsError netknot::g_invalidArgsError;
+
+NETKNOT_API InvalidArgsError::InvalidArgsError() noexcept : Exception(EXCEPT_INVALID_ARGS) {}
+NETKNOT_API InvalidArgsError::~InvalidArgsError() {}
+
+NETKNOT_API void InvalidArgsError::dealloc() {
+}
+
+NETKNOT_API InvalidArgsError *InvalidArgsError::alloc() noexcept {
+	return &g_invalidArgsError;
+}
+
 NETKNOT_API NetworkError::NetworkError(peff::Alloc *allocator, NetworkErrorCode errorCode)
-	: Exception(EXCEPT_IO), errorCode(errorCode) {}
+	: Exception(EXCEPT_IO), allocator(allocator), errorCode(errorCode) {}
 NETKNOT_API NetworkError::~NetworkError() {}
 
 NETKNOT_API void NetworkError::dealloc() {
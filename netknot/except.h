@@ -8,7 +8,9 @@ namespace netknot {
 	constexpr static peff::UUID
 		EXCEPT_OOM = PEFF_UUID(6e1a12d1, 2a61, 47dd, ac92, afc369290d1b),
 		EXCEPT_BUFFER_IS_TOO_BIG = PEFF_UUID(11451419, 1981, 0114, 5141, 919810114514),
-		EXCEPT_IO = PEFF_UUID(eed80e28, b8fb, 40de, 9b97, 81a8a6d688f3);
+		EXCEPT_IO = PEFF_UUID(eed80e28, b8fb, 40de, 9b97, 81a8a6d688f3),
+		EXCEPT_WOULD_BLOCK = PEFF_UUID(3c5e27a0, 58d4, 4f1b, 9e62, 0d7a4b1c93f5),
+		EXCEPT_INVALID_ARGS = PEFF_UUID(9b2f4c61, 0e3a, 4d8b, a571, 6c2e9f0d4b38);
 
 	/// @brief The out of memory error, indicates that a memory allocation has failed.
 	class OutOfMemoryError : public Exception {
@@ -35,6 +37,32 @@ namespace netknot {
 
 	extern BufferIsTooBigError g_bufferIsTooBigError;
 
+	/// @brief The would block error, indicates that the operation was refused instead of blocking or queuing.
+	class WouldBlockError : public Exception {
+	public:
+		NETKNOT_API WouldBlockError() noexcept;
+		NETKNOT_API virtual ~WouldBlockError();
+
+		NETKNOT_API virtual void dealloc() override;
+
+		NETKNOT_API static WouldBlockError *alloc() noexcept;
+	};
+
+	extern WouldBlockError g_wouldBlockError;
+
+	/// @brief The invalid arguments error, indicates that the arguments are not supported by the build or the platform.
+	class InvalidArgsError : public Exception {
+	public:
+		NETKNOT_API InvalidArgsError() noexcept;
+		NETKNOT_API virtual ~InvalidArgsError();
+
+		NETKNOT_API virtual void dealloc() override;
+
+		NETKNOT_API static InvalidArgsError *alloc() noexcept;
+	};
+
+	extern InvalidArgsError g_invalidArgsError;
+
 	enum class NetworkErrorCode : uint32_t {
 		Unknown = 0,
 		AddressInUse,			 // Address is already in use
@@ -8,7 +8,7 @@ NETKNOT_API IOService::IOService() {
 NETKNOT_API IOService::~IOService() {
 }
 
-NETKNOT_API IOServiceCreationParams::IOServiceCreationParams(peff::Alloc *paramsAllocator, peff::Alloc *allocator) : allocator(allocator) {
+NETKNOT_API IOServiceCreationParams::IOServiceCreationParams(peff::Alloc *paramsAllocator, peff::Alloc *allocator) : allocator(allocator), workerCpuSets(paramsAllocator) {
 }
 
 NETKNOT_API IOServiceCreationParams::~IOServiceCreationParams() {
@@ -2,17 +2,101 @@
 #define _NETKNOT_IO_SERVICE_H_
 
 #include "socket.h"
+#include "compute_pool.h"
+#include <peff/containers/dynarray.h>
 
 namespace netknot {
+	/// @brief Set of CPUs that a worker thread is allowed to run on.
+	struct WorkerCpuSet {
+		constexpr static size_t MAX_CPUS = 1024;
+
+		uint64_t bits[MAX_CPUS / 64] = {};
+
+		NETKNOT_FORCEINLINE void set(size_t cpu) noexcept {
+			if (cpu >= MAX_CPUS)
+				std::terminate();
+			bits[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+		}
+
+		NETKNOT_FORCEINLINE bool test(size_t cpu) const noexcept {
+			if (cpu >= MAX_CPUS)
+				return false;
+			return bits[cpu / 64] & ((uint64_t)1 << (cpu % 64));
+		}
+
+		NETKNOT_FORCEINLINE bool isEmpty() const noexcept {
+			for (auto i : bits) {
+				if (i)
+					return false;
+			}
+			return true;
+		}
+	};
+
+	enum class WorkerPlacementPolicy : uint8_t {
+		/// @brief Let the system schedule the workers.
+		Default = 0,
+		/// @brief Pin every worker to the corresponding CPU set in workerCpuSets.
+		Explicit,
+		/// @brief Pin the workers to the physical cores in turn, including all hardware threads of the core.
+		PerPhysicalCore,
+		/// @brief Pin the workers to the NUMA nodes in turn, including all CPUs of the node.
+		PerNumaNode
+	};
+
 	struct IOServiceCreationParams {
 		peff::RcObjectPtr<peff::Alloc> allocator;
 		size_t nWorkerThreads = 0;
 		size_t szWorkerThreadStackSize = 0;
+		/// @brief Maximum time in microseconds that a worker spins polling for events before blocking, 0 to disable busy polling.
+		/// Sockets also have SO_BUSY_POLL set to the budget where it is supported.
+		uint32_t busyPollBudget = 0;
+		/// @brief Adapt the spin time of every worker to the recently observed inter-arrival time of events.
+		bool adaptiveBusyPoll = true;
+		WorkerPlacementPolicy workerPlacementPolicy = WorkerPlacementPolicy::Default;
+		/// @brief CPU sets of the workers for WorkerPlacementPolicy::Explicit, workers without a corresponding set are not pinned.
+		peff::DynArray<WorkerCpuSet> workerCpuSets;
+		/// @brief Number of the threads in the compute pool for offloaded jobs, 0 to run the jobs inline.
+		size_t nComputeThreads = 0;
 
 		NETKNOT_API IOServiceCreationParams(peff::Alloc *paramsAllocator, peff::Alloc *allocator);
 		NETKNOT_API ~IOServiceCreationParams();
 	};
 
+	/// @brief Spin budget controller shared by the backends, all of the times are in nanoseconds.
+	struct BusyPollController {
+		uint64_t maxBudget = 0;
+		uint64_t budget = 0;
+		uint64_t lastArrivalTime = 0;
+		/// @brief Exponentially weighted moving average of the inter-arrival time.
+		uint64_t averageInterArrivalTime = 0;
+		bool isAdaptive = true;
+
+		NETKNOT_FORCEINLINE void init(uint32_t maxBudgetUs, bool isAdaptive) noexcept {
+			maxBudget = (uint64_t)maxBudgetUs * 1000;
+			budget = maxBudget;
+			this->isAdaptive = isAdaptive;
+		}
+
+		NETKNOT_FORCEINLINE void onArrival(uint64_t now) noexcept {
+			if (!isAdaptive)
+				return;
+
+			if (lastArrivalTime) {
+				uint64_t interArrivalTime = now - lastArrivalTime;
+
+				averageInterArrivalTime = averageInterArrivalTime
+											  ? (averageInterArrivalTime * 7 + interArrivalTime) / 8
+											  : interArrivalTime;
+
+				// Spinning only pays off if the next event is likely to arrive within the budget.
+				budget = averageInterArrivalTime * 2 <= maxBudget ? averageInterArrivalTime * 2 : 0;
+			}
+
+			lastArrivalTime = now;
+		}
+	};
+
 	typedef ExceptionPointer (*AddressCompiler)(peff::Alloc *allocator, const Address &address, char *&bufferOut, size_t &szBufferOut);
 
 	class IOService {
@@ -27,12 +111,204 @@ namespace netknot {
 
 		virtual ExceptionPointer postAsyncTask(AsyncTask *task) noexcept = 0;
 
+		/// @brief Begin a submission batch on the calling thread.
+		/// Asynchronous tasks posted by the thread will be held until the matching flush() and submitted together.
+		/// Batches can be nested, only the outermost flush() submits the tasks.
+		virtual void beginBatch() noexcept = 0;
+		/// @brief End a submission batch started by beginBatch() on the calling thread.
+		///
+		/// @return The exception occurred during submission.
+		[[nodiscard]] virtual ExceptionPointer flush() noexcept = 0;
+
+		virtual size_t getWorkerCount() noexcept = 0;
+		/// @brief Get ID of the worker which is running the calling thread.
+		///
+		/// @param workerIdOut Where to store the worker ID.
+		/// @return Whether the calling thread is a worker of the service.
+		virtual bool getCurrentWorkerId(size_t &workerIdOut) noexcept = 0;
+		/// @brief Get the NUMA node that a worker is running on.
+		///
+		/// @param workerId ID of the worker.
+		/// @return The NUMA node, SIZE_MAX if unknown.
+		virtual size_t getWorkerNumaNode(size_t workerId) noexcept = 0;
+
+		/// @brief Allocate a node for posting work, which is usually taken from a pool.
+		///
+		/// @return The allocated node, nullptr if out of memory.
+		virtual PostedWork *allocPostedWork() noexcept = 0;
+		/// @brief Post a node onto a worker, the service takes the ownership of the node whether it succeeds or not.
+		///
+		/// @param workerId ID of the worker to run the work.
+		/// @param work Work to be posted.
+		/// @return The exception occurred during posting.
+		virtual ExceptionPointer postWork(size_t workerId, PostedWork *work) noexcept = 0;
+		/// @brief Post a node onto any of the workers, the service takes the ownership of the node whether it succeeds or not.
+		///
+		/// @param work Work to be posted.
+		/// @return The exception occurred during posting.
+		virtual ExceptionPointer postWork(PostedWork *work) noexcept = 0;
+		/// @brief Discard and release a node which has not been posted, the closure is destroyed if it has been emplaced.
+		///
+		/// @param work Work to be released.
+		virtual void releasePostedWork(PostedWork *work) noexcept = 0;
+
+		/// @brief Run a closure on a worker from any thread.
+		/// On backends whose sockets are not bound to workers (see Socket::setWorkerId()), the work may be run by any worker.
+		///
+		/// @param workerId ID of the worker to run the closure.
+		/// @param fn Closure invocable as ExceptionPointer() noexcept, the returned exception stops the worker.
+		/// @return The exception occurred during posting.
+		template <typename Fn>
+		[[nodiscard]] NETKNOT_FORCEINLINE ExceptionPointer post(size_t workerId, Fn &&fn) noexcept {
+			PostedWork *work = allocPostedWork();
+
+			if (!work)
+				return OutOfMemoryError::alloc();
+
+			work->emplace(std::forward<Fn>(fn));
+
+			return postWork(workerId, work);
+		}
+		/// @brief Run a closure on any of the workers from any thread.
+		/// A worker posting a closure keeps it on itself where the backend supports it.
+		///
+		/// @param fn Closure invocable as ExceptionPointer() noexcept, the returned exception stops the worker.
+		/// @return The exception occurred during posting.
+		template <typename Fn>
+		[[nodiscard]] NETKNOT_FORCEINLINE ExceptionPointer post(Fn &&fn) noexcept {
+			PostedWork *work = allocPostedWork();
+
+			if (!work)
+				return OutOfMemoryError::alloc();
+
+			work->emplace(std::forward<Fn>(fn));
+
+			return postWork(work);
+		}
+
+		/// @brief Get the compute pool of the service.
+		///
+		/// @return The compute pool, nullptr if the service has no compute thread.
+		virtual ComputePool *getComputePool() noexcept = 0;
+
+		/// @brief Run a CPU-heavy job in the compute pool and resume on the calling worker when the job finishes.
+		/// The job and the continuation are run inline if the service has no compute pool,
+		/// and the continuation is run by any of the workers if the caller is not a worker.
+		///
+		/// @param fn Job invocable as ExceptionPointer() noexcept, run by a compute thread.
+		/// @param then Continuation invocable as ExceptionPointer(ExceptionPointer &&jobResult) noexcept, run by the worker.
+		/// @return The exception occurred during submission.
+		template <typename Fn, typename Then>
+		[[nodiscard]] NETKNOT_FORCEINLINE ExceptionPointer offload(Fn &&fn, Then &&then) noexcept {
+			using JobFn = std::remove_cv_t<std::remove_reference_t<Fn>>;
+			using ThenFn = std::remove_cv_t<std::remove_reference_t<Then>>;
+
+			struct Continuation {
+				ExceptionPointer jobResult;
+				ThenFn then;
+
+				NETKNOT_FORCEINLINE Continuation(ThenFn &&then) noexcept : then(std::move(then)) {}
+				NETKNOT_FORCEINLINE Continuation(Continuation &&rhs) noexcept : jobResult(std::move(rhs.jobResult)), then(std::move(rhs.then)) {}
+				NETKNOT_FORCEINLINE ~Continuation() {
+					// The continuation could not be posted back, the result of the job is dropped with it.
+					if (jobResult)
+						jobResult.reset();
+				}
+
+				NETKNOT_FORCEINLINE ExceptionPointer operator()() noexcept {
+					return then(std::move(jobResult));
+				}
+			};
+
+			struct Job {
+				IOService *ioService;
+				PostedWork *continuation;
+				size_t workerId;
+				bool isFromWorker;
+				JobFn fn;
+
+				NETKNOT_FORCEINLINE Job(IOService *ioService, PostedWork *continuation, size_t workerId, bool isFromWorker, JobFn &&fn) noexcept
+					: ioService(ioService), continuation(continuation), workerId(workerId), isFromWorker(isFromWorker), fn(std::move(fn)) {}
+				NETKNOT_FORCEINLINE Job(Job &&rhs) noexcept
+					: ioService(rhs.ioService), continuation(rhs.continuation), workerId(rhs.workerId), isFromWorker(rhs.isFromWorker), fn(std::move(rhs.fn)) {
+					rhs.continuation = nullptr;
+				}
+				NETKNOT_FORCEINLINE ~Job() {
+					// The job was discarded before it could be run.
+					if (continuation)
+						ioService->releasePostedWork(continuation);
+				}
+
+				NETKNOT_FORCEINLINE ExceptionPointer operator()() noexcept {
+					PostedWork *work = continuation;
+					continuation = nullptr;
+
+					std::launder((Continuation *)work->closureStorage)->jobResult = fn();
+
+					return isFromWorker ? ioService->postWork(workerId, work) : ioService->postWork(work);
+				}
+			};
+
+			ComputePool *computePool = getComputePool();
+
+			if (!computePool) {
+				JobFn jobFn(std::forward<Fn>(fn));
+				ThenFn thenFn(std::forward<Then>(then));
+				return thenFn(jobFn());
+			}
+
+			PostedWork *continuation = allocPostedWork();
+			if (!continuation)
+				return OutOfMemoryError::alloc();
+			continuation->emplace(Continuation(ThenFn(std::forward<Then>(then))));
+
+			PostedWork *job = allocPostedWork();
+			if (!job) {
+				releasePostedWork(continuation);
+				return OutOfMemoryError::alloc();
+			}
+
+			size_t workerId = 0;
+			bool isFromWorker = getCurrentWorkerId(workerId);
+
+			job->emplace(Job(this, continuation, workerId, isFromWorker, JobFn(std::forward<Fn>(fn))));
+
+			computePool->submit(job);
+
+			return {};
+		}
+
 		virtual ExceptionPointer createSocket(peff::Alloc *allocator, const peff::UUID &addressFamily, const peff::UUID &socketType, Socket *&socketOut) noexcept = 0;
 
 		virtual ExceptionPointer translateAddress(peff::Alloc *allocator, const Address *address, TranslatedAddress **compiledAddressOut, size_t *compiledAddressSizeOut = nullptr) noexcept = 0;
 		virtual ExceptionPointer detranslateAddress(peff::Alloc *allocator, const peff::UUID &addressFamily, const TranslatedAddress *address, Address &addressOut) noexcept = 0;
 	};
 
+	/// @brief Scoped submission batch, asynchronous tasks posted during its lifetime are submitted together.
+	class SubmissionBatch {
+	private:
+		IOService *_ioService;
+
+	public:
+		NETKNOT_FORCEINLINE SubmissionBatch(IOService *ioService) noexcept : _ioService(ioService) {
+			ioService->beginBatch();
+		}
+		NETKNOT_FORCEINLINE ~SubmissionBatch() {
+			if (_ioService)
+				NETKNOT_UNWRAP_EXCEPT(_ioService->flush());
+		}
+
+		SubmissionBatch(const SubmissionBatch &) = delete;
+		SubmissionBatch &operator=(const SubmissionBatch &) = delete;
+
+		/// @brief Submit the batched tasks before the batch goes out of scope.
+		[[nodiscard]] NETKNOT_FORCEINLINE ExceptionPointer flush() noexcept {
+			IOService *ioService = _ioService;
+			_ioService = nullptr;
+			return ioService->flush();
+		}
+	};
+
 	ExceptionPointer createDefaultIOService(IOService *&ioServiceOut, const IOServiceCreationParams &params) noexcept;
 }
 
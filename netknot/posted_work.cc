@@ -0,0 +1,54 @@
+#include "posted_work.h"
+
+using namespace netknot;
+
+NETKNOT_API PostedWorkPool::PostedWorkPool(peff::Alloc *allocator) : _allocator(allocator) {
+}
+
+NETKNOT_API PostedWorkPool::~PostedWorkPool() {
+	PostedWork *work = _freeList.takeAll();
+
+	while (work) {
+		PostedWork *next = work->next;
+		peff::destroyAndRelease<PostedWork>(_allocator.get(), work, alignof(PostedWork));
+		work = next;
+	}
+}
+
+NETKNOT_API PostedWork *PostedWorkPool::alloc() noexcept {
+	if (PostedWork *work = _freeList.pop(); work)
+		return work;
+
+	return peff::allocAndConstruct<PostedWork>(_allocator.get(), alignof(PostedWork));
+}
+
+NETKNOT_API ExceptionPointer PostedWorkPool::runChain(PostedWork *work) noexcept {
+	while (work) {
+		PostedWork *next = work->next;
+
+		ExceptionPointer e = work->invoke(work);
+		release(work);
+
+		if (e) {
+			discardChain(next);
+			return e;
+		}
+
+		work = next;
+	}
+
+	return {};
+}
+
+NETKNOT_API void PostedWorkPool::discardChain(PostedWork *work) noexcept {
+	while (work) {
+		PostedWork *next = work->next;
+
+		// A node allocated but never emplaced has no closure.
+		if (work->discard)
+			work->discard(work);
+		release(work);
+
+		work = next;
+	}
+}
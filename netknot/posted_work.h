@@ -0,0 +1,138 @@
+#ifndef _NETKNOT_POSTED_WORK_H_
+#define _NETKNOT_POSTED_WORK_H_
+
+#include "except.h"
+#include "tagged_stack.h"
+#include <peff/base/alloc.h>
+#include <peff/base/rcobj.h>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace netknot {
+	/// @brief Work posted onto a worker of an IOService, the closure is stored inline in the node.
+	struct PostedWork {
+		constexpr static size_t INLINE_CLOSURE_SIZE = 96;
+
+		PostedWork *next = nullptr;
+		/// @brief Invoke the closure and destroy it.
+		ExceptionPointer (*invoke)(PostedWork *work) noexcept = nullptr;
+		/// @brief Destroy the closure without invoking it.
+		void (*discard)(PostedWork *work) noexcept = nullptr;
+		alignas(std::max_align_t) char closureStorage[INLINE_CLOSURE_SIZE];
+
+		/// @brief Store a closure into the node.
+		///
+		/// @tparam Fn Type of the closure, which must be invocable as ExceptionPointer() noexcept.
+		/// @param fn The closure to be stored.
+		template <typename Fn>
+		NETKNOT_FORCEINLINE void emplace(Fn &&fn) noexcept {
+			using Closure = std::remove_cv_t<std::remove_reference_t<Fn>>;
+
+			static_assert(sizeof(Closure) <= INLINE_CLOSURE_SIZE, "The closure is too big to be stored inline");
+			static_assert(alignof(Closure) <= alignof(std::max_align_t), "The closure is over-aligned");
+			static_assert(std::is_nothrow_constructible_v<Closure, Fn &&>, "The closure must be nothrow constructible");
+
+			new (closureStorage) Closure(std::forward<Fn>(fn));
+
+			invoke = [](PostedWork *work) noexcept -> ExceptionPointer {
+				Closure *closure = std::launder((Closure *)work->closureStorage);
+				ExceptionPointer e = (*closure)();
+				closure->~Closure();
+				return e;
+			};
+			discard = [](PostedWork *work) noexcept {
+				std::launder((Closure *)work->closureStorage)->~Closure();
+			};
+		}
+	};
+
+	/// @brief Lock-free multiple-producer single-consumer queue of posted work.
+	class PostedWorkQueue {
+	private:
+		std::atomic<PostedWork *> _head = nullptr;
+
+	public:
+		NETKNOT_FORCEINLINE PostedWorkQueue() = default;
+		/// @brief Move a queue which is not being accessed concurrently.
+		NETKNOT_FORCEINLINE PostedWorkQueue(PostedWorkQueue &&rhs) noexcept : _head(rhs._head.exchange(nullptr, std::memory_order_relaxed)) {}
+
+		/// @brief Push a piece of work from any thread.
+		///
+		/// @param work Work to be pushed.
+		/// @return Whether the queue was empty, the consumer has to be woken up if so.
+		NETKNOT_FORCEINLINE bool push(PostedWork *work) noexcept {
+			PostedWork *head = _head.load(std::memory_order_relaxed);
+
+			do {
+				work->next = head;
+			} while (!_head.compare_exchange_weak(head, work, std::memory_order_release, std::memory_order_relaxed));
+
+			return !head;
+		}
+
+		/// @brief Take all of the queued work out, only the consumer is allowed to call it.
+		///
+		/// @return The first work in posting order, the rest are linked by PostedWork::next.
+		NETKNOT_FORCEINLINE PostedWork *takeAll() noexcept {
+			PostedWork *head = _head.exchange(nullptr, std::memory_order_acquire), *reversed = nullptr;
+
+			while (head) {
+				PostedWork *next = head->next;
+				head->next = reversed;
+				reversed = head;
+				head = next;
+			}
+
+			return reversed;
+		}
+
+		NETKNOT_FORCEINLINE bool isEmpty() const noexcept {
+			return !_head.load(std::memory_order_relaxed);
+		}
+	};
+
+	/// @brief Pool of posted work nodes, the nodes are released back by the workers and reused by the posters.
+	class PostedWorkPool {
+	private:
+		peff::RcObjectPtr<peff::Alloc> _allocator;
+		TaggedStack<PostedWork, &PostedWork::next> _freeList;
+
+	public:
+		NETKNOT_API PostedWorkPool(peff::Alloc *allocator);
+		NETKNOT_API ~PostedWorkPool();
+
+		/// @brief Allocate a node, new node is allocated only if there is no free node.
+		///
+		/// @return The allocated node, nullptr if out of memory.
+		NETKNOT_API PostedWork *alloc() noexcept;
+
+		/// @brief Put a node back, whose closure must have been invoked or discarded.
+		NETKNOT_FORCEINLINE void release(PostedWork *work) noexcept {
+			// A reused node has no closure until it is emplaced again.
+			work->invoke = nullptr;
+			work->discard = nullptr;
+
+			if (!_freeList.isPushable(work)) {
+				peff::destroyAndRelease<PostedWork>(_allocator.get(), work, alignof(PostedWork));
+				return;
+			}
+
+			_freeList.push(work);
+		}
+
+		/// @brief Run a chain of work returned by PostedWorkQueue::takeAll() and release the nodes.
+		/// The remaining work is discarded if any of them fails.
+		///
+		/// @param work The first work of the chain.
+		/// @return The exception returned by the failed work.
+		NETKNOT_API ExceptionPointer runChain(PostedWork *work) noexcept;
+		/// @brief Discard a chain of work without running them and release the nodes, which may not have been emplaced.
+		///
+		/// @param work The first work of the chain.
+		NETKNOT_API void discardChain(PostedWork *work) noexcept;
+	};
+}
+
+#endif
@@ -33,7 +33,7 @@ namespace netknot {
 		NETKNOT_FORCEINLINE RcBufferRef(RcBuffer *buffer, size_t offset, size_t size) noexcept : buffer(buffer), offset(offset), size(size) {
 			if(offset >= buffer->size)
 				std::terminate();
-			if(offset + size >= buffer->size)
+			if(size > buffer->size - offset)
 				std::terminate();
 		}
 
@@ -50,8 +50,54 @@ NETKNOT_API AcceptAsyncCallback::AcceptAsyncCallback() {
 NETKNOT_API AcceptAsyncCallback::~AcceptAsyncCallback() {
 }
 
+NETKNOT_API WritableCallback::WritableCallback() {
+}
+
+NETKNOT_API WritableCallback::~WritableCallback() {
+}
+
 NETKNOT_API Socket::Socket() {
 }
 
 NETKNOT_API Socket::~Socket() {
 }
+
+NETKNOT_API void Socket::setWriteWatermarks(size_t szLowWatermark, size_t szHighWatermark) noexcept {
+	if (szLowWatermark > szHighWatermark)
+		std::terminate();
+
+	_szWriteLowWatermark = szLowWatermark;
+	_szWriteHighWatermark = szHighWatermark;
+}
+
+NETKNOT_API void Socket::setWritableCallback(WritableCallback *callback) noexcept {
+	_writableCallback = callback;
+}
+
+NETKNOT_API ExceptionPointer Socket::tryWriteAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) {
+	size_t szPendingWrite = _szPendingWrite;
+
+	// A write is always accepted by an idle socket, even if it is bigger than the high watermark.
+	if (szPendingWrite && ((szPendingWrite >= _szWriteHighWatermark) || (buffer.size > _szWriteHighWatermark - szPendingWrite))) {
+		_isWriteBlocked = true;
+		return WouldBlockError::alloc();
+	}
+
+	return writeAsync(allocator, buffer, callback, asyncTaskOut);
+}
+
+NETKNOT_API void Socket::onWriteQueued(size_t size) noexcept {
+	if ((_szPendingWrite += size) > _szWriteHighWatermark)
+		_isWriteBlocked = true;
+}
+
+NETKNOT_API ExceptionPointer Socket::onWriteFinished(size_t size) noexcept {
+	size_t szPendingWrite = (_szPendingWrite -= size);
+
+	if ((szPendingWrite <= _szWriteLowWatermark) && _isWriteBlocked.exchange(false)) {
+		if (_writableCallback)
+			return _writableCallback->onWritable(this);
+	}
+
+	return {};
+}
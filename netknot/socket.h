@@ -2,6 +2,8 @@
 #define _NETKNOT_SOCKET_H_
 
 #include "rc_buffer.h"
+#include <cstddef>
+#include <type_traits>
 
 namespace netknot {
 	constexpr static peff::UUID
@@ -12,6 +14,14 @@ namespace netknot {
 		SOCKET_TCP = PEFF_UUID(aaf1e2e8, f731, 4b2b, b261, 2db641edc248),
 		SOCKET_UDP = PEFF_UUID(1b18418c, d36a, 4ed0, a135, 36dc249824db);
 
+#ifdef _WIN32
+	/// @brief Native handle of an opened file, a HANDLE on Windows.
+	using NativeFileHandle = void *;
+#else
+	/// @brief Native handle of an opened file, a file descriptor on Unix.
+	using NativeFileHandle = int;
+#endif
+
 	struct Address {
 		peff::UUID addressFamily;
 
@@ -50,7 +60,7 @@ namespace netknot {
 
 	class AsyncTask {
 	private:
-		std::atomic_size_t _refCount = 0;
+		MaybeAtomic<size_t> _refCount = 0;
 		AsyncTaskType _taskType;
 
 	public:
@@ -112,9 +122,101 @@ namespace netknot {
 		NETKNOT_API virtual ~AcceptAsyncTask();
 	};
 
+	/// @brief Handler stored inline in an asynchronous task, which takes the place of the callback object.
+	/// The handler is type-erased, as the sockets cannot be templated on it: the backends still pick the task by its type
+	/// and call the handler through a function pointer, which saves the allocation and the reference counting of a callback
+	/// object rather than the indirect call.
+	template <typename... Args>
+	class InlineAsyncHandler {
+	public:
+		constexpr static size_t INLINE_STORAGE_SIZE = 48;
+
+	private:
+		ExceptionPointer (*_invoke)(void *storage, Args... args) noexcept = nullptr;
+		/// @brief Move the handler to another storage and destroy the original one.
+		void (*_relocate)(void *dest, void *src) noexcept = nullptr;
+		void (*_destroy)(void *storage) noexcept = nullptr;
+		alignas(std::max_align_t) char _storage[INLINE_STORAGE_SIZE];
+
+	public:
+		NETKNOT_FORCEINLINE InlineAsyncHandler() noexcept = default;
+
+		template <typename Handler, typename = std::enable_if_t<!std::is_same_v<std::remove_cv_t<std::remove_reference_t<Handler>>, InlineAsyncHandler>>>
+		NETKNOT_FORCEINLINE explicit InlineAsyncHandler(Handler &&handler) noexcept {
+			using H = std::remove_cv_t<std::remove_reference_t<Handler>>;
+
+			static_assert(std::is_invocable_r_v<ExceptionPointer, H &, Args...>, "The handler is malformed");
+			static_assert(sizeof(H) <= INLINE_STORAGE_SIZE, "The handler is too big to be stored inline");
+			static_assert(alignof(H) <= alignof(std::max_align_t), "The handler is over-aligned");
+			static_assert(std::is_nothrow_move_constructible_v<H>, "The handler must be nothrow move constructible");
+
+			new (_storage) H(std::forward<Handler>(handler));
+
+			_invoke = [](void *storage, Args... args) noexcept -> ExceptionPointer {
+				return (*std::launder((H *)storage))(std::forward<Args>(args)...);
+			};
+			_relocate = [](void *dest, void *src) noexcept {
+				H *h = std::launder((H *)src);
+				new (dest) H(std::move(*h));
+				h->~H();
+			};
+			_destroy = [](void *storage) noexcept {
+				std::launder((H *)storage)->~H();
+			};
+		}
+
+		NETKNOT_FORCEINLINE InlineAsyncHandler(InlineAsyncHandler &&rhs) noexcept {
+			*this = std::move(rhs);
+		}
+
+		NETKNOT_FORCEINLINE ~InlineAsyncHandler() {
+			reset();
+		}
+
+		InlineAsyncHandler(const InlineAsyncHandler &) = delete;
+		InlineAsyncHandler &operator=(const InlineAsyncHandler &) = delete;
+
+		NETKNOT_FORCEINLINE InlineAsyncHandler &operator=(InlineAsyncHandler &&rhs) noexcept {
+			if (this == &rhs)
+				return *this;
+
+			reset();
+
+			if (rhs._invoke) {
+				rhs._relocate(_storage, rhs._storage);
+				_invoke = rhs._invoke;
+				_relocate = rhs._relocate;
+				_destroy = rhs._destroy;
+				rhs._invoke = nullptr;
+			}
+
+			return *this;
+		}
+
+		NETKNOT_FORCEINLINE void reset() noexcept {
+			if (_invoke) {
+				_destroy(_storage);
+				_invoke = nullptr;
+			}
+		}
+
+		NETKNOT_FORCEINLINE explicit operator bool() const noexcept {
+			return _invoke;
+		}
+
+		NETKNOT_FORCEINLINE ExceptionPointer operator()(Args... args) noexcept {
+			return _invoke(_storage, std::forward<Args>(args)...);
+		}
+	};
+
+	/// @brief Inline read handler, invoked with the status, the size read, the buffer and the exception of the task.
+	using ReadAsyncHandler = InlineAsyncHandler<AsyncTaskStatus, size_t, const RcBufferRef &, ExceptionPointer &>;
+	/// @brief Inline write handler, invoked with the status, the size written, the buffer and the exception of the task.
+	using WriteAsyncHandler = InlineAsyncHandler<AsyncTaskStatus, size_t, const RcBufferRef &, ExceptionPointer &>;
+
 	class ReadAsyncCallback {
 	private:
-		std::atomic_size_t _refCount = 0;
+		MaybeAtomic<size_t> _refCount = 0;
 
 	public:
 		NETKNOT_API ReadAsyncCallback();
@@ -140,7 +242,7 @@ namespace netknot {
 
 	class WriteAsyncCallback {
 	private:
-		std::atomic_size_t _refCount = 0;
+		MaybeAtomic<size_t> _refCount = 0;
 
 	public:
 		NETKNOT_API WriteAsyncCallback();
@@ -168,7 +270,7 @@ namespace netknot {
 
 	class AcceptAsyncCallback {
 	private:
-		std::atomic_size_t _refCount = 0;
+		MaybeAtomic<size_t> _refCount = 0;
 
 	public:
 		NETKNOT_API AcceptAsyncCallback();
@@ -192,6 +294,32 @@ namespace netknot {
 		virtual ExceptionPointer onAccepted(Socket *socket) = 0;
 	};
 
+	class WritableCallback {
+	private:
+		MaybeAtomic<size_t> _refCount = 0;
+
+	public:
+		NETKNOT_API WritableCallback();
+		NETKNOT_API virtual ~WritableCallback();
+
+		virtual void onRefZero() noexcept = 0;
+
+		NETKNOT_FORCEINLINE size_t incRef(size_t globalRc) noexcept {
+			return ++_refCount;
+		}
+
+		NETKNOT_FORCEINLINE size_t decRef(size_t globalRc) noexcept {
+			if (!--_refCount) {
+				onRefZero();
+				return 0;
+			}
+
+			return _refCount;
+		}
+
+		virtual ExceptionPointer onWritable(Socket *socket) = 0;
+	};
+
 	template <typename Callback>
 	class FnReadAsyncCallback final : public ReadAsyncCallback {
 	private:
@@ -255,7 +383,34 @@ namespace netknot {
 		}
 	};
 
+	template <typename Callback>
+	class FnWritableCallback final : public WritableCallback {
+	private:
+		peff::Alloc *_allocator;
+		Callback _callback;
+
+	public:
+		static_assert(std::is_invocable_v<Callback, Socket *>, "The callback is malformed");
+
+		NETKNOT_FORCEINLINE FnWritableCallback(peff::Alloc *allocator, Callback &&callback) : _allocator(allocator), _callback(callback) {}
+		virtual inline ~FnWritableCallback() {}
+
+		virtual void onRefZero() noexcept {
+			peff::destroyAndRelease<decltype(*this)>(_allocator, this, alignof(decltype(*this)));
+		}
+
+		virtual ExceptionPointer onWritable(Socket *socket) override {
+			return _callback(socket);
+		}
+	};
+
 	class Socket {
+	private:
+		MaybeAtomic<size_t> _szPendingWrite = 0;
+		size_t _szWriteLowWatermark = 0, _szWriteHighWatermark = SIZE_MAX;
+		MaybeAtomic<bool> _isWriteBlocked = false;
+		peff::RcObjectPtr<WritableCallback> _writableCallback;
+
 	public:
 		NETKNOT_API Socket();
 		NETKNOT_API virtual ~Socket();
@@ -263,6 +418,9 @@ namespace netknot {
 		virtual void dealloc() noexcept = 0;
 
 		virtual void close() = 0;
+		/// @brief Shut down both directions of the connection without closing the socket,
+		/// the pending reads finish with no data and the pending writes fail, so they can be waited for.
+		virtual void shutdown() noexcept = 0;
 
 		virtual ExceptionPointer bind(const TranslatedAddress *address) = 0;
 		virtual ExceptionPointer listen(size_t backlog) = 0;
@@ -275,6 +433,86 @@ namespace netknot {
 		virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncTask *&asyncTaskOut) = 0;
 		virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) = 0;
 		virtual ExceptionPointer acceptAsync(peff::Alloc *allocator, AcceptAsyncCallback *callback, AcceptAsyncTask *&asyncTaskOut) = 0;
+
+		/// @brief Same as readAsync() with a callback, but the handler is stored in the task instead of a separate callback object.
+		virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) = 0;
+		/// @brief Same as writeAsync() with a callback, but the handler is stored in the task instead of a separate callback object.
+		virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) = 0;
+
+		/// @brief Send a region of a file asynchronously, the data are copied by the kernel from the page cache directly.
+		/// The write is ordered with the other writes of the socket, the handler is invoked with an empty buffer.
+		/// The file must be kept open until the handler is invoked.
+		///
+		/// @param allocator Allocator of the task.
+		/// @param file File to be sent.
+		/// @param offset Offset of the region in the file.
+		/// @param size Size of the region.
+		/// @param handler Handler to be invoked when the region has been sent.
+		/// @param asyncTaskOut Where to store the task.
+		virtual ExceptionPointer sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) = 0;
+
+		/// @brief Read asynchronously with a handler invocable as
+		/// ExceptionPointer(AsyncTaskStatus status, size_t szRead, const RcBufferRef &buffer, ExceptionPointer &exception) noexcept.
+		template <typename Handler, typename = std::enable_if_t<!(std::is_convertible_v<Handler, ReadAsyncCallback *> || std::is_same_v<std::remove_cv_t<std::remove_reference_t<Handler>>, ReadAsyncHandler>)>>
+		NETKNOT_FORCEINLINE ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, Handler &&handler, ReadAsyncTask *&asyncTaskOut) {
+			return readAsync(allocator, buffer, ReadAsyncHandler(std::forward<Handler>(handler)), asyncTaskOut);
+		}
+		/// @brief Write asynchronously with a handler invocable as
+		/// ExceptionPointer(AsyncTaskStatus status, size_t szWritten, const RcBufferRef &buffer, ExceptionPointer &exception) noexcept.
+		template <typename Handler, typename = std::enable_if_t<!(std::is_convertible_v<Handler, WriteAsyncCallback *> || std::is_same_v<std::remove_cv_t<std::remove_reference_t<Handler>>, WriteAsyncHandler>)>>
+		NETKNOT_FORCEINLINE ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, Handler &&handler, WriteAsyncTask *&asyncTaskOut) {
+			return writeAsync(allocator, buffer, WriteAsyncHandler(std::forward<Handler>(handler)), asyncTaskOut);
+		}
+		/// @brief Send a region of a file asynchronously with a handler invocable as
+		/// ExceptionPointer(AsyncTaskStatus status, size_t szWritten, const RcBufferRef &buffer, ExceptionPointer &exception) noexcept.
+		template <typename Handler, typename = std::enable_if_t<!std::is_same_v<std::remove_cv_t<std::remove_reference_t<Handler>>, WriteAsyncHandler>>>
+		NETKNOT_FORCEINLINE ExceptionPointer sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, Handler &&handler, WriteAsyncTask *&asyncTaskOut) {
+			return sendFileAsync(allocator, file, offset, size, WriteAsyncHandler(std::forward<Handler>(handler)), asyncTaskOut);
+		}
+
+		/// @brief Enable or disable automatic write coalescing.
+		/// If enabled, writes queued during one event loop iteration are sent together when the iteration ends,
+		/// every write task still completes individually.
+		///
+		/// @param enabled Whether to enable automatic write coalescing.
+		virtual void setAutoCork(bool enabled) noexcept = 0;
+
+		/// @brief Steer the socket to a worker of the I/O service, e.g. the one on the NUMA node of its consumer.
+		/// The socket must have no asynchronous operation in flight.
+		///
+		/// @param workerId ID of the worker.
+		/// @return Whether the socket has been steered, always false for backends without per-worker sockets.
+		virtual bool setWorkerId(size_t workerId) noexcept = 0;
+
+		/// @brief Set the write watermarks of the socket.
+		/// tryWriteAsync() refuses to queue beyond the high watermark, the writable callback is
+		/// invoked once the outstanding write size drops to the low watermark again.
+		///
+		/// @param szLowWatermark The low watermark, in bytes.
+		/// @param szHighWatermark The high watermark, in bytes.
+		NETKNOT_API void setWriteWatermarks(size_t szLowWatermark, size_t szHighWatermark) noexcept;
+		/// @brief Set the callback to be invoked when a blocked socket becomes writable again.
+		NETKNOT_API void setWritableCallback(WritableCallback *callback) noexcept;
+
+		/// @brief Get size of the data queued by asynchronous writes but not written yet.
+		NETKNOT_FORCEINLINE size_t getPendingWriteSize() const noexcept {
+			return _szPendingWrite;
+		}
+
+		/// @brief Same as writeAsync(), but returns WouldBlockError instead of queuing past the high watermark.
+		NETKNOT_API ExceptionPointer tryWriteAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut);
+
+		/// @brief Account a newly queued write, called by the backends.
+		NETKNOT_API void onWriteQueued(size_t size) noexcept;
+		/// @brief Revert the accounting of a write which failed to be queued.
+		NETKNOT_FORCEINLINE void onWriteCancelled(size_t size) noexcept {
+			_szPendingWrite -= size;
+		}
+		/// @brief Account a finished write, called by the backends before the write callback,
+		/// as the callback may release the socket.
+		///
+		/// @return The exception raised by the writable callback.
+		NETKNOT_API ExceptionPointer onWriteFinished(size_t size) noexcept;
 	};
 }
 
@@ -0,0 +1,84 @@
+#ifndef _NETKNOT_TAGGED_STACK_H_
+#define _NETKNOT_TAGGED_STACK_H_
+
+#include "basedefs.h"
+#include <atomic>
+#include <cstdint>
+
+namespace netknot {
+	/// @brief Lock-free intrusive stack of free nodes, which any number of threads may push to and pop from.
+	/// The head is a pointer packed with a tag which is bumped by every change of the head, so a pop is not fooled by
+	/// its node being popped and pushed back by other threads meanwhile (the ABA problem).
+	/// A racing pop may read the link of a node which another thread has taken, which is then rejected by the tag,
+	/// so the nodes must not be freed while the stack may still be accessed.
+	///
+	/// @tparam T Type of the nodes.
+	/// @tparam link Member of the nodes which links them.
+	template <typename T, T *T::*link>
+	class TaggedStack {
+	private:
+		/// @brief Bits of the head which hold the pointer, the user-space addresses fit in 48 bits on the 64-bit targets.
+		constexpr static unsigned TAG_SHIFT = sizeof(void *) == 8 ? 48 : 32;
+		constexpr static uint64_t POINTER_MASK = ((uint64_t)1 << TAG_SHIFT) - 1;
+
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "The head must be exchangeable without a lock");
+
+		std::atomic<uint64_t> _head = 0;
+
+		NETKNOT_FORCEINLINE static T *_getNode(uint64_t head) noexcept {
+			return (T *)(uintptr_t)(head & POINTER_MASK);
+		}
+
+		NETKNOT_FORCEINLINE static uint64_t _makeHead(T *node, uint64_t oldHead) noexcept {
+			return (uint64_t)(uintptr_t)node | (((oldHead >> TAG_SHIFT) + 1) << TAG_SHIFT);
+		}
+
+	public:
+		NETKNOT_FORCEINLINE TaggedStack() = default;
+		TaggedStack(const TaggedStack &) = delete;
+
+		/// @brief Check if a node can be pushed, whose address must fit in the bits of the pointer.
+		NETKNOT_FORCEINLINE static bool isPushable(T *node) noexcept {
+			return !((uint64_t)(uintptr_t)node & ~POINTER_MASK);
+		}
+
+		/// @brief Push a node, which must be pushable.
+		NETKNOT_FORCEINLINE void push(T *node) noexcept {
+			uint64_t head = _head.load(std::memory_order_relaxed);
+
+			do {
+				node->*link = _getNode(head);
+			} while (!_head.compare_exchange_weak(head, _makeHead(node, head), std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		/// @brief Pop a node.
+		///
+		/// @return The node popped, nullptr if the stack is empty.
+		NETKNOT_FORCEINLINE T *pop() noexcept {
+			uint64_t head = _head.load(std::memory_order_acquire);
+
+			while (T *node = _getNode(head)) {
+				if (_head.compare_exchange_weak(head, _makeHead(node->*link, head), std::memory_order_acquire, std::memory_order_acquire)) {
+					node->*link = nullptr;
+					return node;
+				}
+			}
+
+			return nullptr;
+		}
+
+		/// @brief Take all of the nodes out.
+		///
+		/// @return The first node, the rest are linked by the link member.
+		NETKNOT_FORCEINLINE T *takeAll() noexcept {
+			uint64_t head = _head.load(std::memory_order_relaxed);
+
+			while (!_head.compare_exchange_weak(head, _makeHead(nullptr, head), std::memory_order_acquire, std::memory_order_relaxed))
+				;
+
+			return _getNode(head);
+		}
+	};
+}
+
+#endif
@@ -1,7 +1,29 @@
 #include "io_service.h"
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <iterator>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(SO_PREFER_BUSY_POLL)
+	// Available since Linux 5.11, older C libraries do not define it yet.
+	#define SO_PREFER_BUSY_POLL 69
+#endif
 
 using namespace netknot;
 
+struct UnixSubmissionBatch {
+	UnixIOService *ioService = nullptr;
+	size_t depth = 0;
+	UnixAsyncTaskQueue queue;
+};
+
+static thread_local UnixSubmissionBatch g_submissionBatch;
+
+static thread_local UnixIOService::ThreadLocalData *g_currentWorker = nullptr;
+
 NETKNOT_API UnixTranslatedAddress::UnixTranslatedAddress(peff::Alloc *selfAllocator) : selfAllocator(selfAllocator) {
 }
 
@@ -18,25 +40,652 @@ NETKNOT_API void UnixTranslatedAddress::dealloc() noexcept {
 NETKNOT_API void *UnixIOService::_workerThreadProc(void *lpThreadParameter) {
 	ThreadLocalData *tld = (ThreadLocalData *)lpThreadParameter;
 
-	pthread_cond_wait(&tld->startCond, &tld->startMutex);
+	pthread_mutex_lock(&tld->startMutex);
+	while (!(tld->started || tld->terminate))
+		pthread_cond_wait(&tld->startCond, &tld->startMutex);
+	pthread_mutex_unlock(&tld->startMutex);
 
-	while (true) {
-		// TODO: Implement it.
-	}
+	_runLoop(tld);
 
-	pthread_cond_broadcast(&tld->ioService->terminateNotifyConditionVar);
 	return 0;
 }
 
+NETKNOT_API void UnixIOService::_runLoop(ThreadLocalData *tld) noexcept {
+	g_currentWorker = tld;
+
+	// Allocated on the worker's own stack, so the pages are placed on the worker's NUMA node on first touch.
+	epoll_event events[64];
+
+	while (!tld->terminate) {
+		int nEvents = _waitForEvents(tld, events, (int)std::size(events));
+
+		if (nEvents < 0) {
+			if (errno == EINTR)
+				continue;
+			tld->exceptionStorage = errnoToExcept(tld->ioService->selfAllocator.get(), errno);
+			break;
+		}
+
+		for (int i = 0; i < nEvents; ++i) {
+			UnixSocket *socket = (UnixSocket *)events[i].data.ptr;
+
+			if (!socket) {
+				uint64_t value;
+				::read(tld->eventFd, &value, sizeof(value));
+
+				if ((tld->exceptionStorage = _dispatchSubmissions(tld)))
+					break;
+
+				if ((tld->exceptionStorage = _runPostedWork(tld)))
+					break;
+				continue;
+			}
+
+			if ((tld->exceptionStorage = _processSocketEvents(tld, socket, events[i].events)))
+				break;
+		}
+
+		if (tld->exceptionStorage)
+			break;
+
+		if ((tld->exceptionStorage = _updateDirtySockets(tld)))
+			break;
+	}
+
+	if (tld->exceptionStorage)
+		tld->ioService->_requestTerminate();
+
+	g_currentWorker = nullptr;
+}
+
+static uint64_t getMonotonicTime() noexcept {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+NETKNOT_API int UnixIOService::_waitForEvents(ThreadLocalData *tld, epoll_event *events, int maxEvents) noexcept {
+	BusyPollController &busyPoll = tld->busyPoll;
+
+	if (!busyPoll.maxBudget)
+		return epoll_wait(tld->epollFd, events, maxEvents, -1);
+
+	int nEvents = epoll_wait(tld->epollFd, events, maxEvents, 0);
+
+	if ((!nEvents) && busyPoll.budget) {
+		uint64_t deadline = getMonotonicTime() + busyPoll.budget;
+
+		do {
+	#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+	#endif
+			nEvents = epoll_wait(tld->epollFd, events, maxEvents, 0);
+		} while ((!nEvents) && (getMonotonicTime() < deadline));
+	}
+
+	if (!nEvents)
+		nEvents = epoll_wait(tld->epollFd, events, maxEvents, -1);
+
+	if (nEvents > 0)
+		busyPoll.onArrival(getMonotonicTime());
+
+	return nEvents;
+}
+
+NETKNOT_API void UnixIOService::_markSocketDirty(ThreadLocalData *tld, UnixSocket *socket) noexcept {
+	if (socket->isDirty)
+		return;
+
+	socket->isDirty = true;
+	socket->nextDirty = tld->dirtySockets;
+	tld->dirtySockets = socket;
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_dispatchSubmissions(ThreadLocalData *tld) noexcept {
+	UnixAsyncTaskQueue queue;
+
+	pthread_mutex_lock(&tld->submissionMutex);
+	queue.append(tld->submissionQueue);
+	pthread_mutex_unlock(&tld->submissionMutex);
+
+	while (UnixAsyncTaskNode *node = queue.popFront()) {
+		AsyncTask *task = node->task;
+
+		// The tasks interrupted already have failed to be submitted by flush(), they are only completed.
+		if (task->getStatus() != AsyncTaskStatus::Interrupted) {
+			_enqueueTask(tld, node);
+			continue;
+		}
+
+		ExceptionPointer e = _invokeCompletion(task);
+
+		// The reference held by the batch is dropped.
+		task->decRef(0);
+
+		if (e) {
+			// The rest are put back in front of those submitted meanwhile.
+			pthread_mutex_lock(&tld->submissionMutex);
+			queue.append(tld->submissionQueue);
+			tld->submissionQueue.append(queue);
+			pthread_mutex_unlock(&tld->submissionMutex);
+
+			return e;
+		}
+	}
+
+	return {};
+}
+
+NETKNOT_API void UnixIOService::_enqueueTask(ThreadLocalData *tld, UnixAsyncTaskNode *node) noexcept {
+	UnixSocket *socket = node->socket;
+
+	switch (node->task->getTaskType()) {
+		case AsyncTaskType::Read:
+			socket->readQueue.pushBack(node);
+			break;
+		case AsyncTaskType::Write:
+			socket->writeQueue.pushBack(node);
+			break;
+		case AsyncTaskType::Accept:
+			socket->acceptQueue.pushBack(node);
+			break;
+	}
+
+	_markSocketDirty(tld, socket);
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_runPostedWork(ThreadLocalData *tld) noexcept {
+	return tld->ioService->postedWorkPool.runChain(tld->postedWork.takeAll());
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_processSocketEvents(ThreadLocalData *tld, UnixSocket *socket, uint32_t events) noexcept {
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		NETKNOT_RETURN_IF_EXCEPT(_processAcceptQueue(tld, socket));
+		NETKNOT_RETURN_IF_EXCEPT(_processReadQueue(tld, socket));
+	}
+
+	// Corked sockets are flushed when the dirty sockets are updated at the end of the iteration.
+	if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && (!socket->isAutoCorkEnabled)) {
+		NETKNOT_RETURN_IF_EXCEPT(_processWriteQueue(tld, socket));
+	}
+
+	_markSocketDirty(tld, socket);
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_updateDirtySockets(ThreadLocalData *tld) noexcept {
+	while (UnixSocket *socket = tld->dirtySockets) {
+		tld->dirtySockets = socket->nextDirty;
+		socket->nextDirty = nullptr;
+		socket->isDirty = false;
+
+		if (socket->isDeallocDeferred) {
+			// Closing the file descriptor has removed it from the epoll instance,
+			// the tasks left behind can never be finished.
+			socket->registeredEvents = 0;
+
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->acceptQueue, ECANCELED));
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->readQueue, ECANCELED));
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->writeQueue, ECANCELED));
+
+			if (!socket->isDirty)
+				socket->dealloc();
+			continue;
+		}
+
+		// Newly queued writes are attempted right away, most of them will be finished without waiting for EPOLLOUT.
+		// The handlers may release the socket, which is then marked dirty again and released when it is reached.
+		if (!socket->writeQueue.isEmpty()) {
+			ExceptionPointer e;
+
+			socket->isUpdating = true;
+			if (socket->isAutoCorkEnabled)
+				e = _processCorkedWriteQueue(tld, socket);
+			else
+				e = _processWriteQueue(tld, socket);
+			socket->isUpdating = false;
+
+			NETKNOT_RETURN_IF_EXCEPT(std::move(e));
+		}
+
+		if (socket->socket < 0) {
+			// Closed file descriptors are removed from the epoll instance implicitly.
+			socket->registeredEvents = 0;
+			continue;
+		}
+
+		uint32_t events = 0;
+
+		if (!(socket->readQueue.isEmpty() && socket->acceptQueue.isEmpty()))
+			events |= EPOLLIN;
+		if (!socket->writeQueue.isEmpty())
+			events |= EPOLLOUT;
+
+		if (events == socket->registeredEvents)
+			continue;
+
+		epoll_event ev = {};
+		ev.events = events;
+		ev.data.ptr = socket;
+
+		int op;
+		if (!events)
+			op = EPOLL_CTL_DEL;
+		else if (!socket->registeredEvents)
+			op = EPOLL_CTL_ADD;
+		else
+			op = EPOLL_CTL_MOD;
+
+		if (epoll_ctl(tld->epollFd, op, socket->socket, &ev) < 0) {
+			int errorCode = errno;
+
+			socket->registeredEvents = 0;
+
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->acceptQueue, errorCode));
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->readQueue, errorCode));
+			NETKNOT_RETURN_IF_EXCEPT(_interruptQueue(tld, socket->writeQueue, errorCode));
+			continue;
+		}
+
+		socket->registeredEvents = events;
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_processReadQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept {
+	while (UnixAsyncTaskNode *node = socket->readQueue.head) {
+		UnixReadAsyncTask *task = (UnixReadAsyncTask *)node->task;
+
+		ssize_t result = ::recv(socket->socket, task->getBuffer(), task->bufferRef.size, MSG_DONTWAIT);
+
+		if (result < 0) {
+			int errorCode = errno;
+
+			if (errorCode == EINTR)
+				continue;
+			if (errorCode == EAGAIN || errorCode == EWOULDBLOCK)
+				break;
+
+			task->exceptPtr = errnoToExcept(tld->ioService->selfAllocator.get(), errorCode);
+			task->status = AsyncTaskStatus::Interrupted;
+		} else {
+			task->szRead += (size_t)result;
+			task->status = AsyncTaskStatus::Done;
+		}
+
+		socket->readQueue.popFront();
+		NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_processWriteQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept {
+	while (UnixAsyncTaskNode *node = socket->writeQueue.head) {
+		UnixWriteAsyncTask *task = (UnixWriteAsyncTask *)node->task;
+
+		while (task->szWritten < task->getWriteSize()) {
+			ssize_t result = socket->_writeSome(task);
+
+			if (result < 0) {
+				int errorCode = errno;
+
+				if (errorCode == EINTR)
+					continue;
+				if (errorCode == EAGAIN || errorCode == EWOULDBLOCK)
+					return {};
+
+				task->exceptPtr = errnoToExcept(tld->ioService->selfAllocator.get(), errorCode);
+				task->status = AsyncTaskStatus::Interrupted;
+				break;
+			}
+
+			task->szWritten += (size_t)result;
+		}
+
+		if (task->status != AsyncTaskStatus::Interrupted)
+			task->status = AsyncTaskStatus::Done;
+
+		socket->writeQueue.popFront();
+		NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_processCorkedWriteQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept {
+	while (!socket->writeQueue.isEmpty()) {
+		// Files cannot be gathered, they are sent on their own when they reach the head.
+		if (((UnixWriteAsyncTask *)socket->writeQueue.head->task)->file >= 0) {
+			UnixWriteAsyncTask *task = (UnixWriteAsyncTask *)socket->writeQueue.head->task;
+
+			ssize_t result = socket->_writeSome(task);
+
+			if (result < 0) {
+				int errorCode = errno;
+
+				if (errorCode == EINTR)
+					continue;
+				if (errorCode == EAGAIN || errorCode == EWOULDBLOCK)
+					return {};
+
+				task->exceptPtr = errnoToExcept(tld->ioService->selfAllocator.get(), errorCode);
+				task->status = AsyncTaskStatus::Interrupted;
+			} else if ((task->szWritten += (size_t)result) < task->szFile)
+				continue;
+			else
+				task->status = AsyncTaskStatus::Done;
+
+			socket->writeQueue.popFront();
+			NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+			continue;
+		}
+
+		iovec iov[64];
+		size_t nIov = 0, szGathered = 0;
+
+		for (UnixAsyncTaskNode *node = socket->writeQueue.head; node && (nIov < std::size(iov)); node = node->next) {
+			UnixWriteAsyncTask *task = (UnixWriteAsyncTask *)node->task;
+
+			if (task->file >= 0)
+				break;
+
+			iov[nIov].iov_base = task->bufferRef.buffer->data + task->bufferRef.offset + task->szWritten;
+			iov[nIov].iov_len = task->bufferRef.size - task->szWritten;
+			szGathered += iov[nIov].iov_len;
+			++nIov;
+		}
+
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nIov;
+
+		ssize_t result = ::sendmsg(socket->socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (result < 0) {
+			int errorCode = errno;
+
+			if (errorCode == EINTR)
+				continue;
+			if (errorCode == EAGAIN || errorCode == EWOULDBLOCK)
+				return {};
+
+			return _interruptQueue(tld, socket->writeQueue, errorCode);
+		}
+
+		// Distribute the written size to the gathered tasks in order.
+		size_t szRemaining = (size_t)result;
+
+		for (size_t i = 0; i < nIov; ++i) {
+			UnixWriteAsyncTask *task = (UnixWriteAsyncTask *)socket->writeQueue.head->task;
+			size_t szLeft = task->bufferRef.size - task->szWritten;
+
+			if (szRemaining < szLeft) {
+				task->szWritten += szRemaining;
+				break;
+			}
+
+			task->szWritten += szLeft;
+			szRemaining -= szLeft;
+
+			task->status = AsyncTaskStatus::Done;
+
+			socket->writeQueue.popFront();
+			NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+		}
+
+		if ((size_t)result < szGathered)
+			return {};
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_processAcceptQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept {
+	while (UnixAsyncTaskNode *node = socket->acceptQueue.head) {
+		UnixAcceptAsyncTask *task = (UnixAcceptAsyncTask *)node->task;
+
+		int newSocket = ::accept4(socket->socket, nullptr, nullptr, SOCK_CLOEXEC);
+
+		if (newSocket < 0) {
+			int errorCode = errno;
+
+			if (errorCode == EINTR || errorCode == ECONNABORTED)
+				continue;
+			if (errorCode == EAGAIN || errorCode == EWOULDBLOCK)
+				break;
+
+			task->exceptPtr = errnoToExcept(tld->ioService->selfAllocator.get(), errorCode);
+			task->status = AsyncTaskStatus::Interrupted;
+		} else {
+			tld->ioService->_applySocketOptions(newSocket);
+			task->socket->socket = newSocket;
+			task->status = AsyncTaskStatus::Done;
+		}
+
+		socket->acceptQueue.popFront();
+		NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+	}
+
+	return {};
+}
+
+NETKNOT_API void UnixIOService::_interruptTask(AsyncTask *task, ExceptionPointer &&exceptPtr) noexcept {
+	task->getException() = std::move(exceptPtr);
+
+	switch (task->getTaskType()) {
+		case AsyncTaskType::Read:
+			((UnixReadAsyncTask *)task)->status = AsyncTaskStatus::Interrupted;
+			break;
+		case AsyncTaskType::Write:
+			((UnixWriteAsyncTask *)task)->status = AsyncTaskStatus::Interrupted;
+			break;
+		case AsyncTaskType::Accept:
+			((UnixAcceptAsyncTask *)task)->status = AsyncTaskStatus::Interrupted;
+			break;
+	}
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_interruptQueue(ThreadLocalData *tld, UnixAsyncTaskQueue &queue, int errorCode) noexcept {
+	while (UnixAsyncTaskNode *node = queue.popFront()) {
+		AsyncTask *task = node->task;
+
+		_interruptTask(task, errnoToExcept(tld->ioService->selfAllocator.get(), errorCode));
+
+		NETKNOT_RETURN_IF_EXCEPT(_completeTask(tld, task));
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_completeTask(ThreadLocalData *tld, AsyncTask *task) noexcept {
+	UnixIOService *ioService = tld->ioService;
+
+	peff::RcObjectPtr<AsyncTask> rawTask = task;
+
+	ioService->_lockCurrentTasks();
+	ioService->currentTasks.remove(task);
+	ioService->_unlockCurrentTasks();
+
+	return _invokeCompletion(task);
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_invokeCompletion(AsyncTask *task) noexcept {
+	switch (task->getTaskType()) {
+		case AsyncTaskType::Read: {
+			UnixReadAsyncTask *t = (UnixReadAsyncTask *)task;
+
+			if (t->handler) {
+				NETKNOT_RETURN_IF_EXCEPT(t->handler(t->status, t->szRead, t->bufferRef, t->exceptPtr));
+			} else {
+				NETKNOT_RETURN_IF_EXCEPT(t->callback->onStatusChanged(t));
+			}
+			break;
+		}
+		case AsyncTaskType::Write: {
+			UnixWriteAsyncTask *t = (UnixWriteAsyncTask *)task;
+
+			// The write is accounted while the socket is known to be alive, the handler may release the socket,
+			// and a failing handler must not leave the pending size behind.
+			ExceptionPointer writableExcept = t->socket->onWriteFinished(t->getWriteSize());
+			ExceptionPointer e = t->handler
+									 ? t->handler(t->status, t->szWritten, t->bufferRef, t->exceptPtr)
+									 : t->callback->onStatusChanged(t);
+
+			if (e) {
+				if (writableExcept)
+					writableExcept.reset();
+				return e;
+			}
+			NETKNOT_RETURN_IF_EXCEPT(std::move(writableExcept));
+			break;
+		}
+		case AsyncTaskType::Accept: {
+			UnixAcceptAsyncTask *t = (UnixAcceptAsyncTask *)task;
+
+			if (t->status != AsyncTaskStatus::Done) {
+				// The pre-allocated socket will never be handed out.
+				t->socket->dealloc();
+				t->socket = nullptr;
+				break;
+			}
+
+			// The socket is owned by the callback from now on.
+			UnixSocket *socket = t->socket;
+			t->socket = nullptr;
+
+			NETKNOT_RETURN_IF_EXCEPT(t->callback->onAccepted(socket));
+			break;
+		}
+	}
+
+	return {};
+}
+
+NETKNOT_API bool UnixIOService::_isOnWorker(size_t workerId) noexcept {
+	return g_currentWorker && (g_currentWorker->ioService == this) && (g_currentWorker->threadId == workerId);
+}
+
+NETKNOT_API void UnixIOService::_submitToWorker(UnixAsyncTaskQueue &queue) noexcept {
+	if (isThreadConfined) {
+		// Only the thread driving the loop may submit, the tasks are queued on the sockets directly.
+		ThreadLocalData *tld = &threadLocalData.at(0);
+
+		while (UnixAsyncTaskNode *node = queue.popFront())
+			_enqueueTask(tld, node);
+		return;
+	}
+
+	// Split the queue by the owning workers, so every worker is locked and woken up only once.
+	while (!queue.isEmpty()) {
+		size_t workerId = queue.head->socket->workerId;
+		UnixAsyncTaskQueue workerQueue, remainingQueue;
+
+		while (UnixAsyncTaskNode *node = queue.popFront()) {
+			if (node->socket->workerId == workerId)
+				workerQueue.pushBack(node);
+			else
+				remainingQueue.pushBack(node);
+		}
+
+		queue.append(remainingQueue);
+
+		ThreadLocalData &tld = threadLocalData.at(workerId);
+
+		if (g_currentWorker == &tld) {
+			// Tasks posted by the owning worker are queued on the sockets directly, in posting order.
+			while (UnixAsyncTaskNode *node = workerQueue.popFront())
+				_enqueueTask(&tld, node);
+			continue;
+		}
+
+		pthread_mutex_lock(&tld.submissionMutex);
+		bool needsWakeup = tld.submissionQueue.isEmpty();
+		tld.submissionQueue.append(workerQueue);
+		pthread_mutex_unlock(&tld.submissionMutex);
+
+		if (needsWakeup)
+			_wakeUpWorker(tld);
+	}
+}
+
+NETKNOT_API void UnixIOService::_wakeUpWorker(ThreadLocalData &tld) noexcept {
+	uint64_t value = 1;
+	::write(tld.eventFd, &value, sizeof(value));
+}
+
+NETKNOT_API void UnixIOService::_requestTerminate() noexcept {
+	if (isThreadConfined) {
+		ThreadLocalData &tld = threadLocalData.at(0);
+
+		tld.terminate = true;
+		if (g_currentWorker != &tld)
+			_wakeUpWorker(tld);
+		return;
+	}
+
+	for (auto &i : threadLocalData) {
+		pthread_mutex_lock(&i.startMutex);
+		i.terminate = true;
+		pthread_cond_broadcast(&i.startCond);
+		pthread_mutex_unlock(&i.startMutex);
+
+		if (i.eventFd >= 0)
+			_wakeUpWorker(i);
+	}
+}
+
+NETKNOT_API size_t UnixIOService::_allocWorkerId() noexcept {
+	size_t nWorkers = threadLocalData.size();
+
+	if (nWorkers <= 1)
+		return 0;
+
+	return _nextWorkerId++ % nWorkers;
+}
+
+NETKNOT_API void UnixIOService::_applySocketOptions(int socket) noexcept {
+	if (busyPollBudget) {
+		// The options are best-effort, raising the busy poll time may require CAP_NET_ADMIN.
+	#ifdef SO_BUSY_POLL
+		int busyPollTime = (int)busyPollBudget;
+		setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &busyPollTime, sizeof(busyPollTime));
+	#endif
+	#ifdef SO_PREFER_BUSY_POLL
+		int preferBusyPoll = 1;
+		setsockopt(socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &preferBusyPoll, sizeof(preferBusyPoll));
+	#endif
+	}
+}
+
 NETKNOT_API UnixIOService::ThreadLocalData::~ThreadLocalData() {
 	if (hThread.hasValue()) {
+		pthread_mutex_lock(&startMutex);
 		terminate = true;
-		pthread_join(hThread, nullptr);
+		pthread_cond_broadcast(&startCond);
+		pthread_mutex_unlock(&startMutex);
+
+		if (eventFd >= 0) {
+			uint64_t value = 1;
+			::write(eventFd, &value, sizeof(value));
+		}
+
+		pthread_join(hThread.value(), nullptr);
 	}
+
+	ioService->postedWorkPool.discardChain(postedWork.takeAll());
+
+	if (eventFd >= 0)
+		::close(eventFd);
+	if (epollFd >= 0)
+		::close(epollFd);
 }
 
 NETKNOT_API UnixIOService::UnixIOService(peff::Alloc *selfAllocator)
 	: selfAllocator(selfAllocator),
+	  postedWorkPool(selfAllocator),
 	  threadLocalData(selfAllocator),
 	  currentTasks(selfAllocator) {
 }
@@ -55,6 +704,7 @@ NETKNOT_API UnixIOService *UnixIOService::alloc(peff::Alloc *selfAllocator) {
 }
 
 NETKNOT_API void UnixIOService::dealloc() noexcept {
+	peff::destroyAndRelease<UnixIOService>(selfAllocator.get(), this, alignof(UnixIOService));
 }
 
 NETKNOT_API ExceptionPointer UnixIOService::run() {
@@ -65,18 +715,38 @@ NETKNOT_API ExceptionPointer UnixIOService::run() {
 		NETKNOT_RETURN_IF_EXCEPT(std::move(i.exceptionStorage));
 	}
 
+	_isRunning = true;
+
+	if (isThreadConfined) {
+		ThreadLocalData &tld = threadLocalData.at(0);
+
+		// Drive the loop on the calling thread.
+		tld.terminate = false;
+		_runLoop(&tld);
+
+		_isRunning = false;
+
+		return std::move(tld.exceptionStorage);
+	}
+
 	for (auto &i : threadLocalData) {
+		pthread_mutex_lock(&i.startMutex);
+		i.started = true;
 		pthread_cond_broadcast(&i.startCond);
+		pthread_mutex_unlock(&i.startMutex);
+	}
+
+	for (auto &i : threadLocalData) {
+		pthread_join(i.hThread.value(), nullptr);
+		i.hThread.reset();
 	}
 
-	pthread_cond_wait(&terminateNotifyConditionVar, &terminateNotifyMutex);
+	_isRunning = false;
 
 	for (auto &i : threadLocalData) {
 		NETKNOT_RETURN_IF_EXCEPT(std::move(i.exceptionStorage));
 	}
 
-	_isRunning = true;
-
 	return {};
 }
 
@@ -84,43 +754,250 @@ NETKNOT_API ExceptionPointer UnixIOService::stop() {
 	if (!_isRunning)
 		std::terminate();
 
-	for (auto &i : threadLocalData) {
-		i.terminate = true;
+	_requestTerminate();
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::postAsyncTask(AsyncTask *task) noexcept {
+	UnixAsyncTaskNode *node = getUnixAsyncTaskNode(task);
+
+	// The owning worker queues the task on the socket right away, there is nothing to batch.
+	if (g_submissionBatch.depth && (g_submissionBatch.ioService == this) && (!_isOnWorker(node->socket->workerId))) {
+		// Hold the task until the batch is flushed.
+		task->incRef(0);
+		g_submissionBatch.queue.pushBack(node);
+		return {};
 	}
 
-	for (auto &i : threadLocalData) {
-		pthread_join(i.hThread, nullptr);
+	{
+		peff::ScopeGuard currentTasksMutexGuard([this]() noexcept {
+			_unlockCurrentTasks();
+		});
+
+		_lockCurrentTasks();
+
+		if (!currentTasks.insert(task))
+			return OutOfMemoryError::alloc();
 	}
 
-	for (auto &i : threadLocalData) {
-		NETKNOT_RETURN_IF_EXCEPT(std::move(i.exceptionStorage));
+	UnixAsyncTaskQueue queue;
+	queue.pushBack(node);
+	_submitToWorker(queue);
+
+	return {};
+}
+
+NETKNOT_API void UnixIOService::beginBatch() noexcept {
+	if (g_submissionBatch.depth++) {
+		// Batches of different I/O services cannot be interleaved.
+		if (g_submissionBatch.ioService != this)
+			std::terminate();
+		return;
 	}
 
-	_isRunning = false;
+	g_submissionBatch.ioService = this;
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::flush() noexcept {
+	if ((!g_submissionBatch.depth) || (g_submissionBatch.ioService != this))
+		std::terminate();
+
+	if (--g_submissionBatch.depth)
+		return {};
+
+	g_submissionBatch.ioService = nullptr;
+
+	UnixAsyncTaskQueue queue, submittedQueue;
+	queue.append(g_submissionBatch.queue);
+
+	{
+		peff::ScopeGuard currentTasksMutexGuard([this]() noexcept {
+			_unlockCurrentTasks();
+		});
+
+		_lockCurrentTasks();
+
+		while (UnixAsyncTaskNode *node = queue.popFront()) {
+			AsyncTask *task = node->task;
+
+			if (!currentTasks.insert(task)) {
+				// The owning worker completes the task with the error, and drops the reference held by the batch.
+				_interruptTask(task, OutOfMemoryError::alloc());
+				submittedQueue.pushBack(node);
+				continue;
+			}
+
+			// The task is now held by the current task set.
+			task->decRef(0);
+			submittedQueue.pushBack(node);
+		}
+	}
+
+	_submitToWorker(submittedQueue);
 
 	return {};
 }
 
-NETKNOT_API ExceptionPointer UnixIOService::postAsyncTask(AsyncTask *task) noexcept {
-	peff::ScopeGuard currentTasksMutexGuard([this]() noexcept {
-		pthread_mutex_unlock(&currentTasksMutex);
-	});
+NETKNOT_API PostedWork *UnixIOService::allocPostedWork() noexcept {
+	return postedWorkPool.alloc();
+}
 
-	pthread_mutex_lock(&currentTasksMutex);
+NETKNOT_API ExceptionPointer UnixIOService::postWork(size_t workerId, PostedWork *work) noexcept {
+	if (workerId >= threadLocalData.size())
+		std::terminate();
 
-	if (!currentTasks.insert(task))
-		return OutOfMemoryError::alloc();
+	ThreadLocalData &tld = threadLocalData.at(workerId);
+
+	if (tld.postedWork.push(work))
+		_wakeUpWorker(tld);
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::postWork(PostedWork *work) noexcept {
+	size_t workerId;
+
+	if (!getCurrentWorkerId(workerId))
+		workerId = _allocWorkerId();
+
+	return postWork(workerId, work);
+}
+
+NETKNOT_API void UnixIOService::releasePostedWork(PostedWork *work) noexcept {
+	work->next = nullptr;
+	postedWorkPool.discardChain(work);
+}
+
+NETKNOT_API ComputePool *UnixIOService::getComputePool() noexcept {
+	return computePool.get();
+}
+
+NETKNOT_API size_t UnixIOService::getWorkerCount() noexcept {
+	return threadLocalData.size();
+}
+
+NETKNOT_API bool UnixIOService::getCurrentWorkerId(size_t &workerIdOut) noexcept {
+	if ((!g_currentWorker) || (g_currentWorker->ioService != this))
+		return false;
+
+	workerIdOut = g_currentWorker->threadId;
+	return true;
+}
+
+NETKNOT_API size_t UnixIOService::getWorkerNumaNode(size_t workerId) noexcept {
+	return threadLocalData.at(workerId).numaNode;
+}
+
+static bool readSysFile(const char *path, char *buffer, size_t size) noexcept {
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	ssize_t szRead = ::read(fd, buffer, size - 1);
+	::close(fd);
+
+	if (szRead < 0)
+		return false;
+
+	buffer[szRead] = '\0';
+	return true;
+}
+
+/// @brief Parse a CPU list in the sysfs format, such as "0-3,8-11".
+static void parseCpuList(const char *s, WorkerCpuSet &cpuSetOut) noexcept {
+	while (*s) {
+		if ((*s < '0') || (*s > '9')) {
+			++s;
+			continue;
+		}
+
+		size_t first = 0, last;
+		while ((*s >= '0') && (*s <= '9'))
+			first = first * 10 + (*s++ - '0');
+
+		last = first;
+		if (*s == '-') {
+			++s;
+			last = 0;
+			while ((*s >= '0') && (*s <= '9'))
+				last = last * 10 + (*s++ - '0');
+		}
+
+		for (size_t i = first; (i <= last) && (i < WorkerCpuSet::MAX_CPUS); ++i)
+			cpuSetOut.set(i);
+	}
+}
+
+static size_t getLowestCpu(const WorkerCpuSet &cpuSet) noexcept {
+	for (size_t i = 0; i < std::size(cpuSet.bits); ++i) {
+		if (cpuSet.bits[i])
+			return i * 64 + __builtin_ctzll(cpuSet.bits[i]);
+	}
+	return SIZE_MAX;
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_enumeratePhysicalCores(peff::DynArray<WorkerCpuSet> &coresOut) noexcept {
+	char path[128], buffer[4096];
+	long nConfiguredCpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	for (size_t i = 0; (i < WorkerCpuSet::MAX_CPUS) && ((long)i < nConfiguredCpus); ++i) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", i);
+
+		// Offline CPUs have no topology.
+		if (!readSysFile(path, buffer, sizeof(buffer)))
+			continue;
+
+		WorkerCpuSet siblings;
+		parseCpuList(buffer, siblings);
+
+		// Every core is recorded once, by its first hardware thread.
+		if (getLowestCpu(siblings) != i)
+			continue;
+
+		if (!coresOut.pushBack(std::move(siblings)))
+			return OutOfMemoryError::alloc();
+	}
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer UnixIOService::_enumerateNumaNodes(peff::DynArray<WorkerCpuSet> &nodesOut, peff::DynArray<size_t> &nodeIdsOut) noexcept {
+	char path[128], buffer[4096];
+
+	// Node IDs are not guaranteed to be contiguous.
+	for (size_t i = 0; i < 256; ++i) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", i);
+
+		if (!readSysFile(path, buffer, sizeof(buffer)))
+			continue;
+
+		WorkerCpuSet cpus;
+		parseCpuList(buffer, cpus);
+
+		// Memory-only nodes have no CPU to run workers on.
+		if (cpus.isEmpty())
+			continue;
+
+		if (!nodesOut.pushBack(std::move(cpus)))
+			return OutOfMemoryError::alloc();
+		if (!nodeIdsOut.pushBack(std::move(i)))
+			return OutOfMemoryError::alloc();
+	}
 
 	return {};
 }
 
 NETKNOT_API ExceptionPointer UnixIOService::createSocket(peff::Alloc *allocator, const peff::UUID &addressFamily, const peff::UUID &socketType, Socket *&socketOut) noexcept {
 	std::unique_ptr<UnixSocket, peff::DeallocableDeleter<UnixSocket>> p(
-		peff::allocAndConstruct<UnixSocket>(allocator, alignof(UnixSocket), this, addressFamily, socketType));
+		peff::allocAndConstruct<UnixSocket>(allocator, alignof(UnixSocket), this, allocator, addressFamily, socketType));
 
 	if (!p)
 		return OutOfMemoryError::alloc();
 
+	p->workerId = _allocWorkerId();
+
 	int &s = p->socket;
 
 	int af;
@@ -133,16 +1010,17 @@ NETKNOT_API ExceptionPointer UnixIOService::createSocket(peff::Alloc *allocator,
 	}
 
 	if (socketType == SOCKET_TCP) {
-		s = socket(af, SOCK_STREAM, IPPROTO_TCP);
+		s = socket(af, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
 	} else if (socketType == SOCKET_UDP) {
-		s = socket(af, SOCK_DGRAM, IPPROTO_UDP);
+		s = socket(af, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
 	} else {
 		std::terminate();
 	}
 
-	if (s < 0) {
-		std::terminate();
-	}
+	if (s < 0)
+		return errnoToExcept(allocator, errno);
+
+	_applySocketOptions(s);
 
 	socketOut = p.release();
 
@@ -208,48 +1086,191 @@ ExceptionPointer UnixIOService::detranslateAddress(peff::Alloc *allocator, const
 	std::terminate();
 }
 
+NETKNOT_API ExceptionPointer netknot::errnoToExcept(peff::Alloc *allocator, int errorCode) noexcept {
+	switch (errorCode) {
+		case ENOMEM:
+		case ENOBUFS:
+			return OutOfMemoryError::alloc();
+		case EADDRINUSE:
+			return NetworkError::alloc(allocator, NetworkErrorCode::AddressInUse);
+		case EACCES:
+		case EPERM:
+			return NetworkError::alloc(allocator, NetworkErrorCode::AccessDenied);
+		case EMFILE:
+		case ENFILE:
+			return NetworkError::alloc(allocator, NetworkErrorCode::TooManyOpenedFiles);
+		case EMSGSIZE:
+			return NetworkError::alloc(allocator, NetworkErrorCode::MessageSizeIsTooBig);
+		case EPROTONOSUPPORT:
+			return NetworkError::alloc(allocator, NetworkErrorCode::ProtocolNotSupported);
+		case ESOCKTNOSUPPORT:
+			return NetworkError::alloc(allocator, NetworkErrorCode::SocketTypeNotSupported);
+		case EADDRNOTAVAIL:
+			return NetworkError::alloc(allocator, NetworkErrorCode::AddressNotAvailable);
+		case ENETDOWN:
+			return NetworkError::alloc(allocator, NetworkErrorCode::NetworkIsDown);
+		case ENETRESET:
+			return NetworkError::alloc(allocator, NetworkErrorCode::NetworkReseted);
+		case ENETUNREACH:
+			return NetworkError::alloc(allocator, NetworkErrorCode::NetworkIsUnreachable);
+		case ECONNRESET:
+			return NetworkError::alloc(allocator, NetworkErrorCode::ConnectionReseted);
+		case ENOTCONN:
+			return NetworkError::alloc(allocator, NetworkErrorCode::SocketIsNotConnected);
+		case EPIPE:
+		case ESHUTDOWN:
+			return NetworkError::alloc(allocator, NetworkErrorCode::Shutdown);
+		case ETIMEDOUT:
+			return NetworkError::alloc(allocator, NetworkErrorCode::TimedOut);
+		case ECONNREFUSED:
+			return NetworkError::alloc(allocator, NetworkErrorCode::ConnectionRefused);
+		case EHOSTDOWN:
+			return NetworkError::alloc(allocator, NetworkErrorCode::HostIsDown);
+		case EHOSTUNREACH:
+			return NetworkError::alloc(allocator, NetworkErrorCode::HostIsUnreachable);
+		case EAGAIN:
+			return NetworkError::alloc(allocator, NetworkErrorCode::ResourceLimitExceeded);
+		default:
+			break;
+	}
+	return NetworkError::alloc(allocator, NetworkErrorCode::Unknown);
+}
+
 NETKNOT_API ExceptionPointer netknot::createDefaultIOService(IOService *&ioServiceOut, const IOServiceCreationParams &params) noexcept {
 	std::unique_ptr<UnixIOService, peff::DeallocableDeleter<UnixIOService>> ioService(UnixIOService::alloc(params.allocator.get()));
 
 	if (!ioService)
 		return OutOfMemoryError::alloc();
 
-	if (!ioService->threadLocalData.resizeUninitialized(params.nWorkerThreads)) {
+#if NETKNOT_SINGLE_THREADED
+	// The reference counts are not atomic, nothing but the thread calling run() may touch the objects.
+	if (params.nWorkerThreads || params.nComputeThreads)
+		return InvalidArgsError::alloc();
+#endif
+
+	ioService->busyPollBudget = params.busyPollBudget;
+
+	// Without worker threads, a single loop is driven by the caller of run().
+	ioService->isThreadConfined = !params.nWorkerThreads;
+	size_t nLoops = ioService->isThreadConfined ? 1 : params.nWorkerThreads;
+
+	if (!ioService->threadLocalData.resizeUninitialized(nLoops)) {
 		return OutOfMemoryError::alloc();
 	}
 
-	for (size_t i = 0; i < params.nWorkerThreads; ++i) {
+	for (size_t i = 0; i < nLoops; ++i) {
 		peff::constructAt(&ioService->threadLocalData.at(i), ioService.get(), i, params.allocator.get());
+		ioService->threadLocalData.at(i).busyPoll.init(params.busyPollBudget, params.adaptiveBusyPoll);
+	}
+
+	for (size_t i = 0; i < nLoops; ++i) {
+		UnixIOService::ThreadLocalData &tld = ioService->threadLocalData.at(i);
+
+		if ((tld.epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			return errnoToExcept(params.allocator.get(), errno);
+
+		if ((tld.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+			return errnoToExcept(params.allocator.get(), errno);
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+
+		if (epoll_ctl(tld.epollFd, EPOLL_CTL_ADD, tld.eventFd, &ev) < 0)
+			return errnoToExcept(params.allocator.get(), errno);
+	}
+
+	peff::DynArray<WorkerCpuSet> coreCpuSets(params.allocator.get());
+	peff::DynArray<WorkerCpuSet> nodeCpuSets(params.allocator.get());
+	peff::DynArray<size_t> nodeIds(params.allocator.get());
+	const peff::DynArray<WorkerCpuSet> *cpuSets = nullptr;
+
+	if (params.workerPlacementPolicy != WorkerPlacementPolicy::Default) {
+		NETKNOT_RETURN_IF_EXCEPT(UnixIOService::_enumerateNumaNodes(nodeCpuSets, nodeIds));
+	}
+
+	switch (params.workerPlacementPolicy) {
+		case WorkerPlacementPolicy::Default:
+			break;
+		case WorkerPlacementPolicy::Explicit:
+			cpuSets = &params.workerCpuSets;
+			break;
+		case WorkerPlacementPolicy::PerPhysicalCore:
+			NETKNOT_RETURN_IF_EXCEPT(UnixIOService::_enumeratePhysicalCores(coreCpuSets));
+			cpuSets = &coreCpuSets;
+			break;
+		case WorkerPlacementPolicy::PerNumaNode:
+			cpuSets = &nodeCpuSets;
+			break;
 	}
 
 	for (size_t i = 0; i < params.nWorkerThreads; ++i) {
 		UnixIOService::ThreadLocalData &tld = ioService->threadLocalData.at(i);
 
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+
+		peff::ScopeGuard destroyAttrGuard([&attr]() noexcept {
+			pthread_attr_destroy(&attr);
+		});
+
+		if (params.szWorkerThreadStackSize) {
+			if (int result = pthread_attr_setstacksize(&attr, params.szWorkerThreadStackSize); result)
+				return errnoToExcept(params.allocator.get(), result);
+		}
+
+		// Explicit CPU sets are assigned one per worker, the enumerated ones are assigned in turn.
+		const WorkerCpuSet *cpuSet = nullptr;
+		if (cpuSets) {
+			if (params.workerPlacementPolicy == WorkerPlacementPolicy::Explicit) {
+				if (i < cpuSets->size())
+					cpuSet = &cpuSets->at(i);
+			} else if (cpuSets->size()) {
+				cpuSet = &cpuSets->at(i % cpuSets->size());
+			}
+		}
+
+		if (cpuSet && (!cpuSet->isEmpty())) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+
+			for (size_t j = 0; (j < WorkerCpuSet::MAX_CPUS) && (j < CPU_SETSIZE); ++j) {
+				if (cpuSet->test(j))
+					CPU_SET(j, &cpus);
+			}
+
+			if (int result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus); result)
+				return errnoToExcept(params.allocator.get(), result);
+
+			size_t lowestCpu = getLowestCpu(*cpuSet);
+			for (size_t j = 0; j < nodeCpuSets.size(); ++j) {
+				if (nodeCpuSets.at(j).test(lowestCpu)) {
+					tld.numaNode = nodeIds.at(j);
+					break;
+				}
+			}
+		}
+
 		peff::ScopeGuard removeThreadHandleGuard([&tld]() noexcept {
 			tld.hThread.reset();
 		});
 
 		tld.hThread = 0;
-		if (pthread_create(&tld.hThread.value(), nullptr, UnixIOService::_workerThreadProc, &tld) < 0) {
-			switch (errno) {
-				case EAGAIN:
-					std::terminate();
-					break;
-				case EINVAL:
-					std::terminate();
-					break;
-				case ENOMEM:
-					std::terminate();
-					break;
-				default:
-					std::terminate();
-					break;
-			}
+		if (int result = pthread_create(&tld.hThread.value(), &attr, UnixIOService::_workerThreadProc, &tld); result) {
+			return errnoToExcept(params.allocator.get(), result);
 		}
 
 		removeThreadHandleGuard.release();
 	}
 
+	if (params.nComputeThreads) {
+		if (!(ioService->computePool = std::unique_ptr<ComputePool, peff::DeallocableDeleter<ComputePool>>(
+				  ComputePool::alloc(params.allocator.get(), &ioService->postedWorkPool))))
+			return OutOfMemoryError::alloc();
+
+		NETKNOT_RETURN_IF_EXCEPT(ioService->computePool->start(params.nComputeThreads));
+	}
+
 	ioServiceOut = ioService.release();
 
 	return {};
@@ -9,6 +9,8 @@
 #include <peff/advutils/buffer_alloc.h>
 #include <pthread.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 namespace netknot {
 	class UnixTranslatedAddress : public TranslatedAddress {
@@ -26,35 +28,104 @@ namespace netknot {
 	class UnixIOService : public IOService {
 	private:
 		bool _isRunning = false;
+		std::atomic_size_t _nextWorkerId = 0;
 
 	public:
 		NETKNOT_API static void *_workerThreadProc(void *lpThreadParameter);
 
-		struct ThreadLocalData {
+		// Aligned to keep the workers from sharing cache lines.
+		struct alignas(64) ThreadLocalData {
 			UnixIOService *ioService;
 			peff::Option<pthread_t> hThread;
 			pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
 			pthread_mutex_t startMutex = PTHREAD_MUTEX_INITIALIZER;
+			bool started = false;
 			size_t threadId;
 			bool terminate = false;
 			ExceptionPointer exceptionStorage;
 
+			int epollFd = -1;
+			/// @brief Event file descriptor used to wake the worker up.
+			int eventFd = -1;
+
+			/// @brief Tasks submitted by other threads, to be dispatched by the worker.
+			pthread_mutex_t submissionMutex = PTHREAD_MUTEX_INITIALIZER;
+			UnixAsyncTaskQueue submissionQueue;
+
+			/// @brief Work posted by any thread, signalled through the event file descriptor as well.
+			PostedWorkQueue postedWork;
+
+			/// @brief Sockets which have their queues changed in current loop iteration.
+			UnixSocket *dirtySockets = nullptr;
+
+			BusyPollController busyPoll;
+
+			/// @brief NUMA node of the CPUs that the worker is pinned to, SIZE_MAX if unknown.
+			size_t numaNode = SIZE_MAX;
+
 			NETKNOT_FORCEINLINE ThreadLocalData(ThreadLocalData &&) = default;
 			NETKNOT_FORCEINLINE ThreadLocalData(UnixIOService *ioService, size_t threadId, peff::Alloc *allocator) : ioService(ioService), threadId(threadId) {
 			}
 			NETKNOT_API ~ThreadLocalData();
 		};
 
-		pthread_mutex_t terminateNotifyMutex = PTHREAD_MUTEX_INITIALIZER;
-		pthread_cond_t terminateNotifyConditionVar = PTHREAD_COND_INITIALIZER;
+		NETKNOT_API static void _runLoop(ThreadLocalData *tld) noexcept;
+		NETKNOT_API static void _markSocketDirty(ThreadLocalData *tld, UnixSocket *socket) noexcept;
+		NETKNOT_API static void _enqueueTask(ThreadLocalData *tld, UnixAsyncTaskNode *node) noexcept;
+		NETKNOT_API static ExceptionPointer _dispatchSubmissions(ThreadLocalData *tld) noexcept;
+		NETKNOT_API static ExceptionPointer _runPostedWork(ThreadLocalData *tld) noexcept;
+		NETKNOT_API static int _waitForEvents(ThreadLocalData *tld, epoll_event *events, int maxEvents) noexcept;
+		NETKNOT_API static ExceptionPointer _processSocketEvents(ThreadLocalData *tld, UnixSocket *socket, uint32_t events) noexcept;
+		NETKNOT_API static ExceptionPointer _updateDirtySockets(ThreadLocalData *tld) noexcept;
+		NETKNOT_API static ExceptionPointer _processReadQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept;
+		NETKNOT_API static ExceptionPointer _processWriteQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept;
+		NETKNOT_API static ExceptionPointer _processCorkedWriteQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept;
+		NETKNOT_API static ExceptionPointer _processAcceptQueue(ThreadLocalData *tld, UnixSocket *socket) noexcept;
+		NETKNOT_API static void _interruptTask(AsyncTask *task, ExceptionPointer &&exceptPtr) noexcept;
+		NETKNOT_API static ExceptionPointer _interruptQueue(ThreadLocalData *tld, UnixAsyncTaskQueue &queue, int errorCode) noexcept;
+		NETKNOT_API static ExceptionPointer _completeTask(ThreadLocalData *tld, AsyncTask *task) noexcept;
+		NETKNOT_API static ExceptionPointer _invokeCompletion(AsyncTask *task) noexcept;
+
+		/// @brief Check if the calling thread is driving the loop of a worker.
+		NETKNOT_API bool _isOnWorker(size_t workerId) noexcept;
+		NETKNOT_API void _submitToWorker(UnixAsyncTaskQueue &queue) noexcept;
+		NETKNOT_API void _wakeUpWorker(ThreadLocalData &tld) noexcept;
+		NETKNOT_API void _requestTerminate() noexcept;
+		NETKNOT_API size_t _allocWorkerId() noexcept;
+		NETKNOT_API void _applySocketOptions(int socket) noexcept;
+
+		NETKNOT_API static ExceptionPointer _enumeratePhysicalCores(peff::DynArray<WorkerCpuSet> &coresOut) noexcept;
+		NETKNOT_API static ExceptionPointer _enumerateNumaNodes(peff::DynArray<WorkerCpuSet> &nodesOut, peff::DynArray<size_t> &nodeIdsOut) noexcept;
+
+		/// @brief Whether the service has no worker thread and its loop is driven by the caller of run().
+		/// Every operation must be done on that thread, so the bookkeeping is not locked.
+		bool isThreadConfined = false;
+
+		NETKNOT_FORCEINLINE void _lockCurrentTasks() noexcept {
+			if (!isThreadConfined)
+				pthread_mutex_lock(&currentTasksMutex);
+		}
+
+		NETKNOT_FORCEINLINE void _unlockCurrentTasks() noexcept {
+			if (!isThreadConfined)
+				pthread_mutex_unlock(&currentTasksMutex);
+		}
 
 		pthread_mutex_t currentTasksMutex = PTHREAD_MUTEX_INITIALIZER;
 		peff::Set<peff::RcObjectPtr<AsyncTask>> currentTasks;
 
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 
+		uint32_t busyPollBudget = 0;
+
+		// Must outlive the workers, which discard their remaining work on destruction.
+		PostedWorkPool postedWorkPool;
+
 		peff::DynArray<ThreadLocalData> threadLocalData;
 
+		// Stopped before the workers are destroyed, because the finished jobs post their continuations onto the workers.
+		std::unique_ptr<ComputePool, peff::DeallocableDeleter<ComputePool>> computePool;
+
 		NETKNOT_API UnixIOService(peff::Alloc *selfAllocator);
 		NETKNOT_API ~UnixIOService();
 
@@ -67,11 +138,27 @@ namespace netknot {
 
 		NETKNOT_API virtual ExceptionPointer postAsyncTask(AsyncTask *task) noexcept override;
 
+		NETKNOT_API virtual void beginBatch() noexcept override;
+		NETKNOT_API virtual ExceptionPointer flush() noexcept override;
+
+		NETKNOT_API virtual size_t getWorkerCount() noexcept override;
+		NETKNOT_API virtual bool getCurrentWorkerId(size_t &workerIdOut) noexcept override;
+		NETKNOT_API virtual size_t getWorkerNumaNode(size_t workerId) noexcept override;
+
+		NETKNOT_API virtual PostedWork *allocPostedWork() noexcept override;
+		NETKNOT_API virtual ExceptionPointer postWork(size_t workerId, PostedWork *work) noexcept override;
+		NETKNOT_API virtual ExceptionPointer postWork(PostedWork *work) noexcept override;
+		NETKNOT_API virtual void releasePostedWork(PostedWork *work) noexcept override;
+
+		NETKNOT_API virtual ComputePool *getComputePool() noexcept override;
+
 		NETKNOT_API virtual ExceptionPointer createSocket(peff::Alloc *allocator, const peff::UUID &addressFamily, const peff::UUID &socketType, Socket *&socketOut) noexcept override;
 
 		NETKNOT_API virtual ExceptionPointer translateAddress(peff::Alloc *allocator, const Address *address, TranslatedAddress **compiledAddressOut, size_t *compiledAddressSizeOut = nullptr) noexcept override;
 		NETKNOT_API virtual ExceptionPointer detranslateAddress(peff::Alloc *allocator, const peff::UUID &addressFamily, const TranslatedAddress *address, Address &addressOut) noexcept override;
 	};
+
+	NETKNOT_API ExceptionPointer errnoToExcept(peff::Alloc *allocator, int errorCode) noexcept;
 }
 
 #endif
@@ -1,8 +1,11 @@
 #include "io_service.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
 
 using namespace netknot;
 
-NETKNOT_API UnixReadAsyncTask::UnixReadAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef) : selfAllocator(allocator), socket(socket), bufferRef(bufferRef) {
+NETKNOT_API UnixReadAsyncTask::UnixReadAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef) : selfAllocator(allocator), node(this, socket), socket(socket), bufferRef(bufferRef) {
 }
 
 NETKNOT_API UnixReadAsyncTask::~UnixReadAsyncTask() {
@@ -36,7 +39,7 @@ NETKNOT_API RcBufferRef UnixReadAsyncTask::getBufferRef() {
 	return bufferRef;
 }
 
-NETKNOT_API UnixWriteAsyncTask::UnixWriteAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef) : selfAllocator(allocator), socket(socket), bufferRef(bufferRef) {
+NETKNOT_API UnixWriteAsyncTask::UnixWriteAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef) : selfAllocator(allocator), node(this, socket), socket(socket), bufferRef(bufferRef) {
 }
 
 NETKNOT_API UnixWriteAsyncTask::~UnixWriteAsyncTask() {
@@ -59,13 +62,16 @@ NETKNOT_API size_t UnixWriteAsyncTask::getCurrentWrittenSize() {
 }
 
 NETKNOT_API size_t UnixWriteAsyncTask::getExpectedWrittenSize() {
-	return bufferRef.size;
+	return getWriteSize();
 }
 
-NETKNOT_API UnixAcceptAsyncTask::UnixAcceptAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const peff::UUID &addressFamily) : selfAllocator(allocator), socket(socket), addressFamily(addressFamily) {
+NETKNOT_API UnixAcceptAsyncTask::UnixAcceptAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const peff::UUID &addressFamily) : selfAllocator(allocator), node(this, socket), socket(nullptr), addressFamily(addressFamily) {
 }
 
 NETKNOT_API UnixAcceptAsyncTask::~UnixAcceptAsyncTask() {
+	// The task is dropped before a connection has been accepted, e.g. when the service is stopped.
+	if (socket)
+		socket->dealloc();
 }
 
 NETKNOT_API void UnixAcceptAsyncTask::onRefZero() noexcept {
@@ -80,25 +86,38 @@ NETKNOT_API ExceptionPointer &UnixAcceptAsyncTask::getException() {
 	return exceptPtr;
 }
 
-NETKNOT_API UnixSocket::UnixSocket(UnixIOService *ioService, const peff::UUID &addressFamily, const peff::UUID &socketTypeId) : ioService(ioService), socket(socket), addressFamily(addressFamily), socketTypeId(socketTypeId) {
+NETKNOT_API UnixSocket::UnixSocket(UnixIOService *ioService, peff::Alloc *selfAllocator, const peff::UUID &addressFamily, const peff::UUID &socketTypeId) : ioService(ioService), selfAllocator(selfAllocator), socket(-1), addressFamily(addressFamily), socketTypeId(socketTypeId) {
 }
 
 NETKNOT_API UnixSocket::~UnixSocket() {
-	if (socket >= 0)
-		std::terminate();
+	close();
 }
 
 NETKNOT_API void UnixSocket::dealloc() noexcept {
+	// The events being processed or the dirty list of the owning worker may still refer to the socket,
+	// it is closed now and released when the dirty sockets are updated at the end of the iteration.
+	if (ioService->_isOnWorker(workerId) && (registeredEvents || isDirty || isUpdating)) {
+		close();
+		isDeallocDeferred = true;
+		UnixIOService::_markSocketDirty(&ioService->threadLocalData.at(workerId), this);
+		return;
+	}
+
 	peff::destroyAndRelease<UnixSocket>(selfAllocator.get(), this, alignof(UnixSocket));
 }
 
 NETKNOT_API void UnixSocket::close() {
-	// TODO: Do we actually need to set socket to INVALID_SOCKET to represent if the socket is closed?
 	if (socket >= 0) {
 		::close(socket);
+		socket = -1;
 	}
 }
 
+NETKNOT_API void UnixSocket::shutdown() noexcept {
+	if (socket >= 0)
+		::shutdown(socket, SHUT_RDWR);
+}
+
 NETKNOT_API ExceptionPointer UnixSocket::bind(const TranslatedAddress *address) {
 	const UnixTranslatedAddress *addr = (const UnixTranslatedAddress *)address;
 
@@ -162,60 +181,231 @@ NETKNOT_API ExceptionPointer UnixSocket::write(const char *buffer, size_t size,
 
 NETKNOT_API ExceptionPointer UnixSocket::accept(peff::Alloc *allocator, Socket *&socketOut) {
 	socklen_t addrLen = 0;
-	int newSocket = ::accept(socket, NULL, &addrLen);
+	int newSocket = ::accept4(socket, NULL, &addrLen, SOCK_CLOEXEC);
 
-	if (newSocket < 0) {
-		// TODO: Handle the errors...
-		std::terminate();
-	}
+	if (newSocket < 0)
+		return errnoToExcept(ioService->selfAllocator.get(), errno);
 
 	std::unique_ptr<UnixSocket, peff::DeallocableDeleter<UnixSocket>> p(
-		peff::allocAndConstruct<UnixSocket>(allocator, alignof(UnixSocket), ioService, addressFamily, socketTypeId));
+		peff::allocAndConstruct<UnixSocket>(allocator, alignof(UnixSocket), ioService, allocator, addressFamily, socketTypeId));
 
-	if (!p)
+	if (!p) {
+		::close(newSocket);
 		return OutOfMemoryError::alloc();
+	}
+
+	ioService->_applySocketOptions(newSocket);
 
 	p->socket = newSocket;
+	p->workerId = ioService->_allocWorkerId();
 
 	socketOut = p.release();
 
 	return {};
 }
 
+/// @brief Depth of the completions being invoked inline on the current thread.
+static thread_local size_t g_inlineCompletionDepth = 0;
+
+NETKNOT_API bool UnixSocket::_canCompleteInline(const UnixAsyncTaskQueue &queue) noexcept {
+	// The queues are only stable on the owning worker, and any queued task must be finished first to keep the order.
+	return (socket >= 0) &&
+		   (g_inlineCompletionDepth < MAX_INLINE_COMPLETION_DEPTH) &&
+		   ioService->_isOnWorker(workerId) &&
+		   queue.isEmpty();
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::_completeInline(AsyncTask *task) noexcept {
+	// The reference is handed out to the caller, and it keeps the task alive during the completion.
+	task->incRef(peff::acquireGlobalRcObjectPtrCounter());
+
+	++g_inlineCompletionDepth;
+	ExceptionPointer e = UnixIOService::_invokeCompletion(task);
+	--g_inlineCompletionDepth;
+
+	if (e) {
+		task->decRef(peff::acquireGlobalRcObjectPtrCounter());
+		return e;
+	}
+
+	return {};
+}
+
 NETKNOT_API ExceptionPointer UnixSocket::readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncTask *&asyncTaskOut) {
-	peff::RcObjectPtr<UnixReadAsyncTask> task(
+	return _readAsync(allocator, buffer, callback, ReadAsyncHandler(), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) {
+	return _readAsync(allocator, buffer, nullptr, std::move(handler), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::_readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) {
+	std::unique_ptr<UnixReadAsyncTask, AsyncTaskDeleter> task(
 		peff::allocAndConstruct<UnixReadAsyncTask>(allocator, alignof(UnixReadAsyncTask), allocator, this, buffer));
 
 	if (!task)
 		return OutOfMemoryError::alloc();
 
-	// TODO: Implement it.
-
 	task->callback = callback;
+	task->handler = std::move(handler);
+
+	if (_canCompleteInline(readQueue)) {
+		ssize_t result;
+
+		do {
+			result = ::recv(socket, task->bufferRef.buffer->data + task->bufferRef.offset, task->bufferRef.size, MSG_DONTWAIT);
+		} while ((result < 0) && (errno == EINTR));
+
+		int errorCode = errno;
+
+		// Only a read which would block is left to the poller.
+		if ((result >= 0) || ((errorCode != EAGAIN) && (errorCode != EWOULDBLOCK))) {
+			if (result < 0) {
+				task->exceptPtr = errnoToExcept(ioService->selfAllocator.get(), errorCode);
+				task->status = AsyncTaskStatus::Interrupted;
+			} else {
+				task->szRead = (size_t)result;
+				task->status = AsyncTaskStatus::Done;
+			}
+
+			UnixReadAsyncTask *t = task.release();
+			NETKNOT_RETURN_IF_EXCEPT(_completeInline(t));
+			asyncTaskOut = t;
+			return {};
+		}
+	}
 
-	NETKNOT_RETURN_IF_EXCEPT(ioService->postAsyncTask(task.get()));
+	// The worker may finish and release the task as soon as it is posted, the reference of the caller is taken first.
+	UnixReadAsyncTask *t = task.release();
+	t->incRef(peff::acquireGlobalRcObjectPtrCounter());
+	asyncTaskOut = t;
 
-	task->incRef(peff::acquireGlobalRcObjectPtrCounter());
-	asyncTaskOut = task.get();
+	if (ExceptionPointer e = ioService->postAsyncTask(t); e) {
+		asyncTaskOut = nullptr;
+		t->decRef(peff::acquireGlobalRcObjectPtrCounter());
+		return e;
+	}
 
 	return {};
 }
 
 NETKNOT_API ExceptionPointer UnixSocket::writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) {
+	return _writeAsync(allocator, buffer, callback, WriteAsyncHandler(), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
+	return _writeAsync(allocator, buffer, nullptr, std::move(handler), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
 	std::unique_ptr<UnixWriteAsyncTask, AsyncTaskDeleter> task(
-		peff::allocAndConstruct<UnixWriteAsyncTask>(allocator, alignof(UnixWriteAsyncTask), allocator, this, buffer));
+		peff::allocAndConstruct<UnixWriteAsyncTask>(allocator, alignof(UnixWriteAsyncTask), allocator, this, RcBufferRef()));
 
 	if (!task)
 		return OutOfMemoryError::alloc();
 
-	// TODO: Implement it.
+	if (!isNonBlocking) {
+		// sendfile() takes no flags, the socket itself must never block the worker.
+		int flags = fcntl(socket, F_GETFL, 0);
+
+		if ((flags < 0) || (fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0))
+			return errnoToExcept(ioService->selfAllocator.get(), errno);
+
+		isNonBlocking = true;
+	}
+
+	task->file = file;
+	task->fileOffset = offset;
+	task->szFile = size;
+	task->handler = std::move(handler);
+
+	return _submitWriteTask(std::move(task), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::_writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
+	std::unique_ptr<UnixWriteAsyncTask, AsyncTaskDeleter> task(
+		peff::allocAndConstruct<UnixWriteAsyncTask>(allocator, alignof(UnixWriteAsyncTask), allocator, this, buffer));
+
+	if (!task)
+		return OutOfMemoryError::alloc();
 
 	task->callback = callback;
+	task->handler = std::move(handler);
 
-	NETKNOT_RETURN_IF_EXCEPT(ioService->postAsyncTask(task.get()));
+	return _submitWriteTask(std::move(task), asyncTaskOut);
+}
 
-	task->incRef(peff::acquireGlobalRcObjectPtrCounter());
-	asyncTaskOut = task.release();
+NETKNOT_API ssize_t UnixSocket::_writeSome(UnixWriteAsyncTask *task) noexcept {
+	if (task->file >= 0) {
+		off_t offset = (off_t)(task->fileOffset + task->szWritten);
+
+		ssize_t result = ::sendfile(socket, task->file, &offset, task->szFile - task->szWritten);
+
+		// The file is shorter than expected, e.g. truncated after being opened.
+		if (!result) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		return result;
+	}
+
+	return ::send(socket,
+		task->bufferRef.buffer->data + task->bufferRef.offset + task->szWritten,
+		task->bufferRef.size - task->szWritten,
+		MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+NETKNOT_API ExceptionPointer UnixSocket::_submitWriteTask(std::unique_ptr<UnixWriteAsyncTask, AsyncTaskDeleter> &&task, WriteAsyncTask *&asyncTaskOut) {
+	const size_t size = task->getWriteSize();
+
+	// Accounted before posting, the worker may finish the write at any time after.
+	onWriteQueued(size);
+
+	// Corked sockets leave the writes to the poller to coalesce them.
+	if ((!isAutoCorkEnabled) && _canCompleteInline(writeQueue)) {
+		while (task->szWritten < size) {
+			ssize_t result = _writeSome(task.get());
+
+			if (result < 0) {
+				int errorCode = errno;
+
+				if (errorCode == EINTR)
+					continue;
+				if ((errorCode == EAGAIN) || (errorCode == EWOULDBLOCK))
+					break;
+
+				task->exceptPtr = errnoToExcept(ioService->selfAllocator.get(), errorCode);
+				task->status = AsyncTaskStatus::Interrupted;
+				break;
+			}
+
+			task->szWritten += (size_t)result;
+		}
+
+		// A partially written buffer is queued with the rest.
+		if ((task->status == AsyncTaskStatus::Interrupted) || (task->szWritten == size)) {
+			if (task->status != AsyncTaskStatus::Interrupted)
+				task->status = AsyncTaskStatus::Done;
+
+			UnixWriteAsyncTask *t = task.release();
+			NETKNOT_RETURN_IF_EXCEPT(_completeInline(t));
+			asyncTaskOut = t;
+			return {};
+		}
+	}
+
+	// The worker may finish and release the task as soon as it is posted, the reference of the caller is taken first.
+	UnixWriteAsyncTask *t = task.release();
+	t->incRef(peff::acquireGlobalRcObjectPtrCounter());
+	asyncTaskOut = t;
+
+	if (ExceptionPointer e = ioService->postAsyncTask(t); e) {
+		asyncTaskOut = nullptr;
+		onWriteCancelled(size);
+		t->decRef(peff::acquireGlobalRcObjectPtrCounter());
+		return e;
+	}
 
 	return {};
 }
@@ -227,34 +417,58 @@ NETKNOT_API ExceptionPointer UnixSocket::acceptAsync(peff::Alloc *allocator, Acc
 	if (!task)
 		return OutOfMemoryError::alloc();
 
-	std::unique_ptr<UnixSocket, peff::DeallocableDeleter<UnixSocket>> newSocket;
-	{
-		Socket *s;
+	if (!isNonBlocking) {
+		// Accepting is driven by readiness notifications, the listening socket must never block the worker.
+		int flags = fcntl(socket, F_GETFL, 0);
 
-		NETKNOT_RETURN_IF_EXCEPT(ioService->createSocket(allocator, addressFamily, socketTypeId, s));
+		if ((flags < 0) || (fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0))
+			return errnoToExcept(ioService->selfAllocator.get(), errno);
 
-		newSocket = std::unique_ptr<UnixSocket, peff::DeallocableDeleter<UnixSocket>>((UnixSocket *)s);
+		isNonBlocking = true;
 	}
 
-	size_t compiledAddrSize;
-
-	{
-		Address addr(addressFamily);
+	// The file descriptor is assigned by the worker once a connection is accepted.
+	std::unique_ptr<UnixSocket, peff::DeallocableDeleter<UnixSocket>> newSocket(
+		peff::allocAndConstruct<UnixSocket>(allocator, alignof(UnixSocket), ioService, allocator, addressFamily, socketTypeId));
 
-		ioService->translateAddress(nullptr, &addr, nullptr, &compiledAddrSize).unwrap();
-	}
+	if (!newSocket)
+		return OutOfMemoryError::alloc();
 
-	// TODO: Implement it.
+	newSocket->workerId = ioService->_allocWorkerId();
 
 	task->socket = newSocket.get();
 	task->callback = callback;
 
-	NETKNOT_RETURN_IF_EXCEPT(ioService->postAsyncTask(task.get()));
+	// The worker may finish and release the task as soon as it is posted, the reference of the caller is taken first.
+	UnixAcceptAsyncTask *t = task.release();
+	t->incRef(peff::acquireGlobalRcObjectPtrCounter());
+	asyncTaskOut = t;
 
-	newSocket.release();
+	if (ExceptionPointer e = ioService->postAsyncTask(t); e) {
+		asyncTaskOut = nullptr;
+		t->decRef(peff::acquireGlobalRcObjectPtrCounter());
+		return e;
+	}
 
-	task->incRef(peff::acquireGlobalRcObjectPtrCounter());
-	asyncTaskOut = task.release();
+	// The new socket is owned by the task from now on.
+	newSocket.release();
 
 	return {};
 }
+
+NETKNOT_API void UnixSocket::setAutoCork(bool enabled) noexcept {
+	isAutoCorkEnabled = enabled;
+}
+
+NETKNOT_API bool UnixSocket::setWorkerId(size_t workerId) noexcept {
+	if (workerId >= ioService->threadLocalData.size())
+		return false;
+
+	// The socket is still in the epoll instance of its current worker.
+	if (registeredEvents)
+		return false;
+
+	this->workerId = workerId;
+
+	return true;
+}
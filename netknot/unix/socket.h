@@ -1,25 +1,79 @@
-#ifndef _NETKNOT_WIN_SOCKET_H_
-#define _NETKNOT_WIN_SOCKET_H_
+#ifndef _NETKNOT_UNIX_SOCKET_H_
+#define _NETKNOT_UNIX_SOCKET_H_
 
 #include "../socket.h"
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <peff/advutils/unique_ptr.h>
 #include <peff/base/deallocable.h>
 #include <unistd.h>
+#include <memory>
 
 namespace netknot {
 	class UnixSocket;
 	class UnixIOService;
 
+	/// @brief Intrusive queue node embedded in every Unix asynchronous task.
+	struct UnixAsyncTaskNode {
+		UnixAsyncTaskNode *next = nullptr;
+		AsyncTask *task;
+		/// @brief Socket that the task operates on.
+		UnixSocket *socket;
+
+		NETKNOT_FORCEINLINE UnixAsyncTaskNode(AsyncTask *task, UnixSocket *socket) noexcept : task(task), socket(socket) {}
+	};
+
+	struct UnixAsyncTaskQueue {
+		UnixAsyncTaskNode *head = nullptr, *tail = nullptr;
+
+		NETKNOT_FORCEINLINE bool isEmpty() const noexcept {
+			return !head;
+		}
+
+		NETKNOT_FORCEINLINE void pushBack(UnixAsyncTaskNode *node) noexcept {
+			node->next = nullptr;
+			if (tail)
+				tail->next = node;
+			else
+				head = node;
+			tail = node;
+		}
+
+		NETKNOT_FORCEINLINE void append(UnixAsyncTaskQueue &other) noexcept {
+			if (other.isEmpty())
+				return;
+			if (tail)
+				tail->next = other.head;
+			else
+				head = other.head;
+			tail = other.tail;
+			other.head = nullptr;
+			other.tail = nullptr;
+		}
+
+		NETKNOT_FORCEINLINE UnixAsyncTaskNode *popFront() noexcept {
+			UnixAsyncTaskNode *node = head;
+			if (node) {
+				if (!(head = node->next))
+					tail = nullptr;
+				node->next = nullptr;
+			}
+			return node;
+		}
+	};
+
 	class UnixReadAsyncTask : public ReadAsyncTask {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		AsyncTaskStatus status = AsyncTaskStatus::Ready;
+		UnixAsyncTaskNode node;
 		UnixSocket *socket;
 		RcBufferRef bufferRef;
 		size_t szRead = 0;
 		ExceptionPointer exceptPtr;
 		peff::RcObjectPtr<ReadAsyncCallback> callback;
+		/// @brief Handler invoked instead of the callback if set.
+		ReadAsyncHandler handler;
 
 		NETKNOT_API UnixReadAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef);
 		NETKNOT_API virtual ~UnixReadAsyncTask();
@@ -40,11 +94,23 @@ namespace netknot {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		AsyncTaskStatus status = AsyncTaskStatus::Ready;
+		UnixAsyncTaskNode node;
 		UnixSocket *socket;
 		RcBufferRef bufferRef;
 		size_t szWritten = 0;
+		/// @brief File to be sent instead of the buffer, -1 if the task writes the buffer.
+		int file = -1;
+		uint64_t fileOffset = 0;
+		size_t szFile = 0;
 		ExceptionPointer exceptPtr;
 		peff::RcObjectPtr<WriteAsyncCallback> callback;
+		/// @brief Handler invoked instead of the callback if set.
+		WriteAsyncHandler handler;
+
+		/// @brief Get the total size to be written by the task.
+		NETKNOT_FORCEINLINE size_t getWriteSize() const noexcept {
+			return (file >= 0) ? szFile : bufferRef.size;
+		}
 
 		NETKNOT_API UnixWriteAsyncTask(peff::Alloc *allocator, UnixSocket *socket, const RcBufferRef &bufferRef);
 		NETKNOT_API virtual ~UnixWriteAsyncTask();
@@ -62,6 +128,8 @@ namespace netknot {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		AsyncTaskStatus status = AsyncTaskStatus::Ready;
+		UnixAsyncTaskNode node;
+		/// @brief Socket of the connection to be accepted, which is released with the task unless it has been handed out.
 		UnixSocket *socket;
 		peff::UUID addressFamily;
 		ExceptionPointer exceptPtr;
@@ -76,6 +144,18 @@ namespace netknot {
 		NETKNOT_API virtual ExceptionPointer &getException() override;
 	};
 
+	NETKNOT_FORCEINLINE UnixAsyncTaskNode *getUnixAsyncTaskNode(AsyncTask *task) noexcept {
+		switch (task->getTaskType()) {
+			case AsyncTaskType::Read:
+				return &((UnixReadAsyncTask *)task)->node;
+			case AsyncTaskType::Write:
+				return &((UnixWriteAsyncTask *)task)->node;
+			case AsyncTaskType::Accept:
+				return &((UnixAcceptAsyncTask *)task)->node;
+		}
+		std::terminate();
+	}
+
 	class UnixSocket : public Socket {
 	public:
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
@@ -85,12 +165,28 @@ namespace netknot {
 		peff::UUID addressFamily;
 		size_t backlog = 0;
 
-		NETKNOT_API UnixSocket(UnixIOService *ioService, const peff::UUID &addressFamily, const peff::UUID &socketTypeId);
+		/// @brief Index of the worker which owns the socket, all of the queues below are only touched by the worker.
+		size_t workerId = 0;
+		UnixAsyncTaskQueue readQueue, writeQueue, acceptQueue;
+		/// @brief Events currently registered in the epoll instance of the owning worker, 0 if not registered.
+		uint32_t registeredEvents = 0;
+		bool isNonBlocking = false;
+		bool isAutoCorkEnabled = false;
+		/// @brief Next socket in the dirty list of the owning worker.
+		UnixSocket *nextDirty = nullptr;
+		bool isDirty = false;
+		/// @brief Whether the dirty sockets update is processing the queues of the socket, whose handlers must not release it at once.
+		bool isUpdating = false;
+		/// @brief Whether the socket has been released while its worker may still refer to it, see dealloc().
+		bool isDeallocDeferred = false;
+
+		NETKNOT_API UnixSocket(UnixIOService *ioService, peff::Alloc *selfAllocator, const peff::UUID &addressFamily, const peff::UUID &socketTypeId);
 		NETKNOT_API virtual ~UnixSocket();
 
 		NETKNOT_API virtual void dealloc() noexcept override;
 
 		NETKNOT_API virtual void close() override;
+		NETKNOT_API virtual void shutdown() noexcept override;
 
 		NETKNOT_API virtual ExceptionPointer bind(const TranslatedAddress *address) override;
 		NETKNOT_API virtual ExceptionPointer listen(size_t backlog) override;
@@ -103,6 +199,33 @@ namespace netknot {
 		NETKNOT_API virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncTask *&asyncTaskOut) override;
 		NETKNOT_API virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) override;
 		NETKNOT_API virtual ExceptionPointer acceptAsync(peff::Alloc *allocator, AcceptAsyncCallback *callback, AcceptAsyncTask *&asyncTaskOut) override;
+
+		NETKNOT_API virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) override;
+		NETKNOT_API virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) override;
+
+		NETKNOT_API virtual ExceptionPointer sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) override;
+
+		using Socket::readAsync;
+		using Socket::writeAsync;
+		using Socket::sendFileAsync;
+
+		/// @brief Maximum nesting of the completions invoked inline, deeper operations are left to the poller.
+		constexpr static size_t MAX_INLINE_COMPLETION_DEPTH = 16;
+
+		NETKNOT_API bool _canCompleteInline(const UnixAsyncTaskQueue &queue) noexcept;
+		NETKNOT_API static ExceptionPointer _completeInline(AsyncTask *task) noexcept;
+
+		NETKNOT_API ExceptionPointer _readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut);
+		NETKNOT_API ExceptionPointer _writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut);
+		NETKNOT_API ExceptionPointer _submitWriteTask(std::unique_ptr<UnixWriteAsyncTask, AsyncTaskDeleter> &&task, WriteAsyncTask *&asyncTaskOut);
+		/// @brief Write the rest of a task once without blocking.
+		///
+		/// @return Size written, or -1 with errno set.
+		NETKNOT_API ssize_t _writeSome(UnixWriteAsyncTask *task) noexcept;
+
+		NETKNOT_API virtual void setAutoCork(bool enabled) noexcept override;
+
+		NETKNOT_API virtual bool setWorkerId(size_t workerId) noexcept override;
 	};
 }
 
@@ -15,15 +15,60 @@ NETKNOT_API void Win32TranslatedAddress::dealloc() noexcept {
 	peff::destroyAndRelease<Win32TranslatedAddress>(selfAllocator.get(), this, alignof(Win32TranslatedAddress));
 }
 
+static uint64_t getMonotonicTime() noexcept {
+	static LARGE_INTEGER frequency = []() {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f;
+	}();
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
+
+NETKNOT_API BOOL Win32IOService::_waitForCompletion(ThreadLocalData *tld, DWORD *szTransferredOut, ULONG_PTR *keyOut, LPOVERLAPPED *overlappedOut) noexcept {
+	BusyPollController &busyPoll = tld->busyPoll;
+	HANDLE port = tld->ioService->iocpCompletionPort;
+
+	if (!busyPoll.maxBudget)
+		return GetQueuedCompletionStatus(port, szTransferredOut, keyOut, overlappedOut, INFINITE);
+
+	BOOL result = GetQueuedCompletionStatus(port, szTransferredOut, keyOut, overlappedOut, 0);
+
+	if ((!result) && (!*overlappedOut) && (GetLastError() == WAIT_TIMEOUT) && busyPoll.budget) {
+		uint64_t deadline = getMonotonicTime() + busyPoll.budget;
+
+		do {
+			YieldProcessor();
+			result = GetQueuedCompletionStatus(port, szTransferredOut, keyOut, overlappedOut, 0);
+		} while ((!result) && (!*overlappedOut) && (GetLastError() == WAIT_TIMEOUT) && (getMonotonicTime() < deadline));
+	}
+
+	if ((!result) && (!*overlappedOut) && (GetLastError() == WAIT_TIMEOUT))
+		result = GetQueuedCompletionStatus(port, szTransferredOut, keyOut, overlappedOut, INFINITE);
+
+	if (result)
+		busyPoll.onArrival(getMonotonicTime());
+
+	return result;
+}
+
+static thread_local Win32IOService::ThreadLocalData *g_currentWorker = nullptr;
+
 NETKNOT_API DWORD WINAPI Win32IOService::_workerThreadProc(LPVOID lpThreadParameter) {
 	ThreadLocalData *tld = (ThreadLocalData *)lpThreadParameter;
 
+	g_currentWorker = tld;
+	peff::ScopeGuard resetCurrentWorkerGuard([]() noexcept {
+		g_currentWorker = nullptr;
+	});
+
 	while (true) {
 		DWORD szTransferred;
 		ULONG_PTR key;
 		LPOVERLAPPED ov;
 
-		if (!GetQueuedCompletionStatus(tld->ioService->iocpCompletionPort, &szTransferred, &key, &ov, INFINITE)) {
+		if (!_waitForCompletion(tld, &szTransferred, &key, &ov)) {
 			DWORD e = WSAGetLastError();
 			tld->exceptionStorage = wsaLastErrorToExcept(tld->ioService->selfAllocator.get(), e);
 			return e;
@@ -32,15 +77,26 @@ NETKNOT_API DWORD WINAPI Win32IOService::_workerThreadProc(LPVOID lpThreadParame
 		if (!key)
 			break;
 
+		if (key == WIN32_POSTED_WORK_COMPLETION_KEY) {
+			PostedWork *work = (PostedWork *)ov;
+			work->next = nullptr;
+
+			if ((tld->exceptionStorage = tld->ioService->postedWorkPool.runChain(work))) {
+				WakeAllConditionVariable(&tld->ioService->terminateNotifyConditionVar);
+				return -1;
+			}
+			continue;
+		}
+
 		Win32IOCPOverlapped *iocpOverlapped = (Win32IOCPOverlapped *)ov;
 
 		peff::RcObjectPtr<AsyncTask> rawTask = iocpOverlapped->asyncTask;
-		tld->ioService->currentTasksMutex.lock();
+		tld->ioService->_lockCurrentTasks();
 		if (tld->ioService->currentTasks.contains(iocpOverlapped->asyncTask)) {
 			tld->ioService->currentTasks.remove(iocpOverlapped->asyncTask);
 			rawTask->decRef(0);
 
-			tld->ioService->currentTasksMutex.unlock();
+			tld->ioService->_unlockCurrentTasks();
 
 			switch (iocpOverlapped->asyncTask->getTaskType()) {
 				case AsyncTaskType::Read: {
@@ -51,7 +107,9 @@ NETKNOT_API DWORD WINAPI Win32IOService::_workerThreadProc(LPVOID lpThreadParame
 					task->szRead += szTransferred;
 					task->status = AsyncTaskStatus::Done;
 
-					if ((tld->exceptionStorage = task->callback->onStatusChanged(task.get()))) {
+					if ((tld->exceptionStorage = task->handler
+													 ? task->handler(task->status, task->szRead, task->bufferRef, task->exceptPtr)
+													 : task->callback->onStatusChanged(task.get()))) {
 						WakeAllConditionVariable(&tld->ioService->terminateNotifyConditionVar);
 						return -1;
 					}
@@ -66,7 +124,20 @@ NETKNOT_API DWORD WINAPI Win32IOService::_workerThreadProc(LPVOID lpThreadParame
 					task->szWritten += szTransferred;
 					task->status = AsyncTaskStatus::Done;
 
-					if ((tld->exceptionStorage = task->callback->onStatusChanged(task.get()))) {
+					// The write is accounted while the socket is known to be alive, the handler may release the socket,
+					// and a failing handler must not leave the pending size behind.
+					ExceptionPointer writableExcept = task->socket->onWriteFinished(task->getWriteSize());
+
+					if ((tld->exceptionStorage = task->handler
+													 ? task->handler(task->status, task->szWritten, task->bufferRef, task->exceptPtr)
+													 : task->callback->onStatusChanged(task.get()))) {
+						if (writableExcept)
+							writableExcept.reset();
+						WakeAllConditionVariable(&tld->ioService->terminateNotifyConditionVar);
+						return -1;
+					}
+
+					if ((tld->exceptionStorage = std::move(writableExcept))) {
 						WakeAllConditionVariable(&tld->ioService->terminateNotifyConditionVar);
 						return -1;
 					}
@@ -88,7 +159,7 @@ NETKNOT_API DWORD WINAPI Win32IOService::_workerThreadProc(LPVOID lpThreadParame
 				}
 			}
 		} else
-			tld->ioService->currentTasksMutex.unlock();
+			tld->ioService->_unlockCurrentTasks();
 	}
 
 	return 0;
@@ -103,6 +174,7 @@ NETKNOT_API Win32IOService::ThreadLocalData::~ThreadLocalData() {
 
 NETKNOT_API Win32IOService::Win32IOService(peff::Alloc *selfAllocator)
 	: selfAllocator(selfAllocator),
+	  postedWorkPool(selfAllocator),
 	  threadLocalData(selfAllocator),
 	  currentTasks(selfAllocator) {
 	InitializeConditionVariable(&terminateNotifyConditionVar);
@@ -110,6 +182,21 @@ NETKNOT_API Win32IOService::Win32IOService(peff::Alloc *selfAllocator)
 }
 
 NETKNOT_API Win32IOService::~Win32IOService() {
+	if (iocpCompletionPort != INVALID_HANDLE_VALUE) {
+		// Discard the work which have never been run.
+		DWORD szTransferred;
+		ULONG_PTR key;
+		LPOVERLAPPED ov;
+
+		while (GetQueuedCompletionStatus(iocpCompletionPort, &szTransferred, &key, &ov, 0) || ov) {
+			if (key == WIN32_POSTED_WORK_COMPLETION_KEY) {
+				PostedWork *work = (PostedWork *)ov;
+				work->next = nullptr;
+				postedWorkPool.discardChain(work);
+			}
+		}
+	}
+
 	WSACleanup();
 }
 
@@ -137,6 +224,17 @@ NETKNOT_API ExceptionPointer Win32IOService::run() {
 
 	_isRunning = true;
 
+	if (isThreadConfined) {
+		ThreadLocalData &tld = threadLocalData.at(0);
+
+		// Drive the loop on the calling thread.
+		_workerThreadProc(&tld);
+
+		_isRunning = false;
+
+		return std::move(tld.exceptionStorage);
+	}
+
 	for (auto &i : threadLocalData) {
 		ResumeThread(i.hThread);
 	}
@@ -162,6 +260,12 @@ NETKNOT_API ExceptionPointer Win32IOService::stop() {
 	if (!_isRunning)
 		std::terminate();
 
+	if (isThreadConfined) {
+		// Stop the loop once it gets back to the completion port.
+		PostQueuedCompletionStatus(iocpCompletionPort, 0, 0, nullptr);
+		return {};
+	}
+
 	_isRunning = false;
 
 	WakeAllConditionVariable(&terminateNotifyConditionVar);
@@ -170,7 +274,10 @@ NETKNOT_API ExceptionPointer Win32IOService::stop() {
 }
 
 NETKNOT_API ExceptionPointer Win32IOService::postAsyncTask(AsyncTask *task) noexcept {
-	std::lock_guard currentTasksGuard(currentTasksMutex);
+	_lockCurrentTasks();
+	peff::ScopeGuard unlockCurrentTasksGuard([this]() noexcept {
+		_unlockCurrentTasks();
+	});
 
 	if (!currentTasks.insert(task))
 		return OutOfMemoryError::alloc();
@@ -178,6 +285,103 @@ NETKNOT_API ExceptionPointer Win32IOService::postAsyncTask(AsyncTask *task) noex
 	return {};
 }
 
+// Overlapped operations are issued to the completion port directly and the completions must find their tasks
+// in the current task set, so the batches are only tracked for nesting and every task is submitted eagerly.
+static thread_local size_t g_submissionBatchDepth = 0;
+
+NETKNOT_API void Win32IOService::beginBatch() noexcept {
+	++g_submissionBatchDepth;
+}
+
+NETKNOT_API ExceptionPointer Win32IOService::flush() noexcept {
+	if (!g_submissionBatchDepth)
+		std::terminate();
+
+	--g_submissionBatchDepth;
+
+	return {};
+}
+
+NETKNOT_API PostedWork *Win32IOService::allocPostedWork() noexcept {
+	return postedWorkPool.alloc();
+}
+
+NETKNOT_API ExceptionPointer Win32IOService::postWork(size_t workerId, PostedWork *work) noexcept {
+	if (workerId >= threadLocalData.size())
+		std::terminate();
+
+	// The workers share the completion port and none of the sockets is bound to a worker.
+	return postWork(work);
+}
+
+NETKNOT_API ExceptionPointer Win32IOService::postWork(PostedWork *work) noexcept {
+	if (!PostQueuedCompletionStatus(iocpCompletionPort, 0, WIN32_POSTED_WORK_COMPLETION_KEY, (LPOVERLAPPED)work)) {
+		DWORD errorCode = GetLastError();
+
+		releasePostedWork(work);
+
+		return lastErrorToExcept(selfAllocator.get(), errorCode);
+	}
+
+	return {};
+}
+
+NETKNOT_API void Win32IOService::releasePostedWork(PostedWork *work) noexcept {
+	work->next = nullptr;
+	postedWorkPool.discardChain(work);
+}
+
+NETKNOT_API ComputePool *Win32IOService::getComputePool() noexcept {
+	return computePool.get();
+}
+
+NETKNOT_API size_t Win32IOService::getWorkerCount() noexcept {
+	return threadLocalData.size();
+}
+
+NETKNOT_API bool Win32IOService::getCurrentWorkerId(size_t &workerIdOut) noexcept {
+	if ((!g_currentWorker) || (g_currentWorker->ioService != this))
+		return false;
+
+	workerIdOut = g_currentWorker->threadId;
+	return true;
+}
+
+NETKNOT_API size_t Win32IOService::getWorkerNumaNode(size_t workerId) noexcept {
+	return threadLocalData.at(workerId).numaNode;
+}
+
+/// @brief Get processor masks of the physical cores or the NUMA nodes in processor group 0.
+static ExceptionPointer enumerateProcessorMasks(peff::Alloc *allocator, LOGICAL_PROCESSOR_RELATIONSHIP relationship, peff::DynArray<ULONG_PTR> &masksOut) noexcept {
+	DWORD szBuffer = 0;
+
+	GetLogicalProcessorInformation(nullptr, &szBuffer);
+	if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+		return lastErrorToExcept(allocator, GetLastError());
+
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)allocator->alloc(szBuffer, alignof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info)
+		return OutOfMemoryError::alloc();
+
+	peff::ScopeGuard releaseInfoGuard([allocator, info, szBuffer]() noexcept {
+		allocator->release(info, szBuffer, alignof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	});
+
+	if (!GetLogicalProcessorInformation(info, &szBuffer))
+		return lastErrorToExcept(allocator, GetLastError());
+
+	for (size_t i = 0; i < szBuffer / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); ++i) {
+		if (info[i].Relationship != relationship)
+			continue;
+
+		ULONG_PTR mask = info[i].ProcessorMask;
+		if (!masksOut.pushBack(std::move(mask)))
+			return OutOfMemoryError::alloc();
+	}
+
+	return {};
+}
+
 NETKNOT_API ExceptionPointer Win32IOService::createSocket(peff::Alloc *allocator, const peff::UUID &addressFamily, const peff::UUID &socketType, Socket *&socketOut) noexcept {
 	std::unique_ptr<Win32Socket, peff::DeallocableDeleter<Win32Socket>> p(
 		peff::allocAndConstruct<Win32Socket>(allocator, alignof(Win32Socket), this, allocator, addressFamily, socketType));
@@ -356,12 +560,23 @@ NETKNOT_API ExceptionPointer netknot::createIOCPIOService(IOService *&ioServiceO
 	if (!ioService)
 		return OutOfMemoryError::alloc();
 
-	if (!ioService->threadLocalData.resizeUninitialized(params.nWorkerThreads)) {
+#if NETKNOT_SINGLE_THREADED
+	// The reference counts are not atomic, nothing but the thread calling run() may touch the objects.
+	if (params.nWorkerThreads || params.nComputeThreads)
+		return InvalidArgsError::alloc();
+#endif
+
+	// Without worker threads, a single loop is driven by the caller of run().
+	ioService->isThreadConfined = !params.nWorkerThreads;
+	size_t nLoops = ioService->isThreadConfined ? 1 : params.nWorkerThreads;
+
+	if (!ioService->threadLocalData.resizeUninitialized(nLoops)) {
 		return OutOfMemoryError::alloc();
 	}
 
-	for (size_t i = 0; i < params.nWorkerThreads; ++i) {
+	for (size_t i = 0; i < nLoops; ++i) {
 		peff::constructAt(&ioService->threadLocalData.at(i), ioService.get(), i, params.allocator.get());
+		ioService->threadLocalData.at(i).busyPoll.init(params.busyPollBudget, params.adaptiveBusyPoll);
 	}
 
 	size_t idxWorkerThread = 0;
@@ -372,6 +587,27 @@ NETKNOT_API ExceptionPointer netknot::createIOCPIOService(IOService *&ioServiceO
 			ResumeThread(tld.hThread);
 		}
 	});
+	// Only processor group 0 is supported, which covers up to 64 logical processors.
+	peff::DynArray<ULONG_PTR> processorMasks(params.allocator.get());
+
+	switch (params.workerPlacementPolicy) {
+		case WorkerPlacementPolicy::Default:
+			break;
+		case WorkerPlacementPolicy::Explicit:
+			for (size_t i = 0; i < params.workerCpuSets.size(); ++i) {
+				ULONG_PTR mask = (ULONG_PTR)params.workerCpuSets.at(i).bits[0];
+				if (!processorMasks.pushBack(std::move(mask)))
+					return OutOfMemoryError::alloc();
+			}
+			break;
+		case WorkerPlacementPolicy::PerPhysicalCore:
+			NETKNOT_RETURN_IF_EXCEPT(enumerateProcessorMasks(params.allocator.get(), RelationProcessorCore, processorMasks));
+			break;
+		case WorkerPlacementPolicy::PerNumaNode:
+			NETKNOT_RETURN_IF_EXCEPT(enumerateProcessorMasks(params.allocator.get(), RelationNumaNode, processorMasks));
+			break;
+	}
+
 	while (idxWorkerThread < params.nWorkerThreads) {
 		Win32IOService::ThreadLocalData &tld = ioService->threadLocalData.at(idxWorkerThread);
 
@@ -382,6 +618,26 @@ NETKNOT_API ExceptionPointer netknot::createIOCPIOService(IOService *&ioServiceO
 
 		tld.hThread = hThread;
 
+		ULONG_PTR mask = 0;
+		if (params.workerPlacementPolicy == WorkerPlacementPolicy::Explicit) {
+			if (idxWorkerThread < processorMasks.size())
+				mask = processorMasks.at(idxWorkerThread);
+		} else if (processorMasks.size()) {
+			mask = processorMasks.at(idxWorkerThread % processorMasks.size());
+		}
+
+		if (mask) {
+			if (!SetThreadAffinityMask(hThread, mask))
+				return lastErrorToExcept(params.allocator.get(), GetLastError());
+
+			DWORD lowestProcessor;
+			BitScanForward64(&lowestProcessor, (DWORD64)mask);
+
+			UCHAR node;
+			if (GetNumaProcessorNode((UCHAR)lowestProcessor, &node))
+				tld.numaNode = node;
+		}
+
 		++idxWorkerThread;
 	}
 
@@ -389,6 +645,14 @@ NETKNOT_API ExceptionPointer netknot::createIOCPIOService(IOService *&ioServiceO
 		std::terminate();
 	}
 
+	if (params.nComputeThreads) {
+		if (!(ioService->computePool = std::unique_ptr<ComputePool, peff::DeallocableDeleter<ComputePool>>(
+				  ComputePool::alloc(params.allocator.get(), &ioService->postedWorkPool))))
+			return OutOfMemoryError::alloc();
+
+		NETKNOT_RETURN_IF_EXCEPT(ioService->computePool->start(params.nComputeThreads));
+	}
+
 	releaseThreadsGuard.release();
 
 	ioServiceOut = ioService.release();
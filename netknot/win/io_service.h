@@ -22,6 +22,9 @@ namespace netknot {
 		NETKNOT_API virtual void dealloc() noexcept override;
 	};
 
+	/// @brief Completion key of the packets carrying posted work, the sockets use the address of the service as the key.
+	constexpr static ULONG_PTR WIN32_POSTED_WORK_COMPLETION_KEY = 1;
+
 	struct Win32IOCPOverlapped : public OVERLAPPED {
 		WSABUF buf;
 		size_t addrSize;
@@ -38,12 +41,16 @@ namespace netknot {
 	public:
 		NETKNOT_API static DWORD WINAPI _workerThreadProc(LPVOID lpThreadParameter);
 
-		struct ThreadLocalData {
+		// Aligned to keep the workers from sharing cache lines.
+		struct alignas(64) ThreadLocalData {
 			Win32IOService *ioService;
 			HANDLE hThread = INVALID_HANDLE_VALUE;
 			size_t threadId;
 			bool terminate = false;
 			ExceptionPointer exceptionStorage;
+			BusyPollController busyPoll;
+			/// @brief NUMA node of the CPUs that the worker is pinned to, SIZE_MAX if unknown.
+			size_t numaNode = SIZE_MAX;
 
 			NETKNOT_FORCEINLINE ThreadLocalData(ThreadLocalData &&) = default;
 			NETKNOT_FORCEINLINE ThreadLocalData(Win32IOService *ioService, size_t threadId, peff::Alloc *allocator) : ioService(ioService), threadId(threadId) {
@@ -51,17 +58,37 @@ namespace netknot {
 			NETKNOT_API ~ThreadLocalData();
 		};
 
+		NETKNOT_API static BOOL _waitForCompletion(ThreadLocalData *tld, DWORD *szTransferredOut, ULONG_PTR *keyOut, LPOVERLAPPED *overlappedOut) noexcept;
+
 		CRITICAL_SECTION terminateNotifyCriticalSection;
 		CONDITION_VARIABLE terminateNotifyConditionVar;
 
+		/// @brief Whether the service has no worker thread and its loop is driven by the caller of run().
+		/// Every operation must be done on that thread, so the bookkeeping is not locked.
+		bool isThreadConfined = false;
+
+		NETKNOT_FORCEINLINE void _lockCurrentTasks() noexcept {
+			if (!isThreadConfined)
+				currentTasksMutex.lock();
+		}
+
+		NETKNOT_FORCEINLINE void _unlockCurrentTasks() noexcept {
+			if (!isThreadConfined)
+				currentTasksMutex.unlock();
+		}
+
 		std::mutex currentTasksMutex;
 		peff::Set<peff::RcObjectPtr<AsyncTask>> currentTasks;
 
 		peff::RcObjectPtr<peff::Alloc> selfAllocator;
 		HANDLE iocpCompletionPort = INVALID_HANDLE_VALUE;
 
+		PostedWorkPool postedWorkPool;
+
 		peff::DynArray<ThreadLocalData> threadLocalData;
 
+		std::unique_ptr<ComputePool, peff::DeallocableDeleter<ComputePool>> computePool;
+
 		NETKNOT_API Win32IOService(peff::Alloc *selfAllocator);
 		NETKNOT_API ~Win32IOService();
 
@@ -74,6 +101,20 @@ namespace netknot {
 
 		NETKNOT_API virtual ExceptionPointer postAsyncTask(AsyncTask *task) noexcept override;
 
+		NETKNOT_API virtual void beginBatch() noexcept override;
+		NETKNOT_API virtual ExceptionPointer flush() noexcept override;
+
+		NETKNOT_API virtual size_t getWorkerCount() noexcept override;
+		NETKNOT_API virtual bool getCurrentWorkerId(size_t &workerIdOut) noexcept override;
+		NETKNOT_API virtual size_t getWorkerNumaNode(size_t workerId) noexcept override;
+
+		NETKNOT_API virtual PostedWork *allocPostedWork() noexcept override;
+		NETKNOT_API virtual ExceptionPointer postWork(size_t workerId, PostedWork *work) noexcept override;
+		NETKNOT_API virtual ExceptionPointer postWork(PostedWork *work) noexcept override;
+		NETKNOT_API virtual void releasePostedWork(PostedWork *work) noexcept override;
+
+		NETKNOT_API virtual ComputePool *getComputePool() noexcept override;
+
 		NETKNOT_API virtual ExceptionPointer createSocket(peff::Alloc *allocator, const peff::UUID &addressFamily, const peff::UUID &socketType, Socket *&socketOut) noexcept override;
 
 		NETKNOT_API virtual ExceptionPointer translateAddress(peff::Alloc *allocator, const Address *address, TranslatedAddress **compiledAddressOut, size_t *compiledAddressSizeOut = nullptr) noexcept override;
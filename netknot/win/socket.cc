@@ -61,7 +61,7 @@ NETKNOT_API size_t Win32WriteAsyncTask::getCurrentWrittenSize() {
 }
 
 NETKNOT_API size_t Win32WriteAsyncTask::getExpectedWrittenSize() {
-	return bufferRef.size;
+	return getWriteSize();
 }
 
 NETKNOT_API Win32AcceptAsyncTask::Win32AcceptAsyncTask(peff::Alloc *allocator, Win32Socket *socket, const peff::UUID &addressFamily) : selfAllocator(allocator), socket(socket), addressFamily(addressFamily) {
@@ -101,6 +101,11 @@ NETKNOT_API void Win32Socket::close() {
 	}
 }
 
+NETKNOT_API void Win32Socket::shutdown() noexcept {
+	if (socket != INVALID_SOCKET)
+		::shutdown(socket, SD_BOTH);
+}
+
 NETKNOT_API ExceptionPointer Win32Socket::bind(const TranslatedAddress *address) {
 	const Win32TranslatedAddress *addr = (const Win32TranslatedAddress *)address;
 
@@ -174,6 +179,14 @@ NETKNOT_API ExceptionPointer Win32Socket::accept(peff::Alloc *allocator, Socket
 }
 
 NETKNOT_API ExceptionPointer Win32Socket::readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncTask *&asyncTaskOut) {
+	return _readAsync(allocator, buffer, callback, ReadAsyncHandler(), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer Win32Socket::readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) {
+	return _readAsync(allocator, buffer, nullptr, std::move(handler), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer Win32Socket::_readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) {
 	if (buffer.buffer->size > ULONG_MAX)
 		return BufferIsTooBigError::alloc();
 	peff::RcObjectPtr<Win32ReadAsyncTask> task(
@@ -191,6 +204,7 @@ NETKNOT_API ExceptionPointer Win32Socket::readAsync(peff::Alloc *allocator, cons
 	task->overlapped = overlapped;
 
 	task->callback = callback;
+	task->handler = std::move(handler);
 
 	int result = WSARecv(socket, &overlapped->buf, 1, &overlapped->szOperated, &overlapped->flags, overlapped, NULL);
 
@@ -209,6 +223,14 @@ NETKNOT_API ExceptionPointer Win32Socket::readAsync(peff::Alloc *allocator, cons
 }
 
 NETKNOT_API ExceptionPointer Win32Socket::writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) {
+	return _writeAsync(allocator, buffer, callback, WriteAsyncHandler(), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer Win32Socket::writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
+	return _writeAsync(allocator, buffer, nullptr, std::move(handler), asyncTaskOut);
+}
+
+NETKNOT_API ExceptionPointer Win32Socket::_writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
 	if (buffer.buffer->size > ULONG_MAX)
 		return BufferIsTooBigError::alloc();
 	std::unique_ptr<Win32WriteAsyncTask, AsyncTaskDeleter> task(
@@ -226,11 +248,64 @@ NETKNOT_API ExceptionPointer Win32Socket::writeAsync(peff::Alloc *allocator, con
 	task->overlapped = overlapped;
 
 	task->callback = callback;
+	task->handler = std::move(handler);
+
+	// Accounted before issuing, the completion may arrive at any time after.
+	onWriteQueued(buffer.size);
 
 	int result = WSASend(socket, &overlapped->buf, 1, &overlapped->szOperated, 0, overlapped, NULL);
 
-	if (result == SOCKET_ERROR)
-		return wsaLastErrorToExcept(ioService->selfAllocator.get(), WSAGetLastError());
+	if (result == SOCKET_ERROR) {
+		int errorCode = WSAGetLastError();
+		if (errorCode != WSA_IO_PENDING) {
+			onWriteCancelled(buffer.size);
+			return wsaLastErrorToExcept(ioService->selfAllocator.get(), errorCode);
+		}
+	}
+
+	NETKNOT_RETURN_IF_EXCEPT(ioService->postAsyncTask(task.get()));
+
+	task->incRef(0);
+	asyncTaskOut = task.release();
+
+	return {};
+}
+
+NETKNOT_API ExceptionPointer Win32Socket::sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) {
+	// TransmitFile() sends at most 2^31 - 2 bytes at once.
+	if (size > INT_MAX - 1)
+		return BufferIsTooBigError::alloc();
+	std::unique_ptr<Win32WriteAsyncTask, AsyncTaskDeleter> task(
+		peff::allocAndConstruct<Win32WriteAsyncTask>(allocator, alignof(Win32WriteAsyncTask), allocator, this, RcBufferRef()));
+
+	if (!task)
+		return OutOfMemoryError::alloc();
+
+	Win32IOCPOverlapped *overlapped;
+
+	if (!(overlapped = (Win32IOCPOverlapped *)allocOverlapped(allocator, 0, RcBufferRef(), task.get()))) {
+		return OutOfMemoryError::alloc();
+	}
+
+	// The file offset is passed through the overlapped structure.
+	overlapped->Offset = (DWORD)offset;
+	overlapped->OffsetHigh = (DWORD)(offset >> 32);
+
+	task->overlapped = overlapped;
+
+	task->szFile = size;
+	task->handler = std::move(handler);
+
+	// Accounted before issuing, the completion may arrive at any time after.
+	onWriteQueued(size);
+
+	if (!TransmitFile(socket, (HANDLE)file, (DWORD)size, 0, overlapped, NULL, 0)) {
+		int errorCode = WSAGetLastError();
+		if (errorCode != WSA_IO_PENDING) {
+			onWriteCancelled(size);
+			return wsaLastErrorToExcept(ioService->selfAllocator.get(), errorCode);
+		}
+	}
 
 	NETKNOT_RETURN_IF_EXCEPT(ioService->postAsyncTask(task.get()));
 
@@ -292,6 +367,17 @@ NETKNOT_API ExceptionPointer Win32Socket::acceptAsync(peff::Alloc *allocator, Ac
 	return {};
 }
 
+NETKNOT_API void Win32Socket::setAutoCork(bool enabled) noexcept {
+	// Every WSASend() is issued to the completion port as soon as it is requested,
+	// so the flag is only recorded as a hint.
+	isAutoCorkEnabled = enabled;
+}
+
+NETKNOT_API bool Win32Socket::setWorkerId(size_t workerId) noexcept {
+	// Completions of the shared completion port are dequeued by any of the workers.
+	return false;
+}
+
 NETKNOT_API Win32IOCPOverlapped* netknot::allocOverlapped(peff::Alloc* allocator, size_t addrSize, const RcBufferRef& buffer, AsyncTask* asyncTask) {
 	Win32IOCPOverlapped *overlapped = nullptr;
 
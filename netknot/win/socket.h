@@ -23,6 +23,8 @@ namespace netknot {
 		ExceptionPointer exceptPtr;
 		Win32IOCPOverlapped *overlapped = nullptr;
 		peff::RcObjectPtr<ReadAsyncCallback> callback;
+		/// @brief Handler invoked instead of the callback if set.
+		ReadAsyncHandler handler;
 
 		NETKNOT_API Win32ReadAsyncTask(peff::Alloc *allocator, Win32Socket *socket, const RcBufferRef &bufferRef);
 		NETKNOT_API virtual ~Win32ReadAsyncTask();
@@ -47,9 +49,18 @@ namespace netknot {
 		Win32Socket *socket;
 		RcBufferRef bufferRef;
 		size_t szWritten = 0;
+		/// @brief Size of the file region to be sent instead of the buffer, 0 if the task writes the buffer.
+		size_t szFile = 0;
 		ExceptionPointer exceptPtr;
 		Win32IOCPOverlapped *overlapped = nullptr;
 		peff::RcObjectPtr<WriteAsyncCallback> callback;
+		/// @brief Handler invoked instead of the callback if set.
+		WriteAsyncHandler handler;
+
+		/// @brief Get the total size to be written by the task.
+		NETKNOT_FORCEINLINE size_t getWriteSize() const noexcept {
+			return szFile ? szFile : bufferRef.size;
+		}
 
 		NETKNOT_API Win32WriteAsyncTask(peff::Alloc *allocator, Win32Socket *socket, const RcBufferRef &bufferRef);
 		NETKNOT_API virtual ~Win32WriteAsyncTask();
@@ -90,6 +101,7 @@ namespace netknot {
 		peff::UUID socketTypeId;
 		Win32IOService *ioService;
 		peff::UUID addressFamily;
+		bool isAutoCorkEnabled = false;
 
 		NETKNOT_API Win32Socket(Win32IOService *ioService, peff::Alloc *selfAllocator, const peff::UUID &addressFamily, const peff::UUID &socketTypeId);
 		NETKNOT_API virtual ~Win32Socket();
@@ -97,6 +109,7 @@ namespace netknot {
 		NETKNOT_API virtual void dealloc() noexcept override;
 
 		NETKNOT_API virtual void close() override;
+		NETKNOT_API virtual void shutdown() noexcept override;
 
 		NETKNOT_API virtual ExceptionPointer bind(const TranslatedAddress *address) override;
 		NETKNOT_API virtual ExceptionPointer listen(size_t backlog) override;
@@ -109,6 +122,22 @@ namespace netknot {
 		NETKNOT_API virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncTask *&asyncTaskOut) override;
 		NETKNOT_API virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncTask *&asyncTaskOut) override;
 		NETKNOT_API virtual ExceptionPointer acceptAsync(peff::Alloc *allocator, AcceptAsyncCallback *callback, AcceptAsyncTask *&asyncTaskOut) override;
+
+		NETKNOT_API virtual ExceptionPointer readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut) override;
+		NETKNOT_API virtual ExceptionPointer writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) override;
+
+		NETKNOT_API virtual ExceptionPointer sendFileAsync(peff::Alloc *allocator, NativeFileHandle file, uint64_t offset, size_t size, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut) override;
+
+		using Socket::readAsync;
+		using Socket::writeAsync;
+		using Socket::sendFileAsync;
+
+		NETKNOT_API ExceptionPointer _readAsync(peff::Alloc *allocator, const RcBufferRef &buffer, ReadAsyncCallback *callback, ReadAsyncHandler &&handler, ReadAsyncTask *&asyncTaskOut);
+		NETKNOT_API ExceptionPointer _writeAsync(peff::Alloc *allocator, const RcBufferRef &buffer, WriteAsyncCallback *callback, WriteAsyncHandler &&handler, WriteAsyncTask *&asyncTaskOut);
+
+		NETKNOT_API virtual void setAutoCork(bool enabled) noexcept override;
+
+		NETKNOT_API virtual bool setWorkerId(size_t workerId) noexcept override;
 	};
 
 	NETKNOT_API Win32IOCPOverlapped *allocOverlapped(peff::Alloc *allocator, size_t addrSize, const RcBufferRef &buffer, AsyncTask *asyncTask);